@@ -0,0 +1,97 @@
+//
+//  ActiveNotes.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Set of notes currently held, as one 128-bit set per MIDI channel.
+// test/set/clear are a shift and a mask; iterating all held notes skips
+// empty channels and empty 64-note halves.
+
+#ifndef __LeapMIDIX__ActiveNotes__
+#define __LeapMIDIX__ActiveNotes__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace leapmidi {
+
+class ActiveNotes {
+public:
+    ActiveNotes() { clearAll(); }
+
+    bool test(unsigned char channel, unsigned char note) const {
+        return (bits[channel & 0x0F][(note >> 6) & 1] >> (note & 63)) & 1;
+    }
+
+    void set(unsigned char channel, unsigned char note) {
+        channel &= 0x0F;
+        bits[channel][(note >> 6) & 1] |= (uint64_t)1 << (note & 63);
+        channelMask |= 1 << channel;
+    }
+
+    void clear(unsigned char channel, unsigned char note) {
+        channel &= 0x0F;
+        bits[channel][(note >> 6) & 1] &= ~((uint64_t)1 << (note & 63));
+        if (! bits[channel][0] && ! bits[channel][1])
+            channelMask &= ~(1 << channel);
+    }
+
+    void clearAll() {
+        for (int ch = 0; ch < 16; ch++)
+            bits[ch][0] = bits[ch][1] = 0;
+        channelMask = 0;
+    }
+
+    bool empty() const { return channelMask == 0; }
+    bool empty(unsigned char channel) const { return ! ((channelMask >> (channel & 0x0F)) & 1); }
+    // bit n set if channel n has any notes
+    uint16_t channels() const { return channelMask; }
+
+    size_t count() const {
+        size_t n = 0;
+        for (int ch = 0; ch < 16; ch++)
+            n += __builtin_popcountll(bits[ch][0]) + __builtin_popcountll(bits[ch][1]);
+        return n;
+    }
+
+    size_t count(unsigned char channel) const {
+        channel &= 0x0F;
+        return __builtin_popcountll(bits[channel][0]) + __builtin_popcountll(bits[channel][1]);
+    }
+
+    // calls f(channel, note) for every held note, lowest channel/note first
+    // (notes may be cleared from f)
+    template <typename F>
+    void forEach(F f) const {
+        unsigned int channels = channelMask;
+        while (channels) {
+            unsigned char ch = __builtin_ctz(channels);
+            channels &= channels - 1;
+            forEach(ch, f);
+        }
+    }
+
+    // same for one channel
+    template <typename F>
+    void forEach(unsigned char channel, F f) const {
+        channel &= 0x0F;
+        for (int half = 0; half < 2; half++) {
+            uint64_t word = bits[channel][half];
+            while (word) {
+                unsigned char note = (half << 6) + __builtin_ctzll(word);
+                word &= word - 1;
+                f(channel, note);
+            }
+        }
+    }
+
+protected:
+    uint64_t bits[16][2];
+    uint16_t channelMask; // channels with at least one held note
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__ActiveNotes__) */
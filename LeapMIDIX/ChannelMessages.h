@@ -0,0 +1,86 @@
+//
+//  ChannelMessages.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// MIDI 1.0 channel voice messages as distinct types, for
+// MIDIEncoder::appendRun(). Each kind's status byte is a compile-time
+// constant ORed with the channel, and so is how many data bytes it has,
+// so the encoder is specialized per kind and never looks at a status
+// byte to decide what to write. Data bytes are masked to 7 bits when the
+// message is made.
+
+#ifndef __LeapMIDIX__ChannelMessages__
+#define __LeapMIDIX__ChannelMessages__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leapmidi {
+
+template <uint8_t Type, size_t DataLength>
+struct ChannelMessage {
+    static const uint8_t type = Type;
+    static const size_t dataLength = DataLength;
+
+    static constexpr uint8_t statusByte(uint8_t channel) { return Type | (channel & 0x0F); }
+
+    // channel 0, data bytes 0
+    constexpr ChannelMessage() : status(Type), data1(0), data2(0) {}
+    constexpr ChannelMessage(uint8_t channel, uint8_t data1_, uint8_t data2_)
+        : status(statusByte(channel)), data1(data1_ & 0x7F), data2(data2_ & 0x7F) {}
+
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2; // 0 for kinds with one data byte
+};
+
+struct NoteOff : ChannelMessage<0x80, 2> {
+    constexpr NoteOff() {}
+    constexpr NoteOff(uint8_t channel, uint8_t note, uint8_t velocity)
+        : ChannelMessage<0x80, 2>(channel, note, velocity) {}
+};
+
+struct NoteOn : ChannelMessage<0x90, 2> {
+    constexpr NoteOn() {}
+    constexpr NoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+        : ChannelMessage<0x90, 2>(channel, note, velocity) {}
+};
+
+struct ControlChange : ChannelMessage<0xB0, 2> {
+    constexpr ControlChange() {}
+    constexpr ControlChange(uint8_t channel, uint8_t controller, uint8_t value)
+        : ChannelMessage<0xB0, 2>(channel, controller, value) {}
+};
+
+struct ProgramChange : ChannelMessage<0xC0, 1> {
+    constexpr ProgramChange() {}
+    constexpr ProgramChange(uint8_t channel, uint8_t program)
+        : ChannelMessage<0xC0, 1>(channel, program, 0) {}
+};
+
+// value 0-16383, 8192 is the center; LSB first on the wire
+struct PitchBend : ChannelMessage<0xE0, 2> {
+    constexpr PitchBend() {}
+    constexpr PitchBend(uint8_t channel, uint16_t value)
+        : ChannelMessage<0xE0, 2>(channel, value & 0x7F, value >> 7) {}
+};
+
+// 14 bit controller 0-31, a pair of control changes: the MSB on the
+// controller itself and the LSB on controller + 32
+struct ControlChange14 {
+    constexpr ControlChange14(uint8_t channel, uint8_t controller, uint16_t value)
+        : msb(channel, controller & 0x1F, value >> 7), lsb(channel, (controller & 0x1F) + 32, value) {}
+
+    ControlChange msb;
+    ControlChange lsb;
+};
+
+// so a ControlChange14 can be encoded as a run of two
+static_assert(sizeof(ControlChange14) == 2 * sizeof(ControlChange), "ControlChange14 must be two packed ControlChanges");
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__ChannelMessages__) */
@@ -0,0 +1,102 @@
+//
+//  ClockMapper.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "ClockMapper.h"
+
+// how much of each window's drift measurement to apply, < 1 smooths it out
+#define DRIFT_GAIN 0.5
+
+// ignore drift estimates beyond 500 ppm (0.5ns per us), they're clock jumps
+// or a window where every frame was held up
+#define MAX_DRIFT 0.5
+
+namespace leapmidi {
+
+ClockMapper::ClockMapper(int64_t windowMicros) {
+    window = windowMicros;
+    reset();
+}
+
+void ClockMapper::reset() {
+    haveBase = false;
+    baseLeap = 0;
+    baseHost = 0;
+    anchorResidual = 0;
+    anchorAt = 0;
+    drift = 0;
+    haveDrift = false;
+    windowStart = 0;
+    windowMin = 0;
+    windowMinAt = 0;
+    haveWindowMin = false;
+    prevMin = 0;
+    prevMinAt = 0;
+    havePrevMin = false;
+}
+
+double ClockMapper::nominal(int64_t leapMicros) const {
+    return (double)baseHost + (double)(leapMicros - baseLeap) * 1000.0;
+}
+
+uint64_t ClockMapper::map(int64_t leapMicros) const {
+    double mapped = nominal(leapMicros) + anchorResidual + drift * (double)(leapMicros - anchorAt);
+    if (mapped < 0)
+        return 0;
+    return (uint64_t)mapped;
+}
+
+uint64_t ClockMapper::update(int64_t leapMicros, uint64_t hostNanos) {
+    if (haveBase && leapMicros < windowStart) {
+        // leap clock went backwards, the service was restarted
+        reset();
+    }
+
+    if (! haveBase) {
+        haveBase = true;
+        baseLeap = leapMicros;
+        baseHost = hostNanos;
+        anchorAt = leapMicros;
+        windowStart = leapMicros;
+        return hostNanos;
+    }
+
+    double residual = (double)hostNanos - nominal(leapMicros);
+    if (! haveWindowMin || residual < windowMin) {
+        windowMin = residual;
+        windowMinAt = leapMicros;
+        haveWindowMin = true;
+    }
+
+    if (! havePrevMin) {
+        // still in the first window, anchor at the best frame so far
+        anchorResidual = windowMin;
+        anchorAt = windowMinAt;
+    }
+
+    if (leapMicros - windowStart >= window) {
+        if (havePrevMin && windowMinAt > prevMinAt) {
+            double measured = (windowMin - prevMin) / (double)(windowMinAt - prevMinAt);
+            if (measured < MAX_DRIFT && measured > -MAX_DRIFT) {
+                drift = haveDrift ? drift + (measured - drift) * DRIFT_GAIN : measured;
+                haveDrift = true;
+            }
+        }
+
+        prevMin = windowMin;
+        prevMinAt = windowMinAt;
+        havePrevMin = true;
+        anchorResidual = windowMin;
+        anchorAt = windowMinAt;
+
+        windowStart = leapMicros;
+        haveWindowMin = false;
+    }
+
+    return map(leapMicros);
+}
+
+} // namespace leapmidi
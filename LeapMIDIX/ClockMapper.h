@@ -0,0 +1,72 @@
+//
+//  ClockMapper.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Maps Leap frame capture timestamps (microseconds on the Leap service's
+// clock) into host clock nanoseconds.
+//
+// Every frame gives us a pair (capture time, time we got it). The arrival
+// time is the capture time plus a delivery delay that is never negative
+// but jitters, so we follow the lower envelope of the arrivals: the least
+// delayed frame of each window anchors the offset, and the slope between
+// the anchors of consecutive windows is the drift between the two clocks.
+
+#ifndef __LeapMIDIX__ClockMapper__
+#define __LeapMIDIX__ClockMapper__
+
+#include <stdint.h>
+
+namespace leapmidi {
+
+class ClockMapper {
+public:
+    // windowMicros: how much Leap time each offset/drift update covers
+    ClockMapper(int64_t windowMicros = 1000000);
+
+    // record that the frame captured at leapMicros arrived at hostNanos
+    // returns the capture time mapped into host nanoseconds
+    uint64_t update(int64_t leapMicros, uint64_t hostNanos);
+
+    // map a capture time with the current estimate, without updating it
+    uint64_t map(int64_t leapMicros) const;
+
+    // forget everything, e.g. when the Leap service restarts
+    void reset();
+
+    // estimated host nanoseconds per Leap microsecond (nominally 1000)
+    double rate() const { return 1000.0 + drift; }
+    bool synced() const { return haveBase; }
+
+protected:
+    // host time predicted for a capture time at exactly 1000ns/us
+    double nominal(int64_t leapMicros) const;
+
+    int64_t window;
+
+    bool haveBase;
+    int64_t baseLeap;
+    uint64_t baseHost;
+
+    // envelope point the mapping is anchored at, and drift since then
+    // (residuals are relative to the nominal mapping)
+    double anchorResidual;
+    int64_t anchorAt;
+    double drift; // extra host ns per leap us
+    bool haveDrift;
+
+    // least delayed frame of the current and previous window
+    int64_t windowStart;
+    double windowMin;
+    int64_t windowMinAt;
+    bool haveWindowMin;
+    double prevMin;
+    int64_t prevMinAt;
+    bool havePrevMin;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__ClockMapper__) */
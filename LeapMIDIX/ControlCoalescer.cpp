@@ -0,0 +1,69 @@
+//
+//  ControlCoalescer.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "ControlCoalescer.h"
+
+namespace leapmidi {
+
+ControlCoalescer::ControlCoalescer() {
+    dirtyCount = 0;
+    superseded = 0;
+
+    for (unsigned int ch = 0; ch < LMX_COALESCER_CHANNELS; ch++) {
+        for (unsigned int cc = 0; cc < LMX_COALESCER_CONTROLLERS; cc++) {
+            Slot &slot = slots[ch * LMX_COALESCER_CONTROLLERS + cc];
+            slot.entry.channel = ch;
+            slot.entry.controller = cc;
+            slot.entry.value = 0;
+            slot.entry.highRes = false;
+            slot.entry.timestamp = 0;
+            slot.entry.queuedAt = 0;
+            slot.dirty = false;
+        }
+    }
+}
+
+bool ControlCoalescer::update(unsigned char channel, unsigned char controller, leapmidi::midi_control_value value, uint64_t timestamp, bool highRes, uint64_t queuedAt) {
+    unsigned short index = (channel & 0x0F) * LMX_COALESCER_CONTROLLERS + (controller & 0x7F);
+    Slot &slot = slots[index];
+
+    slot.entry.value = value;
+    slot.entry.highRes = highRes;
+    slot.entry.timestamp = timestamp;
+
+    if (slot.dirty) {
+        // older value never made it out, it's gone now
+        superseded++;
+        return true;
+    }
+
+    slot.dirty = true;
+    slot.entry.queuedAt = queuedAt;
+    dirtyList[dirtyCount++] = index;
+    return false;
+}
+
+void ControlCoalescer::clear() {
+    for (size_t i = 0; i < dirtyCount; i++)
+        slots[dirtyList[i]].dirty = false;
+    dirtyCount = 0;
+}
+
+void ControlCoalescer::consume(size_t count) {
+    if (count >= dirtyCount) {
+        clear();
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        slots[dirtyList[i]].dirty = false;
+    for (size_t i = count; i < dirtyCount; i++)
+        dirtyList[i - count] = dirtyList[i];
+    dirtyCount -= count;
+}
+
+} // namespace leapmidi
@@ -0,0 +1,74 @@
+//
+//  ControlCoalescer.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Last-value-wins table for control change messages.
+// Every (channel, controller) pair has a fixed slot; updating a slot that is
+// already pending just overwrites its value, so only the newest value of
+// each controller is sent when the table is flushed.
+// Pending slots are tracked in a dirty list so a flush only visits the
+// controllers that actually changed.
+// A 14 bit controller (0-31) shares the slot of its 7 bit MSB, whichever
+// was set last is sent.
+
+#ifndef __LeapMIDIX__ControlCoalescer__
+#define __LeapMIDIX__ControlCoalescer__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "LeapMIDI.h"
+
+#define LMX_COALESCER_CHANNELS 16
+#define LMX_COALESCER_CONTROLLERS 128
+
+namespace leapmidi {
+
+class ControlCoalescer {
+public:
+    struct Entry {
+        unsigned char channel;
+        unsigned char controller;
+        leapmidi::midi_control_value value;
+        bool highRes; // value is 14 bits, for an MSB/LSB pair
+        uint64_t timestamp; // of the newest value
+        uint64_t queuedAt;  // when the controller became pending
+    };
+
+    ControlCoalescer();
+
+    // store the newest value for a controller
+    // returns true if this replaced a value that was still pending
+    // queuedAt is only recorded if the controller wasn't pending yet
+    bool update(unsigned char channel, unsigned char controller, leapmidi::midi_control_value value, uint64_t timestamp = 0, bool highRes = false, uint64_t queuedAt = 0);
+
+    // pending entries, in the order their controllers were first touched
+    size_t pendingCount() const { return dirtyCount; }
+    const Entry &pendingEntry(size_t i) const { return slots[dirtyList[i]].entry; }
+
+    // forget all pending entries, O(pending)
+    void clear();
+    // forget the first count pending entries, the rest stay pending in
+    // order, O(pending)
+    void consume(size_t count);
+
+    // number of values that were overwritten before they got sent
+    unsigned long supersededCount() const { return superseded; }
+
+protected:
+    struct Slot {
+        Entry entry;
+        bool dirty;
+    };
+
+    Slot slots[LMX_COALESCER_CHANNELS * LMX_COALESCER_CONTROLLERS];
+    unsigned short dirtyList[LMX_COALESCER_CHANNELS * LMX_COALESCER_CONTROLLERS];
+    size_t dirtyCount;
+    unsigned long superseded;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__ControlCoalescer__) */
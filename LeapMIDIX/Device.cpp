@@ -6,20 +6,24 @@
 //
 
 #include "Device.h"
-#include <CoreMIDI/CoreMIDI.h>
-#include <CoreMIDI/MIDIServices.h>
+#include "OutputReactor.h"
+#include "Log.h"
 
-pthread_mutex_t debug_output_mutex;
 static void fatal(const char *msg);
-static void lmx_dev_debug(const char *msg);
 
 namespace leapmidi {
     
 void Device::init() {
-    initPacketList();
     createDevice();
     
+    // the reactor's thread does the sending
+    if (reactor) {
+        reactor->addDevice(this);
+        return;
+    }
+    
     // start message sending queue
+    senderRunning = true;
     int res = pthread_create(&messageQueueThread, NULL, _messageSendingThreadEntry, this);
     if (res) {
         std::cerr << "pthread_create failed " << res << std::endl;
@@ -28,298 +32,1168 @@ void Device::init() {
 }
 
 void Device::addControlMessage(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue) {
-    pthread_mutex_lock(&messageQueueMutex);
-    
-    midi_message msg;
-    msg.control_index = controlIndex;
-    msg.control_value = controlValue;
-    msg.type = MSG_CONTROL;
-    gettimeofday(&msg.timestamp, NULL);
-    midiMessageQueue.push(msg);
-    pthread_mutex_unlock(&messageQueueMutex);
-    pthread_cond_signal(&messageQueueCond);
+    enqueueMessage(makeControlMessage(controlIndex, controlValue, 0, messageClock(clock->now())));
 }
     
 void Device::addNoteMessage(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue) {
-    pthread_mutex_lock(&messageQueueMutex);
+    if (noteIndex >= LMX_NOTE_COUNT)
+        return;
+    enqueueMessage(makeNoteMessage(noteIndex, noteValue, 0, messageClock(clock->now())));
+}
+
+void Device::addControl14Message(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue) {
+    enqueueMessage(makeControl14Message(controlIndex, controlValue, 0, messageClock(clock->now())));
+}
+
+void Device::addNRPNMessage(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value) {
+    midi_message msgs[2];
+    makeParameterMessages(msgs, false, parameter, value, 0, messageClock(clock->now()));
+    enqueueMessages(msgs, 2);
+}
+
+void Device::addRPNMessage(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value) {
+    midi_message msgs[2];
+    makeParameterMessages(msgs, true, parameter, value, 0, messageClock(clock->now()));
+    enqueueMessages(msgs, 2);
+}
+
+void Device::scheduleNoteMessage(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue, uint64_t delay) {
+    if (noteIndex >= LMX_NOTE_COUNT)
+        return;
+    enqueueMessage(makeNoteMessage(noteIndex, noteValue, 0, messageClock(clock->now() + delay)));
+}
+
+void Device::scheduleControlMessage(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue, uint64_t delay) {
+    enqueueMessage(makeControlMessage(controlIndex, controlValue, 0, messageClock(clock->now() + delay)));
+}
+
+void Device::cancelScheduledNote(leapmidi::midi_note_index noteIndex, unsigned char channel) {
+    if (noteIndex >= LMX_NOTE_COUNT)
+        return;
+    enqueueMessage(makeCancelMessage(noteNumber(noteIndex), channel));
+}
+
+void Device::cancelScheduledMessages() {
+    enqueueMessage(makeCancelMessage(0, 0, true));
+}
+
+void Device::addMessages(MessageBatch &batch) {
+    addMessages(batch, clock->now());
+}
+
+void Device::addMessages(MessageBatch &batch, uint64_t captureTime) {
+    if (batch.empty())
+        return;
+    
+    // the whole frame shares one timestamp
+    midi_message *msgs = batch.begin();
+    uint32_t time = messageClock(captureTime);
+    for (size_t i = 0; i < batch.size(); i++)
+        msgs[i].time = time;
     
-    midi_message msg;
-    msg.note_index = noteIndex;
-    msg.note_value = noteValue;
-    msg.type = MSG_NOTE;
-    gettimeofday(&msg.timestamp, NULL);
-    midiMessageQueue.push(msg);
-    pthread_mutex_unlock(&messageQueueMutex);
-    pthread_cond_signal(&messageQueueCond);
+    enqueueMessages(msgs, batch.size());
+}
+
+// lock-free, may be called from any thread
+void Device::enqueueMessage(const midi_message &msg) {
+    if (! messageRing.push(msg)) {
+        // sending thread is hopelessly behind, drop the newest message
+        droppedMessageCount++;
+        return;
+    }
+    
+    wakeSender();
+}
+
+// lock-free, may be called from any thread
+// the messages are pushed contiguously or not at all
+void Device::enqueueMessages(const midi_message *msgs, size_t count) {
+    if (! messageRing.pushBatch(msgs, count)) {
+        droppedMessageCount += count;
+        return;
+    }
+    
+    wakeSender();
+}
+
+void Device::requestAllNotesOff() {
+    allNotesOffRequested = true;
+    wakeSender();
+}
+
+bool Device::sendSysEx(SysExTransfer *transfer) {
+    const Byte *data = transfer->data;
+    size_t length = transfer->length;
+    transfer->sent.store(0, std::memory_order_relaxed);
+    
+    if (length < 2 || data[0] != 0xF0 || data[length - 1] != 0xF7) {
+        LMX_LOG(LOG_WARN, "Not sending %zu bytes that aren't SysEx", length);
+        transfer->state.store(SysExTransfer::FAILED, std::memory_order_release);
+        return false;
+    }
+    
+    transfer->state.store(SysExTransfer::QUEUED, std::memory_order_release);
+    if (! sysExQueue.push(transfer)) {
+        transfer->state.store(SysExTransfer::FAILED, std::memory_order_release);
+        return false;
+    }
+    
+    wakeSender();
+    return true;
+}
+
+void Device::wakeSender() {
+    // only wake up the sending thread if it is parked (or about to park),
+    // and only once however many producers get here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (senderWaiting.load() && senderWaiting.exchange(false))
+        senderNotifier.signal();
+}
+
+void MessageBatch::addControl(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue) {
+    assert(! full());
+    messages[count++] = makeControlMessage(controlIndex, controlValue);
+}
+
+void MessageBatch::addNote(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue) {
+    if (noteIndex >= LMX_NOTE_COUNT)
+        return;
+    assert(! full());
+    messages[count++] = makeNoteMessage(noteIndex, noteValue);
+}
+
+void MessageBatch::addControl14(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue) {
+    assert(! full());
+    messages[count++] = makeControl14Message(controlIndex, controlValue);
+}
+
+void MessageBatch::addNRPN(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value) {
+    assert(space() >= 2);
+    makeParameterMessages(messages + count, false, parameter, value);
+    count += 2;
+}
+
+void MessageBatch::addRPN(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value) {
+    assert(space() >= 2);
+    makeParameterMessages(messages + count, true, parameter, value);
+    count += 2;
+}
+
+void MessageBatch::addCancel(leapmidi::midi_note_index noteIndex) {
+    if (noteIndex >= LMX_NOTE_COUNT)
+        return;
+    assert(! full());
+    messages[count++] = makeCancelMessage(noteNumber(noteIndex));
 }
 
 
 /*******/
 
-Device::Device() {
-    pthread_mutex_init(&debug_output_mutex, NULL);
+// default latency offset, long enough to cover frame delivery jitter
+#define DEFAULT_LATENCY_OFFSET_NS 5000000ULL
+
+// stack the sending thread touches up front
+#define SENDER_STACK_PREFAULT (64 * 1024)
+
+// most bytes a message can take on the wire, what has to be available
+// under the rate limit before it goes; it's charged what it actually took
+#define NOTE_BYTES 3
+#define CONTROL_BYTES 3
+#define CONTROL_14BIT_BYTES 6
+#define PARAMETER_BYTES 12
+
+// most note-ons or note-offs gathered into one run
+#define NOTE_RUN_LENGTH 128
+
+Device::Device(Clock *clock_, OutputBackend *output_) {
+    clock = clock_ ? clock_ : HostClock::shared();
+    epoch = clock->now();
+    protocol = PROTOCOL_MIDI1;
+    ownsOutput = false;
+    if (! output_) {
+        output_ = createDefaultOutput();
+        ownsOutput = true;
+    }
+    outputs.push_back(output_);
+    outputLimits.resize(1);
+    rateLimited = false;
+    outputOpen = false;
+    latencyOffset = DEFAULT_LATENCY_OFFSET_NS;
+    sendAhead = LMX_SEND_AHEAD_UNLIMITED;
+    scheduledCount = 0;
     
-    pthread_mutex_init(&messageQueueMutex, NULL);
-    pthread_cond_init(&messageQueueCond, NULL);
+    senderWaiting = false;
+    senderRunning = false;
+    droppedMessageCount = 0;
+    for (int i = 0; i < LANE_COUNT; i++) {
+        laneSent[i] = 0;
+        laneDelayTotal[i] = 0;
+        laneDelayMax[i] = 0;
+    }
+    allNotesOffRequested = false;
+    sysExCurrent = NULL;
+    sysExChunkSize = LMX_SYSEX_CHUNK_SIZE;
+    sysExInMessage = false;
+    umpSysExStartPending = false;
+    for (int ch = 0; ch < 16; ch++)
+        parameterSelect[ch].status = 0;
+    messageQueueThread = 0;
+    reactor = NULL;
+    senderThreadConfig.stackPrefault = SENDER_STACK_PREFAULT;
     
-    packetListSize = 512; // buffer size for midi packet messages
-    deviceClient = NULL;
-    deviceEndpoint = NULL;
-    midiPacketList = NULL;
+    encoderTimestamp = 0;
+    encodedBytes = 0;
+    umpTimestamp = 0;
+    legacyOutputs = true;
 }
 
 Device::~Device() {
-    if (deviceEndpoint)
-        MIDIEndpointDispose(deviceEndpoint);
-    if (deviceClient)
-        MIDIDeviceDispose(deviceClient);
-    if (midiPacketList)
-        free(midiPacketList);
+    if (messageQueueThread) {
+        senderRunning = false;
+        senderNotifier.signal();
+        pthread_join(messageQueueThread, NULL);
+    } else if (reactor) {
+        reactor->removeDevice(this);
+    }
+    
+    // don't leave anything hanging on the receiving end
+    if (outputOpen) {
+        if (sysExInMessage) {
+            // cut the message short, a receiver waits for its end forever
+            static const Byte endOfExclusive = 0xF7;
+            addPacket(&endOfExclusive, 1);
+            sysExInMessage = false;
+        }
+        queueAllNotesOff();
+        sendMIDIQueue();
+        for (size_t i = 0; i < outputs.size(); i++)
+            outputs[i]->close();
+    }
     
-    if (messageQueueThread)
-        pthread_cancel(messageQueueThread);
+    failSysExTransfers();
     
-    pthread_mutex_destroy(&messageQueueMutex);
-    pthread_cond_destroy(&messageQueueCond);
+    if (ownsOutput)
+        delete outputs[0];
     
     std::cout << "closed down device\n";
 }
 
-void Device::initPacketList() {
-    if (midiPacketList) {
-        free(midiPacketList);
-        midiPacketList = NULL;
+void Device::addOutput(OutputBackend *output) {
+    assert(! messageQueueThread);
+    outputs.push_back(output);
+    outputLimits.resize(outputs.size());
+}
+
+void Device::setRateLimit(OutputBackend *output, uint64_t bytesPerSecond, uint64_t burstBytes) {
+    assert(! messageQueueThread);
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (outputs[i] == output)
+            outputLimits[i].setRate(bytesPerSecond, burstBytes);
     }
-    
-    midiPacketList = (MIDIPacketList *)malloc(packetListSize * sizeof(char));
-    curPacket = MIDIPacketListInit(midiPacketList);
+}
+
+uint32_t Device::messageClock(uint64_t time) const {
+    return time > epoch ? (uint32_t)((time - epoch) / 1000) : 0;
+}
+
+uint64_t Device::messageTime(uint32_t time, uint64_t now) const {
+    int64_t nowMicros = now > epoch ? (now - epoch) / 1000 : 0;
+    // whichever way the truncated clocks wrapped, the difference is right
+    int64_t micros = nowMicros + (int32_t)(time - (uint32_t)nowMicros);
+    return epoch + (micros > 0 ? micros : 0) * 1000;
+}
+
+uint64_t Device::laneAverageDelay(Lane lane) const {
+    unsigned long sent = laneSent[lane].load();
+    return sent ? laneDelayTotal[lane].load() / sent : 0;
 }
 
 void Device::createDevice() {
-    OSStatus result;
+    if (! outputs[0]->open())
+        fatal("Failed to open MIDI output");
+    outputOpen = true;
     
-    result = MIDIClientCreate(CFSTR("LeapMIDIX"), NULL, NULL, &deviceClient);
-    if (result)
-        fatal("Failed to create MIDI client");
+    // extra outputs are optional, carry on without the ones that fail
+    for (size_t i = 1; i < outputs.size(); ) {
+        if (outputs[i]->open()) {
+            i++;
+            continue;
+        }
+        LMX_LOG(LOG_ERROR, "Failed to open %s output, not using it", outputs[i]->name());
+        outputs.erase(outputs.begin() + i);
+        outputLimits.erase(outputLimits.begin() + i);
+    }
     
-    result = MIDISourceCreate(deviceClient, CFSTR("LeapMIDIX Control"), &deviceEndpoint);
-    if (result)
-        fatal("Failed to create MIDI source");
+    for (size_t i = 0; i < outputs.size(); i++) {
+        // an output that sends everything right away needs the sending
+        // thread to hold messages until they're due
+        if (! outputs[i]->schedulesPackets() && sendAhead == LMX_SEND_AHEAD_UNLIMITED)
+            sendAhead = 0;
+        
+        if (outputLimits[i].limited()) {
+            rateLimited = true;
+            LMX_LOG(LOG_INFO, "MIDI output: %s, at most %llu bytes per second", outputs[i]->name(), (unsigned long long)outputLimits[i].getRate());
+        } else {
+            LMX_LOG(LOG_INFO, "MIDI output: %s", outputs[i]->name());
+        }
+    }
     
+    legacyOutputs = false;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (protocol != PROTOCOL_UMP || ! outputs[i]->acceptsUMP())
+            legacyOutputs = true;
+    }
 }
 
 void *Device::messageSendingThreadEntry() {
-//        std::cout << "messageSendingThreadEntry\n";
-    struct timeval tv;
-    struct timespec ts;
+    senderGuarantees = applyThreadConfig(senderThreadConfig, "MIDI sender");
+
+    while (senderRunning) {
+        uint64_t deadline;
+        if (! serviceSender(deadline))
+            waitForMessages(deadline);
+    }
+    
+    return NULL;
+}
 
-    while (1) {
-        pthread_testcancel();
+bool Device::serviceSender(uint64_t &deadline) {
+    bool queued = false;
+    
+    // nothing may go out in the middle of a SysEx message
+    if (! sysExInMessage && allNotesOffRequested.exchange(false)) {
+        queueAllNotesOff();
+        queued = true;
+    }
+    
+    // held messages whose time has come go first, they're older
+    size_t released = releaseHeldMessages(clock->now());
+    if (released) {
+        queueMessages(releasedMessages, released);
+        queued = true;
+    }
+    
+    // grab everything producers have published so far in one batch
+    size_t count = messageRing.drain(drainedMessages, LMX_MESSAGE_RING_SIZE);
+    if (count) {
+        // add control messages to MIDI packet queue
+        queueMessages(drainedMessages, count);
+        queued = true;
+    }
+    
+    // whatever the rate limit held back gets another go
+    if (! lanesEmpty() && serviceLanes(clock->now()))
+        queued = true;
+    
+    // SysEx goes a chunk at a time once everything else is out, so
+    // whatever comes in meanwhile waits for one chunk at most
+    if ((lanesEmpty() || sysExInMessage) && sendSysExChunk(clock->now()))
+        queued = true;
+    
+    if (! queued) {
+        // nothing to do until the next item, or until the next held
+        // message is due or there's bandwidth for what's waiting in a lane
+        deadline = heldMessages.nextDeadline();
+        uint64_t laneDue = laneDeadline(clock->now());
+        if (laneDue && (! deadline || laneDue < deadline))
+            deadline = laneDue;
+        return false;
+    }
+    
+    // flush MIDI queue to output
+    sendMIDIQueue();
+    deadline = 0;
+    return true;
+}
+
+void Device::waitForMessages(uint64_t deadline) {
+    if (parkSender() && senderRunning) {
+        int64_t timeout = -1;
+        if (deadline) {
+            uint64_t now = clock->now();
+            timeout = deadline > now ? (int64_t)(deadline - now) : 0;
+        }
+        if (timeout != 0)
+            senderNotifier.wait(timeout);
+    }
+    
+    unparkSender();
+}
+
+bool Device::parkSender() {
+    // announce we are going to sleep, then check the ring again so a
+    // message pushed in between can't be missed
+    senderWaiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    
+    return messageRing.empty() && sysExQueue.empty() && ! allNotesOffRequested;
+}
+
+void Device::unparkSender() {
+    senderWaiting.store(false);
+}
+
+// keep a message back if it isn't due to be handed over yet: with a
+// send-ahead, until that long before it's due; otherwise until its capture
+// time, which only a future-dated message hasn't reached
+bool Device::holdMessage(const midi_message &msg, uint64_t now) {
+    uint64_t time = messageTime(msg.time, now);
+    uint64_t release = time;
+    if (sendAhead != LMX_SEND_AHEAD_UNLIMITED) {
+        uint64_t due = time + latencyOffset;
+        release = due > sendAhead ? due - sendAhead : 0;
+    }
+    if (release <= now)
+        return false;
+    
+    // notes can be cancelled by note
+    uint16_t key = LMX_TIMER_NO_KEY;
+    if ((msg.status & 0xF0) == LMX_STATUS_NOTE)
+        key = (msg.status & 0x0F) * 128 + msg.data1;
+    if (! heldMessages.insert(release, now, msg, key))
+        return false; // send it early rather than not at all
+    
+    scheduledCount.store(heldMessages.size(), std::memory_order_relaxed);
+    return true;
+}
+
+// move held messages that are due into releasedMessages, in order
+size_t Device::releaseHeldMessages(uint64_t now) {
+    if (heldMessages.empty())
+        return 0;
+    
+    size_t released = heldMessages.advance(now, releasedMessages, LMX_MESSAGE_RING_SIZE);
+    scheduledCount.store(heldMessages.size(), std::memory_order_relaxed);
+    return released;
+}
+
+void Device::cancelScheduled(const midi_message &msg) {
+    if (msg.data2 & LMX_CANCEL_ALL)
+        heldMessages.clear();
+    else
+        heldMessages.cancelKey((msg.status & 0x0F) * 128 + msg.data1);
+    scheduledCount.store(heldMessages.size(), std::memory_order_relaxed);
+}
+
+// everything in one call is treated as one flush window: control changes
+// are coalesced so only the newest value per controller goes out, and are
+// queued after the notes from the same window; (N)RPN changes keep their
+// order, as each one only makes sense after its parameter select
+// with a rate limit, what doesn't fit stays in its lane for later windows
+void Device::queueMessages(const midi_message *messages, size_t count) {
+    uint64_t now = clock->now();
+
+    for (size_t i = 0; i < count; i++) {
+        const midi_message &msg = messages[i];
+        
+        // only affects what was queued before it
+        if ((msg.status & 0xF0) == LMX_STATUS_CANCEL) {
+            cancelScheduled(msg);
+            continue;
+        }
+        
+        if (holdMessage(msg, now))
+            continue;
+        
+        unsigned char type = msg.status & 0xF0;
+        unsigned char channel = msg.status & 0x0F;
+        
+        if (type == LMX_STATUS_CONTROL) {
+            // a stale value is simply overwritten by a newer one for the
+            // same controller, lateness is only checked for the newest
+            bool highRes = msg.data1 & LMX_DATA_14BIT;
+            leapmidi::midi_control_value value = highRes ? (msg.data2 << 7) | msg.data3 : msg.data2;
+            if (controlCoalescer.update(channel, msg.data1 & 0x7F, value, messageTime(msg.time, now), highRes, now))
+                dropPolicy.countSuperseded();
+            continue;
+        }
         
-        // wait for next item to go in the queue
-        pthread_mutex_lock(&messageQueueMutex);
+        if (type == LMX_STATUS_RPN || type == LMX_STATUS_NRPN) {
+            // the value may not have been published yet
+            parameterSelect[channel] = msg;
+            continue;
+        }
         
-        // check if we have anything in the queue to send
-        if (midiMessageQueue.empty()) {
-            // wait on next item
-            gettimeofday(&tv, NULL);
-            ts.tv_sec = tv.tv_sec + 2; // timeout 2s
-            ts.tv_nsec = 0;
-            // wait until other thread posts a notif
-            int res = pthread_cond_timedwait(&messageQueueCond, &messageQueueMutex, &ts);
-            if (res == ETIMEDOUT) {
-                // no message was waiting
-//                lmx_dev_debug("ETIMEDOUT\n");
-                pthread_mutex_unlock(&messageQueueMutex);
+        if (type == LMX_STATUS_PARAMETER_VALUE) {
+            midi_message &select = parameterSelect[channel];
+            if (! select.status) {
+                LMX_LOG(LOG_WARN, "Parameter value without a parameter select; ignoring");
                 continue;
             }
-            if (res != 0) {
-                std::cerr << "unexpected pthread_cond_timedwait retval=" << res << std::endl;
-                exit(1);
-                continue;
+            if (parameterLane.space() >= 2) {
+                parameterLane.push(select, now);
+                parameterLane.push(msg, now);
+            } else {
+                droppedMessageCount += 2; // hopelessly rate limited
             }
+            select.status = 0;
+            continue;
+        }
+        
+        if (type != LMX_STATUS_NOTE) {
+            LMX_LOG(LOG_WARN, "Unknown MIDI message type %02X; ignoring", msg.status);
+            continue;
+        }
+        if (! noteLane.push(msg, now))
+            droppedMessageCount++; // hopelessly rate limited
+    }
+    
+    serviceLanes(now);
+}
+
+size_t Device::serviceLanes(uint64_t now) {
+    if (sysExInMessage)
+        return 0;
+    
+    size_t count = flushNoteLane(now);
+    if (! noteLane.empty())
+        return count;
+    
+    count += flushParameterLane(now);
+    if (! parameterLane.empty())
+        return count;
+    
+    return count + flushCoalescedControls(now);
+}
+
+// lateness is checked when a message leaves its lane, time spent waiting
+// for bandwidth counts
+// note-ons (or note-offs) one after the other on one channel for one
+// point in time are gathered and encoded as one run
+size_t Device::flushNoteLane(uint64_t now) {
+    NoteOn ons[NOTE_RUN_LENGTH];
+    NoteOff offs[NOTE_RUN_LENGTH];
+    size_t runLength = 0, runCharged = 0;
+    bool runOn = false;
+    unsigned char runChannel = 0;
+    MIDITimeStamp runTimestamp = 0;
+    auto flushRun = [&]() {
+        if (runOn)
+            encodeRun(ons, runLength, runTimestamp, runCharged, now);
+        else
+            encodeRun(offs, runLength, runTimestamp, runCharged, now);
+        runLength = runCharged = 0;
+    };
+    
+    size_t count = 0;
+    while (! noteLane.empty()) {
+        const MessageLane::Entry &entry = noteLane.front();
+        const midi_message &msg = entry.msg;
+        
+        uint64_t timestamp = messageTime(msg.time, now);
+        
+        DropPolicy::MessageClass cls = msg.data2 ? DropPolicy::NOTE_ON : DropPolicy::NOTE_OFF;
+        if (! dropPolicy.shouldDrop(cls, timestamp + latencyOffset, now)) {
+            bool on = msg.data2;
+            unsigned char channel = msg.status & 0x0F;
+            MIDITimeStamp outTimestamp = outputTimestamp(timestamp, now);
+            if (runLength && (on != runOn || channel != runChannel || outTimestamp != runTimestamp || runLength == NOTE_RUN_LENGTH))
+                flushRun();
             
-            if (midiMessageQueue.empty()) {
-                lmx_dev_debug("EMPTY\n");
-                pthread_mutex_unlock(&messageQueueMutex);
-                continue;
+            if (! haveBandwidth(NOTE_BYTES, now))
+                break;
+            if (protocol == PROTOCOL_UMP) {
+                uint64_t mark = encodedBytes;
+                queueNotePacket(msg.data1, msg.data2, channel, outTimestamp);
+                chargeBandwidth(encodedSince(mark, NOTE_BYTES), now);
+            } else if (trackNote(msg.data1, msg.data2, channel)) {
+                size_t bytes = 2;
+                if (! runLength) {
+                    runOn = on;
+                    runChannel = channel;
+                    runTimestamp = outTimestamp;
+                    bytes = encodedLength(on ? NoteOn::statusByte(channel) : NoteOff::statusByte(channel), 2, outTimestamp);
+                }
+                // (note-offs have the release velocity they always had)
+                if (on)
+                    ons[runLength++] = NoteOn(channel, msg.data1, msg.data2);
+                else
+                    offs[runLength++] = NoteOff(channel, msg.data1, 0x7F);
+                chargeBandwidth(bytes, now);
+                runCharged += bytes;
             }
+            countLaneDelay(LANE_NOTE, entry.queuedAt, now);
         }
         
-        // copy messages from shared queue into thread-local copy
-        // (is there a cleaner way to do this?)
-//            lmx_dev_debug("queue copy lock acquired\n");
-        std::queue<midi_message> queueCopy;
-        while (! midiMessageQueue.empty()) {
-            midi_message msg = midiMessageQueue.front();
-            queueCopy.push(msg);
-            midiMessageQueue.pop();
+        noteLane.pop();
+        count++;
+    }
+    
+    flushRun();
+    return count;
+}
+
+size_t Device::flushParameterLane(uint64_t now) {
+    size_t count = 0;
+    while (parameterLane.size() >= 2) {
+        const MessageLane::Entry &entry = parameterLane.front();
+        const midi_message &select = entry.msg;
+        uint64_t timestamp = messageTime(select.time, now);
+        
+        if (! dropPolicy.shouldDrop(DropPolicy::CONTROL, timestamp + latencyOffset, now)) {
+            if (! haveBandwidth(PARAMETER_BYTES, now))
+                break;
+            
+            bool registered = (select.status & 0xF0) == LMX_STATUS_RPN;
+            leapmidi::midi_control_index parameter = (select.data1 << 7) | select.data2;
+            uint64_t queuedAt = entry.queuedAt;
+            parameterLane.pop();
+            const midi_message &value = parameterLane.front().msg;
+            uint64_t mark = encodedBytes;
+            queueParameterPacket(registered, parameter, (value.data2 << 7) | value.data3, select.status & 0x0F, outputTimestamp(timestamp, now));
+            chargeBandwidth(encodedSince(mark, PARAMETER_BYTES), now);
+            countLaneDelay(LANE_CONTROL, queuedAt, now);
+        } else {
+            parameterLane.pop();
         }
-        // unlock
-        if (pthread_mutex_unlock(&messageQueueMutex) != 0) {
-            std::cerr << "message queue mutex unlock failure\n";
-            exit(1);
+        
+        parameterLane.pop();
+        count++;
+    }
+    return count;
+}
+
+uint64_t Device::laneDeadline(uint64_t now) {
+    if (sysExCurrent && sysExInMessage)
+        return bandwidthAvailableAt(sysExChunkLength(sysExCurrent), now);
+    if (! noteLane.empty())
+        return bandwidthAvailableAt(NOTE_BYTES, now);
+    if (! parameterLane.empty())
+        return bandwidthAvailableAt(PARAMETER_BYTES, now);
+    if (controlCoalescer.pendingCount())
+        return bandwidthAvailableAt(controlCoalescer.pendingEntry(0).highRes ? CONTROL_14BIT_BYTES : CONTROL_BYTES, now);
+    if (sysExCurrent)
+        return bandwidthAvailableAt(sysExChunkLength(sysExCurrent), now);
+    return 0;
+}
+
+// hand the next chunk of the current SysEx transfer to the outputs
+// returns false if there is none or no bandwidth for it
+bool Device::sendSysExChunk(uint64_t now) {
+    if (! sysExCurrent) {
+        if (! sysExQueue.drain(&sysExCurrent, 1))
+            return false;
+        sysExCurrent->state.store(SysExTransfer::SENDING, std::memory_order_release);
+    }
+    
+    size_t offset = sysExCurrent->sent.load(std::memory_order_relaxed);
+    size_t length = sysExChunkLength(sysExCurrent);
+    if (! takeBandwidth(length, now))
+        return false;
+    
+    // it can't share a packet with anything, whatever is encoded goes first
+    flushUMP();
+    flushEncodedPacket();
+    
+    const Byte *chunk = sysExCurrent->data + offset;
+    if (legacyOutputs)
+        addPacket(chunk, length);
+    if (protocol == PROTOCOL_UMP)
+        sendSysExUMP(chunk, length);
+    sysExInMessage = chunk[length - 1] != 0xF7;
+    
+    offset += length;
+    sysExCurrent->sent.store(offset, std::memory_order_relaxed);
+    if (offset == sysExCurrent->length) {
+        sysExCurrent->state.store(SysExTransfer::SENT, std::memory_order_release);
+        sysExCurrent = NULL;
+    }
+    return true;
+}
+
+// at most the chunk size, ending after the last F7 in it if there is one
+size_t Device::sysExChunkLength(const SysExTransfer *transfer) const {
+    size_t offset = transfer->sent.load(std::memory_order_relaxed);
+    size_t length = transfer->length - offset;
+    if (length <= sysExChunkSize)
+        return length;
+    
+    length = sysExChunkSize;
+    for (size_t i = length; i > 0; i--) {
+        if (transfer->data[offset + i - 1] == 0xF7)
+            return i;
+    }
+    return length;
+}
+
+// SysEx7 packets of up to 6 data bytes; a packet is only known to be a
+// message's last when its F7 is in the same chunk, otherwise an empty end
+// packet follows
+void Device::sendSysExUMP(const Byte *data, size_t length) {
+    auto flush = [this]() {
+        for (size_t i = 0; i < outputs.size(); i++) {
+            if (! umpSysExEncoder.empty() && outputs[i]->acceptsUMP())
+                outputs[i]->sendUMP(umpSysExEncoder.words(), umpSysExEncoder.wordCount(), 0);
+        }
+        umpSysExEncoder.reset();
+    };
+    umpSysExEncoder.setGroup(umpEncoder.getGroup());
+    umpSysExEncoder.reset();
+    
+    for (size_t pos = 0; pos < length; ) {
+        if (data[pos] == 0xF0) {
+            umpSysExStartPending = true;
+            pos++;
+            continue;
+        }
+        if (data[pos] >= 0x80 && data[pos] != 0xF7) {
+            pos++; // realtime message, not part of the SysEx
+            continue;
         }
         
-        // add control messages to MIDI packet queue
-        queueMessages(queueCopy);
+        size_t count = 0;
+        while (pos + count < length && count < LMX_UMP_SYSEX_PACKET_BYTES && data[pos + count] < 0x80)
+            count++;
+        bool end = pos + count < length && data[pos + count] == 0xF7;
+        if (! count && ! end) {
+            pos++;
+            continue;
+        }
         
-        // flush MIDI queue to output
-        sendMIDIQueue();
+        uint8_t status;
+        if (end)
+            status = umpSysExStartPending ? LMX_UMP_SYSEX_COMPLETE : LMX_UMP_SYSEX_END;
+        else
+            status = umpSysExStartPending ? LMX_UMP_SYSEX_START : LMX_UMP_SYSEX_CONTINUE;
+        
+        if (umpSysExEncoder.space() < 2)
+            flush();
+        umpSysExEncoder.sysEx7(status, data + pos, count);
+        
+        umpSysExStartPending = false;
+        pos += count + (end ? 1 : 0);
     }
     
-    return NULL;
+    flush();
+}
+
+void Device::failSysExTransfers() {
+    if (sysExCurrent)
+        sysExCurrent->state.store(SysExTransfer::FAILED, std::memory_order_release);
+    sysExCurrent = NULL;
+    
+    SysExTransfer *transfer;
+    while (sysExQueue.drain(&transfer, 1))
+        transfer->state.store(SysExTransfer::FAILED, std::memory_order_release);
 }
 
-void Device::queueMessages(std::queue<midi_message> &messages) {
-    struct timeval tv;
+void Device::countLaneDelay(Lane lane, uint64_t queuedAt, uint64_t now) {
+    uint64_t delay = now > queuedAt ? now - queuedAt : 0;
+    laneSent[lane]++;
+    laneDelayTotal[lane] += delay;
+    if (delay > laneDelayMax[lane].load(std::memory_order_relaxed))
+        laneDelayMax[lane].store(delay);
+}
+
+bool Device::takeBandwidth(size_t bytes, uint64_t now) {
+    if (! haveBandwidth(bytes, now))
+        return false;
+    chargeBandwidth(bytes, now);
+    return true;
+}
 
-    while (! messages.empty()) {
-        midi_message msg = messages.front();
-        messages.pop();
+bool Device::haveBandwidth(size_t bytes, uint64_t now) {
+    return ! rateLimited || bandwidthAvailableAt(bytes, now) <= now;
+}
+
+// all or nothing, every output gets the same bytes
+void Device::chargeBandwidth(size_t bytes, uint64_t now) {
+    if (! rateLimited || ! bytes)
+        return;
+    for (size_t i = 0; i < outputLimits.size(); i++)
+        outputLimits[i].consume(bytes, now);
+}
+
+// the bytes encoded since encodedBytes was mark; UMP words are only
+// translated for the MIDI 1.0 outputs when they're flushed, so those are
+// charged the most the message can take
+size_t Device::encodedSince(uint64_t mark, size_t maxBytes) const {
+    return protocol == PROTOCOL_UMP ? maxBytes : (size_t)(encodedBytes - mark);
+}
+
+uint64_t Device::bandwidthAvailableAt(size_t bytes, uint64_t now) {
+    uint64_t available = now;
+    for (size_t i = 0; i < outputLimits.size(); i++) {
+        uint64_t at = outputLimits[i].availableAt(bytes, now);
+        if (at > available)
+            available = at;
+    }
+    return available;
+}
+
+MIDITimeStamp Device::outputTimestamp(uint64_t captureTime, uint64_t now) {
+    uint64_t due = captureTime + latencyOffset;
+    if (due <= now)
+        return 0;
+    return clock->toHostTicks(due);
+}
+
+// queue the newest value of every pending controller, in the order they
+// were first touched, as far as the rate limit allows
+// 7 bit controllers one after the other on one channel for one point in
+// time are gathered and encoded as one run of control changes
+size_t Device::flushCoalescedControls(uint64_t now) {
+    // a channel has at most one pending entry per controller
+    ControlChange run[LMX_COALESCER_CONTROLLERS];
+    size_t runLength = 0, runCharged = 0;
+    MIDITimeStamp runTimestamp = 0;
+    auto flushRun = [&]() {
+        encodeRun(run, runLength, runTimestamp, runCharged, now);
+        // each may have been half of a 14 bit value or a parameter select
+        for (size_t i = 0; i < runLength; i++)
+            highResControls.controlSent(run[i].status & 0x0F, run[i].data1);
+        runLength = runCharged = 0;
+    };
+    
+    size_t count = 0;
+    for (; count < controlCoalescer.pendingCount(); count++) {
+        const ControlCoalescer::Entry &entry = controlCoalescer.pendingEntry(count);
+        if (dropPolicy.shouldDrop(DropPolicy::CONTROL, entry.timestamp + latencyOffset, now))
+            continue;
         
-        // figure out when this packet was added
-        gettimeofday(&tv, NULL);
-        double elapsedTime = (tv.tv_sec - msg.timestamp.tv_sec) * 1000.0;      // sec to ms
-        elapsedTime += (tv.tv_usec - msg.timestamp.tv_usec) / 1000.0;   // us to ms
-        if (elapsedTime > 2) {
-            // message was triggered too long ago, we don't want to emit old messages
-            std::cerr << "Warning, MIDI control message latency of " << elapsedTime << "ms detected.\n";
-            continue; // drop message
-        }
+        MIDITimeStamp timestamp = outputTimestamp(entry.timestamp, now);
+        bool inRun = protocol != PROTOCOL_UMP && ! entry.highRes;
+        if (runLength && (! inRun || entry.channel != (run[0].status & 0x0F) || timestamp != runTimestamp))
+            flushRun();
         
-        if (msg.type == MSG_CONTROL) {
-            // we have data to send. i think this blocks
-            queueControlPacket(msg.control_index, msg.control_value);
-        } else if (msg.type == MSG_NOTE) {
-            // we have data to send. i think this blocks
-            queueNotePacket(msg.note_index, msg.note_value);
+        size_t maxBytes = entry.highRes ? CONTROL_14BIT_BYTES : CONTROL_BYTES;
+        if (! haveBandwidth(maxBytes, now))
+            break;
+        
+        if (inRun) {
+            assert(entry.controller < 120);
+            size_t bytes = 2;
+            if (! runLength) {
+                runTimestamp = timestamp;
+                bytes = encodedLength(ControlChange::statusByte(entry.channel), 2, timestamp);
+            }
+            run[runLength++] = ControlChange(entry.channel, entry.controller, entry.value);
+            chargeBandwidth(bytes, now);
+            runCharged += bytes;
         } else {
-            printf("Unknown MIDI message type; ignoring\n");
+            uint64_t mark = encodedBytes;
+            if (entry.highRes)
+                queueControl14Packet(entry.controller, entry.value, entry.channel, timestamp);
+            else
+                queueControlPacket(entry.controller, entry.value, entry.channel, timestamp);
+            chargeBandwidth(encodedSince(mark, maxBytes), now);
         }
+        countLaneDelay(LANE_CONTROL, entry.queuedAt, now);
     }
+    
+    flushRun();
+    controlCoalescer.consume(count);
+    return count;
 }
 
-// "send" a packet, really pretends that our virtual device source received a packet
 OSStatus Device::sendMIDIQueue() {
+    flushUMP();
+    flushEncodedPacket();
+    return sendPacketList();
+}
+
+OSStatus Device::sendPacketList() {
+    if (packetList.empty())
+        return 0;
+    
     // send current packet list
-    OSStatus res = MIDIReceived(deviceEndpoint, midiPacketList);
+    OSStatus res = 0;
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (protocol == PROTOCOL_UMP && outputs[i]->acceptsUMP())
+            continue; // got it as UMP
+        OSStatus outputRes = outputs[i]->send(packetList.get());
+        if (outputRes) {
+            LMX_LOG(LOG_WARN, "%s output failed to send MIDI: %d", outputs[i]->name(), outputRes);
+            if (! i)
+                res = outputRes;
+        }
+    }
     
-    // reinitialize packet list, MIDIReceived does not appear to flush the list
-    // none of this is really documented but this seems to work ok
-    initPacketList();
+    // reinitialize packet list, the backends don't consume it
+    packetList.reset();
     
     return res;
 }
 
+void Device::addPacket(const Byte *data, size_t length, MIDITimeStamp timestamp) {
+    if (packetList.add(timestamp, length, data))
+        return;
+    
+    // burst is bigger than the list, send what we have so far and retry
+    if (! packetList.empty()) {
+        sendPacketList();
+        if (packetList.add(timestamp, length, data))
+            return;
+    }
+    
+    // doesn't even fit in an empty list, use more of the buffer
+    while (packetList.grow()) {
+        if (packetList.add(timestamp, length, data))
+            return;
+    }
+    
+    LMX_LOG(LOG_WARN, "MIDI packet of %zu bytes is too large for packet list, dropping", length);
+}
+
+void Device::encodeMessage(Byte status, Byte data1, Byte data2, MIDITimeStamp timestamp, size_t dataLength) {
+    // a packet only holds messages for one point in time
+    if (! encoder.empty() && timestamp != encoderTimestamp)
+        flushEncodedPacket();
+    
+    size_t before = encoder.length();
+    if (! encoder.append(status, data1, data2, dataLength)) {
+        // packet is full, start another one
+        flushEncodedPacket();
+        before = 0;
+        encoder.append(status, data1, data2, dataLength);
+    }
+    encodedBytes += encoder.length() - before;
+    encoderTimestamp = timestamp;
+}
+
+template <typename Message>
+void Device::encodeMessages(const Message *msgs, size_t count, MIDITimeStamp timestamp) {
+    if (! count)
+        return;
+    if (! encoder.empty() && timestamp != encoderTimestamp)
+        flushEncodedPacket();
+    encoderTimestamp = timestamp;
+    
+    // as many as fit in each packet
+    for (;;) {
+        size_t before = encoder.length();
+        size_t encoded = encoder.appendRun(msgs, count);
+        encodedBytes += encoder.length() - before;
+        msgs += encoded;
+        count -= encoded;
+        if (! count)
+            break;
+        flushEncodedPacket();
+    }
+}
+
+size_t Device::encodedLength(Byte status, size_t dataLength, MIDITimeStamp timestamp) const {
+    bool running = ! encoder.empty() && timestamp == encoderTimestamp && encoder.getRunningStatus() == status;
+    return (running ? 0 : 1) + dataLength;
+}
+
+template <typename Message>
+void Device::encodeRun(const Message *msgs, size_t count, MIDITimeStamp timestamp, size_t charged, uint64_t now) {
+    uint64_t mark = encodedBytes;
+    encodeMessages(msgs, count, timestamp);
+    size_t encoded = encodedBytes - mark;
+    if (encoded > charged)
+        chargeBandwidth(encoded - charged, now);
+}
+
+void Device::flushEncodedPacket() {
+    if (encoder.empty())
+        return;
+    
+    addPacket(encoder.data(), encoder.length(), encoderTimestamp);
+    encoder.reset();
+}
+
+void Device::prepareUMP(size_t words, MIDITimeStamp timestamp) {
+    // like packets, a run of words is for one point in time
+    if (! umpEncoder.empty() && (timestamp != umpTimestamp || umpEncoder.space() < words))
+        flushUMP();
+    umpTimestamp = timestamp;
+}
+
+void Device::flushUMP() {
+    if (umpEncoder.empty())
+        return;
+    
+    for (size_t i = 0; i < outputs.size(); i++) {
+        if (! outputs[i]->acceptsUMP())
+            continue;
+        OSStatus res = outputs[i]->sendUMP(umpEncoder.words(), umpEncoder.wordCount(), umpTimestamp);
+        if (res)
+            LMX_LOG(LOG_WARN, "%s output failed to send UMP: %d", outputs[i]->name(), res);
+    }
+    
+    if (legacyOutputs) {
+        size_t length = umpTranslator.toMIDI1(umpEncoder.words(), umpEncoder.wordCount(), translatedMessages, sizeof(translatedMessages));
+        for (size_t pos = 0; pos < length; ) {
+            // every message has its status byte
+            Byte status = translatedMessages[pos];
+            size_t dataLength = (status & 0xE0) == 0xC0 ? 1 : 2;
+            encodeMessage(status, translatedMessages[pos + 1], dataLength == 2 ? translatedMessages[pos + 2] : 0, umpTimestamp, dataLength);
+            pos += 1 + dataLength;
+        }
+    }
+    
+    umpEncoder.reset();
+}
+
+// the translation to MIDI 1.0 has to know which controllers are 14 bit,
+// words already collected are translated with what was true for them
+void Device::markControl14(unsigned char channel, leapmidi::midi_control_index control, bool control14) {
+    if (! legacyOutputs || control >= 32 || umpTranslator.isControl14(channel, control) == control14)
+        return;
+    flushUMP();
+    umpTranslator.setControl14(channel, control, control14);
+}
+
 // control = MIDI control #, 0-119
 // value = MIDI control message value, 0-127
-void Device::queueControlPacket(leapmidi::midi_control_index control, leapmidi::midi_control_value value) {
+// channel = MIDI channel, 0-15
+// timestamp = host time to deliver at, 0 for now
+void Device::queueControlPacket(leapmidi::midi_control_index control, leapmidi::midi_control_value value, unsigned char channel, MIDITimeStamp timestamp) {
     assert(control < 120);
     assert(value <= 127);
+    assert(channel < 16);
     
-    // assign channel value
-    // (hardcoded to channel 0 for now)
-    unsigned char channelBase = 0xB0;
-    unsigned char channel = 0;
-    unsigned char midiChannel = channelBase + channel;
-    
-    // assign control selector
-    unsigned char controlBase = 0x00;
-    unsigned char midiControl = controlBase + control;
-    
-    // build midi packet
-    Byte packetOut[3];
-    packetOut[0] = midiChannel;
-    packetOut[1] = midiControl;
-    packetOut[2] = value;
-    
-//    int z;
-//    printf("Sending MIDI packet: ");
-//    for (z = 0; z < 3; z++)
-//    {
-//        if (z > 0) printf(":");
-//        printf("%02X", packetOut[z]);
-//    }
-//    printf("\n");
-
-    
-    // add packet to packet list
-    curPacket = MIDIPacketListAdd(midiPacketList, packetListSize, curPacket, 0, 3, packetOut);
-    if (! curPacket) {
-        std::cerr << "Buffer overrun on midi packet list\n";
-        exit(1);
+    if (protocol == PROTOCOL_UMP) {
+        markControl14(channel, control, false);
+        prepareUMP(2, timestamp);
+        umpEncoder.controlChange(channel, control, UMPEncoder::scaleUp(value, 7, 32));
+        return;
     }
-}
     
-// note = MIDI note #, 0-119
-// value = MIDI note message velocity, 0-127
-void Device::queueNotePacket(leapmidi::midi_note_index note, leapmidi::midi_note_value value) {
-    assert(note < 127);
-    assert(value <= 127);
+    // add message to the packet being encoded
+    ControlChange msg(channel, control, value);
+    encodeMessages(&msg, 1, timestamp);
     
-    // assign channel value
-    // (hardcoded to channel 0 - Registered Parameter LSB)
-    unsigned char channelBase = 0x90;
-    unsigned char channel = 0;
+    // may have been half of a 14 bit value or a parameter select
+    highResControls.controlSent(channel, control);
+}
+
+// control = 14 bit controller #, 0-31, its LSB is control + 32
+// value = 0-16383
+// the MSB is only sent when it changes, the LSB when either changes
+void Device::queueControl14Packet(leapmidi::midi_control_index control, leapmidi::midi_control_value value, unsigned char channel, MIDITimeStamp timestamp) {
+    assert(control < 32);
+    assert(value <= 16383);
+    assert(channel < 16);
     
-    if (value < 50) {
-        // if value is less than 50, turn note off
-        channelBase = 0x80;
+    if (protocol == PROTOCOL_UMP) {
+        // one message, no MSB/LSB pair needed
+        markControl14(channel, control, true);
+        prepareUMP(2, timestamp);
+        umpEncoder.controlChange(channel, control, UMPEncoder::scaleUp(value, 14, 32));
+        return;
     }
+    
+    unsigned int send = highResControls.control(channel, control, value);
+    ControlChange14 msg(channel, control, value);
+    if (send == (HighResControls::SEND_MSB | HighResControls::SEND_LSB))
+        encodeMessages(&msg.msb, 2, timestamp);
+    else if (send & HighResControls::SEND_MSB)
+        encodeMessages(&msg.msb, 1, timestamp);
+    else if (send & HighResControls::SEND_LSB)
+        encodeMessages(&msg.lsb, 1, timestamp);
+}
 
-    unsigned char midiChannel = channelBase + channel;
+// parameter = NRPN/RPN #, 0-16383
+// value = 0-16383
+// the parameter select is left out when the parameter is already selected,
+// data entry follows the same rules as a 14 bit controller
+void Device::queueParameterPacket(bool registered, leapmidi::midi_control_index parameter, leapmidi::midi_control_value value, unsigned char channel, MIDITimeStamp timestamp) {
+    assert(parameter <= 16383);
+    assert(value <= 16383);
+    assert(channel < 16);
     
-    // assign control selector
-    unsigned char noteBase = 0x48;
-    unsigned char midiNote = noteBase + note;
+    if (protocol == PROTOCOL_UMP) {
+        // one message, parameter and value together
+        prepareUMP(2, timestamp);
+        uint32_t value32 = UMPEncoder::scaleUp(value, 14, 32);
+        if (registered)
+            umpEncoder.registeredController(channel, parameter, value32);
+        else
+            umpEncoder.assignableController(channel, parameter, value32);
+        return;
+    }
     
-    if (value >= 50) {
-        //unsigned char midiControl = noteBase + note;
-        int i = 0;
-        for (i = 0; i < activeNotes.size(); i++) {
-            if (activeNotes.at(i) == midiNote) {
-                // this note is already on, don't try playing it again
-                printf("Not playing another note on\n");
-                return;
-            }
-        }
-        
-        activeNotes.push_back(midiNote);
-    } else if (value < 50) {
-        //unsigned char midiControl = noteBase + note;
-        int i = 0;
-        for (i = 0; i < activeNotes.size(); i++) {
-            if (activeNotes.at(i) == midiNote) {
-                // remove from list of active notes
-                activeNotes.erase(activeNotes.begin() + i);
-            }
-        }
+    // up to four control changes on one channel, encoded in one go
+    ControlChange msgs[4] = {
+        ControlChange(channel, registered ? LMX_CC_RPN_MSB : LMX_CC_NRPN_MSB, parameter >> 7),
+        ControlChange(channel, registered ? LMX_CC_RPN_LSB : LMX_CC_NRPN_LSB, parameter),
+        ControlChange(channel, LMX_CC_DATA_ENTRY_MSB, value >> 7),
+        ControlChange(channel, LMX_CC_DATA_ENTRY_LSB, value)
+    };
+    size_t count = 0;
+    if (highResControls.selectParameter(channel, registered, parameter))
+        count = 2;
+    
+    unsigned int send = highResControls.dataEntry(channel, value);
+    if (send & HighResControls::SEND_MSB)
+        msgs[count++] = msgs[2];
+    if (send & HighResControls::SEND_LSB)
+        msgs[count++] = msgs[3];
+    encodeMessages(msgs, count, timestamp);
+}
+    
+// note = MIDI note #, 0-127
+// velocity = MIDI note message velocity, 0 for a note-off
+// timestamp = host time to deliver at, 0 for now
+void Device::queueNotePacket(leapmidi::midi_note_index note, leapmidi::midi_note_value velocity, unsigned char channel, MIDITimeStamp timestamp) {
+    if (! trackNote(note, velocity, channel))
+        return;
+    
+    if (protocol == PROTOCOL_UMP) {
+        prepareUMP(2, timestamp);
+        if (velocity)
+            umpEncoder.noteOn(channel, note, UMPEncoder::scaleUp(velocity, 7, 16));
+        else
+            umpEncoder.noteOff(channel, note, UMPEncoder::scaleUp(0x7F, 7, 16));
+        return;
     }
     
-    // build midi packet
-    Byte packetOut[3];
-    packetOut[0] = midiChannel;
-    packetOut[1] = midiNote;
-    packetOut[2] = 0x7F;
-    //        packetOut[2] = value;
+    // add message to the packet being encoded
+    if (velocity) {
+        NoteOn msg(channel, note, velocity);
+        encodeMessages(&msg, 1, timestamp);
+    } else {
+        NoteOff msg(channel, note, 0x7F);
+        encodeMessages(&msg, 1, timestamp);
+    }
+}
+
+bool Device::trackNote(leapmidi::midi_note_index note, leapmidi::midi_note_value velocity, unsigned char channel) {
+    assert(note <= 127);
+    assert(velocity <= 127);
+    assert(channel < 16);
     
-    int z;
-    printf("Sending MIDI packet: ");
-    for (z = 0; z < 3; z++)
-    {
-        if (z > 0) printf(":");
-        printf("%02X", packetOut[z]);
+    if (velocity) {
+        if (activeNotes.test(channel, note)) {
+            // this note is already on, don't try playing it again
+            LMX_LOG(LOG_DEBUG, "Not playing another note on");
+            return false;
+        }
+        
+        activeNotes.set(channel, note);
+    } else {
+        // remove from list of active notes
+        activeNotes.clear(channel, note);
     }
-    printf("\n");
     
+    // (note-offs have the release velocity they always had)
+    LMX_LOG(LOG_DEBUG, "Sending MIDI note %s: %d:%02X:%02X", velocity ? "on" : "off", channel, note, velocity ? velocity : 0x7F);
+    return true;
+}
+
+void Device::queueAllNotesOff() {
+    if (protocol == PROTOCOL_UMP) {
+        activeNotes.forEach([this](unsigned char channel, unsigned char note) {
+            prepareUMP(2, 0);
+            umpEncoder.noteOff(channel, note, UMPEncoder::scaleUp(0x7F, 7, 16));
+        });
+        activeNotes.clearAll();
+        return;
+    }
     
-    // add packet to packet list
-    curPacket = MIDIPacketListAdd(midiPacketList, packetListSize, curPacket, 0, 3, packetOut);
-    if (! curPacket) {
-        std::cerr << "Buffer overrun on midi packet list\n";
-        exit(1);
+    // a channel's note-offs at a time, one status byte for all of them
+    NoteOff offs[128];
+    for (unsigned char channel = 0; channel < 16; channel++) {
+        size_t count = 0;
+        activeNotes.forEach(channel, [&](unsigned char, unsigned char note) {
+            offs[count++] = NoteOff(channel, note, 0x7F);
+        });
+        encodeMessages(offs, count);
     }
+    activeNotes.clearAll();
 }
 
 
@@ -327,13 +1201,8 @@ void Device::queueNotePacket(leapmidi::midi_note_index note, leapmidi::midi_note
 
 ///
 
-static void lmx_dev_debug(const char *msg) {
-    pthread_mutex_lock(&debug_output_mutex);
-    fprintf(stderr, "DEBUG: %s", msg);
-    pthread_mutex_unlock(&debug_output_mutex);
-}
-
 static void fatal(const char *msg) {
+    leapmidi::Logger::shared().flush();
     fprintf(stderr, "Fatal error: %s\n", msg);
     exit(1);
 }
@@ -6,70 +6,478 @@
 //
 
 // LeapMIDIX::Device represents a virtual MIDI source device
-// This emits MIDI control messages
+// This emits MIDI control messages through an OutputBackend
 
 #ifndef __LeapMIDIX__LeapMIDIXDevice__
 #define __LeapMIDIX__LeapMIDIXDevice__
 
 #include <iostream>
-#include <queue>
+#include <atomic>
+#include <vector>
 #include <pthread.h>
-#include <sys/time.h>
-#include <CoreMIDI/CoreMIDI.h>
+#include <assert.h>
+#include "MIDICompat.h"
 #include "LeapMIDI.h"
+#include "MessageRing.h"
+#include "MIDIMessage.h"
+#include "ControlCoalescer.h"
+#include "PacketList.h"
+#include "MIDIEncoder.h"
+#include "UMPEncoder.h"
+#include "UMPTranslator.h"
+#include "HostClock.h"
+#include "ActiveNotes.h"
+#include "HighResControls.h"
+#include "DropPolicy.h"
+#include "TokenBucket.h"
+#include "TimerWheel.h"
+#include "RealtimeThread.h"
+#include "EventNotifier.h"
+#include "OutputBackend.h"
 
 namespace leapmidi {
     
-typedef struct {
-    leapmidi::midi_control_index control_index;
-    leapmidi::midi_control_value control_value;
+class OutputReactor;
+    
+// max number of messages waiting to be sent, must be a power of two
+#define LMX_MESSAGE_RING_SIZE 1024
+
+// setSendAhead() value for handing messages to the output right away
+#define LMX_SEND_AHEAD_UNLIMITED UINT64_MAX
+
+// max number of messages collected from a single Leap frame
+#define LMX_MESSAGE_BATCH_SIZE 128
+
+// max number of SysEx transfers waiting to be sent, must be a power of two
+#define LMX_SYSEX_QUEUE_SIZE 16
+
+// default SysEx chunk size, one MIDIPacket
+#define LMX_SYSEX_CHUNK_SIZE 256
+
+// fixed-size collection of messages handed to the Device in one call
+// (not thread-safe, meant to be owned by a single frame callback)
+class MessageBatch {
+public:
+    MessageBatch() : count(0) {}
+    
+    void addControl(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue);
+    // notes from LMX_NOTE_COUNT up are past MIDI note 127 and left out
+    void addNote(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue);
+    // high resolution controls, values 0-16383
+    // an (N)RPN takes two of the batch's messages
+    void addControl14(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue);
+    void addNRPN(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value);
+    void addRPN(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value);
+    // drop what's scheduled for a note (see Device::cancelScheduledNote),
+    // effects move it along with the note it cancels
+    void addCancel(leapmidi::midi_note_index noteIndex);
+    
+    void clear() { count = 0; }
+    // keep only the first n messages (e.g. after filtering in place)
+    void truncate(size_t n) { assert(n <= count); count = n; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == LMX_MESSAGE_BATCH_SIZE; }
+    size_t space() const { return LMX_MESSAGE_BATCH_SIZE - count; }
+    size_t size() const { return count; }
+    
+    midi_message *begin() { return messages; }
+    const midi_message *begin() const { return messages; }
+    
+protected:
+    midi_message messages[LMX_MESSAGE_BATCH_SIZE];
+    size_t count;
+};
+
+// SysEx data handed to Device::sendSysEx(), one or more complete messages
+// (F0 ... F7) back to back.
+// Owned by the caller, who must keep it and its data around until done();
+// the Device reads the data in place and never copies it anywhere but
+// into the packet being sent.
+class SysExTransfer {
+public:
+    enum State {
+        IDLE,
+        QUEUED,
+        SENDING,
+        SENT,
+        FAILED // rejected, or the Device went away first
+    };
+    
+    SysExTransfer(const Byte *data_, size_t length_) : data(data_), length(length_), state(IDLE), sent(0) {}
+    
+    const Byte *getData() const { return data; }
+    size_t getLength() const { return length; }
+    
+    // thread-safe
+    State getState() const { return (State)state.load(std::memory_order_acquire); }
+    bool done() const { return getState() == SENT || getState() == FAILED; }
+    size_t bytesSent() const { return sent.load(std::memory_order_relaxed); }
+    
+protected:
+    friend class Device;
+    
+    const Byte *data;
+    size_t length;
+    std::atomic<int> state;
+    std::atomic<size_t> sent;
+    
+private:
+    SysExTransfer(const SysExTransfer &);
+    SysExTransfer &operator=(const SysExTransfer &);
+};
 
-    leapmidi::midi_note_index note_index;
-    leapmidi::midi_note_value note_value;
+// FIFO of messages waiting for their turn at the output
+// (only touched by the sending thread)
+class MessageLane {
+public:
+    struct Entry {
+        midi_message msg;
+        uint64_t queuedAt;
+    };
+    
+    MessageLane() : head(0), count(0) {}
+    
+    // false if the lane is full
+    bool push(const midi_message &msg, uint64_t queuedAt) {
+        if (count == LMX_MESSAGE_RING_SIZE)
+            return false;
+        Entry &entry = entries[(head + count++) & (LMX_MESSAGE_RING_SIZE - 1)];
+        entry.msg = msg;
+        entry.queuedAt = queuedAt;
+        return true;
+    }
+    const Entry &front() const { return entries[head]; }
+    void pop() { head = (head + 1) & (LMX_MESSAGE_RING_SIZE - 1); count--; }
     
-    int type;
-    timeval timestamp;
-} midi_message;
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    size_t space() const { return LMX_MESSAGE_RING_SIZE - count; }
+    
+protected:
+    Entry entries[LMX_MESSAGE_RING_SIZE];
+    size_t head;
+    size_t count;
+};
 
 class Device {
 public:
-    Device();
+    // output priority, what's in a lane only goes out once the lanes
+    // before it are empty
+    enum Lane {
+        LANE_NOTE,    // note on/off
+        LANE_CONTROL, // control changes and (N)RPNs
+        LANE_COUNT
+    };
+    
+    enum Protocol {
+        PROTOCOL_MIDI1, // byte stream, the default
+        // MIDI 2.0 Universal MIDI Packets, with 32 bit controller values;
+        // outputs that don't accept UMP get it translated to MIDI 1.0
+        PROTOCOL_UMP
+    };
+    
+    // clock defaults to the shared host clock
+    // output defaults to the platform's native MIDI output; one passed in
+    // is not deleted by the Device and must outlive it
+    Device(Clock *clock = NULL, OutputBackend *output = NULL);
     virtual ~Device();
     virtual void init();
     
+    // send everything to another output as well (e.g. a recorder),
+    // must be called before init(); not deleted by the Device
+    // outputs are sent to one after the other, a FanOutBus as the output
+    // keeps a slow one from holding up the rest
+    virtual void addOutput(OutputBackend *output);
+    
     // thread-safe interface
     virtual void addControlMessage(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue);
+    // notes from LMX_NOTE_COUNT up are dropped, here and when scheduled
     virtual void addNoteMessage(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue);
+    // 14 bit controller 0-31 (MSB, with its LSB at +32), value 0-16383
+    virtual void addControl14Message(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue);
+    // non-registered/registered parameter 0-16383, value 0-16383
+    virtual void addNRPNMessage(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value);
+    virtual void addRPNMessage(leapmidi::midi_control_index parameter, leapmidi::midi_control_value value);
+    // enqueue a whole batch with one timestamp and one wakeup
+    // captureTime is when the batch's input was captured, in host clock
+    // nanoseconds; without it the batch is stamped with the current time
+    virtual void addMessages(MessageBatch &batch);
+    virtual void addMessages(MessageBatch &batch, uint64_t captureTime);
+    
+    // future-dated messages: anything with a capture time in the future
+    // (e.g. a batch added with one) is held back until then and goes out
+    // as if it had been captured at that moment, so a note-off can follow
+    // its note-on, a tap can echo or a held gesture can step an arpeggio
+    // delay is nanoseconds from now, at most half an hour
+    // these go straight to the device, LMXListener has the same ones
+    // running through its effects first
+    virtual void scheduleNoteMessage(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue, uint64_t delay);
+    virtual void scheduleControlMessage(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue, uint64_t delay);
+    // drop what's scheduled for a note on a channel, or everything
+    // scheduled, as of now; a note-off dropped this way leaves its note on
+    virtual void cancelScheduledNote(leapmidi::midi_note_index noteIndex, unsigned char channel = 0);
+    virtual void cancelScheduledMessages();
+    // messages waiting for their time
+    size_t scheduledMessageCount() const { return scheduledCount.load(std::memory_order_relaxed); }
+    
+    // messages go out this long after they were captured (nanoseconds)
+    // a small constant delay in exchange for removing the jitter of
+    // frame delivery and of the sending thread's wakeups
+    void setLatencyOffset(uint64_t nanos) { latencyOffset = nanos; }
+    uint64_t getLatencyOffset() const { return latencyOffset; }
+    
+    // hand messages to the output no earlier than this long before they
+    // are due (nanoseconds); the sending thread sleeps until then
+    // unlimited (the default) suits outputs that schedule by timestamp
+    // themselves and becomes 0 for those that don't, which sends every
+    // message exactly when it is due
+    void setSendAhead(uint64_t nanos) { sendAhead = nanos; }
+    uint64_t getSendAhead() const { return sendAhead; }
+    
+    // must be set before init()
+    void setProtocol(Protocol protocol_) { protocol = protocol_; }
+    Protocol getProtocol() const { return protocol; }
+    
+    Clock *getClock() const { return clock; }
+    
+    // midi_message times: capture time in microseconds since the epoch
+    // (the Device's creation), truncated to 32 bits, and back; a message
+    // time is taken to be the one nearest to now, so it stays unambiguous
+    // for half an hour either way
+    uint32_t messageClock(uint64_t time) const;
+    uint64_t messageTime(uint32_t time, uint64_t now) const;
+    // the primary output
+    OutputBackend *getOutput() const { return outputs[0]; }
+    
+    // cap the bytes per second sent to an output (e.g.
+    // LMX_DIN_BYTES_PER_SECOND for a DIN port downstream), 0 for no cap;
+    // every output gets the same stream, so the tightest cap holds for all
+    // (an output that mustn't be held back by another's cap needs a Device
+    // of its own); what's charged is the bytes actually encoded, after
+    // running status and leaving out what the receiver already has
+    // must be set before init()
+    void setRateLimit(OutputBackend *output, uint64_t bytesPerSecond, uint64_t burstBytes = LMX_ENCODER_MAX_PACKET);
+    
+    // messages sent from a lane and how long they waited in it
+    // (nanoseconds from being queued to being handed to the output)
+    unsigned long laneSentCount(Lane lane) const { return laneSent[lane].load(); }
+    uint64_t laneAverageDelay(Lane lane) const;
+    uint64_t laneMaxDelay(Lane lane) const { return laneDelayMax[lane].load(); }
+    
+    // per-class lateness deadlines and drop counters
+    DropPolicy &getDropPolicy() { return dropPolicy; }
+    
+    // CC messages left out of high resolution output because the
+    // receiver already had them
+    unsigned long suppressedControlCount() const { return highResControls.suppressedCount(); }
+    
+    // scheduling/affinity/memory locking for the sending thread,
+    // must be set before init()
+    void setSenderThreadConfig(const ThreadConfig &config) { senderThreadConfig = config; }
+    // what the sending thread actually got, once it is running
+    ThreadGuarantees getSenderGuarantees() const { return senderGuarantees; }
+    
+    // have the reactor's thread do the sending instead of a thread of our
+    // own (the thread config above doesn't apply then, the reactor's does);
+    // must be set before init(), the reactor must outlive the Device
+    void setReactor(OutputReactor *reactor_) { reactor = reactor_; }
+    OutputReactor *getReactor() const { return reactor; }
     
     // add MIDI control messages to the MIDI packet queue to transmit
     // these may block and not be safe to call from another thread
-    virtual void queueMessages(std::queue<midi_message> &messages);
-    virtual void queueControlPacket(leapmidi::midi_control_index control, leapmidi::midi_control_value value);
-    virtual void queueNotePacket(leapmidi::midi_note_index note, leapmidi::midi_note_value value);
+    virtual void queueMessages(const midi_message *messages, size_t count);
+    virtual void queueControlPacket(leapmidi::midi_control_index control, leapmidi::midi_control_value value, unsigned char channel = 0, MIDITimeStamp timestamp = 0);
+    // only the bytes the receiver doesn't already have go out
+    virtual void queueControl14Packet(leapmidi::midi_control_index control, leapmidi::midi_control_value value, unsigned char channel = 0, MIDITimeStamp timestamp = 0);
+    virtual void queueParameterPacket(bool registered, leapmidi::midi_control_index parameter, leapmidi::midi_control_value value, unsigned char channel = 0, MIDITimeStamp timestamp = 0);
+    virtual void queueNotePacket(leapmidi::midi_note_index note, leapmidi::midi_note_value velocity, unsigned char channel = 0, MIDITimeStamp timestamp = 0);
+    // update the held notes for a note about to be queued, false for a
+    // note-on that's already sounding (nothing to send)
+    virtual bool trackNote(leapmidi::midi_note_index note, leapmidi::midi_note_value velocity, unsigned char channel);
+    // queue a note-off for every held note
+    virtual void queueAllNotesOff();
+    
+    // thread-safe, have the sending thread release every held note
+    // (e.g. when switching programs)
+    virtual void requestAllNotesOff();
+    
+    // thread-safe, stream SysEx to the outputs a chunk at a time, with
+    // notes and controls going out in between; false (and FAILED) if it
+    // isn't SysEx or too many transfers are waiting already
+    // chunks end on a message boundary where they can: MIDI 1.0 can't
+    // have anything else inside a SysEx message, so a message longer than
+    // a chunk holds everything up until it's through
+    virtual bool sendSysEx(SysExTransfer *transfer);
+    // must be set before init()
+    void setSysExChunkSize(size_t bytes) { sysExChunkSize = bytes; }
+    size_t getSysExChunkSize() const { return sysExChunkSize; }
     
 protected:
-    virtual void initPacketList();
     virtual void createDevice();
     
+    // packet timestamp for a message captured at captureTime
+    // (0, meaning now, if that moment has already passed)
+    virtual MIDITimeStamp outputTimestamp(uint64_t captureTime, uint64_t now);
+    
+    Clock *clock;
+    uint64_t epoch;
+    Protocol protocol;
+    uint64_t latencyOffset;
+    uint64_t sendAhead;
+    DropPolicy dropPolicy;
+    
     // thread-safe MIDI message queue
     virtual void *messageSendingThreadEntry();
-    std::queue<midi_message> midiMessageQueue;
-    pthread_mutex_t messageQueueMutex;
+    // one pass of the sending thread's work, true if anything was sent;
+    // otherwise deadline is when there's something to do without a
+    // producer's help (host clock nanoseconds, 0 for none)
+    virtual bool serviceSender(uint64_t &deadline);
+    virtual void enqueueMessage(const midi_message &msg);
+    virtual void enqueueMessages(const midi_message *msgs, size_t count);
+    virtual void wakeSender();
+    // sleep until a producer pushes something or until deadline
+    // (host clock nanoseconds, 0 for none)
+    virtual void waitForMessages(uint64_t deadline);
+    // announce the sending thread is about to sleep, false if producers
+    // have published something in the meantime; unparkSender once awake
+    bool parkSender();
+    void unparkSender();
+    MessageRing<midi_message, LMX_MESSAGE_RING_SIZE> messageRing;
+    midi_message drainedMessages[LMX_MESSAGE_RING_SIZE];
+    std::atomic<unsigned long> droppedMessageCount; // ring was full
+    
+    // messages ready to go out wait in their lane until the lanes ahead
+    // of them are empty and the rate limit allows
+    // serviceLanes returns the number of messages sent or dropped
+    // (only touched by the sending thread)
+    virtual size_t serviceLanes(uint64_t now);
+    virtual size_t flushNoteLane(uint64_t now);
+    virtual size_t flushParameterLane(uint64_t now);
+    bool lanesEmpty() const { return noteLane.empty() && parameterLane.empty() && ! controlCoalescer.pendingCount(); }
+    // when the next message waiting in a lane can go, 0 if none is waiting
+    virtual uint64_t laneDeadline(uint64_t now);
+    void countLaneDelay(Lane lane, uint64_t queuedAt, uint64_t now);
+    MessageLane noteLane;
+    MessageLane parameterLane; // select/value pairs in order, part of LANE_CONTROL
+    midi_message parameterSelect[16]; // per channel, waiting for its value
+    std::atomic<unsigned long> laneSent[LANE_COUNT];
+    std::atomic<uint64_t> laneDelayTotal[LANE_COUNT];
+    std::atomic<uint64_t> laneDelayMax[LANE_COUNT];
+    
+    // newest value per controller, the rest of LANE_CONTROL; a controller
+    // that can't go out yet keeps only its newest value
+    virtual size_t flushCoalescedControls(uint64_t now);
+    ControlCoalescer controlCoalescer;
+    
+    // SysEx transfers waiting to be sent, and the one being sent
+    // (only touched by the sending thread, once queued)
+    virtual bool sendSysExChunk(uint64_t now);
+    virtual size_t sysExChunkLength(const SysExTransfer *transfer) const;
+    virtual void sendSysExUMP(const Byte *data, size_t length);
+    virtual void failSysExTransfers();
+    MessageRing<SysExTransfer *, LMX_SYSEX_QUEUE_SIZE> sysExQueue;
+    SysExTransfer *sysExCurrent;
+    size_t sysExChunkSize;
+    // the last chunk ended inside a message, nothing else may go out
+    // until the rest of it has
+    bool sysExInMessage;
+    // for UMP outputs: an F0 that hasn't gone out in a SysEx7 packet yet
+    bool umpSysExStartPending;
+    UMPEncoder umpSysExEncoder;
+    
+    // take bytes from every output's rate limit, false if one of them
+    // doesn't have enough
+    virtual bool takeBandwidth(size_t bytes, uint64_t now);
+    // the same in two steps, for messages whose length is only known once
+    // encoded: check there's room for the most they can take, then charge
+    // what they took
+    virtual bool haveBandwidth(size_t bytes, uint64_t now);
+    virtual void chargeBandwidth(size_t bytes, uint64_t now);
+    size_t encodedSince(uint64_t mark, size_t maxBytes) const;
+    // when bytes will be available on every output
+    virtual uint64_t bandwidthAvailableAt(size_t bytes, uint64_t now);
+    std::vector<TokenBucket> outputLimits; // one per output
+    bool rateLimited;
+    
+    // what the receiver has of our 14 bit controllers and parameters
+    // (only touched by the sending thread)
+    HighResControls highResControls;
+    
+    // messages that are not due to be handed to the output yet
+    // (only touched by the sending thread)
+    virtual bool holdMessage(const midi_message &msg, uint64_t now);
+    virtual size_t releaseHeldMessages(uint64_t now);
+    virtual void cancelScheduled(const midi_message &msg);
+    TimerWheel heldMessages;
+    midi_message releasedMessages[LMX_MESSAGE_RING_SIZE];
+    std::atomic<size_t> scheduledCount; // heldMessages.size(), for other threads
+    
+    // producers only signal the notifier when the sending thread has
+    // announced it is going to sleep, i.e. on the empty to non-empty
+    // transition, so a busy sender costs them no system calls
+    std::atomic<bool> senderWaiting;
+    std::atomic<bool> senderRunning;
+    EventNotifier senderNotifier;
     pthread_t messageQueueThread;
-    pthread_cond_t messageQueueCond;
+    OutputReactor *reactor; // sending for us instead of messageQueueThread
+    ThreadConfig senderThreadConfig;
+    ThreadGuarantees senderGuarantees;
     
     // send midi packets
     virtual OSStatus sendMIDIQueue();
+    virtual OSStatus sendPacketList();
+    
+    // every packet list goes to all of them, the primary one first
+    std::vector<OutputBackend *> outputs;
+    bool ownsOutput; // the primary one
+    bool outputOpen;
     
-    MIDIClientRef deviceClient;
-    MIDIEndpointRef deviceEndpoint;
-    MIDIPacketList *midiPacketList;
-    unsigned int packetListSize;
-    MIDIPacket *curPacket;
+    // append an encoded packet to the packet list; flushes early or grows
+    // the list if it doesn't fit
+    virtual void addPacket(const Byte *data, size_t length, MIDITimeStamp timestamp = 0);
+    PacketList packetList;
     
-    std::vector<int> activeNotes;
+    // channel messages with the same timestamp are packed into one packet
+    // with running status before they go into the packet list
+    virtual void encodeMessage(Byte status, Byte data1, Byte data2, MIDITimeStamp timestamp = 0, size_t dataLength = 2);
+    // the same for typed messages of one kind on one channel, without
+    // deciding anything per message
+    template <typename Message>
+    void encodeMessages(const Message *msgs, size_t count, MIDITimeStamp timestamp = 0);
+    // bytes a message will take going into the packet being encoded next
+    size_t encodedLength(Byte status, size_t dataLength, MIDITimeStamp timestamp) const;
+    // the lanes gather messages into runs like this, charging the rate
+    // limit for each message as it's gathered; a run split over packets
+    // is charged the status bytes that took on top
+    template <typename Message>
+    void encodeRun(const Message *msgs, size_t count, MIDITimeStamp timestamp, size_t charged, uint64_t now);
+    virtual void flushEncodedPacket();
+    MIDIEncoder encoder;
+    MIDITimeStamp encoderTimestamp;
+    uint64_t encodedBytes; // ever, running status and all
+    
+    // with the UMP protocol, messages are collected as UMP words per
+    // timestamp instead; flushing sends them to the outputs that accept
+    // UMP and the MIDI 1.0 translation through the encoder to the others
+    // prepareUMP makes room for that many more words at timestamp
+    virtual void prepareUMP(size_t words, MIDITimeStamp timestamp);
+    virtual void flushUMP();
+    // tell the translation whether a controller 0-31 carries 14 bit values
+    void markControl14(unsigned char channel, leapmidi::midi_control_index control, bool control14);
+    UMPEncoder umpEncoder;
+    MIDITimeStamp umpTimestamp;
+    UMPTranslator umpTranslator;
+    Byte translatedMessages[LMX_UMP_MAX_WORDS * 6]; // 12 bytes per message at most
+    bool legacyOutputs; // some outputs don't accept UMP
+    
+    // notes we have sent a note-on for and no note-off yet
+    // (only touched by the sending thread)
+    ActiveNotes activeNotes;
+    std::atomic<bool> allNotesOffRequested;
     
 private:
+    friend class OutputReactor;
+    
     static void *_messageSendingThreadEntry(void * This) {((Device *)This)->messageSendingThreadEntry(); return NULL;}
 
 };
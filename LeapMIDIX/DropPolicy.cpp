@@ -0,0 +1,48 @@
+//
+//  DropPolicy.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "DropPolicy.h"
+
+// note-ons more than 2ms late are dropped by default
+#define DEFAULT_NOTE_ON_DEADLINE_NS 2000000ULL
+
+namespace leapmidi {
+
+DropPolicy::DropPolicy() {
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        deadlines[i] = 0;
+        drops[i] = 0;
+    }
+    superseded = 0;
+
+    // controls are only ever superseded unless asked otherwise
+    deadlines[NOTE_ON] = DEFAULT_NOTE_ON_DEADLINE_NS;
+}
+
+void DropPolicy::setDeadline(MessageClass cls, uint64_t nanos) {
+    if (cls == NOTE_OFF)
+        return; // always delivered
+    deadlines[cls].store(nanos, std::memory_order_relaxed);
+}
+
+uint64_t DropPolicy::getDeadline(MessageClass cls) const {
+    return deadlines[cls].load(std::memory_order_relaxed);
+}
+
+bool DropPolicy::shouldDrop(MessageClass cls, uint64_t due, uint64_t now) {
+    if (cls == NOTE_OFF)
+        return false;
+
+    uint64_t deadline = deadlines[cls].load(std::memory_order_relaxed);
+    if (! deadline || now <= due || now - due <= deadline)
+        return false;
+
+    drops[cls].fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+} // namespace leapmidi
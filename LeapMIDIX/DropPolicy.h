@@ -0,0 +1,60 @@
+//
+//  DropPolicy.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Decides which late messages are still worth sending.
+// Each class of message has its own deadline past its scheduled time:
+//   control changes are superseded by newer values, and can optionally be
+//   dropped when late;
+//   note-ons are dropped when late, a note that sounds long after the
+//   gesture is worse than none;
+//   note-offs are always delivered, dropping one leaves a stuck note.
+// Deadlines can be changed from any thread while the sender is running.
+// Nothing is printed, drops are only counted.
+
+#ifndef __LeapMIDIX__DropPolicy__
+#define __LeapMIDIX__DropPolicy__
+
+#include <atomic>
+#include <stdint.h>
+
+namespace leapmidi {
+
+class DropPolicy {
+public:
+    enum MessageClass {
+        CONTROL = 0,
+        NOTE_ON,
+        NOTE_OFF,
+        NUM_CLASSES
+    };
+
+    DropPolicy();
+
+    // max nanoseconds a message may be past its scheduled time and still
+    // be sent, 0 to never drop; note-offs ignore this
+    void setDeadline(MessageClass cls, uint64_t nanos);
+    uint64_t getDeadline(MessageClass cls) const;
+
+    // true if a message of class cls that was due at `due` should be
+    // dropped at time `now` (counted as a drop)
+    bool shouldDrop(MessageClass cls, uint64_t due, uint64_t now);
+
+    // control change overwritten by a newer value before it was sent
+    void countSuperseded() { superseded++; }
+
+    unsigned long dropCount(MessageClass cls) const { return drops[cls].load(); }
+    unsigned long supersededCount() const { return superseded.load(); }
+
+protected:
+    std::atomic<uint64_t> deadlines[NUM_CLASSES];
+    std::atomic<unsigned long> drops[NUM_CLASSES];
+    std::atomic<unsigned long> superseded;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__DropPolicy__) */
@@ -0,0 +1,275 @@
+//
+//  EffectChain.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <math.h>
+#include "EffectChain.h"
+#include "Device.h"
+#include "Log.h"
+
+// a table entry that drops the message
+#define DROP 0xFF
+
+// noteMap entries
+#define NOTE_NONE 0xFFFF
+#define NOTE_DROPPED 0xFFFE
+
+namespace leapmidi {
+
+static inline uint16_t noteKey(const midi_message &msg) {
+    return ((msg.status & 0x0F) << 7) | msg.data1;
+}
+
+static inline bool isNote(const midi_message &msg) {
+    return (msg.status & 0xF0) == LMX_STATUS_NOTE;
+}
+
+// a cancel for a note's scheduled messages goes where the note would
+static inline bool isNoteCancel(const midi_message &msg) {
+    return (msg.status & 0xF0) == LMX_STATUS_CANCEL && ! (msg.data2 & LMX_CANCEL_ALL);
+}
+
+EffectChain::EffectChain() {
+    count = 0;
+    for (size_t i = 0; i < sizeof(noteMap) / sizeof(noteMap[0]); i++)
+        noteMap[i] = NOTE_NONE;
+}
+
+EffectChain::Stage *EffectChain::addStage(StageType type) {
+    if (count == LMX_EFFECT_MAX_STAGES) {
+        LMX_LOG(LOG_ERROR, "Effect chain is full, not adding another stage");
+        return NULL;
+    }
+    Stage *stage = &stages[count++];
+    stage->type = type;
+    stage->above = 0;
+    return stage;
+}
+
+bool EffectChain::addTranspose(int semitones) {
+    Stage *stage = addStage(TRANSPOSE);
+    if (! stage)
+        return false;
+    for (int note = 0; note < 128; note++) {
+        int moved = note + semitones;
+        stage->table[note] = moved >= 0 && moved <= 127 ? moved : DROP;
+    }
+    return true;
+}
+
+bool EffectChain::addScaleQuantize(unsigned root, uint16_t scale) {
+    scale &= LMX_SCALE_CHROMATIC;
+    if (! scale || root > 11) {
+        LMX_LOG(LOG_ERROR, "Not quantizing to an empty scale or root %u", root);
+        return false;
+    }
+    Stage *stage = addStage(SCALE_QUANTIZE);
+    if (! stage)
+        return false;
+
+    for (int note = 0; note < 128; note++) {
+        stage->table[note] = DROP;
+        // every scale has a note within 11 semitones either way
+        for (int distance = 0; distance < 12; distance++) {
+            int down = note - distance;
+            if (down >= 0 && (scale >> ((down + 12 - root) % 12) & 1)) {
+                stage->table[note] = down;
+                break;
+            }
+            int up = note + distance;
+            if (up <= 127 && (scale >> ((up + 12 - root) % 12) & 1)) {
+                stage->table[note] = up;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool EffectChain::addChannelRemap(const uint8_t map[16]) {
+    Stage *stage = addStage(CHANNEL_REMAP);
+    if (! stage)
+        return false;
+    for (int channel = 0; channel < 16; channel++)
+        stage->table[channel] = map[channel] < 16 ? map[channel] : DROP;
+    return true;
+}
+
+bool EffectChain::addVelocityCurve(float exponent, uint8_t min, uint8_t max) {
+    // a note-on never turns into a note-off
+    if (max > 127)
+        max = 127;
+    if (min < 1)
+        min = 1;
+    if (min > max)
+        min = max;
+    Stage *stage = addStage(VELOCITY_CURVE);
+    if (! stage)
+        return false;
+
+    stage->table[0] = 0;
+    for (int velocity = 1; velocity < 128; velocity++) {
+        float curved = min + (max - min) * powf(velocity / 127.0f, exponent);
+        int rounded = (int)(curved + 0.5f);
+        stage->table[velocity] = rounded < min ? min : rounded > max ? max : rounded;
+    }
+    return true;
+}
+
+bool EffectChain::addControlToNote(uint8_t controller, uint8_t threshold, uint8_t note, uint8_t velocity) {
+    Stage *stage = addStage(CONTROL_TO_NOTE);
+    if (! stage)
+        return false;
+    stage->controller = controller & 0x7F;
+    stage->threshold = threshold & 0x7F;
+    stage->note = note & 0x7F;
+    stage->velocity = velocity ? (velocity & 0x7F) : 1;
+    return true;
+}
+
+void EffectChain::clear() {
+    count = 0;
+}
+
+void EffectChain::process(MessageBatch &batch) {
+    batch.truncate(process(batch.begin(), batch.size()));
+}
+
+size_t EffectChain::process(midi_message *msgs, size_t n) {
+    // what the stages know about each message: the note it came in as, and
+    // whether it's already where it's going (a note-off sent after its
+    // note-on); a batch's worth at a time to keep them on the stack
+    uint16_t origin[LMX_MESSAGE_BATCH_SIZE];
+    bool final[LMX_MESSAGE_BATCH_SIZE];
+
+    size_t kept = 0;
+    for (size_t start = 0; start < n; start += LMX_MESSAGE_BATCH_SIZE) {
+        midi_message *chunk = msgs + start;
+        size_t length = n - start < LMX_MESSAGE_BATCH_SIZE ? n - start : LMX_MESSAGE_BATCH_SIZE;
+
+        for (size_t i = 0; i < length; i++) {
+            origin[i] = NOTE_NONE;
+            final[i] = false;
+            if (! isNote(chunk[i]))
+                continue;
+            origin[i] = noteKey(chunk[i]);
+            if (! chunk[i].data2)
+                final[i] = resolveNoteOff(chunk[i], origin[i]);
+        }
+
+        for (size_t s = 0; s < count; s++) {
+            Stage &stage = stages[s];
+            switch (stage.type) {
+                case TRANSPOSE:
+                case SCALE_QUANTIZE:
+                    applyNoteTable(stage, chunk, length, final);
+                    break;
+                case CHANNEL_REMAP:
+                    applyChannelTable(stage, chunk, length, final);
+                    break;
+                case VELOCITY_CURVE:
+                    applyVelocityTable(stage, chunk, length, final);
+                    break;
+                case CONTROL_TO_NOTE:
+                    applyControlToNote(stage, chunk, length, origin, final);
+                    break;
+            }
+        }
+
+        // remember where the notes went, and squeeze out the dropped
+        // messages (a dropped message keeps everything but its status)
+        for (size_t i = 0; i < length; i++) {
+            const midi_message msg = chunk[i];
+            if (origin[i] != NOTE_NONE) {
+                if (! msg.status)
+                    noteMap[origin[i]] = msg.data2 ? NOTE_DROPPED : NOTE_NONE;
+                else
+                    noteMap[origin[i]] = msg.data2 ? noteKey(msg) : NOTE_NONE;
+            }
+            if (msg.status)
+                msgs[kept++] = msg;
+        }
+    }
+    return kept;
+}
+
+bool EffectChain::resolveNoteOff(midi_message &msg, uint16_t origin) {
+    uint16_t sounding = noteMap[origin];
+    if (sounding == NOTE_NONE)
+        return false;
+    if (sounding == NOTE_DROPPED) {
+        msg.status = 0;
+        return true;
+    }
+    msg.status = LMX_STATUS_NOTE | (sounding >> 7);
+    msg.data1 = sounding & 0x7F;
+    return true;
+}
+
+void EffectChain::applyNoteTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final) {
+    for (size_t i = 0; i < n; i++) {
+        midi_message &msg = msgs[i];
+        if ((! isNote(msg) && ! isNoteCancel(msg)) || final[i])
+            continue;
+        uint8_t note = stage.table[msg.data1];
+        if (note == DROP)
+            msg.status = 0;
+        else
+            msg.data1 = note;
+    }
+}
+
+void EffectChain::applyChannelTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final) {
+    for (size_t i = 0; i < n; i++) {
+        midi_message &msg = msgs[i];
+        uint8_t type = msg.status & 0xF0;
+        if (final[i])
+            continue;
+        if (type != LMX_STATUS_NOTE && type != LMX_STATUS_CONTROL && type != LMX_STATUS_RPN &&
+            type != LMX_STATUS_NRPN && type != LMX_STATUS_PARAMETER_VALUE && ! isNoteCancel(msg))
+            continue;
+        uint8_t channel = stage.table[msg.status & 0x0F];
+        if (channel == DROP)
+            msg.status = 0;
+        else
+            msg.status = type | channel;
+    }
+}
+
+void EffectChain::applyVelocityTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final) {
+    for (size_t i = 0; i < n; i++) {
+        midi_message &msg = msgs[i];
+        if (isNote(msg) && msg.data2 && ! final[i])
+            msg.data2 = stage.table[msg.data2];
+    }
+}
+
+void EffectChain::applyControlToNote(Stage &stage, midi_message *msgs, size_t n, uint16_t *origin, bool *final) {
+    for (size_t i = 0; i < n; i++) {
+        midi_message &msg = msgs[i];
+        // 14 bit controllers have LMX_DATA_14BIT set, so never match
+        if ((msg.status & 0xF0) != LMX_STATUS_CONTROL || msg.data1 != stage.controller)
+            continue;
+
+        uint8_t channel = msg.status & 0x0F;
+        bool above = msg.data2 >= stage.threshold;
+        bool wasAbove = (stage.above >> channel) & 1;
+        if (above == wasAbove) {
+            msg.status = 0;
+            continue;
+        }
+        stage.above ^= 1 << channel;
+
+        msg.status = LMX_STATUS_NOTE | channel;
+        msg.data1 = stage.note;
+        msg.data2 = above ? stage.velocity : 0;
+        origin[i] = noteKey(msg);
+        if (! above)
+            final[i] = resolveNoteOff(msg, origin[i]);
+    }
+}
+
+} // namespace leapmidi
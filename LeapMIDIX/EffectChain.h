@@ -0,0 +1,117 @@
+//
+//  EffectChain.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// MIDI effects applied to a frame's messages between the listener and the
+// Device: transpose, scale quantization, channel remapping, a velocity
+// curve, and turning a controller into a note when it crosses a threshold.
+// Each stage runs over the whole batch in place before the next one does,
+// and the note stages are a 128 entry table lookup per message. Messages
+// a stage drops are compacted out at the end. Stages live in a fixed
+// array, nothing allocates after construction.
+// A note-off goes wherever its note-on went, even if the chain changed in
+// between (the chain remembers where each sounding note ended up), so
+// changing the transpose while playing can't leave notes hanging.
+// A cancel for a note's scheduled messages is moved like a note-on, so it
+// finds the note the chain scheduled.
+// Not thread-safe, meant to be owned and set up by the thread that
+// produces the messages (the listener's).
+
+#ifndef __LeapMIDIX__EffectChain__
+#define __LeapMIDIX__EffectChain__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MIDIMessage.h"
+
+#define LMX_EFFECT_MAX_STAGES 8
+
+// scales for addScaleQuantize(), bit n is n semitones above the root
+#define LMX_SCALE_CHROMATIC 0x0FFF
+#define LMX_SCALE_MAJOR 0x0AB5
+#define LMX_SCALE_MINOR 0x05AD
+#define LMX_SCALE_PENTATONIC_MAJOR 0x0295
+#define LMX_SCALE_PENTATONIC_MINOR 0x04A9
+
+// channel map entry that drops the channel's messages
+#define LMX_CHANNEL_DROP 0xFF
+
+namespace leapmidi {
+
+class MessageBatch;
+
+class EffectChain {
+public:
+    EffectChain();
+
+    // stages run in the order they were added; false if the chain is full
+    // notes moved out of 0-127 are dropped
+    bool addTranspose(int semitones);
+    // notes outside the scale move to the nearest note in it (down on a
+    // tie); root is 0 (C) to 11
+    bool addScaleQuantize(unsigned root, uint16_t scale);
+    // map[n] is the channel for messages on channel n, or LMX_CHANNEL_DROP
+    bool addChannelRemap(const uint8_t map[16]);
+    // note-on velocities v become min + (max - min) * (v / 127)^exponent,
+    // exponent < 1 is softer touch, > 1 harder
+    bool addVelocityCurve(float exponent, uint8_t min = 1, uint8_t max = 127);
+    // controller (7 bit) going up to threshold or above plays note, going
+    // back below releases it; the controller's messages are dropped
+    bool addControlToNote(uint8_t controller, uint8_t threshold, uint8_t note, uint8_t velocity = 127);
+
+    // remove all stages; notes already sounding still get their note-offs
+    // sent where they went
+    void clear();
+    size_t stageCount() const { return count; }
+
+    // run the chain over msgs, returns how many are left
+    size_t process(midi_message *msgs, size_t n);
+    void process(MessageBatch &batch);
+
+protected:
+    enum StageType {
+        TRANSPOSE,       // note table
+        SCALE_QUANTIZE,  // note table
+        CHANNEL_REMAP,   // channel table
+        VELOCITY_CURVE,  // velocity table
+        CONTROL_TO_NOTE
+    };
+
+    struct Stage {
+        StageType type;
+        uint8_t table[128]; // 0xFF drops
+        // CONTROL_TO_NOTE
+        uint8_t controller;
+        uint8_t threshold;
+        uint8_t note;
+        uint8_t velocity;
+        uint16_t above;     // channels whose controller is at the threshold or above
+    };
+
+    Stage *addStage(StageType type);
+    void applyNoteTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final);
+    void applyChannelTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final);
+    void applyVelocityTable(const Stage &stage, midi_message *msgs, size_t n, const bool *final);
+    void applyControlToNote(Stage &stage, midi_message *msgs, size_t n, uint16_t *origin, bool *final);
+    // send a note-off where its note-on went, true if it knew where that was
+    bool resolveNoteOff(midi_message &msg, uint16_t origin);
+
+    Stage stages[LMX_EFFECT_MAX_STAGES];
+    size_t count;
+
+    // where each note (channel << 7 | note) coming in is sounding after
+    // the chain, same encoding, NOTE_NONE if it isn't or NOTE_DROPPED if
+    // the chain swallowed it
+    uint16_t noteMap[16 * 128];
+
+private:
+    EffectChain(const EffectChain &);
+    EffectChain &operator=(const EffectChain &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__EffectChain__) */
@@ -0,0 +1,125 @@
+//
+//  EventNotifier.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "EventNotifier.h"
+
+#ifdef __APPLE__
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <poll.h>
+#include <sys/eventfd.h>
+#endif
+
+// identifier of our EVFILT_USER event
+#define NOTIFY_IDENT 1
+
+namespace leapmidi {
+
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+#ifdef __APPLE__
+
+EventNotifier::EventNotifier() {
+    notifyFd = kqueue();
+    if (notifyFd < 0)
+        fatal("kqueue");
+
+    // EV_CLEAR: the event resets itself once it has been reported
+    struct kevent ev;
+    EV_SET(&ev, NOTIFY_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(notifyFd, &ev, 1, NULL, 0, NULL) < 0)
+        fatal("kevent(EVFILT_USER)");
+}
+
+void EventNotifier::signal() {
+    struct kevent ev;
+    EV_SET(&ev, NOTIFY_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    kevent(notifyFd, &ev, 1, NULL, 0, NULL);
+}
+
+bool EventNotifier::wait(int64_t timeoutNanos) {
+    struct timespec timeout;
+    struct timespec *tp = NULL;
+    if (timeoutNanos >= 0) {
+        timeout.tv_sec = timeoutNanos / 1000000000LL;
+        timeout.tv_nsec = timeoutNanos % 1000000000LL;
+        tp = &timeout;
+    }
+
+    struct kevent ev;
+    int n = kevent(notifyFd, NULL, 0, &ev, 1, tp);
+    return n > 0;
+}
+
+void EventNotifier::consume() {
+    struct kevent ev;
+    struct timespec zero = { 0, 0 };
+    kevent(notifyFd, NULL, 0, &ev, 1, &zero);
+}
+
+#else
+
+EventNotifier::EventNotifier() {
+    notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (notifyFd < 0)
+        fatal("eventfd");
+}
+
+void EventNotifier::signal() {
+    uint64_t one = 1;
+    // only fails if the counter would overflow, in which case it's
+    // signalled already
+    ssize_t res = write(notifyFd, &one, sizeof(one));
+    (void)res;
+}
+
+bool EventNotifier::wait(int64_t timeoutNanos) {
+    struct timespec timeout;
+    struct timespec *tp = NULL;
+    if (timeoutNanos >= 0) {
+        timeout.tv_sec = timeoutNanos / 1000000000LL;
+        timeout.tv_nsec = timeoutNanos % 1000000000LL;
+        tp = &timeout;
+    }
+
+    // ppoll's relative timeout runs on the monotonic clock
+    struct pollfd pfd;
+    pfd.fd = notifyFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int n = ppoll(&pfd, 1, tp, NULL);
+    if (n <= 0)
+        return false;
+
+    consume();
+    return true;
+}
+
+void EventNotifier::consume() {
+    uint64_t count;
+    ssize_t res = read(notifyFd, &count, sizeof(count));
+    (void)res;
+}
+
+#endif
+
+EventNotifier::~EventNotifier() {
+    if (notifyFd >= 0)
+        close(notifyFd);
+}
+
+} // namespace leapmidi
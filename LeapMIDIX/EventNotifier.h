@@ -0,0 +1,51 @@
+//
+//  EventNotifier.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Wakeup primitive for the sending thread.
+// An eventfd on Linux, a kqueue with an EVFILT_USER event on OS X. Both
+// time out on the monotonic clock, so wall clock changes can't stall a
+// waiting thread, and both expose a descriptor so several notifiers can
+// be waited on together.
+// signal() never blocks; signals sent while nobody waits are remembered
+// until the next wait (several collapse into one).
+
+#ifndef __LeapMIDIX__EventNotifier__
+#define __LeapMIDIX__EventNotifier__
+
+#include <stdint.h>
+
+namespace leapmidi {
+
+class EventNotifier {
+public:
+    EventNotifier();
+    ~EventNotifier();
+
+    // safe to call from any thread
+    void signal();
+
+    // wait until signalled or timeoutNanos have passed (-1 waits forever)
+    // returns true if signalled, the signal is consumed
+    bool wait(int64_t timeoutNanos);
+
+    // descriptor that becomes readable when signalled, for multiplexing
+    int fd() const { return notifyFd; }
+
+    // reset the signal after fd() was reported readable
+    void consume();
+
+protected:
+    int notifyFd;
+
+private:
+    EventNotifier(const EventNotifier &);
+    EventNotifier &operator=(const EventNotifier &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__EventNotifier__) */
@@ -0,0 +1,90 @@
+//
+//  HighResControls.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "HighResControls.h"
+
+#define PARAMETER_RPN 0x4000
+
+namespace leapmidi {
+
+HighResControls::HighResControls() {
+    suppressed = 0;
+    reset();
+}
+
+void HighResControls::reset() {
+    for (int ch = 0; ch < 16; ch++) {
+        for (int cc = 0; cc < 32; cc++)
+            controlMSB[ch][cc] = controlLSB[ch][cc] = -1;
+        parameter[ch] = -1;
+        dataMSB[ch] = dataLSB[ch] = -1;
+    }
+}
+
+unsigned int HighResControls::update(int16_t &msb, int16_t &lsb, uint16_t value) {
+    int16_t newMSB = (value >> 7) & 0x7F;
+    int16_t newLSB = value & 0x7F;
+
+    unsigned int send = 0;
+    if (newMSB != msb) {
+        // the receiver clears its LSB on an MSB, so it has to follow
+        send = SEND_MSB | SEND_LSB;
+    } else if (newLSB != lsb) {
+        send = SEND_LSB;
+        suppressed++;
+    } else {
+        suppressed += 2;
+    }
+
+    msb = newMSB;
+    lsb = newLSB;
+    return send;
+}
+
+unsigned int HighResControls::control(unsigned char channel, unsigned char cc, uint16_t value) {
+    channel &= 0x0F;
+    cc &= 0x1F;
+    return update(controlMSB[channel][cc], controlLSB[channel][cc], value);
+}
+
+bool HighResControls::selectParameter(unsigned char channel, bool registered, uint16_t param) {
+    channel &= 0x0F;
+    int32_t key = (param & 0x3FFF) | (registered ? PARAMETER_RPN : 0);
+    if (parameter[channel] == key) {
+        suppressed += 2;
+        return false;
+    }
+
+    // data entry values belong to the old parameter
+    parameter[channel] = key;
+    dataMSB[channel] = dataLSB[channel] = -1;
+    return true;
+}
+
+unsigned int HighResControls::dataEntry(unsigned char channel, uint16_t value) {
+    channel &= 0x0F;
+    return update(dataMSB[channel], dataLSB[channel], value);
+}
+
+void HighResControls::controlSent(unsigned char channel, unsigned char controller) {
+    channel &= 0x0F;
+
+    if (controller < 64) {
+        // either half of a 14 bit controller
+        controlMSB[channel][controller & 0x1F] = -1;
+        controlLSB[channel][controller & 0x1F] = -1;
+    }
+    // a plain data entry was meant for some parameter the receiver may have
+    // had selected, so select ours again rather than assume it stuck
+    if (controller == LMX_CC_DATA_ENTRY_MSB || controller == LMX_CC_DATA_ENTRY_LSB ||
+        (controller >= LMX_CC_NRPN_LSB && controller <= LMX_CC_RPN_MSB)) {
+        parameter[channel] = -1;
+        dataMSB[channel] = dataLSB[channel] = -1;
+    }
+}
+
+} // namespace leapmidi
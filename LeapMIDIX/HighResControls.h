@@ -0,0 +1,80 @@
+//
+//  HighResControls.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// What a receiver already knows about our 14 bit controllers, so the
+// extra resolution costs as few bytes as possible.
+// A 14 bit controller is CC 0-31 (MSB) paired with CC 32-63 (LSB). The
+// MSB only needs sending when it changes, and as receivers reset the LSB
+// on every MSB, the LSB always follows it; a change within the same
+// MSB is just the LSB.
+// NRPN/RPN values are a parameter select (CC 99/98 or 101/100) followed
+// by data entry (CC 6/38). The select is only sent when the parameter
+// changes or a plain CC 6, 38 or 98-101 went out in between, and the data
+// entry bytes follow the same rules as a 14 bit controller.
+// Only touched by the sending thread.
+
+#ifndef __LeapMIDIX__HighResControls__
+#define __LeapMIDIX__HighResControls__
+
+#include <stdint.h>
+
+// CC numbers
+#define LMX_CC_DATA_ENTRY_MSB 6
+#define LMX_CC_DATA_ENTRY_LSB 38
+#define LMX_CC_NRPN_LSB 98
+#define LMX_CC_NRPN_MSB 99
+#define LMX_CC_RPN_LSB 100
+#define LMX_CC_RPN_MSB 101
+
+namespace leapmidi {
+
+class HighResControls {
+public:
+    // which halves of a 14 bit value have to go out
+    enum {
+        SEND_MSB = 1,
+        SEND_LSB = 2
+    };
+
+    HighResControls();
+
+    // forget everything, the next values go out in full
+    void reset();
+
+    // 14 bit controller cc (0-31) is about to get value (0-16383)
+    // returns SEND_* flags and assumes they will be sent
+    unsigned int control(unsigned char channel, unsigned char cc, uint16_t value);
+
+    // true if the parameter select has to be sent before data entry
+    bool selectParameter(unsigned char channel, bool registered, uint16_t parameter);
+    // data entry for the selected parameter, returns SEND_* flags
+    unsigned int dataEntry(unsigned char channel, uint16_t value);
+
+    // a plain 7 bit CC went out, whatever it touched is unknown now
+    void controlSent(unsigned char channel, unsigned char controller);
+
+    // CC messages left out
+    unsigned long suppressedCount() const { return suppressed; }
+
+protected:
+    unsigned int update(int16_t &msb, int16_t &lsb, uint16_t value);
+
+    // last sent MSB/LSB per controller, -1 if unknown
+    int16_t controlMSB[16][32];
+    int16_t controlLSB[16][32];
+
+    // selected parameter per channel: bit 14 set for RPN, -1 if unknown
+    int32_t parameter[16];
+    int16_t dataMSB[16];
+    int16_t dataLSB[16];
+
+    unsigned long suppressed;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__HighResControls__) */
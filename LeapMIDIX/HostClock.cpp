@@ -0,0 +1,57 @@
+//
+//  HostClock.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "HostClock.h"
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+namespace leapmidi {
+
+HostClock::HostClock() {
+    numer = 1;
+    denom = 1;
+#ifdef __APPLE__
+    mach_timebase_info_data_t info;
+    if (mach_timebase_info(&info) == 0 && info.numer && info.denom) {
+        numer = info.numer;
+        denom = info.denom;
+    }
+#endif
+}
+
+uint64_t HostClock::now() const {
+#ifdef __APPLE__
+    return HostClock::fromHostTicks(mach_absolute_time());
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+uint64_t HostClock::toHostTicks(uint64_t nanos) const {
+    if (numer == denom)
+        return nanos;
+    return (nanos / numer) * denom + (nanos % numer) * denom / numer;
+}
+
+uint64_t HostClock::fromHostTicks(uint64_t ticks) const {
+    if (numer == denom)
+        return ticks;
+    return (ticks / denom) * numer + (ticks % denom) * numer / denom;
+}
+
+HostClock *HostClock::shared() {
+    static HostClock clock;
+    return &clock;
+}
+
+} // namespace leapmidi
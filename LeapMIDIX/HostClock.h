@@ -0,0 +1,53 @@
+//
+//  HostClock.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Monotonic time source used for all MIDI timing.
+// Times are nanoseconds on an arbitrary, never-decreasing base. Clock is
+// an interface so tests can drive the pipeline from a fake clock.
+
+#ifndef __LeapMIDIX__HostClock__
+#define __LeapMIDIX__HostClock__
+
+#include <stdint.h>
+
+namespace leapmidi {
+
+class Clock {
+public:
+    virtual ~Clock() {}
+
+    // current time in nanoseconds
+    virtual uint64_t now() const = 0;
+
+    // convert nanoseconds on this clock to the ticks the MIDI API
+    // expects in packet timestamps
+    virtual uint64_t toHostTicks(uint64_t nanos) const { return nanos; }
+    // and back
+    virtual uint64_t fromHostTicks(uint64_t ticks) const { return ticks; }
+};
+
+// mach_absolute_time on OS X, CLOCK_MONOTONIC everywhere else
+class HostClock : public Clock {
+public:
+    HostClock();
+
+    virtual uint64_t now() const;
+    virtual uint64_t toHostTicks(uint64_t nanos) const;
+    virtual uint64_t fromHostTicks(uint64_t ticks) const;
+
+    // shared instance used when a Device isn't given a clock
+    static HostClock *shared();
+
+protected:
+    // mach timebase, ticks * numer / denom = nanoseconds
+    uint32_t numer;
+    uint32_t denom;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__HostClock__) */
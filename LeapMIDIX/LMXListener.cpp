@@ -10,15 +10,20 @@
 #include <map>
 
 #include "LMXListener.h"
+#include "Log.h"
 
 namespace leapmidi {
     
 LMXListener::LMXListener() {
     viz = NULL;
     device = NULL;
+    osc = NULL;
+    inFrame = false;
+    frameCaptureTime = 0;
+    frameThreadConfigPending = false;
 }
 
-void LMXListener::init(Leap::Controller *controller) {
+void LMXListener::init(Leap::Controller * /* controller */) {
     std::cout << "Leap MIDI device initalized" << std::endl;
     
     // create virtual midi source
@@ -48,6 +53,13 @@ void LMXListener::init(Leap::Controller *controller) {
 //    setProgram(noteProgram);
 }
 
+void LMXListener::setOSCOutput(OSCOutput *output) {
+    osc = output;
+    // bundles are due when the frame's MIDI is
+    if (osc && device)
+        osc->setLatency(device->getLatencyOffset());
+}
+
 LMXListener::~LMXListener() {
     if (viz)
         delete viz;
@@ -55,6 +67,68 @@ LMXListener::~LMXListener() {
         delete device;
 }
 
+void LMXListener::onFrame(const Leap::Controller &controller) {
+    if (frameThreadConfigPending.exchange(false)) {
+        // we don't create this thread, so this is the first chance we get
+        applyThreadConfig(frameThreadConfig, "Leap frame");
+    }
+    
+    // map the frame's capture time into the device's clock so its messages
+    // go out a fixed delay after the hand actually moved
+    const Leap::Frame frame = controller.frame();
+    frameCaptureTime = frameClock.update(frame.timestamp(), device->getClock()->now());
+    
+    frameBatch.clear();
+    inFrame = true;
+    if (osc)
+        osc->beginBundle(frameCaptureTime);
+    
+    // recognizers call back into onControlUpdated/onNoteUpdated from here
+    leapmidi::Listener::onFrame(controller);
+    
+    inFrame = false;
+    flushFrameBatch();
+    if (osc)
+        osc->sendBundle();
+}
+
+void LMXListener::flushFrameBatch() {
+    if (frameBatch.empty())
+        return;
+    
+    effects.process(frameBatch);
+    device->addMessages(frameBatch, frameCaptureTime);
+    frameBatch.clear();
+}
+
+void LMXListener::sendNow(MessageBatch &batch) {
+    effects.process(batch);
+    device->addMessages(batch);
+}
+
+void LMXListener::sendLater(MessageBatch &batch, uint64_t delay) {
+    effects.process(batch);
+    device->addMessages(batch, device->getClock()->now() + delay);
+}
+
+void LMXListener::scheduleNote(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue, uint64_t delay) {
+    MessageBatch batch;
+    batch.addNote(noteIndex, noteValue);
+    sendLater(batch, delay);
+}
+
+void LMXListener::scheduleControl(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue, uint64_t delay) {
+    MessageBatch batch;
+    batch.addControl(controlIndex, controlValue);
+    sendLater(batch, delay);
+}
+
+void LMXListener::cancelScheduledNote(leapmidi::midi_note_index noteIndex) {
+    MessageBatch batch;
+    batch.addCancel(noteIndex);
+    sendNow(batch);
+}
+
 void LMXListener::onGestureRecognized(const Leap::Controller &controller, GesturePtr gesture) {
     leapmidi::Listener::onGestureRecognized(controller, gesture);
 }
@@ -71,20 +145,26 @@ void LMXListener::onControlUpdated(const Leap::Controller &controller, GesturePt
     // control value
     leapmidi::midi_control_value val = control->mappedValue();
     
-    if (1) {
-        cout << "recognized control index " << controlIndex
-        << " (" << control->description() << ")"
-        << ", raw value: "
-        << control->rawValue() << " mapped value: " << val << endl;
+    LMX_LOG(LOG_DEBUG, "recognized control index %d (%s), raw value: %f mapped value: %d",
+            controlIndex, control->description(), control->rawValue(), val);
+    
+    if (! inFrame) {
+        // not called from a frame callback, send right away
+        MessageBatch batch;
+        batch.addControl(controlIndex, val);
+        sendNow(batch);
+        if (osc)
+            osc->sendControl(controlIndex, control->rawValue());
+        return;
     }
     
+    // full resolution for OSC
+    if (osc)
+        osc->addControl(controlIndex, control->rawValue());
     
-    bool multithreaded = true;
-    
-    if (multithreaded)
-        device->addControlMessage(controlIndex, val);
-    else
-        device->queueControlPacket(controlIndex, val);
+    if (frameBatch.full())
+        flushFrameBatch();
+    frameBatch.addControl(controlIndex, val);
 }
     
 void LMXListener::onNoteUpdated(const Leap::Controller &controller, GesturePtr gesture, NotePtr note) {
@@ -99,14 +179,24 @@ void LMXListener::onNoteUpdated(const Leap::Controller &controller, GesturePtr g
     // control value
     leapmidi::midi_note_value val = note->mappedValue();
     
-    if (1) {
-        cout << "recognized note index " << noteIndex
-        << " (" << note->description() << ")"
-        << ", raw value: "
-        << note->rawValue() << " mapped value: " << val << endl;
+    LMX_LOG(LOG_DEBUG, "recognized note index %d (%s), raw value: %f mapped value: %d",
+            noteIndex, note->description(), note->rawValue(), val);
+    
+    if (! inFrame) {
+        MessageBatch batch;
+        batch.addNote(noteIndex, val);
+        sendNow(batch);
+        if (osc)
+            osc->sendNote(noteIndex, note->rawValue());
+        return;
     }
     
-    device->addNoteMessage(noteIndex, val);
+    if (osc)
+        osc->addNote(noteIndex, note->rawValue());
+    
+    if (frameBatch.full())
+        flushFrameBatch();
+    frameBatch.addNote(noteIndex, val);
 }
 
 
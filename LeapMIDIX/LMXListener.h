@@ -10,8 +10,12 @@
 #define __LeapMIDIX__Listener__
 
 #include <iostream>
+#include <atomic>
 #include "Visualizer.h"
 #include "Device.h"
+#include "ClockMapper.h"
+#include "EffectChain.h"
+#include "OSCOutput.h"
 #include "Leap.h"
 #include "LeapMIDI.h"
 #include "MIDIListener.h"
@@ -36,6 +40,31 @@ public:
     // run forever, drawing frames
     void drawLoop();
     
+    // scheduling for the Leap thread that delivers frames, applied from
+    // inside the next frame callback; the SDK's thread is left as it is
+    // unless this is called
+    void setFrameThreadConfig(const ThreadConfig &config) { frameThreadConfig = config; frameThreadConfigPending = true; }
+    
+    // also send every control/note's raw value over OSC, one bundle per
+    // frame (not owned, must be open)
+    void setOSCOutput(OSCOutput *output);
+    
+    // effects applied to every control/note before it gets to the device,
+    // set up from the thread delivering frames or before the first frame
+    EffectChain &getEffects() { return effects; }
+    
+    // future-dated notes/controls (see Device::scheduleNoteMessage), run
+    // through the effects as they are now, from the same thread; delay is
+    // nanoseconds from now
+    void scheduleNote(leapmidi::midi_note_index noteIndex, leapmidi::midi_note_value noteValue, uint64_t delay);
+    void scheduleControl(leapmidi::midi_control_index controlIndex, leapmidi::midi_control_value controlValue, uint64_t delay);
+    // drop what was scheduled for a note, wherever the effects sent it
+    void cancelScheduledNote(leapmidi::midi_note_index noteIndex);
+    
+    // runs the gesture recognizers for a frame and hands everything
+    // they produced to the device in a single batch
+    virtual void onFrame(const Leap::Controller &controller);
+    
     virtual void onGestureRecognized(const Leap::Controller &controller, GesturePtr gesture);
     virtual void onControlUpdated(const Leap::Controller &controller, GesturePtr gesture, ControlPtr control);
     virtual void onNoteUpdated(const Leap::Controller &controller, GesturePtr gesture, NotePtr note);
@@ -44,8 +73,29 @@ protected:
     void processFrameRaw(const Leap::Frame &frame);
     void processFrameTools(const Leap::Frame &frame);
     
+    // flush the current frame's messages to the device
+    void flushFrameBatch();
+    // run a batch through the effects and hand it to the device as
+    // captured now
+    void sendNow(MessageBatch &batch);
+    // the same, held back until delay nanoseconds from now
+    void sendLater(MessageBatch &batch, uint64_t delay);
+    
     Device *device;
     Visualizer *viz;
+    OSCOutput *osc;
+    
+    // control/note updates collected while processing a frame
+    MessageBatch frameBatch;
+    bool inFrame;
+    EffectChain effects;
+    
+    // capture time of the frame being processed, in device clock time
+    ClockMapper frameClock;
+    uint64_t frameCaptureTime;
+    
+    ThreadConfig frameThreadConfig;
+    std::atomic<bool> frameThreadConfigPending;
 };
     
 }
@@ -0,0 +1,208 @@
+//
+//  Log.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include "Log.h"
+#include "HostClock.h"
+
+// how long the writer sleeps when there's nothing to write
+#define WRITER_IDLE_USEC 10000
+
+namespace leapmidi {
+
+static const char *levelNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+Logger &Logger::shared() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() {
+    minLevel = LOG_INFO;
+    dropped = 0;
+    droppedReported = 0;
+    startTime = now();
+    pthread_mutex_init(&drainMutex, NULL);
+
+    running = true;
+    if (pthread_create(&writerThread, NULL, _writerThreadEntry, this)) {
+        // no writer, records will pile up in the ring and get dropped
+        running = false;
+        fprintf(stderr, "Failed to start log writer thread\n");
+    }
+}
+
+Logger::~Logger() {
+    if (running.exchange(false))
+        pthread_join(writerThread, NULL);
+    flush();
+    pthread_mutex_destroy(&drainMutex);
+}
+
+uint64_t Logger::now() const {
+    return HostClock::shared()->now();
+}
+
+void Logger::setText(LogRecord &rec, const char *value) {
+    rec.types[rec.argc] = LogRecord::ARG_TEXT;
+    rec.args[rec.argc++].text = rec.textUsed;
+
+    if (! value)
+        value = "(null)";
+
+    // copy as much as fits, always NUL terminated
+    size_t room = LMX_LOG_TEXT_SIZE - rec.textUsed;
+    if (! room) {
+        // out of space, point at the terminator of the previous string
+        rec.args[rec.argc - 1].text = LMX_LOG_TEXT_SIZE - 1;
+        return;
+    }
+    size_t len = strlen(value);
+    if (len > room - 1)
+        len = room - 1;
+    memcpy(rec.text + rec.textUsed, value, len);
+    rec.text[rec.textUsed + len] = '\0';
+    rec.textUsed += len + 1;
+}
+
+void Logger::writerThreadEntry() {
+    // logging must never compete with MIDI output
+#ifdef SCHED_IDLE
+    struct sched_param param;
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#else
+    struct sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_OTHER);
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#endif
+
+    while (running) {
+        if (! writeRecords())
+            usleep(WRITER_IDLE_USEC);
+    }
+}
+
+void Logger::flush() {
+    while (writeRecords())
+        ;
+}
+
+// drain and write one batch, returns number of records written
+size_t Logger::writeRecords() {
+    char line[512];
+
+    pthread_mutex_lock(&drainMutex);
+
+    size_t count = ring.drain(drained, sizeof(drained) / sizeof(drained[0]));
+    for (size_t i = 0; i < count; i++) {
+        format(drained[i], line, sizeof(line));
+        fputs(line, stderr);
+    }
+
+    unsigned long lost = dropped.load();
+    if (lost != droppedReported) {
+        fprintf(stderr, "WARN: %lu log messages dropped\n", lost - droppedReported);
+        droppedReported = lost;
+    }
+
+    if (count)
+        fflush(stderr);
+
+    pthread_mutex_unlock(&drainMutex);
+    return count;
+}
+
+// printf-style formatting from the stored arguments
+// length modifiers in the format are ignored, every integer is 64 bits
+void Logger::format(const LogRecord &rec, char *out, size_t outSize) {
+    size_t len = 0;
+    double seconds = (rec.time - startTime) / 1e9;
+    const char *levelName = rec.level < LOG_NONE ? levelNames[rec.level] : "?";
+
+    int n = snprintf(out, outSize, "[%10.6f] %s: ", seconds, levelName);
+    if (n > 0)
+        len = (size_t)n < outSize ? n : outSize - 1;
+
+    const char *f = rec.format;
+    int arg = 0;
+    while (*f && len < outSize - 2) {
+        if (*f != '%') {
+            out[len++] = *f++;
+            continue;
+        }
+
+        if (f[1] == '%') {
+            out[len++] = '%';
+            f += 2;
+            continue;
+        }
+
+        // copy flags/width/precision, skip length modifiers
+        char spec[32];
+        size_t specLen = 0;
+        spec[specLen++] = *f++;
+        while (*f && strchr("-+ #0123456789.", *f) && specLen < sizeof(spec) - 4)
+            spec[specLen++] = *f++;
+        while (*f && strchr("hlLqjzt", *f))
+            f++;
+        char conv = *f;
+        if (! conv)
+            break;
+        f++;
+
+        if (arg >= rec.argc || ! strchr("diouxXcsfFeEgGaAp", conv)) {
+            n = snprintf(out + len, outSize - len, "<?>");
+        } else {
+            uint8_t type = rec.types[arg];
+            if (type == LogRecord::ARG_TEXT) {
+                spec[specLen++] = 's';
+                spec[specLen] = '\0';
+                n = snprintf(out + len, outSize - len, spec, rec.text + rec.args[arg].text);
+            } else if (type == LogRecord::ARG_POINTER) {
+                spec[specLen++] = 'p';
+                spec[specLen] = '\0';
+                n = snprintf(out + len, outSize - len, spec, rec.args[arg].p);
+            } else if (conv == 'f' || conv == 'F' || conv == 'e' || conv == 'E' || conv == 'g' || conv == 'G' || conv == 'a' || conv == 'A') {
+                spec[specLen++] = conv;
+                spec[specLen] = '\0';
+                double value = type == LogRecord::ARG_DOUBLE ? rec.args[arg].d : (double)rec.args[arg].i;
+                n = snprintf(out + len, outSize - len, spec, value);
+            } else if (conv == 'c') {
+                spec[specLen++] = 'c';
+                spec[specLen] = '\0';
+                n = snprintf(out + len, outSize - len, spec, (int)rec.args[arg].i);
+            } else {
+                long long value = type == LogRecord::ARG_DOUBLE ? (long long)rec.args[arg].d : (long long)rec.args[arg].i;
+                spec[specLen++] = 'l';
+                spec[specLen++] = 'l';
+                spec[specLen++] = (conv == 's' || conv == 'p') ? 'd' : conv;
+                spec[specLen] = '\0';
+                if (conv == 'd' || conv == 'i' || conv == 's' || conv == 'p')
+                    n = snprintf(out + len, outSize - len, spec, value);
+                else
+                    n = snprintf(out + len, outSize - len, spec, (unsigned long long)value);
+            }
+            arg++;
+        }
+
+        if (n > 0)
+            len += (size_t)n < outSize - len ? n : outSize - len - 1;
+    }
+
+    // make sure every record ends up on its own line
+    if (len > outSize - 2)
+        len = outSize - 2;
+    if (len && out[len - 1] != '\n')
+        out[len++] = '\n';
+    out[len] = '\0';
+}
+
+} // namespace leapmidi
@@ -0,0 +1,163 @@
+//
+//  Log.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Asynchronous logger for the realtime paths.
+// LMX_LOG() checks the level, then packs the format string pointer and the
+// raw argument values into a fixed-size binary record and pushes it onto
+// a lock-free ring; it never formats, allocates, blocks or makes a system
+// call. A low-priority thread drains the ring, formats the records and
+// writes them to stderr. If the ring is full the record is dropped and
+// counted, and the writer reports how many went missing.
+//
+// The format string must be a literal (only the pointer is stored).
+// String arguments are copied into the record, truncated if needed.
+//
+//   LMX_LOG(LOG_DEBUG, "control %d value %d", index, value);
+
+#ifndef __LeapMIDIX__Log__
+#define __LeapMIDIX__Log__
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <pthread.h>
+#include <stdint.h>
+#include "MessageRing.h"
+
+#define LMX_LOG_MAX_ARGS 6
+#define LMX_LOG_TEXT_SIZE 48
+#define LMX_LOG_RING_SIZE 2048
+
+#define LMX_LOG(level, ...) \
+    do { \
+        leapmidi::Logger &_lmx_logger = leapmidi::Logger::shared(); \
+        if (_lmx_logger.enabled(level)) \
+            _lmx_logger.log(level, __VA_ARGS__); \
+    } while (0)
+
+namespace leapmidi {
+
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR,
+    LOG_NONE
+};
+
+struct LogRecord {
+    enum ArgType { ARG_INT, ARG_DOUBLE, ARG_TEXT, ARG_POINTER };
+
+    uint64_t time;
+    const char *format;
+    uint8_t level;
+    uint8_t argc;
+    uint8_t textUsed;
+    uint8_t types[LMX_LOG_MAX_ARGS];
+    union {
+        int64_t i;
+        double d;
+        const void *p;
+        uint8_t text; // offset into text
+    } args[LMX_LOG_MAX_ARGS];
+    char text[LMX_LOG_TEXT_SIZE];
+};
+
+class Logger {
+public:
+    static Logger &shared();
+
+    void setLevel(LogLevel level) { minLevel.store(level, std::memory_order_relaxed); }
+    LogLevel getLevel() const { return (LogLevel)minLevel.load(std::memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level >= minLevel.load(std::memory_order_relaxed); }
+
+    // records lost because the ring was full
+    unsigned long droppedCount() const { return dropped.load(); }
+
+    template <typename... Args>
+    void log(LogLevel level, const char *format, const Args&... args) {
+        static_assert(sizeof...(Args) <= LMX_LOG_MAX_ARGS, "too many log arguments");
+
+        LogRecord rec;
+        rec.time = now();
+        rec.format = format;
+        rec.level = level;
+        rec.argc = 0;
+        rec.textUsed = 0;
+        addArgs(rec, args...);
+
+        if (! ring.push(rec))
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // format and write everything queued so far, from the calling thread
+    // (for shutdown and fatal errors)
+    void flush();
+
+    ~Logger();
+
+protected:
+    Logger();
+
+    uint64_t now() const;
+
+    static void addArgs(LogRecord &) {}
+
+    template <typename T, typename... Rest>
+    static void addArgs(LogRecord &rec, const T &first, const Rest&... rest) {
+        setArg(rec, first);
+        addArgs(rec, rest...);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    setArg(LogRecord &rec, const T &value) {
+        rec.types[rec.argc] = LogRecord::ARG_INT;
+        rec.args[rec.argc++].i = (int64_t)value;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    setArg(LogRecord &rec, const T &value) {
+        rec.types[rec.argc] = LogRecord::ARG_DOUBLE;
+        rec.args[rec.argc++].d = value;
+    }
+
+    template <typename T>
+    static void setArg(LogRecord &rec, T * const &value) {
+        rec.types[rec.argc] = LogRecord::ARG_POINTER;
+        rec.args[rec.argc++].p = value;
+    }
+
+    static void setArg(LogRecord &rec, const char * const &value) { setText(rec, value); }
+    static void setArg(LogRecord &rec, char * const &value) { setText(rec, value); }
+    static void setArg(LogRecord &rec, const std::string &value) { setText(rec, value.c_str()); }
+
+    static void setText(LogRecord &rec, const char *value);
+
+    // writer thread
+    static void *_writerThreadEntry(void *This) { ((Logger *)This)->writerThreadEntry(); return NULL; }
+    void writerThreadEntry();
+    size_t writeRecords();
+    void format(const LogRecord &rec, char *out, size_t outSize);
+
+    MessageRing<LogRecord, LMX_LOG_RING_SIZE> ring;
+    LogRecord drained[64];
+    pthread_mutex_t drainMutex; // writer thread vs flush()
+
+    std::atomic<int> minLevel;
+    std::atomic<unsigned long> dropped;
+    unsigned long droppedReported;
+    uint64_t startTime;
+
+    pthread_t writerThread;
+    std::atomic<bool> running;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__Log__) */
@@ -0,0 +1,45 @@
+//
+//  MIDICompat.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "MIDICompat.h"
+
+#ifndef __APPLE__
+
+#include <string.h>
+
+MIDIPacket *MIDIPacketListInit(MIDIPacketList *pktlist) {
+    pktlist->numPackets = 0;
+    return &pktlist->packet[0];
+}
+
+MIDIPacket *MIDIPacketListAdd(MIDIPacketList *pktlist, size_t listSize, MIDIPacket *curPacket,
+                              MIDITimeStamp time, size_t nData, const Byte *data) {
+    Byte *listEnd = (Byte *)pktlist + listSize;
+    
+    // like CoreMIDI, messages at the same time share a packet unless
+    // either side is sysex
+    if (pktlist->numPackets && curPacket->timeStamp == time && nData &&
+        data[0] != 0xF0 && curPacket->data[0] != 0xF0 &&
+        curPacket->length + nData <= sizeof(curPacket->data) &&
+        &curPacket->data[curPacket->length] + nData <= listEnd) {
+        memcpy(&curPacket->data[curPacket->length], data, nData);
+        curPacket->length += nData;
+        return curPacket;
+    }
+    
+    MIDIPacket *pkt = pktlist->numPackets ? MIDIPacketNext(curPacket) : &pktlist->packet[0];
+    if (nData > sizeof(pkt->data) || pkt->data + nData > listEnd)
+        return NULL;
+    
+    pkt->timeStamp = time;
+    pkt->length = (UInt16)nData;
+    memcpy(pkt->data, data, nData);
+    pktlist->numPackets++;
+    return pkt;
+}
+
+#endif
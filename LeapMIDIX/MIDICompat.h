@@ -0,0 +1,63 @@
+//
+//  MIDICompat.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The CoreMIDI packet list types, everywhere.
+// The sending path builds MIDIPacketLists no matter which output they end
+// up on. On OS X this is just CoreMIDI; elsewhere the types and the list
+// building functions are defined here with the same layout and behaviour,
+// so the rest of the code doesn't need to care.
+
+#ifndef __LeapMIDIX__MIDICompat__
+#define __LeapMIDIX__MIDICompat__
+
+#ifdef __APPLE__
+
+#include <CoreMIDI/CoreMIDI.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t Byte;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef int32_t OSStatus;
+
+// host clock ticks (nanoseconds off OS X), 0 means now
+typedef uint64_t MIDITimeStamp;
+
+#pragma pack(push, 4)
+struct MIDIPacket {
+    MIDITimeStamp timeStamp;
+    UInt16 length;
+    Byte data[256]; // really variable length
+};
+struct MIDIPacketList {
+    UInt32 numPackets;
+    MIDIPacket packet[1]; // really numPackets of them, back to back
+};
+#pragma pack(pop)
+
+MIDIPacket *MIDIPacketListInit(MIDIPacketList *pktlist);
+// append data to the list, into curPacket if it has the same timestamp
+// returns NULL if the list (listSize bytes in all) has no room for it
+MIDIPacket *MIDIPacketListAdd(MIDIPacketList *pktlist, size_t listSize, MIDIPacket *curPacket,
+                              MIDITimeStamp time, size_t nData, const Byte *data);
+
+static inline MIDIPacket *MIDIPacketNext(const MIDIPacket *pkt) {
+    // packets are 4-byte aligned on ARM, packed on x86
+#if defined(__arm__) || defined(__aarch64__)
+    return (MIDIPacket *)(((uintptr_t)&pkt->data[pkt->length] + 3) & ~(uintptr_t)3);
+#else
+    return (MIDIPacket *)&pkt->data[pkt->length];
+#endif
+}
+
+#endif
+
+#endif /* defined(__LeapMIDIX__MIDICompat__) */
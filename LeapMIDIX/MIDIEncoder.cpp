@@ -0,0 +1,45 @@
+//
+//  MIDIEncoder.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <assert.h>
+#include "MIDIEncoder.h"
+
+namespace leapmidi {
+
+MIDIEncoder::MIDIEncoder() {
+    savedBytes = 0;
+    reset();
+}
+
+void MIDIEncoder::reset() {
+    len = 0;
+    runningStatus = 0;
+}
+
+bool MIDIEncoder::append(uint8_t status, uint8_t data1, uint8_t data2, size_t dataLength) {
+    assert(status >= 0x80 && status < 0xF0);
+    assert(dataLength == 1 || dataLength == 2);
+
+    bool running = (status == runningStatus);
+    size_t needed = dataLength + (running ? 0 : 1);
+    if (len + needed > LMX_ENCODER_MAX_PACKET)
+        return false;
+
+    if (running)
+        savedBytes++;
+    else
+        bytes[len++] = status;
+
+    bytes[len++] = data1 & 0x7F;
+    if (dataLength == 2)
+        bytes[len++] = data2 & 0x7F;
+
+    runningStatus = status;
+    return true;
+}
+
+} // namespace leapmidi
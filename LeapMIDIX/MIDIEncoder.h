@@ -0,0 +1,99 @@
+//
+//  MIDIEncoder.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Packs channel messages that share a timestamp into a single packet,
+// using MIDI running status: a message whose status byte matches the
+// previous one in the packet is written without it.
+// Running status never spans packets, every packet starts with a full
+// status byte so receivers can decode it on its own.
+
+#ifndef __LeapMIDIX__MIDIEncoder__
+#define __LeapMIDIX__MIDIEncoder__
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "ChannelMessages.h"
+
+// largest packet the encoder will build, matches MIDIPacket's data size
+#define LMX_ENCODER_MAX_PACKET 256
+
+namespace leapmidi {
+
+class MIDIEncoder {
+public:
+    MIDIEncoder();
+
+    // start a new packet, forgetting the running status
+    void reset();
+
+    // append a channel voice message (status byte 0x80-0xEF)
+    // dataLength is 1 for program change/channel pressure, 2 otherwise
+    // returns false if the packet is full, leaving it unchanged
+    bool append(uint8_t status, uint8_t data1, uint8_t data2, size_t dataLength = 2);
+
+    // append typed messages (ChannelMessages.h) of one kind, all on one
+    // channel: the status byte goes in at most once and the rest is a
+    // straight copy of the data bytes
+    // returns how many fit, the same bytes as append() one at a time
+    template <typename Message>
+    size_t appendRun(const Message *msgs, size_t count);
+
+    const uint8_t *data() const { return bytes; }
+    size_t length() const { return len; }
+    bool empty() const { return len == 0; }
+    // status byte the next message can leave out, 0 if none
+    uint8_t getRunningStatus() const { return runningStatus; }
+
+    // status bytes left out thanks to running status
+    unsigned long runningStatusSavings() const { return savedBytes; }
+
+protected:
+    uint8_t bytes[LMX_ENCODER_MAX_PACKET];
+    size_t len;
+    uint8_t runningStatus; // 0 if none
+    unsigned long savedBytes;
+};
+
+template <typename Message>
+size_t MIDIEncoder::appendRun(const Message *msgs, size_t count) {
+    if (! count)
+        return 0;
+
+    uint8_t status = msgs[0].status;
+    bool running = (status == runningStatus);
+    size_t space = LMX_ENCODER_MAX_PACKET - len - (running ? 0 : 1);
+    if (space > LMX_ENCODER_MAX_PACKET) // wrapped, not even room for the status
+        return 0;
+    if (count > space / Message::dataLength)
+        count = space / Message::dataLength;
+    if (! count)
+        return 0;
+
+    if (running)
+        savedBytes++;
+    else
+        bytes[len++] = status;
+    savedBytes += count - 1;
+
+    // dataLength is a constant, so is the branch
+    uint8_t *out = bytes + len;
+    for (size_t i = 0; i < count; i++) {
+        assert(msgs[i].status == status);
+        *out++ = msgs[i].data1;
+        if (Message::dataLength == 2)
+            *out++ = msgs[i].data2;
+    }
+    len = out - bytes;
+
+    runningStatus = status;
+    return count;
+}
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__MIDIEncoder__) */
@@ -0,0 +1,103 @@
+//
+//  MIDIMessage.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// A queued message, packed into 8 bytes so a cache line holds 8 of them.
+// status is a MIDI status byte, type in the top nibble and channel below,
+// and the data bytes depend on the type:
+//   0xB0 control change: data1 controller, data2 value
+//        with LMX_DATA_14BIT set in data1 a 14 bit controller (0-31),
+//        value MSB in data2 and LSB in data3
+//   0x90 note: data1 MIDI note number, data2 velocity, 0 for a note-off
+//        (makeNoteMessage maps a note index and value to these)
+//   LMX_STATUS_RPN / LMX_STATUS_NRPN: parameter select, MSB in data1 and
+//        LSB in data2
+//   LMX_STATUS_PARAMETER_VALUE: value of the parameter selected by the
+//        message right before it, MSB in data2 and LSB in data3
+//   LMX_STATUS_CANCEL: drop the scheduled messages for the note in data1,
+//        or with LMX_CANCEL_ALL in data2 every scheduled message
+// The types of our own have the top bit clear, so they can't be confused
+// with MIDI.
+// time is the capture time in microseconds since the Device's epoch,
+// truncated to 32 bits (see Device::messageTime).
+
+#ifndef __LeapMIDIX__MIDIMessage__
+#define __LeapMIDIX__MIDIMessage__
+
+#include <stdint.h>
+
+#define LMX_STATUS_CONTROL 0xB0
+#define LMX_STATUS_NOTE 0x90
+#define LMX_STATUS_RPN 0x20
+#define LMX_STATUS_NRPN 0x30
+#define LMX_STATUS_PARAMETER_VALUE 0x40
+#define LMX_STATUS_CANCEL 0x50
+
+// note indexes count up from this MIDI note
+#define LMX_NOTE_BASE 0x48
+// note indexes that have a MIDI note, ones past the top are dropped
+#define LMX_NOTE_COUNT (128 - LMX_NOTE_BASE)
+// note values below this are note-offs
+#define LMX_NOTE_ON_THRESHOLD 50
+// velocity of the note-ons they become
+#define LMX_NOTE_VELOCITY 0x7F
+
+// data1 flag of a 14 bit control change
+#define LMX_DATA_14BIT 0x80
+
+// data2 flag of a cancel for every scheduled message
+#define LMX_CANCEL_ALL 0x01
+
+namespace leapmidi {
+
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t data3;
+    uint32_t time;
+} midi_message;
+
+static_assert(sizeof(midi_message) == 8, "midi_message should pack into 8 bytes");
+
+inline midi_message makeControlMessage(uint8_t controller, uint8_t value, uint8_t channel = 0, uint32_t time = 0) {
+    midi_message msg = { (uint8_t)(LMX_STATUS_CONTROL | (channel & 0x0F)), (uint8_t)(controller & 0x7F), (uint8_t)(value & 0x7F), 0, time };
+    return msg;
+}
+
+inline midi_message makeControl14Message(uint8_t controller, uint16_t value, uint8_t channel = 0, uint32_t time = 0) {
+    midi_message msg = { (uint8_t)(LMX_STATUS_CONTROL | (channel & 0x0F)), (uint8_t)(LMX_DATA_14BIT | (controller & 0x1F)), (uint8_t)((value >> 7) & 0x7F), (uint8_t)(value & 0x7F), time };
+    return msg;
+}
+
+// MIDI note number of a note index below LMX_NOTE_COUNT
+inline uint8_t noteNumber(uint8_t noteIndex) {
+    return LMX_NOTE_BASE + noteIndex;
+}
+
+// a note value from LMX_NOTE_ON_THRESHOLD up is a note-on
+// noteIndex must be below LMX_NOTE_COUNT
+inline midi_message makeNoteMessage(uint8_t noteIndex, uint16_t value, uint8_t channel = 0, uint32_t time = 0) {
+    midi_message msg = { (uint8_t)(LMX_STATUS_NOTE | (channel & 0x0F)), noteNumber(noteIndex), (uint8_t)(value >= LMX_NOTE_ON_THRESHOLD ? LMX_NOTE_VELOCITY : 0), 0, time };
+    return msg;
+}
+
+// an (N)RPN change takes two messages, the select and the value
+inline void makeParameterMessages(midi_message *msgs, bool registered, uint16_t parameter, uint16_t value, uint8_t channel = 0, uint32_t time = 0) {
+    midi_message select = { (uint8_t)((registered ? LMX_STATUS_RPN : LMX_STATUS_NRPN) | (channel & 0x0F)), (uint8_t)((parameter >> 7) & 0x7F), (uint8_t)(parameter & 0x7F), 0, time };
+    midi_message data = { (uint8_t)(LMX_STATUS_PARAMETER_VALUE | (channel & 0x0F)), 0, (uint8_t)((value >> 7) & 0x7F), (uint8_t)(value & 0x7F), time };
+    msgs[0] = select;
+    msgs[1] = data;
+}
+
+inline midi_message makeCancelMessage(uint8_t note, uint8_t channel = 0, bool all = false) {
+    midi_message msg = { (uint8_t)(LMX_STATUS_CANCEL | (channel & 0x0F)), (uint8_t)(note & 0x7F), (uint8_t)(all ? LMX_CANCEL_ALL : 0), 0, 0 };
+    return msg;
+}
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__MIDIMessage__) */
@@ -0,0 +1,151 @@
+//
+//  MessageRing.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Bounded, preallocated multi-producer/single-consumer ring buffer.
+// Producers (Leap callback threads) claim a slot with a single CAS and
+// never take a lock or allocate; the consumer (the MIDI sending thread)
+// drains everything that has been published in one pass.
+//
+// Each cell carries a sequence number (Vyukov's bounded queue):
+//   sequence == pos          cell is free for the producer claiming pos
+//   sequence == pos + 1      cell holds data published for pos
+//   sequence == pos + size   cell was consumed and is free for the next lap
+
+#ifndef __LeapMIDIX__MessageRing__
+#define __LeapMIDIX__MessageRing__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace leapmidi {
+
+template <typename T, size_t Capacity>
+class MessageRing {
+public:
+    MessageRing() {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                      "MessageRing capacity must be a power of two");
+        for (size_t i = 0; i < Capacity; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos = 0;
+    }
+
+    // safe to call from any number of threads
+    // returns false if the ring is full
+    bool push(const T &item) {
+        Cell *cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+        while (1) {
+            cell = &cells[pos & (Capacity - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                // slot is free, try to claim it
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // consumer hasn't freed this slot yet, ring is full
+                return false;
+            } else {
+                // another producer got here first
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // safe to call from any number of threads
+    // claims count contiguous slots with a single CAS so the whole batch
+    // is consumed in order; returns false (pushing nothing) if it doesn't fit
+    bool pushBatch(const T *items, size_t count) {
+        if (! count)
+            return true;
+        if (count > Capacity)
+            return false;
+        
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        
+        while (1) {
+            // slots are freed in order, so if the last slot of the range
+            // is free for this lap then all of them are
+            size_t lastPos = pos + count - 1;
+            Cell *last = &cells[lastPos & (Capacity - 1)];
+            size_t seq = last->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)lastPos;
+            
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        
+        for (size_t i = 0; i < count; i++) {
+            Cell *cell = &cells[(pos + i) & (Capacity - 1)];
+            cell->data = items[i];
+            cell->sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // consumer only
+    // copies up to max published items into out, returns number copied
+    size_t drain(T *out, size_t max) {
+        size_t count = 0;
+
+        while (count < max) {
+            Cell *cell = &cells[dequeuePos & (Capacity - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            if (seq != dequeuePos + 1)
+                break; // nothing (more) published
+
+            out[count++] = cell->data;
+            cell->sequence.store(dequeuePos + Capacity, std::memory_order_release);
+            dequeuePos++;
+        }
+
+        return count;
+    }
+
+    // consumer only
+    bool empty() const {
+        const Cell *cell = &cells[dequeuePos & (Capacity - 1)];
+        return cell->sequence.load(std::memory_order_acquire) != dequeuePos + 1;
+    }
+
+    size_t capacity() const { return Capacity; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    // keep the producer and consumer cursors on separate cache lines
+    Cell cells[Capacity];
+    char pad0[64];
+    std::atomic<size_t> enqueuePos;
+    char pad1[64];
+    size_t dequeuePos;
+
+    MessageRing(const MessageRing &);
+    MessageRing &operator=(const MessageRing &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__MessageRing__) */
@@ -0,0 +1,238 @@
+//
+//  OutputReactor.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include "OutputReactor.h"
+#include "Device.h"
+#include "Log.h"
+
+#ifdef __APPLE__
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
+// stack the thread touches up front
+#define REACTOR_STACK_PREFAULT (64 * 1024)
+
+// most notifiers reported by one wait, the rest are picked up by the next
+#define MAX_EVENTS 32
+
+namespace leapmidi {
+
+static void fatal(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+OutputReactor::OutputReactor() {
+#ifdef __APPLE__
+    pollFd = kqueue();
+    if (pollFd < 0)
+        fatal("kqueue");
+#else
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pollFd < 0)
+        fatal("epoll_create1");
+#endif
+    watch(NULL, true);
+
+    pthread_mutex_init(&lock, NULL);
+    running = false;
+    thread = 0;
+    threadStarted = false;
+    threadConfig.stackPrefault = REACTOR_STACK_PREFAULT;
+    wakeups = 0;
+    passes = 0;
+}
+
+OutputReactor::~OutputReactor() {
+    if (threadStarted) {
+        running = false;
+        notifier.signal();
+        pthread_join(thread, NULL);
+    }
+    if (! devices.empty())
+        LMX_LOG(LOG_WARN, "Output reactor going away with %zu Devices left", devices.size());
+
+    close(pollFd);
+    pthread_mutex_destroy(&lock);
+}
+
+// watch a Device's notifier, or ours (NULL)
+void OutputReactor::watch(Device *device, bool add) {
+    int fd = device ? device->senderNotifier.fd() : notifier.fd();
+#ifdef __APPLE__
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, add ? EV_ADD : EV_DELETE, 0, 0, device);
+    if (kevent(pollFd, &ev, 1, NULL, 0, NULL) < 0 && add)
+        fatal("kevent(EVFILT_READ)");
+#else
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = device;
+    if (epoll_ctl(pollFd, add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev) < 0 && add)
+        fatal("epoll_ctl");
+#endif
+}
+
+void OutputReactor::addDevice(Device *device) {
+    pthread_mutex_lock(&lock);
+    devices.push_back(device);
+    watch(device, true);
+    if (! threadStarted) {
+        running = true;
+        int res = pthread_create(&thread, NULL, _threadEntry, this);
+        if (res) {
+            LMX_LOG(LOG_ERROR, "Failed to start output reactor thread: %s", strerror(res));
+            fatal("pthread_create");
+        }
+        threadStarted = true;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // it has work to do, maybe
+    notifier.signal();
+}
+
+void OutputReactor::removeDevice(Device *device) {
+    pthread_mutex_lock(&lock);
+    std::vector<Device *>::iterator it = std::find(devices.begin(), devices.end(), device);
+    if (it != devices.end()) {
+        devices.erase(it);
+        watch(device, false);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+size_t OutputReactor::deviceCount() {
+    pthread_mutex_lock(&lock);
+    size_t count = devices.size();
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void OutputReactor::threadEntry() {
+    guarantees = applyThreadConfig(threadConfig, "MIDI output reactor");
+
+    while (running) {
+        pthread_mutex_lock(&lock);
+        int64_t timeout;
+        bool busy = serviceDevices(timeout) || ! parkDevices();
+        pthread_mutex_unlock(&lock);
+        if (busy)
+            continue;
+
+        if (running) {
+            waitForEvents(timeout);
+            wakeups++;
+        }
+
+        pthread_mutex_lock(&lock);
+        unparkDevices();
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+bool OutputReactor::serviceDevices(int64_t &timeout) {
+    passes++;
+    bool sent = false;
+    timeout = -1;
+    for (size_t i = 0; i < devices.size(); i++) {
+        Device *device = devices[i];
+        uint64_t deadline;
+        if (device->serviceSender(deadline)) {
+            sent = true;
+            continue;
+        }
+        if (! deadline)
+            continue;
+
+        // Devices may be on different clocks, compare time left instead
+        uint64_t now = device->clock->now();
+        int64_t left = deadline > now ? (int64_t)(deadline - now) : 0;
+        if (timeout < 0 || left < timeout)
+            timeout = left;
+    }
+    return sent;
+}
+
+bool OutputReactor::parkDevices() {
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (! devices[i]->parkSender()) {
+            for (size_t j = 0; j <= i; j++)
+                devices[j]->unparkSender();
+            return false;
+        }
+    }
+    return true;
+}
+
+void OutputReactor::unparkDevices() {
+    for (size_t i = 0; i < devices.size(); i++)
+        devices[i]->unparkSender();
+}
+
+void OutputReactor::waitForEvents(int64_t timeoutNanos) {
+    if (timeoutNanos == 0)
+        return;
+
+    struct timespec timeout;
+    struct timespec *tp = NULL;
+    if (timeoutNanos > 0) {
+        timeout.tv_sec = timeoutNanos / 1000000000LL;
+        timeout.tv_nsec = timeoutNanos % 1000000000LL;
+        tp = &timeout;
+    }
+
+    Device *ready[MAX_EVENTS];
+    int n;
+#ifdef __APPLE__
+    struct kevent events[MAX_EVENTS];
+    n = kevent(pollFd, NULL, 0, events, MAX_EVENTS, tp);
+    for (int i = 0; i < n; i++)
+        ready[i] = (Device *)events[i].udata;
+#else
+    // epoll_wait only takes milliseconds, too coarse for note timing;
+    // the epoll descriptor itself is pollable, so sleep in ppoll
+    struct pollfd pfd;
+    pfd.fd = pollFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (ppoll(&pfd, 1, tp, NULL) <= 0)
+        return;
+    struct epoll_event events[MAX_EVENTS];
+    n = epoll_wait(pollFd, events, MAX_EVENTS, 0);
+    for (int i = 0; i < n; i++)
+        ready[i] = (Device *)events[i].data.ptr;
+#endif
+    if (n <= 0)
+        return;
+
+    // reset the notifiers that woke us, skipping any whose Device left
+    // while we were asleep
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < n; i++) {
+        if (! ready[i])
+            notifier.consume();
+        else if (std::find(devices.begin(), devices.end(), ready[i]) != devices.end())
+            ready[i]->senderNotifier.consume();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+} // namespace leapmidi
@@ -0,0 +1,95 @@
+//
+//  OutputReactor.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// One sending thread for many Devices.
+// A Device normally has a sending thread of its own, which adds up to a
+// pile of mostly idle threads with one Device per channel group or per
+// Leap. Devices given a reactor with Device::setReactor() are served by
+// its thread instead: each pass runs every Device's sender work and
+// flushes their packets, then the thread sleeps on all of their
+// notifiers at once (epoll on Linux, kqueue on OS X) until a producer
+// signals one of them or the earliest deadline among them comes up.
+// Devices join on init() and leave when destroyed, from any thread.
+
+#ifndef __LeapMIDIX__OutputReactor__
+#define __LeapMIDIX__OutputReactor__
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include "EventNotifier.h"
+#include "RealtimeThread.h"
+
+namespace leapmidi {
+
+class Device;
+
+class OutputReactor {
+public:
+    OutputReactor();
+    // all Devices must be gone by now
+    ~OutputReactor();
+
+    // scheduling/affinity/memory locking for the thread,
+    // must be set before the first Device joins
+    void setThreadConfig(const ThreadConfig &config) { threadConfig = config; }
+    // what the thread actually got, once it is running
+    ThreadGuarantees getGuarantees() const { return guarantees; }
+
+    // thread-safe; the thread starts with the first Device
+    void addDevice(Device *device);
+    // thread-safe; returns once the thread is done with the Device
+    void removeDevice(Device *device);
+
+    size_t deviceCount();
+    // times the thread woke up, and passes it made over the Devices
+    unsigned long wakeupCount() const { return wakeups.load(); }
+    unsigned long passCount() const { return passes.load(); }
+
+protected:
+    void threadEntry();
+    // one pass over every Device, true if any of them sent something;
+    // otherwise timeout is how long until the earliest of their
+    // deadlines (nanoseconds, -1 for none)
+    bool serviceDevices(int64_t &timeout);
+    // park every Device, false (and none parked) if one has work already
+    bool parkDevices();
+    void unparkDevices();
+    // sleep until a notifier is signalled or timeoutNanos have passed
+    // (-1 waits forever)
+    void waitForEvents(int64_t timeoutNanos);
+    void watch(Device *device, bool add);
+
+    int pollFd; // the epoll or kqueue descriptor
+    // signalled when Devices join and to stop the thread
+    EventNotifier notifier;
+
+    // held by the thread for every pass, so a Device can't leave in the
+    // middle of one
+    pthread_mutex_t lock;
+    std::vector<Device *> devices;
+
+    std::atomic<bool> running;
+    pthread_t thread;
+    bool threadStarted;
+    ThreadConfig threadConfig;
+    ThreadGuarantees guarantees;
+
+    std::atomic<unsigned long> wakeups;
+    std::atomic<unsigned long> passes;
+
+private:
+    static void *_threadEntry(void *This) { ((OutputReactor *)This)->threadEntry(); return NULL; }
+
+    OutputReactor(const OutputReactor &);
+    OutputReactor &operator=(const OutputReactor &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__OutputReactor__) */
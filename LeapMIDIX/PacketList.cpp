@@ -0,0 +1,67 @@
+//
+//  PacketList.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "PacketList.h"
+
+namespace leapmidi {
+
+PacketList::PacketList(size_t initialSize, size_t maxSize_) {
+    if (maxSize_ < initialSize)
+        maxSize_ = initialSize;
+
+    usableSize = initialSize;
+    maxSize = maxSize_;
+    flushes = 0;
+    overflows = 0;
+
+    list = (MIDIPacketList *)malloc(maxSize);
+    if (! list) {
+        fprintf(stderr, "Fatal error: failed to allocate MIDI packet list\n");
+        exit(1);
+    }
+    curPacket = MIDIPacketListInit(list);
+}
+
+PacketList::~PacketList() {
+    free(list);
+}
+
+void PacketList::reset() {
+    if (! empty())
+        flushes++;
+
+    // MIDIReceived does not clear the list, start over in the same buffer
+    curPacket = MIDIPacketListInit(list);
+}
+
+bool PacketList::add(MIDITimeStamp timestamp, size_t length, const Byte *data) {
+    MIDIPacket *next = MIDIPacketListAdd(list, usableSize, curPacket, timestamp, length, data);
+    if (! next) {
+        // curPacket is still valid, the list is unchanged
+        overflows++;
+        return false;
+    }
+
+    curPacket = next;
+    return true;
+}
+
+bool PacketList::grow() {
+    if (usableSize >= maxSize)
+        return false;
+
+    // the buffer is already allocated at maxSize, so the packets
+    // written so far stay where they are
+    usableSize *= 2;
+    if (usableSize > maxSize)
+        usableSize = maxSize;
+    return true;
+}
+
+} // namespace leapmidi
@@ -0,0 +1,63 @@
+//
+//  PacketList.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Reusable MIDIPacketList.
+// The backing buffer is allocated once, at the largest size the list may
+// ever need, and reset in place after every flush. The list starts out
+// using only part of it; grow() raises the usable size for packets that
+// wouldn't fit even in an empty list.
+
+#ifndef __LeapMIDIX__PacketList__
+#define __LeapMIDIX__PacketList__
+
+#include <stddef.h>
+#include "MIDICompat.h"
+
+namespace leapmidi {
+
+class PacketList {
+public:
+    // initialSize and maxSize are in bytes, including the list header
+    PacketList(size_t initialSize = 512, size_t maxSize = 8192);
+    ~PacketList();
+
+    // start a new, empty list in the same buffer
+    void reset();
+
+    // append a packet, returns false if there is no room left
+    // (which is counted as an overflow)
+    bool add(MIDITimeStamp timestamp, size_t length, const Byte *data);
+
+    // double the usable size, up to the preallocated maximum
+    // returns false if already at the maximum
+    bool grow();
+
+    bool empty() const { return list->numPackets == 0; }
+    MIDIPacketList *get() { return list; }
+    const MIDIPacketList *get() const { return list; }
+    size_t size() const { return usableSize; }
+
+    unsigned long flushCount() const { return flushes; }
+    unsigned long overflowCount() const { return overflows; }
+
+protected:
+    MIDIPacketList *list;
+    MIDIPacket *curPacket;
+    size_t usableSize;
+    size_t maxSize;
+
+    unsigned long flushes;   // resets of a non-empty list
+    unsigned long overflows; // failed adds
+
+private:
+    PacketList(const PacketList &);
+    PacketList &operator=(const PacketList &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__PacketList__) */
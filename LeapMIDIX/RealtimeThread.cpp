@@ -0,0 +1,161 @@
+//
+//  RealtimeThread.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <alloca.h>
+#include "RealtimeThread.h"
+#include "HostClock.h"
+#include "Log.h"
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+// largest stack prefault we'll do, keep well under the default stack size
+#define MAX_STACK_PREFAULT (256 * 1024)
+
+// time constraint policy for the sender on OS X: it needs up to 0.5ms of
+// CPU within 1ms of waking up
+#define RT_COMPUTATION_NS 500000ULL
+#define RT_CONSTRAINT_NS 1000000ULL
+
+namespace leapmidi {
+
+static bool setRealtime(int priority) {
+#ifdef __APPLE__
+    (void)priority;
+    Clock *clock = HostClock::shared();
+    thread_time_constraint_policy_data_t policy;
+    policy.period = 0;
+    policy.computation = (uint32_t)clock->toHostTicks(RT_COMPUTATION_NS);
+    policy.constraint = (uint32_t)clock->toHostTicks(RT_CONSTRAINT_NS);
+    policy.preemptible = 1;
+    kern_return_t res = thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                          THREAD_TIME_CONSTRAINT_POLICY,
+                                          (thread_policy_t)&policy,
+                                          THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+    if (res != KERN_SUCCESS) {
+        LMX_LOG(LOG_WARN, "thread_policy_set(THREAD_TIME_CONSTRAINT_POLICY) failed: %d", res);
+        return false;
+    }
+    return true;
+#else
+    int minPriority = sched_get_priority_min(SCHED_FIFO);
+    int maxPriority = sched_get_priority_max(SCHED_FIFO);
+    if (priority <= 0)
+        priority = (minPriority + maxPriority) / 2;
+    if (priority < minPriority)
+        priority = minPriority;
+    if (priority > maxPriority)
+        priority = maxPriority;
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (res) {
+        LMX_LOG(LOG_WARN, "SCHED_FIFO priority %d not available: %s", priority, strerror(res));
+        return false;
+    }
+    return true;
+#endif
+}
+
+static bool setAffinity(int cpu) {
+#if defined(__APPLE__)
+    // OS X has no hard pinning, threads with the same tag share a cache
+    thread_affinity_policy_data_t policy;
+    policy.affinity_tag = cpu + 1; // 0 means no affinity
+    kern_return_t res = thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                                          THREAD_AFFINITY_POLICY,
+                                          (thread_policy_t)&policy,
+                                          THREAD_AFFINITY_POLICY_COUNT);
+    if (res != KERN_SUCCESS) {
+        LMX_LOG(LOG_WARN, "thread affinity hint failed: %d", res);
+        return false;
+    }
+    return true;
+#elif defined(__linux__)
+    // CPU_SET doesn't check, past the set is past the end of it
+    if (cpu >= CPU_SETSIZE) {
+        LMX_LOG(LOG_WARN, "can't pin thread to CPU %d, only 0-%d can be", cpu, CPU_SETSIZE - 1);
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (res) {
+        LMX_LOG(LOG_WARN, "failed to pin thread to CPU %d: %s", cpu, strerror(res));
+        return false;
+    }
+    return true;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+static bool lockMemory() {
+    static std::atomic<int> locked(-1); // -1 not tried yet
+
+    int state = locked.load();
+    if (state >= 0)
+        return state == 1;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        LMX_LOG(LOG_WARN, "mlockall failed: %s", strerror(errno));
+        locked = 0;
+        return false;
+    }
+    locked = 1;
+    return true;
+}
+
+static bool prefaultStack(size_t bytes) {
+    if (bytes > MAX_STACK_PREFAULT)
+        bytes = MAX_STACK_PREFAULT;
+
+    // touch every page so it's mapped (and locked, with mlockall) now
+    // rather than on first use in the middle of a performance
+    volatile char *stack = (volatile char *)alloca(bytes);
+    for (size_t i = 0; i < bytes; i += 4096)
+        stack[i] = 0;
+    if (bytes)
+        stack[bytes - 1] = 0;
+    return true;
+}
+
+ThreadGuarantees applyThreadConfig(const ThreadConfig &config, const char *threadName) {
+    ThreadGuarantees got;
+
+    if (config.lockMemory)
+        got.memoryLocked = lockMemory();
+    if (config.stackPrefault)
+        got.stackPrefaulted = prefaultStack(config.stackPrefault);
+    if (config.cpu >= 0)
+        got.affinity = setAffinity(config.cpu);
+    if (config.realtime)
+        got.realtime = setRealtime(config.priority);
+
+    LMX_LOG(LOG_INFO, "%s thread: realtime %s, cpu affinity %s, memory locked %s, stack prefaulted %s",
+            threadName,
+            config.realtime ? (got.realtime ? "yes" : "DENIED") : "off",
+            config.cpu >= 0 ? (got.affinity ? "yes" : "DENIED") : "off",
+            config.lockMemory ? (got.memoryLocked ? "yes" : "DENIED") : "off",
+            config.stackPrefault ? (got.stackPrefaulted ? "yes" : "no") : "off");
+
+    return got;
+}
+
+} // namespace leapmidi
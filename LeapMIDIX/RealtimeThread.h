@@ -0,0 +1,50 @@
+//
+//  RealtimeThread.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Scheduling, CPU pinning and memory locking for latency-critical threads.
+// Everything here is best effort: without the privilege for a setting the
+// thread just runs without it, and the returned guarantees (also logged)
+// say what was actually obtained.
+
+#ifndef __LeapMIDIX__RealtimeThread__
+#define __LeapMIDIX__RealtimeThread__
+
+#include <stddef.h>
+
+namespace leapmidi {
+
+struct ThreadConfig {
+    ThreadConfig() : realtime(true), priority(0), cpu(-1), lockMemory(false), stackPrefault(0) {}
+
+    // SCHED_FIFO (time constraint policy on OS X)
+    bool realtime;
+    // SCHED_FIFO priority, 0 for the middle of the allowed range
+    int priority;
+    // pin to this CPU, -1 to let the scheduler decide
+    // (only an affinity hint on OS X)
+    int cpu;
+    // mlockall the whole process (done once, whichever thread asks first)
+    bool lockMemory;
+    // bytes of this thread's stack to touch up front so they're resident
+    size_t stackPrefault;
+};
+
+struct ThreadGuarantees {
+    ThreadGuarantees() : realtime(false), affinity(false), memoryLocked(false), stackPrefaulted(false) {}
+
+    bool realtime;
+    bool affinity;
+    bool memoryLocked;
+    bool stackPrefaulted;
+};
+
+// apply config to the calling thread and log what we got
+ThreadGuarantees applyThreadConfig(const ThreadConfig &config, const char *threadName);
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__RealtimeThread__) */
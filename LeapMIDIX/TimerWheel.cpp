@@ -0,0 +1,320 @@
+//
+//  TimerWheel.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "TimerWheel.h"
+
+// a tick is 2^16 ns, 65.5us
+#define TICK_SHIFT 16
+
+#define LEVELS 4
+#define LEVEL0_SIZE 256
+#define LEVEL_SIZE 64
+// ticks the four levels cover, 73 minutes
+#define WHEEL_SPAN (1ULL << 26)
+
+// end of a list
+#define NONE 0xFFFF
+#define NO_SLOT 0xFFFF
+
+namespace leapmidi {
+
+// a slot at level n turns over every 2^levelShift[n] ticks
+static const unsigned levelShift[LEVELS] = { 0, 8, 14, 20 };
+
+static inline uint16_t slotIndex(unsigned level, uint64_t tick) {
+    if (! level)
+        return tick & (LEVEL0_SIZE - 1);
+    return LEVEL0_SIZE + (level - 1) * LEVEL_SIZE + ((tick >> levelShift[level]) & (LEVEL_SIZE - 1));
+}
+
+TimerWheel::TimerWheel() {
+    for (size_t i = 0; i < sizeof(slotHead) / sizeof(slotHead[0]); i++) {
+        slotHead[i] = NONE;
+        slotTail[i] = NONE;
+    }
+    for (size_t i = 0; i < LMX_TIMER_WHEEL_KEYS; i++)
+        keyHead[i] = NONE;
+    for (size_t i = 0; i < LEVELS; i++) {
+        occupied0[i] = 0;
+        occupied[i] = 0;
+    }
+
+    for (size_t i = 0; i < LMX_TIMER_WHEEL_SIZE; i++) {
+        entries[i].next = i + 1 < LMX_TIMER_WHEEL_SIZE ? i + 1 : NONE;
+        entries[i].slot = NO_SLOT;
+        entries[i].generation = 0;
+    }
+    freeList = 0;
+    count = 0;
+    currentTick = 0;
+}
+
+TimerWheel::Handle TimerWheel::insert(uint64_t due, uint64_t now, const midi_message &msg, uint16_t key) {
+    if (freeList == NONE)
+        return 0;
+
+    // the wheel only turns while there's something in it
+    if (! count && (now >> TICK_SHIFT) > currentTick)
+        currentTick = now >> TICK_SHIFT;
+
+    uint16_t index = freeList;
+    Entry &entry = entries[index];
+    freeList = entry.next;
+    if (! ++entry.generation)
+        entry.generation = 1;
+    entry.due = due;
+    entry.msg = msg;
+    entry.key = key < LMX_TIMER_WHEEL_KEYS ? key : LMX_TIMER_NO_KEY;
+    entry.keyPrev = NONE;
+    entry.keyNext = NONE;
+    if (entry.key != LMX_TIMER_NO_KEY) {
+        entry.keyNext = keyHead[key];
+        if (entry.keyNext != NONE)
+            entries[entry.keyNext].keyPrev = index;
+        keyHead[key] = index;
+    }
+    count++;
+
+    schedule(index);
+    return ((Handle)entry.generation << 16) | index;
+}
+
+bool TimerWheel::cancel(Handle handle) {
+    uint16_t index = handle & 0xFFFF;
+    if (index >= LMX_TIMER_WHEEL_SIZE)
+        return false;
+    Entry &entry = entries[index];
+    if (entry.slot == NO_SLOT || entry.generation != handle >> 16)
+        return false;
+
+    release(index);
+    return true;
+}
+
+size_t TimerWheel::cancelKey(uint16_t key) {
+    if (key >= LMX_TIMER_WHEEL_KEYS)
+        return 0;
+
+    size_t cancelled = 0;
+    while (keyHead[key] != NONE) {
+        release(keyHead[key]);
+        cancelled++;
+    }
+    return cancelled;
+}
+
+void TimerWheel::clear() {
+    for (uint16_t i = 0; count && i < LMX_TIMER_WHEEL_SIZE; i++) {
+        if (entries[i].slot != NO_SLOT)
+            release(i);
+    }
+}
+
+size_t TimerWheel::advance(uint64_t now, midi_message *out, size_t max) {
+    uint64_t nowTick = now >> TICK_SHIFT;
+    if (! count) {
+        if (nowTick > currentTick)
+            currentTick = nowTick;
+        return 0;
+    }
+
+    size_t released = 0;
+    for (;;) {
+        released += releaseSlot(now, out + released, max - released);
+        if (released == max || currentTick >= nowTick)
+            break;
+
+        // straight to the next tick with anything to do
+        uint64_t next = nextEventTick();
+        if (next > nowTick) {
+            currentTick = nowTick;
+            break;
+        }
+        currentTick = next;
+        if (! (currentTick & (LEVEL0_SIZE - 1)))
+            cascade(currentTick);
+    }
+    return released;
+}
+
+uint64_t TimerWheel::nextDeadline() const {
+    if (! count)
+        return 0;
+
+    // the earliest in the current tick, whose slot has been released up to now
+    uint64_t deadline = UINT64_MAX;
+    for (uint16_t index = slotHead[currentTick & (LEVEL0_SIZE - 1)]; index != NONE; index = entries[index].next) {
+        uint64_t due = entries[index].due;
+        if ((due >> TICK_SHIFT) > currentTick)
+            due = currentTick << TICK_SHIFT; // waiting to be put back
+        if (due < deadline)
+            deadline = due;
+    }
+
+    // or the start of the next tick with something in it
+    uint64_t next = nextEventTick();
+    if (next != UINT64_MAX && (next << TICK_SHIFT) < deadline)
+        deadline = next << TICK_SHIFT;
+    return deadline ? deadline : 1;
+}
+
+uint64_t TimerWheel::nextEventTick() const {
+    uint64_t best = UINT64_MAX;
+
+    // first level: the rest of this turn, then the slots before the
+    // current one, which are for the next turn
+    unsigned current = currentTick & (LEVEL0_SIZE - 1);
+    uint64_t turnStart = currentTick - current;
+    for (unsigned i = current + 1; i < current + LEVEL0_SIZE; ) {
+        unsigned slot = i & (LEVEL0_SIZE - 1);
+        uint64_t bits = occupied0[slot >> 6] >> (slot & 63);
+        if (bits) {
+            best = turnStart + i + __builtin_ctzll(bits);
+            break;
+        }
+        i += 64 - (slot & 63);
+    }
+    // the scan above may run past the current slot in the last word
+    if (best != UINT64_MAX && best >= currentTick + LEVEL0_SIZE)
+        best = UINT64_MAX;
+
+    // the levels above: the next slot that cascades, counting from the
+    // next turn of the level below
+    for (unsigned level = 1; level < LEVELS; level++) {
+        uint64_t bits = occupied[level];
+        if (! bits)
+            continue;
+        unsigned shift = levelShift[level];
+        uint64_t turn = (currentTick >> shift) + 1;
+        unsigned start = turn & (LEVEL_SIZE - 1);
+        uint64_t rotated = (bits >> start) | (bits << ((LEVEL_SIZE - start) & (LEVEL_SIZE - 1)));
+        uint64_t tick = (turn + __builtin_ctzll(rotated)) << shift;
+        if (tick < best)
+            best = tick;
+    }
+
+    return best;
+}
+
+// release what's due in the current tick's slot
+size_t TimerWheel::releaseSlot(uint64_t now, midi_message *out, size_t max) {
+    size_t released = 0;
+    uint16_t index = slotHead[currentTick & (LEVEL0_SIZE - 1)];
+    while (index != NONE && released < max) {
+        Entry &entry = entries[index];
+        uint16_t next = entry.next;
+        if ((entry.due >> TICK_SHIFT) > currentTick) {
+            // was beyond the wheel's reach, it may be within it now
+            unlink(index);
+            schedule(index);
+        } else if (entry.due <= now) {
+            out[released++] = entry.msg;
+            release(index);
+        }
+        index = next;
+    }
+    return released;
+}
+
+// the lower levels have turned over at tick, move the slots that are due
+// down from the levels above
+void TimerWheel::cascade(uint64_t tick) {
+    for (unsigned level = 1; level < LEVELS; level++) {
+        uint16_t slot = slotIndex(level, tick);
+        uint16_t index = slotHead[slot];
+        slotHead[slot] = NONE;
+        slotTail[slot] = NONE;
+        occupied[level] &= ~(1ULL << (slot - LEVEL0_SIZE - (level - 1) * LEVEL_SIZE));
+
+        while (index != NONE) {
+            uint16_t next = entries[index].next;
+            schedule(index);
+            index = next;
+        }
+
+        // the levels above only cascade when this one turns over too
+        if ((tick >> levelShift[level]) & (LEVEL_SIZE - 1))
+            break;
+    }
+}
+
+void TimerWheel::schedule(uint16_t index) {
+    uint64_t tick = entries[index].due >> TICK_SHIFT;
+    if (tick < currentTick)
+        tick = currentTick; // overdue, goes out with the current tick
+    uint64_t delta = tick - currentTick;
+    if (delta >= WHEEL_SPAN) {
+        tick = currentTick + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    unsigned level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << levelShift[level + 1]))
+        level++;
+    link(index, slotIndex(level, tick));
+}
+
+void TimerWheel::link(uint16_t index, uint16_t slot) {
+    Entry &entry = entries[index];
+    entry.slot = slot;
+    entry.next = NONE;
+    entry.prev = slotTail[slot];
+    if (entry.prev != NONE)
+        entries[entry.prev].next = index;
+    else
+        slotHead[slot] = index;
+    slotTail[slot] = index;
+
+    if (slot < LEVEL0_SIZE)
+        occupied0[slot >> 6] |= 1ULL << (slot & 63);
+    else
+        occupied[1 + (slot - LEVEL0_SIZE) / LEVEL_SIZE] |= 1ULL << ((slot - LEVEL0_SIZE) & 63);
+}
+
+void TimerWheel::unlink(uint16_t index) {
+    Entry &entry = entries[index];
+    uint16_t slot = entry.slot;
+    if (entry.prev != NONE)
+        entries[entry.prev].next = entry.next;
+    else
+        slotHead[slot] = entry.next;
+    if (entry.next != NONE)
+        entries[entry.next].prev = entry.prev;
+    else
+        slotTail[slot] = entry.prev;
+    entry.slot = NO_SLOT;
+
+    if (slotHead[slot] != NONE)
+        return;
+    if (slot < LEVEL0_SIZE)
+        occupied0[slot >> 6] &= ~(1ULL << (slot & 63));
+    else
+        occupied[1 + (slot - LEVEL0_SIZE) / LEVEL_SIZE] &= ~(1ULL << ((slot - LEVEL0_SIZE) & 63));
+}
+
+void TimerWheel::unlinkKey(uint16_t index) {
+    Entry &entry = entries[index];
+    if (entry.key == LMX_TIMER_NO_KEY)
+        return;
+    if (entry.keyPrev != NONE)
+        entries[entry.keyPrev].keyNext = entry.keyNext;
+    else
+        keyHead[entry.key] = entry.keyNext;
+    if (entry.keyNext != NONE)
+        entries[entry.keyNext].keyPrev = entry.keyPrev;
+    entry.key = LMX_TIMER_NO_KEY;
+}
+
+void TimerWheel::release(uint16_t index) {
+    unlink(index);
+    unlinkKey(index);
+    entries[index].next = freeList;
+    freeList = index;
+    count--;
+}
+
+} // namespace leapmidi
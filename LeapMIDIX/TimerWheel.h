@@ -0,0 +1,107 @@
+//
+//  TimerWheel.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Messages waiting for a time in the future, in a hierarchical timer
+// wheel (Varghese & Lauck): the first level has a slot per tick (65.5us),
+// each level above it a slot per full turn of the one below, four levels
+// in all covering 73 minutes. Inserting puts a message in the slot of the
+// level its time falls in; when a lower level turns over, the next slot
+// up is cascaded down into it. Anything further out waits in the last
+// slot of the top level and is put back once it's reached.
+// Insert and cancel are O(1), and so is finding the next slot with
+// anything in it (a bitmap per level), so advancing skips straight over
+// empty ticks however many messages are waiting further out. Messages
+// come out on time to the nanosecond, in order of their tick and within a
+// tick in the order they were inserted.
+// Entries come from a preallocated pool, nothing allocates after
+// construction. A message may carry a key (e.g. its channel and note) so
+// everything with that key can be cancelled at once.
+// Not thread-safe, meant to be owned by the sending thread.
+
+#ifndef __LeapMIDIX__TimerWheel__
+#define __LeapMIDIX__TimerWheel__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MIDIMessage.h"
+
+// max number of messages waiting, at most 65535
+#define LMX_TIMER_WHEEL_SIZE 4096
+
+// keys are 0 up to this, e.g. channel * 128 + note
+#define LMX_TIMER_WHEEL_KEYS 2048
+#define LMX_TIMER_NO_KEY 0xFFFF
+
+namespace leapmidi {
+
+class TimerWheel {
+public:
+    // identifies an inserted message, 0 is never a valid one
+    typedef uint32_t Handle;
+
+    TimerWheel();
+
+    // due and now are nanoseconds; returns 0 if the wheel is full
+    Handle insert(uint64_t due, uint64_t now, const midi_message &msg, uint16_t key = LMX_TIMER_NO_KEY);
+    // false if it has already come out or been cancelled
+    bool cancel(Handle handle);
+    // cancel everything inserted with key, returns how many
+    size_t cancelKey(uint16_t key);
+    void clear();
+
+    // move up to max messages due by now into out
+    size_t advance(uint64_t now, midi_message *out, size_t max);
+    // when advance() may have something to do next, 0 if the wheel is empty
+    uint64_t nextDeadline() const;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == LMX_TIMER_WHEEL_SIZE; }
+
+protected:
+    struct Entry {
+        uint64_t due;
+        midi_message msg;
+        uint16_t next;       // in its slot, or in the free list
+        uint16_t prev;
+        uint16_t keyNext;    // among the entries with its key
+        uint16_t keyPrev;
+        uint16_t slot;       // NO_SLOT while free
+        uint16_t key;
+        uint16_t generation; // bumped on every reuse, part of the handle
+    };
+
+    // first tick at which there's a slot to release or cascade after the
+    // current one, UINT64_MAX if none
+    uint64_t nextEventTick() const;
+    size_t releaseSlot(uint64_t now, midi_message *out, size_t max);
+    void cascade(uint64_t tick);
+    // put an entry in the slot for its due time
+    void schedule(uint16_t index);
+    void link(uint16_t index, uint16_t slot);
+    void unlink(uint16_t index);
+    void unlinkKey(uint16_t index);
+    void release(uint16_t index);
+
+    Entry entries[LMX_TIMER_WHEEL_SIZE];
+    uint16_t freeList;
+    size_t count;
+
+    // 256 first level slots, then 64 for each level above
+    uint16_t slotHead[256 + 3 * 64];
+    uint16_t slotTail[256 + 3 * 64];
+    uint64_t occupied0[4]; // first level slots with anything in them
+    uint64_t occupied[4];  // the same for the levels above (1-3)
+
+    uint16_t keyHead[LMX_TIMER_WHEEL_KEYS];
+
+    uint64_t currentTick; // everything before it has been released
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__TimerWheel__) */
@@ -0,0 +1,76 @@
+//
+//  TokenBucket.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "TokenBucket.h"
+
+#define NANOS_PER_SECOND 1000000000ULL
+
+namespace leapmidi {
+
+TokenBucket::TokenBucket() {
+    rate = 0;
+    capacity = 0;
+    credit = 0;
+    lastRefill = 0;
+}
+
+void TokenBucket::setRate(uint64_t bytesPerSecond, uint64_t burstBytes) {
+    rate = bytesPerSecond;
+    capacity = burstBytes * NANOS_PER_SECOND;
+    credit = capacity;
+    lastRefill = 0;
+}
+
+void TokenBucket::refill(uint64_t now) {
+    if (! lastRefill || now < lastRefill) {
+        lastRefill = now;
+        return;
+    }
+
+    // don't overflow when it's been idle for a long time
+    uint64_t elapsed = now - lastRefill;
+    uint64_t room = capacity - credit;
+    if (elapsed >= room / rate)
+        credit = capacity;
+    else
+        credit += elapsed * rate;
+    lastRefill = now;
+}
+
+uint64_t TokenBucket::availableAt(size_t bytes, uint64_t now) {
+    if (! rate)
+        return now;
+
+    refill(now);
+    uint64_t needed = bytes * NANOS_PER_SECOND;
+    if (credit >= needed)
+        return now;
+    // a message bigger than the burst waits for a full bucket
+    if (needed > capacity)
+        needed = capacity;
+    return now + (needed - credit + rate - 1) / rate;
+}
+
+bool TokenBucket::consume(size_t bytes, uint64_t now) {
+    if (! rate)
+        return true;
+
+    refill(now);
+    uint64_t needed = bytes * NANOS_PER_SECOND;
+    if (credit >= needed) {
+        credit -= needed;
+        return true;
+    }
+    // bigger than the burst, let it through on a full bucket
+    if (credit == capacity) {
+        credit = 0;
+        return true;
+    }
+    return false;
+}
+
+} // namespace leapmidi
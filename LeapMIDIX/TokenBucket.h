@@ -0,0 +1,52 @@
+//
+//  TokenBucket.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Byte rate limit for an output that can't take MIDI as fast as we make
+// it, e.g. a 31250 baud DIN port (3125 bytes per second).
+// Credit accumulates at the given rate up to a burst size; sending costs
+// credit, and what doesn't have enough waits. Credit is kept in
+// byte-nanoseconds, so no floating point and no rounding drift.
+// Not thread-safe, only used by the sending thread.
+
+#ifndef __LeapMIDIX__TokenBucket__
+#define __LeapMIDIX__TokenBucket__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// bytes per second of a MIDI 1.0 DIN connection: 31250 baud, 10 bits a byte
+#define LMX_DIN_BYTES_PER_SECOND 3125
+
+namespace leapmidi {
+
+class TokenBucket {
+public:
+    // unlimited until setRate()
+    TokenBucket();
+
+    // bytesPerSecond 0 for unlimited; starts out with a full burst
+    void setRate(uint64_t bytesPerSecond, uint64_t burstBytes);
+    bool limited() const { return rate != 0; }
+    uint64_t getRate() const { return rate; }
+
+    // time at which bytes worth of credit will be there (now if it is)
+    uint64_t availableAt(size_t bytes, uint64_t now);
+    // take bytes worth of credit, false (taking nothing) if there isn't enough
+    bool consume(size_t bytes, uint64_t now);
+
+protected:
+    void refill(uint64_t now);
+
+    uint64_t rate;       // bytes per second, 0 for unlimited
+    uint64_t capacity;   // byte-nanoseconds
+    uint64_t credit;     // byte-nanoseconds
+    uint64_t lastRefill; // clock nanoseconds
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__TokenBucket__) */
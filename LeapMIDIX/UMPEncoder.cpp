@@ -0,0 +1,101 @@
+//
+//  UMPEncoder.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <assert.h>
+#include "UMPEncoder.h"
+
+namespace leapmidi {
+
+UMPEncoder::UMPEncoder() {
+    count = 0;
+    group = 0;
+}
+
+// first word: type, group, status, channel, then two index bytes
+// second word: the data
+bool UMPEncoder::append(uint8_t status, uint8_t channel, uint8_t index1, uint8_t index2, uint32_t data) {
+    if (space() < 2)
+        return false;
+
+    buffer[count++] = ((uint32_t)LMX_UMP_MIDI2_CHANNEL_VOICE << 28) | ((uint32_t)group << 24) |
+        ((uint32_t)(status & 0x0F) << 20) | ((uint32_t)(channel & 0x0F) << 16) |
+        ((uint32_t)index1 << 8) | index2;
+    buffer[count++] = data;
+    return true;
+}
+
+// index2 is the attribute type, we don't use any
+bool UMPEncoder::noteOn(uint8_t channel, uint8_t note, uint16_t velocity) {
+    return append(0x9, channel, note & 0x7F, 0, (uint32_t)velocity << 16);
+}
+
+bool UMPEncoder::noteOff(uint8_t channel, uint8_t note, uint16_t velocity) {
+    return append(0x8, channel, note & 0x7F, 0, (uint32_t)velocity << 16);
+}
+
+bool UMPEncoder::controlChange(uint8_t channel, uint8_t index, uint32_t value) {
+    return append(0xB, channel, index & 0x7F, 0, value);
+}
+
+// bank and index are the parameter's MSB and LSB
+bool UMPEncoder::registeredController(uint8_t channel, uint16_t parameter, uint32_t value) {
+    return append(LMX_UMP_REGISTERED_CONTROLLER, channel, (parameter >> 7) & 0x7F, parameter & 0x7F, value);
+}
+
+bool UMPEncoder::assignableController(uint8_t channel, uint16_t parameter, uint32_t value) {
+    return append(LMX_UMP_ASSIGNABLE_CONTROLLER, channel, (parameter >> 7) & 0x7F, parameter & 0x7F, value);
+}
+
+// first word: type, group, status, byte count, two data bytes
+// second word: four more data bytes
+bool UMPEncoder::sysEx7(uint8_t status, const uint8_t *data, size_t length) {
+    assert(length <= LMX_UMP_SYSEX_PACKET_BYTES);
+    if (space() < 2)
+        return false;
+
+    uint8_t bytes[LMX_UMP_SYSEX_PACKET_BYTES] = { 0, 0, 0, 0, 0, 0 };
+    for (size_t i = 0; i < length; i++)
+        bytes[i] = data[i] & 0x7F;
+
+    buffer[count++] = ((uint32_t)LMX_UMP_SYSEX7 << 28) | ((uint32_t)group << 24) |
+        ((uint32_t)(status & 0x0F) << 20) | ((uint32_t)length << 16) |
+        ((uint32_t)bytes[0] << 8) | bytes[1];
+    buffer[count++] = ((uint32_t)bytes[2] << 24) | ((uint32_t)bytes[3] << 16) | ((uint32_t)bytes[4] << 8) | bytes[5];
+    return true;
+}
+
+size_t UMPEncoder::messageWords(uint32_t word) {
+    static const size_t sizes[16] = { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+    return sizes[word >> 28];
+}
+
+// min-center-max: values up to the center are shifted, values above it
+// fill the new low bits with repeats of their own bits below the top one,
+// so the maximum maps to the maximum
+uint32_t UMPEncoder::scaleUp(uint32_t value, unsigned int srcBits, unsigned int dstBits) {
+    assert(srcBits > 1 && srcBits <= dstBits && dstBits <= 32);
+
+    unsigned int scaleBits = dstBits - srcBits;
+    uint32_t shifted = value << scaleBits;
+    if (value <= (1U << (srcBits - 1)))
+        return shifted;
+
+    unsigned int repeatBits = srcBits - 1;
+    uint32_t repeat = value & ((1U << repeatBits) - 1);
+    if (scaleBits > repeatBits)
+        repeat <<= scaleBits - repeatBits;
+    else
+        repeat >>= repeatBits - scaleBits;
+
+    while (repeat) {
+        shifted |= repeat;
+        repeat >>= repeatBits;
+    }
+    return shifted;
+}
+
+} // namespace leapmidi
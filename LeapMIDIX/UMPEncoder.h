@@ -0,0 +1,88 @@
+//
+//  UMPEncoder.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Builds MIDI 2.0 Universal MIDI Packets (UMP) for one point in time, the
+// UMP counterpart to MIDIEncoder.
+// Channel voice messages are the 64 bit MIDI 2.0 kind (message type 4),
+// with 32 bit controller values and 16 bit velocities, written straight
+// into a fixed buffer of 32 bit words in host byte order.
+// Values coming from 7 or 14 bit sources are scaled up with the MIDI 2.0
+// min-center-max rule, so scaling them back down gives the same value.
+
+#ifndef __LeapMIDIX__UMPEncoder__
+#define __LeapMIDIX__UMPEncoder__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// largest number of words the encoder holds, the same size as a MIDI 1.0
+// packet's data
+#define LMX_UMP_MAX_WORDS 64
+
+// message types (top 4 bits of the first word)
+#define LMX_UMP_MIDI1_CHANNEL_VOICE 0x2
+#define LMX_UMP_SYSEX7 0x3
+#define LMX_UMP_MIDI2_CHANNEL_VOICE 0x4
+
+// MIDI 2.0 channel voice status nibbles that aren't MIDI 1.0 ones
+#define LMX_UMP_REGISTERED_CONTROLLER 0x2
+#define LMX_UMP_ASSIGNABLE_CONTROLLER 0x3
+
+// SysEx7 packet status: a whole message, or its first/middle/last part
+#define LMX_UMP_SYSEX_COMPLETE 0x0
+#define LMX_UMP_SYSEX_START 0x1
+#define LMX_UMP_SYSEX_CONTINUE 0x2
+#define LMX_UMP_SYSEX_END 0x3
+// SysEx data bytes per packet
+#define LMX_UMP_SYSEX_PACKET_BYTES 6
+
+namespace leapmidi {
+
+class UMPEncoder {
+public:
+    UMPEncoder();
+
+    // start over
+    void reset() { count = 0; }
+
+    // UMP group (0-15) messages are sent on
+    void setGroup(uint8_t group_) { group = group_ & 0x0F; }
+    uint8_t getGroup() const { return group; }
+
+    // each returns false if the buffer is full, leaving it unchanged
+    bool noteOn(uint8_t channel, uint8_t note, uint16_t velocity);
+    bool noteOff(uint8_t channel, uint8_t note, uint16_t velocity);
+    bool controlChange(uint8_t channel, uint8_t index, uint32_t value);
+    // RPN/NRPN in one message, parameter 0-16383
+    bool registeredController(uint8_t channel, uint16_t parameter, uint32_t value);
+    bool assignableController(uint8_t channel, uint16_t parameter, uint32_t value);
+    // one SysEx7 packet, up to 6 data bytes without the F0/F7
+    bool sysEx7(uint8_t status, const uint8_t *data, size_t length);
+
+    const uint32_t *words() const { return buffer; }
+    size_t wordCount() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t space() const { return LMX_UMP_MAX_WORDS - count; }
+
+    // number of words in the message starting with this word
+    static size_t messageWords(uint32_t word);
+
+    // value of srcBits bits to dstBits bits (at most 32) and back
+    static uint32_t scaleUp(uint32_t value, unsigned int srcBits, unsigned int dstBits);
+    static uint32_t scaleDown(uint32_t value, unsigned int srcBits, unsigned int dstBits) { return value >> (srcBits - dstBits); }
+
+protected:
+    bool append(uint8_t status, uint8_t channel, uint8_t index1, uint8_t index2, uint32_t data);
+
+    uint32_t buffer[LMX_UMP_MAX_WORDS];
+    size_t count;
+    uint8_t group;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__UMPEncoder__) */
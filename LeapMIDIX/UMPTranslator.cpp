@@ -0,0 +1,175 @@
+//
+//  UMPTranslator.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "UMPTranslator.h"
+#include "UMPEncoder.h"
+
+namespace leapmidi {
+
+static size_t put(uint8_t *out, uint8_t status, uint8_t data1, uint8_t data2) {
+    out[0] = status;
+    out[1] = data1 & 0x7F;
+    out[2] = data2 & 0x7F;
+    return 3;
+}
+
+UMPTranslator::UMPTranslator() {
+    skipped = 0;
+    for (int ch = 0; ch < 16; ch++)
+        control14[ch] = 0;
+}
+
+void UMPTranslator::setControl14(uint8_t channel, uint8_t controller, bool enabled) {
+    if (controller >= 32)
+        return;
+    uint32_t bit = 1u << controller;
+    if (enabled)
+        control14[channel & 0x0F] |= bit;
+    else
+        control14[channel & 0x0F] &= ~bit;
+}
+
+size_t UMPTranslator::toMIDI1(const uint32_t *words, size_t count, uint8_t *out, size_t maxLength) {
+    size_t written = 0;
+
+    for (size_t i = 0; i < count; ) {
+        uint32_t word = words[i];
+        size_t size = UMPEncoder::messageWords(word);
+        if (i + size > count)
+            break; // truncated message
+        uint8_t type = word >> 28;
+
+        if (type == LMX_UMP_MIDI1_CHANNEL_VOICE) {
+            uint8_t status = (word >> 16) & 0xFF;
+            size_t length = (status & 0xE0) == 0xC0 ? 2 : 3; // program change, channel pressure
+            if (maxLength - written >= length) {
+                out[written] = status;
+                out[written + 1] = (word >> 8) & 0x7F;
+                if (length == 3)
+                    out[written + 2] = word & 0x7F;
+                if ((status & 0xF0) == 0xB0)
+                    highRes.controlSent(status & 0x0F, (word >> 8) & 0x7F);
+                written += length;
+            }
+        } else if (type == LMX_UMP_MIDI2_CHANNEL_VOICE) {
+            written += translateMIDI2(words + i, out + written, maxLength - written);
+        } else {
+            skipped++;
+        }
+
+        i += size;
+    }
+
+    return written;
+}
+
+size_t UMPTranslator::translateMIDI2(const uint32_t *message, uint8_t *out, size_t maxLength) {
+    uint8_t status = (message[0] >> 20) & 0x0F;
+    uint8_t channel = (message[0] >> 16) & 0x0F;
+    uint8_t index1 = (message[0] >> 8) & 0x7F;
+    uint8_t index2 = message[0] & 0x7F;
+    uint32_t data = message[1];
+
+    switch (status) {
+        case 0x8: // note off
+        case 0x9: { // note on
+            if (maxLength < 3)
+                return 0;
+            uint8_t velocity = UMPEncoder::scaleDown(data >> 16, 16, 7);
+            // velocity 0 is a real note-on in MIDI 2.0, not a note-off
+            if (status == 0x9 && ! velocity)
+                velocity = 1;
+            return put(out, (status << 4) | channel, index1, velocity);
+        }
+        case 0xA: // poly pressure
+            if (maxLength < 3)
+                return 0;
+            return put(out, 0xA0 | channel, index1, UMPEncoder::scaleDown(data, 32, 7));
+        case 0xB:
+            return controlChange(channel, index1, data, out, maxLength);
+        case LMX_UMP_REGISTERED_CONTROLLER:
+        case LMX_UMP_ASSIGNABLE_CONTROLLER:
+            return parameter(channel, status == LMX_UMP_REGISTERED_CONTROLLER, (index1 << 7) | index2, data, out, maxLength);
+        case 0xC: { // program change, with the bank if the B flag is set
+            bool bank = message[0] & 0x01;
+            size_t needed = bank ? 8 : 2;
+            if (maxLength < needed)
+                return 0;
+            size_t pos = 0;
+            if (bank) {
+                pos += put(out, 0xB0 | channel, 0, (data >> 8) & 0x7F);
+                pos += put(out + pos, 0xB0 | channel, 32, data & 0x7F);
+                highRes.controlSent(channel, 0);
+            }
+            out[pos++] = 0xC0 | channel;
+            out[pos++] = (data >> 24) & 0x7F;
+            return pos;
+        }
+        case 0xD: // channel pressure
+            if (maxLength < 2)
+                return 0;
+            out[0] = 0xD0 | channel;
+            out[1] = UMPEncoder::scaleDown(data, 32, 7);
+            return 2;
+        case 0xE: { // pitch bend
+            if (maxLength < 3)
+                return 0;
+            uint32_t bend = UMPEncoder::scaleDown(data, 32, 14);
+            return put(out, 0xE0 | channel, bend & 0x7F, bend >> 7);
+        }
+        default: // per-note controllers and management
+            skipped++;
+            return 0;
+    }
+}
+
+size_t UMPTranslator::controlChange(uint8_t channel, uint8_t index, uint32_t value, uint8_t *out, size_t maxLength) {
+    uint8_t msb = UMPEncoder::scaleDown(value, 32, 7);
+
+    // a value that is just a 7 bit one scaled up gets no LSB, the
+    // receiver's LSB is reset by the MSB; unless it's a 14 bit controller,
+    // whose LSB may well be 0
+    if (index >= 32 || (! isControl14(channel, index) && value == UMPEncoder::scaleUp(msb, 7, 32))) {
+        if (maxLength < 3)
+            return 0;
+        highRes.controlSent(channel, index);
+        return put(out, 0xB0 | channel, index, msb);
+    }
+
+    if (maxLength < 6)
+        return 0;
+    uint16_t value14 = UMPEncoder::scaleDown(value, 32, 14);
+    unsigned int send = highRes.control(channel, index, value14);
+    size_t pos = 0;
+    if (send & HighResControls::SEND_MSB)
+        pos += put(out, 0xB0 | channel, index, value14 >> 7);
+    if (send & HighResControls::SEND_LSB)
+        pos += put(out + pos, 0xB0 | channel, index + 32, value14 & 0x7F);
+    return pos;
+}
+
+size_t UMPTranslator::parameter(uint8_t channel, bool registered, uint16_t number, uint32_t value, uint8_t *out, size_t maxLength) {
+    if (maxLength < 12)
+        return 0;
+
+    size_t pos = 0;
+    uint8_t status = 0xB0 | channel;
+    if (highRes.selectParameter(channel, registered, number)) {
+        pos += put(out, status, registered ? LMX_CC_RPN_MSB : LMX_CC_NRPN_MSB, number >> 7);
+        pos += put(out + pos, status, registered ? LMX_CC_RPN_LSB : LMX_CC_NRPN_LSB, number & 0x7F);
+    }
+
+    uint16_t value14 = UMPEncoder::scaleDown(value, 32, 14);
+    unsigned int send = highRes.dataEntry(channel, value14);
+    if (send & HighResControls::SEND_MSB)
+        pos += put(out + pos, status, LMX_CC_DATA_ENTRY_MSB, value14 >> 7);
+    if (send & HighResControls::SEND_LSB)
+        pos += put(out + pos, status, LMX_CC_DATA_ENTRY_LSB, value14 & 0x7F);
+    return pos;
+}
+
+} // namespace leapmidi
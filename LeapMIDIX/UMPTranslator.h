@@ -0,0 +1,63 @@
+//
+//  UMPTranslator.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Turns Universal MIDI Packets back into MIDI 1.0 channel messages, for
+// outputs that only speak the byte stream.
+// MIDI 1.0 messages in UMP (type 2) pass through. MIDI 2.0 channel voice
+// messages (type 4) are scaled down the way the MIDI 2.0 translation
+// rules say, with two exceptions that keep what MIDI 1.0 can carry:
+// - a controller 0-31 that carries 14 bit values (setControl14()), or
+//   whose value has more than 7 bits of resolution, is sent as a 14 bit
+//   MSB/LSB pair; without the former, a 14 bit value whose low bits
+//   happen to be 0 would look like a 7 bit one and lose its LSB
+// - RPN/NRPN messages become a parameter select plus data entry (14 bit)
+// Both leave out what the receiver already has (see HighResControls).
+// Anything else (system messages, per-note controllers, other groups'
+// utility messages) is skipped.
+
+#ifndef __LeapMIDIX__UMPTranslator__
+#define __LeapMIDIX__UMPTranslator__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "HighResControls.h"
+
+namespace leapmidi {
+
+class UMPTranslator {
+public:
+    UMPTranslator();
+
+    // forget what the receiver has
+    void reset() { highRes.reset(); }
+
+    // controller (0-31) on channel carries 14 bit values from now on, or
+    // doesn't any more; applies to the words translated next
+    void setControl14(uint8_t channel, uint8_t controller, bool enabled);
+    bool isControl14(uint8_t channel, uint8_t controller) const { return (control14[channel & 0x0F] >> (controller & 0x1F)) & 1; }
+
+    // translate count words into complete MIDI 1.0 messages, each with
+    // its status byte; messages that don't fit in maxLength are dropped
+    // returns the number of bytes written
+    size_t toMIDI1(const uint32_t *words, size_t count, uint8_t *out, size_t maxLength);
+
+    // MIDI 2.0 messages with no MIDI 1.0 equivalent
+    unsigned long skippedCount() const { return skipped; }
+
+protected:
+    size_t translateMIDI2(const uint32_t *message, uint8_t *out, size_t maxLength);
+    size_t controlChange(uint8_t channel, uint8_t index, uint32_t value, uint8_t *out, size_t maxLength);
+    size_t parameter(uint8_t channel, bool registered, uint16_t number, uint32_t value, uint8_t *out, size_t maxLength);
+
+    HighResControls highRes;
+    uint32_t control14[16]; // per channel, a bit per controller 0-31
+    unsigned long skipped;
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__UMPTranslator__) */
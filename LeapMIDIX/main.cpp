@@ -13,7 +13,7 @@
 
 void sendNote();
 
-int main(int argc, const char * argv[]) {
+int main(int /* argc */, const char * /* argv */[]) {
     // start listening for events
     leapmidi::LMXListener listener;
     Leap::Controller controller;
@@ -0,0 +1,193 @@
+//
+//  AlsaOutput.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "AlsaOutput.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include "Log.h"
+
+// library side buffer for the events of one send(), sized to hold a full
+// packet list without an intermediate write
+#define OUTPUT_BUFFER_SIZE (32 * 1024)
+
+// largest message the parser can assemble (sysex is split beyond this)
+#define PARSER_BUFFER_SIZE 256
+
+namespace leapmidi {
+
+OutputBackend *createDefaultOutput() {
+    return new AlsaOutput();
+}
+
+// whether a SysEx message is still open after data, given whether one was
+// before it: the last status byte decides, realtime bytes don't count
+static bool endsInSysEx(const Byte *data, size_t length, bool open) {
+    for (size_t i = length; i > 0; i--) {
+        Byte b = data[i - 1];
+        if (b < 0x80 || b >= 0xF8)
+            continue;
+        return b == 0xF0;
+    }
+    return open;
+}
+
+AlsaOutput::AlsaOutput(Delivery delivery_, Clock *clock_) {
+    delivery = delivery_;
+    clock = clock_ ? clock_ : HostClock::shared();
+    seq = NULL;
+    port = -1;
+    queue = -1;
+    parser = NULL;
+    sysExOpen = false;
+}
+
+AlsaOutput::~AlsaOutput() {
+    close();
+}
+
+bool AlsaOutput::open() {
+    int res = snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0);
+    if (res < 0) {
+        LMX_LOG(LOG_ERROR, "Failed to open ALSA sequencer: %s", snd_strerror(res));
+        seq = NULL;
+        return false;
+    }
+    snd_seq_set_client_name(seq, "LeapMIDIX");
+    snd_seq_set_output_buffer_size(seq, OUTPUT_BUFFER_SIZE);
+    
+    port = snd_seq_create_simple_port(seq, "LeapMIDIX Control",
+                                      SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                      SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if (port < 0) {
+        LMX_LOG(LOG_ERROR, "Failed to create ALSA sequencer port: %s", snd_strerror(port));
+        close();
+        return false;
+    }
+    
+    if (delivery == QUEUED) {
+        queue = snd_seq_alloc_named_queue(seq, "LeapMIDIX");
+        if (queue < 0) {
+            LMX_LOG(LOG_ERROR, "Failed to allocate ALSA sequencer queue: %s", snd_strerror(queue));
+            close();
+            return false;
+        }
+        snd_seq_start_queue(seq, queue, NULL);
+        snd_seq_drain_output(seq);
+    }
+    
+    res = snd_midi_event_new(PARSER_BUFFER_SIZE, &parser);
+    if (res < 0) {
+        LMX_LOG(LOG_ERROR, "Failed to create ALSA MIDI parser: %s", snd_strerror(res));
+        parser = NULL;
+        close();
+        return false;
+    }
+    sysExOpen = false;
+    
+    return true;
+}
+
+void AlsaOutput::close() {
+    if (parser)
+        snd_midi_event_free(parser);
+    parser = NULL;
+    
+    if (! seq)
+        return;
+    
+    if (queue >= 0) {
+        // let whatever is still scheduled play out first
+        snd_seq_drain_output(seq);
+        snd_seq_sync_output_queue(seq);
+        snd_seq_free_queue(seq, queue);
+    }
+    snd_seq_close(seq);
+    
+    seq = NULL;
+    port = -1;
+    queue = -1;
+}
+
+int AlsaOutput::outputEvent(snd_seq_event_t *ev) {
+    int res = snd_seq_event_output_buffer(seq, ev);
+    if (res != -EAGAIN)
+        return res;
+    
+    // buffer is full, write it out and try again
+    res = snd_seq_drain_output(seq);
+    if (res < 0)
+        return res;
+    return snd_seq_event_output_buffer(seq, ev);
+}
+
+OSStatus AlsaOutput::send(const MIDIPacketList *packets) {
+    if (! seq || ! parser)
+        return -ENODEV;
+    
+    // timestamps are host clock ticks, which are nanoseconds off OS X;
+    // they are scheduled relative to now so the sequencer's timer and our
+    // clock never have to agree on an epoch
+    uint64_t now = clock->now();
+    int err = 0;
+    
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (UInt32 i = 0; i < packets->numPackets; i++, pkt = MIDIPacketNext(pkt)) {
+        snd_seq_real_time_t delay = { 0, 0 };
+        if (delivery == QUEUED) {
+            uint64_t wait = pkt->timeStamp > now ? pkt->timeStamp - now : 0;
+            delay.tv_sec = (unsigned int)(wait / 1000000000ULL);
+            delay.tv_nsec = (unsigned int)(wait % 1000000000ULL);
+        }
+        
+        // every packet starts with a status byte, running status inside
+        // it is handled by the parser; except the rest of a SysEx message
+        // sent in chunks, which has to go on from what the parser has
+        if (! sysExOpen)
+            snd_midi_event_reset_encode(parser);
+        long pos = 0;
+        while (pos < pkt->length) {
+            snd_seq_event_t ev;
+            snd_seq_ev_clear(&ev);
+            long used = snd_midi_event_encode(parser, pkt->data + pos, pkt->length - pos, &ev);
+            if (used <= 0)
+                break;
+            pos += used;
+            if (ev.type == SND_SEQ_EVENT_NONE)
+                continue; // message not complete yet
+            
+            snd_seq_ev_set_source(&ev, port);
+            snd_seq_ev_set_subs(&ev);
+            if (delivery == QUEUED)
+                snd_seq_ev_schedule_real(&ev, queue, 1, &delay);
+            else
+                snd_seq_ev_set_direct(&ev);
+            
+            int res = outputEvent(&ev);
+            if (res < 0 && ! err) {
+                LMX_LOG(LOG_WARN, "Failed to queue ALSA sequencer event: %s", snd_strerror(res));
+                err = res;
+            }
+        }
+        sysExOpen = endsInSysEx(pkt->data, pkt->length, sysExOpen);
+    }
+    
+    // one write for the whole list
+    int res = snd_seq_drain_output(seq);
+    if (res < 0) {
+        LMX_LOG(LOG_WARN, "Failed to write ALSA sequencer events: %s", snd_strerror(res));
+        if (! err)
+            err = res;
+    }
+    
+    return err;
+}
+
+} // namespace leapmidi
+
+#endif
@@ -0,0 +1,70 @@
+//
+//  AlsaOutput.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// ALSA sequencer client with one virtual output port, for Linux.
+// Other clients subscribe to "LeapMIDIX:LeapMIDIX Control" (e.g. with
+// aconnect) to receive its MIDI.
+// Each send() turns the packet list into sequencer events in the library's
+// output buffer and writes them to the kernel in one go.
+// Delivery is either DIRECT, where events go out as soon as they're
+// written and timestamps are ignored, or QUEUED, where they go through a
+// sequencer queue and the kernel delivers them at their timestamps.
+
+#ifndef __LeapMIDIX__AlsaOutput__
+#define __LeapMIDIX__AlsaOutput__
+
+#ifdef __linux__
+
+#include <alsa/asoundlib.h>
+#include "OutputBackend.h"
+#include "HostClock.h"
+
+namespace leapmidi {
+
+class AlsaOutput : public OutputBackend {
+public:
+    enum Delivery {
+        DIRECT,
+        QUEUED
+    };
+    
+    // clock is the one the packet timestamps come from, defaults to the
+    // shared host clock
+    AlsaOutput(Delivery delivery = QUEUED, Clock *clock = NULL);
+    virtual ~AlsaOutput();
+    
+    virtual bool open();
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    virtual bool schedulesPackets() const { return delivery == QUEUED; }
+    virtual const char *name() const { return "ALSA sequencer"; }
+    
+    Delivery getDelivery() const { return delivery; }
+    
+protected:
+    // add one event to the output buffer, writing the buffer out first
+    // if it's full
+    virtual int outputEvent(snd_seq_event_t *ev);
+    
+    Delivery delivery;
+    Clock *clock;
+    
+    snd_seq_t *seq;
+    int port;
+    int queue;
+    // turns raw MIDI bytes into sequencer events
+    snd_midi_event_t *parser;
+    // the last packet ended inside a SysEx message, whose start is still
+    // in the parser waiting for the rest
+    bool sysExOpen;
+};
+
+} // namespace leapmidi
+
+#endif
+
+#endif /* defined(__LeapMIDIX__AlsaOutput__) */
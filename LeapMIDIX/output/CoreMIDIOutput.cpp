@@ -0,0 +1,65 @@
+//
+//  CoreMIDIOutput.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "CoreMIDIOutput.h"
+
+#ifdef __APPLE__
+
+#include <CoreMIDI/MIDIServices.h>
+#include "Log.h"
+
+namespace leapmidi {
+
+OutputBackend *createDefaultOutput() {
+    return new CoreMIDIOutput();
+}
+
+CoreMIDIOutput::CoreMIDIOutput() {
+    deviceClient = 0;
+    deviceEndpoint = 0;
+}
+
+CoreMIDIOutput::~CoreMIDIOutput() {
+    close();
+}
+
+bool CoreMIDIOutput::open() {
+    OSStatus result;
+    
+    result = MIDIClientCreate(CFSTR("LeapMIDIX"), NULL, NULL, &deviceClient);
+    if (result) {
+        LMX_LOG(LOG_ERROR, "Failed to create MIDI client: %d", result);
+        return false;
+    }
+    
+    result = MIDISourceCreate(deviceClient, CFSTR("LeapMIDIX Control"), &deviceEndpoint);
+    if (result) {
+        LMX_LOG(LOG_ERROR, "Failed to create MIDI source: %d", result);
+        close();
+        return false;
+    }
+    
+    return true;
+}
+
+void CoreMIDIOutput::close() {
+    if (deviceEndpoint)
+        MIDIEndpointDispose(deviceEndpoint);
+    if (deviceClient)
+        MIDIClientDispose(deviceClient);
+    deviceEndpoint = 0;
+    deviceClient = 0;
+}
+
+// "send" a packet, really pretends that our virtual device source received a packet
+OSStatus CoreMIDIOutput::send(const MIDIPacketList *packets) {
+    return MIDIReceived(deviceEndpoint, packets);
+}
+
+} // namespace leapmidi
+
+#endif
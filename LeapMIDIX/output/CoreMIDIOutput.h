@@ -0,0 +1,40 @@
+//
+//  CoreMIDIOutput.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Virtual CoreMIDI source, shows up as "LeapMIDIX Control" in other apps.
+// CoreMIDI schedules packets by their host time timestamps itself.
+
+#ifndef __LeapMIDIX__CoreMIDIOutput__
+#define __LeapMIDIX__CoreMIDIOutput__
+
+#ifdef __APPLE__
+
+#include "OutputBackend.h"
+
+namespace leapmidi {
+
+class CoreMIDIOutput : public OutputBackend {
+public:
+    CoreMIDIOutput();
+    virtual ~CoreMIDIOutput();
+    
+    virtual bool open();
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    virtual bool schedulesPackets() const { return true; }
+    virtual const char *name() const { return "CoreMIDI"; }
+    
+protected:
+    MIDIClientRef deviceClient;
+    MIDIEndpointRef deviceEndpoint;
+};
+
+} // namespace leapmidi
+
+#endif
+
+#endif /* defined(__LeapMIDIX__CoreMIDIOutput__) */
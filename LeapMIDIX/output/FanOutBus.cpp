@@ -0,0 +1,261 @@
+//
+//  FanOutBus.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <assert.h>
+#include "FanOutBus.h"
+#include "Log.h"
+
+namespace leapmidi {
+
+// append a packet, using more of the list's buffer if it doesn't fit
+static bool addGrowing(PacketList &list, MIDITimeStamp timestamp, size_t length, const Byte *data) {
+    if (list.add(timestamp, length, data))
+        return true;
+    while (list.grow()) {
+        if (list.add(timestamp, length, data))
+            return true;
+    }
+    return false;
+}
+
+FanOutBus::FanOutBus(Clock *clock_) {
+    clock = clock_ ? clock_ : HostClock::shared();
+    poolExhausted = 0;
+    running = false;
+}
+
+FanOutBus::~FanOutBus() {
+    close();
+    for (size_t i = 0; i < sinks.size(); i++)
+        delete sinks[i];
+    for (size_t i = 0; i < batches.size(); i++)
+        delete batches[i];
+}
+
+bool FanOutBus::addSink(OutputBackend *output, int64_t latencyOffset) {
+    assert(! running);
+    if (sinks.size() == LMX_FANOUT_MAX_SINKS) {
+        LMX_LOG(LOG_ERROR, "Fan-out bus is full, not adding %s output", output->name());
+        return false;
+    }
+
+    Sink *sink = new Sink;
+    sink->bus = this;
+    sink->output = output;
+    sink->latencyOffset = latencyOffset;
+    sink->open = false;
+    sink->waiting = false;
+    sink->threadStarted = false;
+    sink->sent = 0;
+    sink->dropped = 0;
+    sinks.push_back(sink);
+    return true;
+}
+
+void FanOutBus::setLatencyOffset(OutputBackend *output, int64_t latencyOffset) {
+    for (size_t i = 0; i < sinks.size(); i++) {
+        if (sinks[i]->output == output)
+            sinks[i]->latencyOffset.store(latencyOffset, std::memory_order_relaxed);
+    }
+}
+
+bool FanOutBus::open() {
+    size_t openCount = 0;
+    for (size_t i = 0; i < sinks.size(); i++) {
+        Sink *sink = sinks[i];
+        sink->open = sink->output->open();
+        if (! sink->open) {
+            LMX_LOG(LOG_ERROR, "Failed to open %s output, leaving it off the bus", sink->output->name());
+            continue;
+        }
+        openCount++;
+    }
+    if (! openCount)
+        return false;
+
+    // a sink holds at most a full queue and the batch it's sending, so the
+    // pool can't run dry however slow they are
+    size_t poolSize = openCount * (LMX_FANOUT_QUEUE_SIZE + 1) + 1;
+    while (batches.size() < poolSize) {
+        Batch *batch = new Batch;
+        batch->references = 0;
+        batches.push_back(batch);
+        freeBatches.push(batch);
+    }
+
+    running = true;
+    for (size_t i = 0; i < sinks.size(); i++) {
+        Sink *sink = sinks[i];
+        if (! sink->open)
+            continue;
+        if (pthread_create(&sink->thread, NULL, _sinkThreadEntry, sink)) {
+            LMX_LOG(LOG_ERROR, "Failed to start thread for %s output, leaving it off the bus", sink->output->name());
+            sink->output->close();
+            sink->open = false;
+            continue;
+        }
+        sink->threadStarted = true;
+        LMX_LOG(LOG_INFO, "Fan-out bus sink: %s, latency offset %lldus", sink->output->name(), (long long)(sink->latencyOffset.load() / 1000));
+    }
+
+    return true;
+}
+
+void FanOutBus::close() {
+    running = false;
+    for (size_t i = 0; i < sinks.size(); i++) {
+        Sink *sink = sinks[i];
+        if (sink->threadStarted) {
+            sink->notifier.signal();
+            pthread_join(sink->thread, NULL);
+            sink->threadStarted = false;
+        }
+        if (sink->open) {
+            sink->output->close();
+            sink->open = false;
+        }
+    }
+}
+
+// sending thread, never blocks
+OSStatus FanOutBus::send(const MIDIPacketList *packets) {
+    if (! running || ! packets->numPackets)
+        return 0;
+
+    Batch *batch;
+    if (! freeBatches.drain(&batch, 1)) {
+        poolExhausted++;
+        return 0;
+    }
+
+    // the one copy every sink shares
+    // (a Device's list always fits, it's no bigger than ours)
+    batch->packets.reset();
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (UInt32 i = 0; i < packets->numPackets; i++, pkt = MIDIPacketNext(pkt))
+        addGrowing(batch->packets, pkt->timeStamp, pkt->length, pkt->data);
+
+    // every sink's reference up front, so an early release can't free it
+    size_t openCount = 0;
+    for (size_t i = 0; i < sinks.size(); i++) {
+        if (sinks[i]->threadStarted)
+            openCount++;
+    }
+    batch->references.store(openCount + 1);
+
+    for (size_t i = 0; i < sinks.size(); i++) {
+        Sink *sink = sinks[i];
+        if (! sink->threadStarted)
+            continue;
+        if (! sink->queue.push(batch)) {
+            // this sink is a whole queue behind, it misses this one
+            sink->dropped++;
+            release(batch);
+            continue;
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sink->waiting.load() && sink->waiting.exchange(false))
+            sink->notifier.signal();
+    }
+
+    release(batch);
+    return 0;
+}
+
+void FanOutBus::release(Batch *batch) {
+    if (batch->references.fetch_sub(1) == 1)
+        freeBatches.push(batch);
+}
+
+void FanOutBus::sinkThreadEntry(Sink *sink) {
+    // once closing, finish what's queued
+    for (;;) {
+        Batch *batch;
+        if (sink->queue.drain(&batch, 1)) {
+            sendBatch(sink, batch->packets.get());
+            release(batch);
+            sink->sent++;
+            continue;
+        }
+        if (! running)
+            break;
+        waitForBatch(sink);
+    }
+}
+
+void FanOutBus::sendBatch(Sink *sink, const MIDIPacketList *packets) {
+    int64_t offset = sink->latencyOffset.load(std::memory_order_relaxed);
+    bool schedules = sink->output->schedulesPackets();
+
+    // the shared batch as it is
+    if (! offset && schedules) {
+        OSStatus res = sink->output->send(packets);
+        if (res)
+            LMX_LOG(LOG_WARN, "%s output failed to send MIDI: %d", sink->output->name(), res);
+        return;
+    }
+
+    // our own copy with the offset applied; a sink that doesn't schedule
+    // gets everything up to a packet that isn't due yet, then that one
+    // when it is
+    sink->shifted.reset();
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (UInt32 i = 0; i < packets->numPackets; i++, pkt = MIDIPacketNext(pkt)) {
+        uint64_t now = clock->now();
+        MIDITimeStamp timestamp = shiftTimestamp(pkt->timeStamp, offset, now);
+        if (! schedules && timestamp) {
+            sendShifted(sink);
+            waitUntil(sink, clock->fromHostTicks(timestamp));
+            timestamp = 0;
+        }
+
+        if (sink->shifted.add(timestamp, pkt->length, pkt->data))
+            continue;
+        sendShifted(sink);
+        addGrowing(sink->shifted, timestamp, pkt->length, pkt->data);
+    }
+    sendShifted(sink);
+}
+
+void FanOutBus::sendShifted(Sink *sink) {
+    if (sink->shifted.empty())
+        return;
+    OSStatus res = sink->output->send(sink->shifted.get());
+    if (res)
+        LMX_LOG(LOG_WARN, "%s output failed to send MIDI: %d", sink->output->name(), res);
+    sink->shifted.reset();
+}
+
+MIDITimeStamp FanOutBus::shiftTimestamp(MIDITimeStamp timestamp, int64_t offset, uint64_t now) const {
+    int64_t due = (int64_t)(timestamp ? clock->fromHostTicks(timestamp) : now) + offset;
+    if (due <= (int64_t)now)
+        return 0;
+    return clock->toHostTicks(due);
+}
+
+void FanOutBus::waitForBatch(Sink *sink) {
+    // announce we are going to sleep, then check the queue again so a
+    // batch pushed in between can't be missed
+    sink->waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sink->queue.empty() && running)
+        sink->notifier.wait(-1);
+    sink->waiting.store(false);
+}
+
+void FanOutBus::waitUntil(Sink *sink, uint64_t due) {
+    // only close() signals while we're not waiting for a batch
+    for (;;) {
+        uint64_t now = clock->now();
+        if (now >= due || ! running)
+            return;
+        sink->notifier.wait(due - now);
+    }
+}
+
+} // namespace leapmidi
@@ -0,0 +1,133 @@
+//
+//  FanOutBus.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Output that hands what the Device encoded to several sinks (e.g. the
+// live port, a recorder and an RTP-MIDI session) without any of them
+// holding up the others.
+// Device::addOutput() sends each packet list to every output in turn on
+// the sending thread, so one slow output delays them all. The bus instead
+// copies each packet list once into an immutable, reference counted batch
+// from a preallocated pool and queues a pointer to it for every sink.
+// Every sink has its own thread that sends the batches on and drops its
+// reference; the last one returns the batch to the pool.
+// Each sink has a latency offset added to the packet timestamps, to line
+// up receivers with different delays downstream. Negative offsets send
+// early, which only works within the Device's latency offset. Sinks that
+// don't schedule packets themselves are sent each packet when it's due.
+// A sink that falls a whole queue behind loses batches (counted); the
+// others never notice.
+// MIDI 1.0 only, the bus doesn't take UMP.
+
+#ifndef __LeapMIDIX__FanOutBus__
+#define __LeapMIDIX__FanOutBus__
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include "OutputBackend.h"
+#include "MessageRing.h"
+#include "PacketList.h"
+#include "EventNotifier.h"
+#include "HostClock.h"
+
+// batches waiting for one sink, must be a power of two
+#define LMX_FANOUT_QUEUE_SIZE 16
+#define LMX_FANOUT_MAX_SINKS 8
+// enough batches for every sink to have a full queue and one in hand
+#define LMX_FANOUT_POOL_SIZE 256
+
+namespace leapmidi {
+
+class FanOutBus : public OutputBackend {
+public:
+    // clock is the one the packet timestamps come from, defaults to the
+    // shared host clock
+    FanOutBus(Clock *clock = NULL);
+    virtual ~FanOutBus();
+
+    // offset in nanoseconds, must be called before open(); sinks are not
+    // deleted by the bus
+    bool addSink(OutputBackend *sink, int64_t latencyOffset = 0);
+    // thread-safe
+    void setLatencyOffset(OutputBackend *sink, int64_t latencyOffset);
+
+    // open the sinks and start their threads; sinks that fail to open are
+    // left out, false if none opened
+    virtual bool open();
+    // send what's queued, then stop the threads and close the sinks
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    // sinks that don't schedule get their packets at the right time anyway
+    virtual bool schedulesPackets() const { return true; }
+    virtual const char *name() const { return "fan-out bus"; }
+
+    size_t sinkCount() const { return sinks.size(); }
+    // batches a sink has sent, and lost because it fell behind
+    unsigned long sentCount(size_t sink) const { return sinks[sink]->sent.load(); }
+    unsigned long droppedCount(size_t sink) const { return sinks[sink]->dropped.load(); }
+    // packet lists lost because the pool ran dry, which a full queue per
+    // sink should make impossible
+    unsigned long poolExhaustedCount() const { return poolExhausted.load(); }
+
+protected:
+    // one packet list as the Device sent it, shared by all sinks
+    struct Batch {
+        PacketList packets;
+        std::atomic<int> references;
+    };
+
+    struct Sink {
+        FanOutBus *bus;
+        OutputBackend *output;
+        std::atomic<int64_t> latencyOffset;
+        bool open;
+
+        MessageRing<Batch *, LMX_FANOUT_QUEUE_SIZE> queue;
+        // like the Device's sending thread: only signalled when the sink's
+        // thread has said it's going to sleep
+        EventNotifier notifier;
+        std::atomic<bool> waiting;
+        pthread_t thread;
+        bool threadStarted;
+
+        // only touched by the sink's thread
+        PacketList shifted; // the batch with this sink's timestamps
+
+        std::atomic<unsigned long> sent;
+        std::atomic<unsigned long> dropped;
+    };
+
+    // sink thread
+    void sinkThreadEntry(Sink *sink);
+    void sendBatch(Sink *sink, const MIDIPacketList *packets);
+    void sendShifted(Sink *sink);
+    // sleep until the sink has something queued, or the bus is closing
+    void waitForBatch(Sink *sink);
+    // sleep until due (nanoseconds), or the bus is closing
+    void waitUntil(Sink *sink, uint64_t due);
+    // timestamp plus offset, 0 (now) if that has passed already
+    MIDITimeStamp shiftTimestamp(MIDITimeStamp timestamp, int64_t offset, uint64_t now) const;
+    void release(Batch *batch);
+
+    Clock *clock;
+    std::vector<Sink *> sinks;
+    std::vector<Batch *> batches; // the pool, owned
+    MessageRing<Batch *, LMX_FANOUT_POOL_SIZE> freeBatches;
+    std::atomic<unsigned long> poolExhausted;
+    std::atomic<bool> running;
+
+private:
+    static void *_sinkThreadEntry(void *sink) { ((Sink *)sink)->bus->sinkThreadEntry((Sink *)sink); return NULL; }
+
+    FanOutBus(const FanOutBus &);
+    FanOutBus &operator=(const FanOutBus &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__FanOutBus__) */
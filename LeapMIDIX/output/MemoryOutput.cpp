@@ -0,0 +1,120 @@
+//
+//  MemoryOutput.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include "MemoryOutput.h"
+
+namespace leapmidi {
+
+// the default where there's no native output, or when asked for (the
+// tests and benchmarks, which build without the native outputs)
+#if defined(LMX_MEMORY_DEFAULT_OUTPUT) || (! defined(__APPLE__) && ! defined(__linux__))
+OutputBackend *createDefaultOutput() {
+    return new MemoryOutput();
+}
+#endif
+
+MemoryOutput::MemoryOutput(Clock *clock_, bool schedules_, bool ump_) {
+    clock = clock_ ? clock_ : HostClock::shared();
+    schedules = schedules_;
+    ump = ump_;
+    opened = false;
+    pthread_mutex_init(&mutex, NULL);
+}
+
+MemoryOutput::~MemoryOutput() {
+    pthread_mutex_destroy(&mutex);
+}
+
+bool MemoryOutput::open() {
+    pthread_mutex_lock(&mutex);
+    opened = true;
+    pthread_mutex_unlock(&mutex);
+    return true;
+}
+
+void MemoryOutput::close() {
+    pthread_mutex_lock(&mutex);
+    opened = false;
+    pthread_mutex_unlock(&mutex);
+}
+
+bool MemoryOutput::isOpen() const {
+    pthread_mutex_lock(&mutex);
+    bool res = opened;
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+OSStatus MemoryOutput::send(const MIDIPacketList *packets) {
+    uint64_t now = clock->now();
+    
+    pthread_mutex_lock(&mutex);
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (UInt32 i = 0; i < packets->numPackets; i++) {
+        Packet rec;
+        rec.timestamp = pkt->timeStamp;
+        rec.sentAt = now;
+        rec.data.assign(pkt->data, pkt->data + pkt->length);
+        recorded.push_back(rec);
+        pkt = MIDIPacketNext(pkt);
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    return 0;
+}
+
+OSStatus MemoryOutput::sendUMP(const uint32_t *words, size_t count, MIDITimeStamp timestamp) {
+    UMPPacket rec;
+    rec.timestamp = timestamp;
+    rec.sentAt = clock->now();
+    rec.words.assign(words, words + count);
+    
+    pthread_mutex_lock(&mutex);
+    recordedUMP.push_back(rec);
+    pthread_mutex_unlock(&mutex);
+    
+    return 0;
+}
+
+std::vector<MemoryOutput::Packet> MemoryOutput::packets() const {
+    pthread_mutex_lock(&mutex);
+    std::vector<Packet> res = recorded;
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+std::vector<MemoryOutput::UMPPacket> MemoryOutput::umpPackets() const {
+    pthread_mutex_lock(&mutex);
+    std::vector<UMPPacket> res = recordedUMP;
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+std::vector<Byte> MemoryOutput::bytes() const {
+    std::vector<Byte> res;
+    pthread_mutex_lock(&mutex);
+    for (size_t i = 0; i < recorded.size(); i++)
+        res.insert(res.end(), recorded[i].data.begin(), recorded[i].data.end());
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+size_t MemoryOutput::packetCount() const {
+    pthread_mutex_lock(&mutex);
+    size_t res = recorded.size();
+    pthread_mutex_unlock(&mutex);
+    return res;
+}
+
+void MemoryOutput::clear() {
+    pthread_mutex_lock(&mutex);
+    recorded.clear();
+    recordedUMP.clear();
+    pthread_mutex_unlock(&mutex);
+}
+
+} // namespace leapmidi
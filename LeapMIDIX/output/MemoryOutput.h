@@ -0,0 +1,80 @@
+//
+//  MemoryOutput.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Output that just records what was sent, for tests and for running the
+// pipeline where there's no MIDI system.
+// Every packet is kept with its timestamp and the time it was handed
+// over; the recording can be read from any thread.
+// It can also stand in for a MIDI 2.0 receiver, recording UMP words.
+
+#ifndef __LeapMIDIX__MemoryOutput__
+#define __LeapMIDIX__MemoryOutput__
+
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include "OutputBackend.h"
+#include "HostClock.h"
+
+namespace leapmidi {
+
+class MemoryOutput : public OutputBackend {
+public:
+    struct Packet {
+        MIDITimeStamp timestamp; // as given by the Device
+        uint64_t sentAt;         // clock time send() was called
+        std::vector<Byte> data;
+    };
+    
+    struct UMPPacket {
+        MIDITimeStamp timestamp;
+        uint64_t sentAt;
+        std::vector<uint32_t> words;
+    };
+    
+    // clock defaults to the shared host clock
+    // schedules: what schedulesPackets() reports
+    // ump: what acceptsUMP() reports
+    MemoryOutput(Clock *clock = NULL, bool schedules = true, bool ump = false);
+    virtual ~MemoryOutput();
+    
+    virtual bool open();
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    virtual bool schedulesPackets() const { return schedules; }
+    virtual const char *name() const { return "memory"; }
+    virtual bool acceptsUMP() const { return ump; }
+    virtual OSStatus sendUMP(const uint32_t *words, size_t count, MIDITimeStamp timestamp);
+    
+    bool isOpen() const;
+    
+    // copy of everything recorded so far
+    std::vector<Packet> packets() const;
+    // all recorded bytes back to back
+    std::vector<Byte> bytes() const;
+    size_t packetCount() const;
+    // copy of the UMP words recorded so far
+    std::vector<UMPPacket> umpPackets() const;
+    void clear();
+    
+protected:
+    Clock *clock;
+    bool schedules;
+    bool ump;
+    bool opened;
+    std::vector<Packet> recorded;
+    std::vector<UMPPacket> recordedUMP;
+    mutable pthread_mutex_t mutex;
+    
+private:
+    MemoryOutput(const MemoryOutput &);
+    MemoryOutput &operator=(const MemoryOutput &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__MemoryOutput__) */
@@ -0,0 +1,209 @@
+//
+//  OSCOutput.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "OSCOutput.h"
+#include "Log.h"
+
+#define BUNDLE_HEADER_SIZE 16 // "#bundle\0" and the timetag
+
+// seconds from the NTP epoch (1900) to the Unix epoch (1970)
+#define NTP_UNIX_OFFSET 2208988800ULL
+
+namespace leapmidi {
+
+static void put32(uint8_t *out, uint32_t v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+OSCOutput::OSCOutput(const std::string &host_, uint16_t port_, const std::string &prefix_, Clock *clock_) {
+    host = host_;
+    port = port_;
+    prefix = prefix_;
+    clock = clock_ ? clock_ : HostClock::shared();
+    latency = 0;
+    sock = -1;
+    wallClockOffset = 0;
+    length = 0;
+    messageCount = 0;
+    inBundle = false;
+    bundleTimetag = 0;
+    sent = 0;
+    dropped = 0;
+}
+
+OSCOutput::~OSCOutput() {
+    close();
+}
+
+bool OSCOutput::open() {
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    int err = getaddrinfo(host.c_str(), service, &hints, &res);
+    if (err || ! res) {
+        LMX_LOG(LOG_ERROR, "Failed to resolve OSC host %s: %s", host.c_str(), gai_strerror(err));
+        return false;
+    }
+
+    sock = socket(res->ai_family, SOCK_DGRAM, 0);
+    if (sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+        LMX_LOG(LOG_ERROR, "Failed to set up OSC socket to %s:%d: %s", host.c_str(), port, strerror(errno));
+        freeaddrinfo(res);
+        close();
+        return false;
+    }
+    freeaddrinfo(res);
+
+    // never wait for the network in the frame callback
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t wallNanos = (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+    wallClockOffset = (int64_t)(wallNanos - clock->now());
+
+    LMX_LOG(LOG_INFO, "Sending OSC to %s:%d", host.c_str(), port);
+    return true;
+}
+
+void OSCOutput::close() {
+    if (sock >= 0)
+        ::close(sock);
+    sock = -1;
+    inBundle = false;
+}
+
+uint64_t OSCOutput::timetag(uint64_t hostTime) const {
+    uint64_t wallNanos = hostTime + wallClockOffset;
+    uint64_t seconds = wallNanos / 1000000000ULL + NTP_UNIX_OFFSET;
+    uint64_t fraction = ((wallNanos % 1000000000ULL) << 32) / 1000000000ULL;
+    return (seconds << 32) | fraction;
+}
+
+void OSCOutput::beginBundle(uint64_t captureTime) {
+    bundleTimetag = timetag(captureTime + latency);
+    inBundle = true;
+    startPacket();
+}
+
+void OSCOutput::startPacket() {
+    memcpy(buffer, "#bundle\0", 8);
+    put32(buffer + 8, bundleTimetag >> 32);
+    put32(buffer + 12, (uint32_t)bundleTimetag);
+    length = BUNDLE_HEADER_SIZE;
+    messageCount = 0;
+}
+
+void OSCOutput::addControl(midi_control_index index, float value) {
+    addMessage("control", 7, index, value);
+}
+
+void OSCOutput::addNote(midi_note_index index, float value) {
+    addMessage("note", 4, index, value);
+}
+
+// bundle element: size, then the message: address, type tags ",f", float
+// strings are NUL terminated and padded to a multiple of 4 bytes
+void OSCOutput::addMessage(const char *kind, size_t kindLength, unsigned int index, float value) {
+    if (! inBundle || sock < 0)
+        return;
+
+    char digits[12];
+    size_t digitCount = 0;
+    do {
+        digits[digitCount++] = '0' + index % 10;
+        index /= 10;
+    } while (index);
+
+    size_t addressLength = prefix.size() + 1 + kindLength + 1 + digitCount;
+    size_t paddedAddress = (addressLength + 4) & ~(size_t)3;
+    size_t messageLength = paddedAddress + 4 + 4;
+
+    if (length + 4 + messageLength > sizeof(buffer)) {
+        if (! messageCount)
+            return; // can't happen with any sane prefix
+        sendPacket();
+        startPacket();
+    }
+
+    uint8_t *out = buffer + length;
+    put32(out, messageLength);
+    out += 4;
+
+    // address
+    memset(out, 0, paddedAddress);
+    memcpy(out, prefix.data(), prefix.size());
+    size_t pos = prefix.size();
+    out[pos++] = '/';
+    memcpy(out + pos, kind, kindLength);
+    pos += kindLength;
+    out[pos++] = '/';
+    while (digitCount)
+        out[pos++] = digits[--digitCount];
+    out += paddedAddress;
+
+    // type tags
+    memcpy(out, ",f\0\0", 4);
+    out += 4;
+
+    // argument, big endian IEEE 754
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put32(out, bits);
+
+    length += 4 + messageLength;
+    messageCount++;
+}
+
+void OSCOutput::sendBundle() {
+    if (! inBundle)
+        return;
+    if (messageCount)
+        sendPacket();
+    inBundle = false;
+}
+
+void OSCOutput::sendPacket() {
+    ssize_t res = ::send(sock, buffer, length, 0);
+    if (res < 0) {
+        // EAGAIN: the socket buffer is full, dropping beats waiting;
+        // ECONNREFUSED: nobody listening (yet)
+        dropped++;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+            LMX_LOG(LOG_WARN, "OSC send failed: %s", strerror(errno));
+        return;
+    }
+    sent++;
+}
+
+void OSCOutput::sendControl(midi_control_index index, float value) {
+    beginBundle(clock->now());
+    addControl(index, value);
+    sendBundle();
+}
+
+void OSCOutput::sendNote(midi_note_index index, float value) {
+    beginBundle(clock->now());
+    addNote(index, value);
+    sendBundle();
+}
+
+} // namespace leapmidi
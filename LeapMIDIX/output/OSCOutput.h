@@ -0,0 +1,96 @@
+//
+//  OSCOutput.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Open Sound Control over UDP, for receivers that want the controls'
+// full resolution raw values instead of 7 bit MIDI.
+// Everything updated in one Leap frame goes out as one bundle, timetagged
+// with the frame's capture time plus a latency, as messages
+//   <prefix>/control/<index> f <raw value>
+//   <prefix>/note/<index> f <raw value>
+// Bundles are built in place in a preallocated buffer and sent on a
+// non-blocking socket: nothing allocates or waits, so this is safe to
+// call from the Leap frame callback. A bundle that would outgrow one
+// datagram is sent in pieces with the same timetag; datagrams the socket
+// can't take right away are dropped and counted.
+// Not thread-safe, meant to be driven by a single frame callback.
+
+#ifndef __LeapMIDIX__OSCOutput__
+#define __LeapMIDIX__OSCOutput__
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include "LeapMIDI.h"
+#include "HostClock.h"
+
+// largest datagram, fits an ethernet frame without fragmentation
+#define LMX_OSC_MAX_PACKET 1472
+
+namespace leapmidi {
+
+class OSCOutput {
+public:
+    // clock is the one capture times are on, defaults to the shared host clock
+    OSCOutput(const std::string &host, uint16_t port, const std::string &prefix = "/leapmidi", Clock *clock = NULL);
+    ~OSCOutput();
+
+    bool open();
+    void close();
+    bool isOpen() const { return sock >= 0; }
+
+    // timetags are capture time plus this (nanoseconds), usually the
+    // Device's latency offset so OSC and MIDI line up
+    void setLatency(uint64_t nanos) { latency = nanos; }
+
+    // start the bundle for a frame captured at captureTime
+    void beginBundle(uint64_t captureTime);
+    void addControl(midi_control_index index, float value);
+    void addNote(midi_note_index index, float value);
+    // send the bundle, if there's anything in it
+    void sendBundle();
+
+    // a single control/note outside of a frame, as its own bundle
+    void sendControl(midi_control_index index, float value);
+    void sendNote(midi_note_index index, float value);
+
+    unsigned long sentCount() const { return sent; }
+    unsigned long droppedCount() const { return dropped; }
+
+protected:
+    void addMessage(const char *kind, size_t kindLength, unsigned int index, float value);
+    void startPacket();
+    void sendPacket();
+    // NTP format: seconds since 1900 in the upper 32 bits, fraction below
+    uint64_t timetag(uint64_t hostTime) const;
+
+    std::string host;
+    uint16_t port;
+    std::string prefix;
+    Clock *clock;
+    uint64_t latency;
+
+    int sock;
+    // wall clock (nanoseconds since 1970) minus host clock, taken at open()
+    int64_t wallClockOffset;
+
+    uint8_t buffer[LMX_OSC_MAX_PACKET];
+    size_t length;       // bytes used in buffer
+    size_t messageCount; // messages in the current datagram
+    bool inBundle;
+    uint64_t bundleTimetag;
+
+    unsigned long sent;
+    unsigned long dropped;
+
+private:
+    OSCOutput(const OSCOutput &);
+    OSCOutput &operator=(const OSCOutput &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__OSCOutput__) */
@@ -0,0 +1,57 @@
+//
+//  OutputBackend.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Where the Device's MIDI goes.
+// The Device encodes everything into MIDIPacketLists and hands each one
+// to its backend from the sending thread. Timestamps in the list are host
+// clock ticks (see Clock::toHostTicks), 0 meaning as soon as possible.
+// A backend only ever sees one thread at a time: open() and close() are
+// called from the Device's owner, send() only from the sending thread in
+// between.
+// A backend that takes Universal MIDI Packets says so with acceptsUMP();
+// a Device set to the UMP protocol sends it words instead of packet lists.
+
+#ifndef __LeapMIDIX__OutputBackend__
+#define __LeapMIDIX__OutputBackend__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MIDICompat.h"
+
+namespace leapmidi {
+
+class OutputBackend {
+public:
+    virtual ~OutputBackend() {}
+    
+    // create the port/source, returns false if this output is unavailable
+    virtual bool open() = 0;
+    virtual void close() = 0;
+    
+    // send every packet in the list, returns 0 or an error status
+    virtual OSStatus send(const MIDIPacketList *packets) = 0;
+    
+    // true if packets are delivered at their timestamps rather than
+    // right away; if not, the Device holds messages until they're due
+    virtual bool schedulesPackets() const = 0;
+    
+    // for log messages
+    virtual const char *name() const = 0;
+    
+    // Universal MIDI Packets, count 32 bit words all due at timestamp
+    virtual bool acceptsUMP() const { return false; }
+    virtual OSStatus sendUMP(const uint32_t * /* words */, size_t /* count */, MIDITimeStamp /* timestamp */) { return 0; }
+};
+
+// the native output for this platform: a CoreMIDI source on OS X, an ALSA
+// sequencer port on Linux, otherwise a MemoryOutput
+// the caller owns it
+OutputBackend *createDefaultOutput();
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__OutputBackend__) */
@@ -0,0 +1,295 @@
+//
+//  RTPMIDIJournal.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <string.h>
+#include "RTPMIDIJournal.h"
+
+// journal header flags
+#define JOURNAL_A 0x20 // channel journals present
+#define JOURNAL_Y 0x40 // system journal present
+
+// chapter flags in a channel journal header, in the order they appear
+#define CHAPTER_P 0x80
+#define CHAPTER_C 0x40
+#define CHAPTER_M 0x20
+#define CHAPTER_W 0x10
+#define CHAPTER_N 0x08
+
+// velocity of note-offs played during recovery
+#define RECOVERY_OFF_VELOCITY 0x40
+
+namespace leapmidi {
+
+RTPMIDIJournal::RTPMIDIJournal() {
+    reset(0);
+}
+
+void RTPMIDIJournal::reset(uint16_t firstSeq) {
+    // the journal covers the packets after the checkpoint
+    checkpointSeq = firstSeq - 1;
+    controls.clearAll();
+    notes.clearAll();
+    offNotes.clearAll();
+}
+
+void RTPMIDIJournal::record(uint16_t seq, const uint8_t *message, size_t length) {
+    if (length < 3)
+        return;
+
+    uint8_t type = message[0] & 0xF0;
+    uint8_t ch = message[0] & 0x0F;
+    uint8_t number = message[1] & 0x7F;
+
+    if (type == 0xB0) {
+        controls.set(ch, number);
+        controlValue[ch][number] = message[2] & 0x7F;
+        controlSeq[ch][number] = seq;
+    } else if (type == 0x90 && message[2]) {
+        notes.set(ch, number);
+        offNotes.clear(ch, number);
+        noteVelocity[ch][number] = message[2] & 0x7F;
+        noteSeq[ch][number] = seq;
+    } else if (type == 0x80 || type == 0x90) {
+        notes.clear(ch, number);
+        offNotes.set(ch, number);
+        noteSeq[ch][number] = seq;
+    }
+}
+
+void RTPMIDIJournal::acknowledge(uint16_t seq) {
+    if (! afterCheckpoint(seq))
+        return; // old or duplicate feedback
+    checkpointSeq = seq;
+
+    // forget whatever the receiver is known to have
+    controls.forEach([this](unsigned char ch, unsigned char number) {
+        if (! afterCheckpoint(controlSeq[ch][number]))
+            controls.clear(ch, number);
+    });
+    notes.forEach([this](unsigned char ch, unsigned char note) {
+        if (! afterCheckpoint(noteSeq[ch][note]))
+            notes.clear(ch, note);
+    });
+    offNotes.forEach([this](unsigned char ch, unsigned char note) {
+        if (! afterCheckpoint(noteSeq[ch][note]))
+            offNotes.clear(ch, note);
+    });
+}
+
+size_t RTPMIDIJournal::encode(uint8_t *out, size_t maxLength) const {
+    unsigned int channels = controls.channels() | notes.channels() | offNotes.channels();
+    if (! channels || maxLength < 3)
+        return 0;
+
+    // header: S Y A H TOTCHAN, checkpoint seqnum
+    out[0] = JOURNAL_A | ((__builtin_popcount(channels) - 1) & 0x0F);
+    out[1] = checkpointSeq >> 8;
+    out[2] = checkpointSeq & 0xFF;
+    size_t pos = 3;
+
+    while (channels) {
+        unsigned char ch = __builtin_ctz(channels);
+        channels &= channels - 1;
+
+        // room for this channel (counting all 16 offbits octets)
+        size_t controlCount = controls.count(ch);
+        size_t noteCount = notes.count(ch);
+        size_t needed = 3 + (controlCount ? 1 + 2 * controlCount : 0);
+        if (noteCount || ! offNotes.empty(ch))
+            needed += 2 + 2 * (noteCount < 127 ? noteCount : 127) + 16;
+        if (maxLength - pos < needed)
+            return 0;
+
+        size_t start = pos;
+        uint8_t chapters = 0;
+        pos += 3;
+
+        // chapter C: S LEN, then S NUMBER / A VALUE per controller
+        if (! controls.empty(ch)) {
+            chapters |= CHAPTER_C;
+            size_t header = pos++;
+            size_t count = 0;
+            controls.forEach(ch, [&](unsigned char, unsigned char number) {
+                out[pos++] = number;
+                out[pos++] = controlValue[ch][number];
+                count++;
+            });
+            out[header] = (count - 1) & 0x7F;
+        }
+
+        // chapter N: B LEN / LOW HIGH, note logs, then OFFBITS
+        if (! notes.empty(ch) || ! offNotes.empty(ch)) {
+            chapters |= CHAPTER_N;
+            size_t header = pos;
+            pos += 2;
+
+            size_t count = 0;
+            notes.forEach(ch, [&](unsigned char, unsigned char note) {
+                if (count == 127)
+                    return; // LEN is 7 bits
+                out[pos++] = note;
+                out[pos++] = 0x80 | noteVelocity[ch][note]; // Y: play it
+                count++;
+            });
+
+            // octets LOW..HIGH, each a bitmap of 8 notes from 8 * octet
+            // (most significant bit first); LOW 15 HIGH 0 for none
+            uint8_t low = 15, high = 0;
+            if (! offNotes.empty(ch)) {
+                uint8_t offbits[16];
+                memset(offbits, 0, sizeof(offbits));
+                low = 16;
+                offNotes.forEach(ch, [&](unsigned char, unsigned char note) {
+                    uint8_t octet = note >> 3;
+                    offbits[octet] |= 0x80 >> (note & 7);
+                    if (octet < low)
+                        low = octet;
+                    high = octet;
+                });
+                for (uint8_t i = low; i <= high; i++)
+                    out[pos++] = offbits[i];
+            }
+
+            out[header] = count & 0x7F;
+            out[header + 1] = (low << 4) | high;
+        }
+
+        // channel header: S CHAN H LENGTH(10 bits), chapter flags
+        size_t length = pos - start;
+        out[start] = (ch << 3) | ((length >> 8) & 0x03);
+        out[start + 1] = length & 0xFF;
+        out[start + 2] = chapters;
+    }
+
+    return pos;
+}
+
+/*******/
+
+RTPMIDIRecovery::RTPMIDIRecovery() {
+    reset();
+}
+
+void RTPMIDIRecovery::reset() {
+    notes.clearAll();
+    for (int ch = 0; ch < 16; ch++)
+        for (int i = 0; i < 128; i++)
+            controlValue[ch][i] = -1;
+}
+
+void RTPMIDIRecovery::track(const uint8_t *message, size_t length) {
+    if (length < 3)
+        return;
+
+    uint8_t type = message[0] & 0xF0;
+    uint8_t ch = message[0] & 0x0F;
+    uint8_t number = message[1] & 0x7F;
+
+    if (type == 0xB0)
+        controlValue[ch][number] = message[2] & 0x7F;
+    else if (type == 0x90 && message[2])
+        notes.set(ch, number);
+    else if (type == 0x80 || type == 0x90)
+        notes.clear(ch, number);
+}
+
+size_t RTPMIDIRecovery::recover(const uint8_t *journal, size_t journalLength, uint8_t *out, size_t maxLength) {
+    if (journalLength < 3)
+        return 0;
+
+    size_t written = 0;
+    const uint8_t *end = journal + journalLength;
+    const uint8_t *p = journal + 3;
+
+    // we don't use the system journal, skip it
+    if (journal[0] & JOURNAL_Y) {
+        if (end - p < 2)
+            return 0;
+        p += ((p[0] & 0x03) << 8) | p[1];
+    }
+    if (! (journal[0] & JOURNAL_A))
+        return 0;
+
+    size_t channelCount = (journal[0] & 0x0F) + 1;
+    for (size_t c = 0; c < channelCount && end - p >= 3; c++) {
+        uint8_t ch = (p[0] >> 3) & 0x0F;
+        size_t length = ((p[0] & 0x03) << 8) | p[1];
+        uint8_t chapters = p[2];
+        const uint8_t *chapter = p + 3;
+        const uint8_t *channelEnd = p + length;
+        if (length < 3 || channelEnd > end)
+            break;
+        p = channelEnd;
+
+        if (chapters & CHAPTER_P)
+            chapter += 3;
+
+        if (chapters & CHAPTER_C) {
+            if (chapter >= channelEnd)
+                continue;
+            size_t logs = (chapter[0] & 0x7F) + 1;
+            chapter++;
+            for (size_t i = 0; i < logs && channelEnd - chapter >= 2; i++, chapter += 2) {
+                if (chapter[1] & 0x80)
+                    continue; // toggle/count tool, we only send values
+                uint8_t number = chapter[0] & 0x7F;
+                uint8_t value = chapter[1] & 0x7F;
+                if (controlValue[ch][number] == value || maxLength - written < 3)
+                    continue;
+                out[written++] = 0xB0 | ch;
+                out[written++] = number;
+                out[written++] = value;
+                controlValue[ch][number] = value;
+            }
+        }
+
+        if (chapters & CHAPTER_M) {
+            if (channelEnd - chapter < 2)
+                continue;
+            chapter += ((chapter[0] & 0x03) << 8) | chapter[1];
+        }
+        if (chapters & CHAPTER_W)
+            chapter += 2;
+
+        if (chapters & CHAPTER_N) {
+            if (channelEnd - chapter < 2)
+                continue;
+            size_t logs = chapter[0] & 0x7F;
+            uint8_t low = chapter[1] >> 4, high = chapter[1] & 0x0F;
+            if (logs == 127 && low == 15 && high == 0)
+                logs = 128;
+            chapter += 2;
+
+            for (size_t i = 0; i < logs && channelEnd - chapter >= 2; i++, chapter += 2) {
+                uint8_t note = chapter[0] & 0x7F;
+                uint8_t velocity = chapter[1] & 0x7F;
+                if (! (chapter[1] & 0x80) || ! velocity || notes.test(ch, note) || maxLength - written < 3)
+                    continue;
+                out[written++] = 0x90 | ch;
+                out[written++] = note;
+                out[written++] = velocity;
+                notes.set(ch, note);
+            }
+
+            for (uint8_t octet = low; octet <= high && chapter < channelEnd; octet++, chapter++) {
+                for (uint8_t bit = 0; bit < 8; bit++) {
+                    uint8_t note = octet * 8 + bit;
+                    if (! (*chapter & (0x80 >> bit)) || ! notes.test(ch, note) || maxLength - written < 3)
+                        continue;
+                    out[written++] = 0x80 | ch;
+                    out[written++] = note;
+                    out[written++] = RECOVERY_OFF_VELOCITY;
+                    notes.clear(ch, note);
+                }
+            }
+        }
+    }
+
+    return written;
+}
+
+} // namespace leapmidi
@@ -0,0 +1,92 @@
+//
+//  RTPMIDIJournal.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// RTP-MIDI recovery journal (RFC 6295), the part that makes a lost UDP
+// packet harmless.
+// The sender keeps the state of every controller and note it has touched
+// since the checkpoint, which is the newest packet the receiver has
+// confirmed with receiver feedback, and appends it to every packet:
+// chapter C holds the last value of each such controller, chapter N the
+// notes still on (with their velocity) and the notes turned off.
+// A receiver that notices a gap in the sequence numbers compares the
+// journal of the next packet with its own state and plays whatever
+// commands bring the two back in line.
+// Only channel voice messages are journaled; there is no system journal.
+
+#ifndef __LeapMIDIX__RTPMIDIJournal__
+#define __LeapMIDIX__RTPMIDIJournal__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ActiveNotes.h"
+
+namespace leapmidi {
+
+// sender side
+class RTPMIDIJournal {
+public:
+    RTPMIDIJournal();
+
+    // start over, the next packet sent has sequence number firstSeq
+    void reset(uint16_t firstSeq);
+
+    // a channel message (with its status byte) went out in packet seq
+    void record(uint16_t seq, const uint8_t *message, size_t length);
+
+    // the receiver has everything up to and including packet seq,
+    // which becomes the checkpoint
+    void acknowledge(uint16_t seq);
+
+    // write the journal for the next packet, returns its length
+    // or 0 if there's nothing to journal or it doesn't fit in maxLength
+    size_t encode(uint8_t *out, size_t maxLength) const;
+
+    bool empty() const { return controls.empty() && notes.empty() && offNotes.empty(); }
+    uint16_t checkpoint() const { return checkpointSeq; }
+
+protected:
+    // true if seq is newer than the checkpoint (sequence numbers wrap)
+    bool afterCheckpoint(uint16_t seq) const { return (int16_t)(seq - checkpointSeq) > 0; }
+
+    uint16_t checkpointSeq;
+
+    // controllers/notes changed since the checkpoint, with the packet
+    // that last changed them
+    ActiveNotes controls;
+    uint8_t controlValue[16][128];
+    uint16_t controlSeq[16][128];
+
+    ActiveNotes notes;     // on
+    ActiveNotes offNotes;  // turned off
+    uint8_t noteVelocity[16][128];
+    uint16_t noteSeq[16][128];
+};
+
+// receiver side: tracks the state the received stream has produced and
+// repairs it from a journal after a loss
+class RTPMIDIRecovery {
+public:
+    RTPMIDIRecovery();
+
+    void reset();
+
+    // a channel message was received (and played)
+    void track(const uint8_t *message, size_t length);
+
+    // packets were lost; write the commands that undo the damage
+    // according to the journal into out, returns their total length
+    // the commands are tracked as well
+    size_t recover(const uint8_t *journal, size_t journalLength, uint8_t *out, size_t maxLength);
+
+protected:
+    ActiveNotes notes;
+    int16_t controlValue[16][128]; // -1 if never seen
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__RTPMIDIJournal__) */
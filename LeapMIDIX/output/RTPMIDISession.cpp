@@ -0,0 +1,911 @@
+//
+//  RTPMIDISession.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "RTPMIDISession.h"
+#include "MIDIEncoder.h"
+#include "Log.h"
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 0x80
+#define RTP_PAYLOAD_TYPE 0x61
+
+// command section header flags
+#define COMMAND_B 0x80 // 12 bit length
+#define COMMAND_J 0x40 // journal follows
+#define COMMAND_Z 0x20 // first command has a delta time
+#define COMMAND_P 0x10 // first command's status byte was left out
+
+// session protocol
+#define PROTOCOL_VERSION 2
+#define EXCHANGE_HEADER_SIZE 16 // up to and including the sender's SSRC
+#define CLOCK_SYNC_SIZE 36
+#define FEEDBACK_SIZE 12
+
+#define INVITATION_ATTEMPTS 12
+#define INVITATION_INTERVAL_NS 1000000000ULL
+// clock sync a few times in quick succession, then every 10 seconds
+#define CLOCK_SYNC_FAST_COUNT 6
+#define CLOCK_SYNC_FAST_NS 1500000000ULL
+#define CLOCK_SYNC_NS 10000000000ULL
+#define FEEDBACK_INTERVAL_NS 1000000000ULL
+// how often the network thread wakes up to run its timers
+#define NETWORK_POLL_MS 50
+
+// room for the commands of one MIDIPacket: a delta time byte for each
+// message beyond the first and a status byte for each running status one
+#define MAX_PACKET_COMMANDS (2 * 256)
+
+namespace leapmidi {
+
+static void put16(uint8_t *out, uint16_t v) {
+    out[0] = v >> 8;
+    out[1] = v;
+}
+
+static void put32(uint8_t *out, uint32_t v) {
+    put16(out, v >> 16);
+    put16(out + 2, v);
+}
+
+static void put64(uint8_t *out, uint64_t v) {
+    put32(out, v >> 32);
+    put32(out + 4, v);
+}
+
+static uint16_t get16(const uint8_t *in) {
+    return (in[0] << 8) | in[1];
+}
+
+static uint32_t get32(const uint8_t *in) {
+    return ((uint32_t)get16(in) << 16) | get16(in + 2);
+}
+
+static uint64_t get64(const uint8_t *in) {
+    return ((uint64_t)get32(in) << 32) | get32(in + 4);
+}
+
+static uint32_t randomId(uint64_t seed) {
+    // splitmix64, good enough for SSRCs and tokens
+    seed += 0x9E3779B97F4A7C15ULL;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(seed ^ (seed >> 31));
+}
+
+// length of the MIDI message starting with status, 0 for sysex
+static size_t messageLength(uint8_t status) {
+    if (status < 0xF0)
+        return (status & 0xE0) == 0xC0 ? 2 : 3;
+    switch (status) {
+        case 0xF0: return 0;
+        case 0xF1: case 0xF3: return 2;
+        case 0xF2: return 3;
+        default: return 1;
+    }
+}
+
+static size_t writeVarLen(uint8_t *out, uint32_t value) {
+    uint8_t buf[4];
+    size_t len = 0;
+    buf[3 - len++] = value & 0x7F;
+    while ((value >>= 7) && len < 4)
+        buf[3 - len++] = 0x80 | (value & 0x7F);
+    memcpy(out, buf + 4 - len, len);
+    return len;
+}
+
+static bool sameHost(const sockaddr_in &a, const sockaddr_in &b) {
+    return a.sin_addr.s_addr == b.sin_addr.s_addr;
+}
+
+RTPMIDISession::RTPMIDISession(const std::string &name, uint16_t localPort, Clock *clock_)
+    : receivedList(1024, 8192) {
+    sessionName = name;
+    controlPort = localPort;
+    clock = clock_ ? clock_ : HostClock::shared();
+    startTime = 0;
+    ssrc = 0;
+
+    initiator = false;
+    initiatorPort = 0;
+    receiver = NULL;
+
+    controlSocket = -1;
+    dataSocket = -1;
+    running = false;
+    networkStarted = false;
+
+    state = IDLE;
+    generation = 0;
+    memset(&peerControl, 0, sizeof(peerControl));
+    memset(&peerData, 0, sizeof(peerData));
+    peerSSRC = 0;
+    token = 0;
+    invitationsLeft = 0;
+    nextInvitation = 0;
+    nextClockSync = 0;
+    clockSyncsSent = 0;
+    peerClockOffset = 0;
+    clockSyncCount = 0;
+
+    haveReceiveSeq = false;
+    receivingSysEx = false;
+    receiveSeq = 0;
+    lastReceivedSeq = 0;
+    feedbackPending = false;
+    nextFeedback = 0;
+    lostCount = 0;
+    recoveredCount = 0;
+
+    feedback = 0;
+    sendGeneration = 0;
+    memset(&sendAddress, 0, sizeof(sendAddress));
+    sendSeq = 0;
+    sendingSysEx = false;
+    resumeOffset = 0;
+    resumeStatus = 0;
+    sentCount = 0;
+}
+
+RTPMIDISession::~RTPMIDISession() {
+    close();
+}
+
+void RTPMIDISession::setInitiator(const std::string &host, uint16_t port) {
+    initiator = true;
+    initiatorHost = host;
+    initiatorPort = port;
+}
+
+void RTPMIDISession::setReceiver(OutputBackend *receiver_) {
+    receiver = receiver_;
+}
+
+// bind control to port and data to port + 1, port 0 for any free one
+static bool bindPorts(int controlSocket, int dataSocket, uint16_t &port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(controlSocket, (sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+    
+    socklen_t len = sizeof(addr);
+    getsockname(controlSocket, (sockaddr *)&addr, &len);
+    uint16_t bound = ntohs(addr.sin_port);
+    addr.sin_port = htons(bound + 1);
+    if (bind(dataSocket, (sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+    
+    port = bound;
+    return true;
+}
+
+bool RTPMIDISession::open() {
+    startTime = clock->now();
+    ssrc = randomId(startTime ^ (uintptr_t)this ^ ((uint64_t)getpid() << 32));
+
+    // with port 0 the data port (control + 1) may be taken, try a few pairs
+    for (int attempt = 0; attempt < 8; attempt++) {
+        controlSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        dataSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (controlSocket < 0 || dataSocket < 0) {
+            LMX_LOG(LOG_ERROR, "Failed to create RTP-MIDI sockets: %s", strerror(errno));
+            close();
+            return false;
+        }
+
+        uint16_t port = controlPort;
+        if (bindPorts(controlSocket, dataSocket, port)) {
+            controlPort = port;
+            break;
+        }
+
+        int err = errno;
+        ::close(controlSocket);
+        ::close(dataSocket);
+        controlSocket = dataSocket = -1;
+        if (controlPort) {
+            LMX_LOG(LOG_ERROR, "Failed to bind RTP-MIDI ports %d/%d: %s", controlPort, controlPort + 1, strerror(err));
+            return false;
+        }
+    }
+    if (controlSocket < 0) {
+        LMX_LOG(LOG_ERROR, "Failed to find a free pair of RTP-MIDI ports");
+        return false;
+    }
+
+    if (initiator) {
+        addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        int err = getaddrinfo(initiatorHost.c_str(), NULL, &hints, &res);
+        if (err || ! res) {
+            LMX_LOG(LOG_ERROR, "Failed to resolve RTP-MIDI peer %s: %s", initiatorHost.c_str(), gai_strerror(err));
+            close();
+            return false;
+        }
+        memcpy(&peerControl, res->ai_addr, sizeof(peerControl));
+        freeaddrinfo(res);
+        peerControl.sin_port = htons(initiatorPort);
+        peerData = peerControl;
+        peerData.sin_port = htons(initiatorPort + 1);
+
+        token = randomId(startTime ^ ssrc);
+        invitationsLeft = INVITATION_ATTEMPTS;
+        nextInvitation = 0; // right away
+        state = INVITING_CONTROL;
+    }
+
+    running = true;
+    if (pthread_create(&networkThread, NULL, _networkThreadEntry, this)) {
+        LMX_LOG(LOG_ERROR, "Failed to start RTP-MIDI network thread");
+        running = false;
+        close();
+        return false;
+    }
+    networkStarted = true;
+
+    if (initiator)
+        LMX_LOG(LOG_INFO, "RTP-MIDI session %s on port %d inviting %s:%d", sessionName.c_str(), controlPort, initiatorHost.c_str(), initiatorPort);
+    else
+        LMX_LOG(LOG_INFO, "RTP-MIDI session %s listening on port %d", sessionName.c_str(), controlPort);
+    return true;
+}
+
+void RTPMIDISession::close() {
+    if (networkStarted) {
+        running = false;
+        pthread_join(networkThread, NULL);
+        networkStarted = false;
+    }
+
+    // the network thread is gone, the session state is ours now
+    if (state.load() == CONNECTED)
+        sendExchange(controlSocket, peerControl, "BY", 0);
+    state = IDLE;
+
+    if (controlSocket >= 0)
+        ::close(controlSocket);
+    if (dataSocket >= 0)
+        ::close(dataSocket);
+    controlSocket = dataSocket = -1;
+}
+
+/*******/
+// sending thread
+
+OSStatus RTPMIDISession::send(const MIDIPacketList *packets) {
+    if (state.load(std::memory_order_acquire) != CONNECTED)
+        return 0; // nobody to send to yet
+
+    // new connection, start a new journal
+    unsigned int gen = generation.load(std::memory_order_acquire);
+    if (gen != sendGeneration) {
+        sendGeneration = gen;
+        sendAddress = peerData;
+        journal.reset(sendSeq);
+    }
+
+    uint32_t ack = feedback.exchange(0);
+    if (ack)
+        journal.acknowledge(ack & 0xFFFF);
+
+    uint64_t now = clock->now();
+    size_t next = 0;
+    resumeOffset = 0;
+    resumeStatus = 0;
+    while (next < packets->numPackets) {
+        // one RTP packet per call unless the commands don't fit
+        if (! encodeCommands(packets, next, now))
+            break;
+    }
+
+    return 0;
+}
+
+// encode MIDIPackets from index next on into one RTP packet and send it
+// a MIDIPacket whose commands don't fit is cut off (a SysEx segment ends
+// in F0 and carries on as F7 ... in the next RTP packet) and the rest of
+// it is left for the next call, see resumeOffset
+// returns false if it couldn't take anything
+bool RTPMIDISession::encodeCommands(const MIDIPacketList *packets, size_t &next, uint64_t now) {
+    // the journal goes out with the packet but describes what came before it
+    size_t journalLength = journal.encode(journalBuffer, LMX_RTPMIDI_MAX_PACKET / 2);
+    if (! journalLength && ! journal.empty())
+        LMX_LOG(LOG_WARN, "RTP-MIDI recovery journal too large, sending packet without it");
+
+    // commands go after the largest command section header, see sendRTP()
+    uint8_t *commands = packet + RTP_HEADER_SIZE + 2;
+    size_t room = LMX_RTPMIDI_MAX_PACKET - RTP_HEADER_SIZE - 2 - journalLength;
+    if (room > 0x0FFF)
+        room = 0x0FFF; // 12 bit length
+    size_t length = 0;
+
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (size_t i = 0; i < next; i++)
+        pkt = MIDIPacketNext(pkt);
+
+    size_t first = next, firstOffset = resumeOffset;
+    uint32_t rtpTime = 0, lastTime = 0;
+    uint8_t encoded[MAX_PACKET_COMMANDS];
+    size_t messageOffsets[256];
+
+    for (; next < packets->numPackets; next++, pkt = MIDIPacketNext(pkt)) {
+        uint64_t nanos = pkt->timeStamp ? clock->fromHostTicks(pkt->timeStamp) : now;
+        uint32_t time = (uint32_t)sessionTime(nanos > startTime ? nanos : startTime);
+        if (next == first)
+            rtpTime = lastTime = time;
+        uint32_t delta = (int32_t)(time - lastTime) > 0 ? time - lastTime : 0;
+
+        // split the packet into commands, each with its own status byte
+        // and all but the first in the RTP packet with a delta time,
+        // from where the last RTP packet cut it off
+        size_t len = 0, messages = 0;
+        size_t pos = next == first ? resumeOffset : 0;
+        uint8_t runningStatus = next == first ? resumeStatus : 0;
+        bool sysEx = sendingSysEx;
+        bool cut = false;
+        while (pos < pkt->length) {
+            uint8_t status = pkt->data[pos];
+            
+            // sysex, split into segments where it spans MIDIPackets:
+            // F0 ... F0 first, F7 ... F0 in the middle, F7 ... F7 last
+            if (status == 0xF0 || (sysEx && status < 0x80)) {
+                const uint8_t *start = pkt->data + pos + (status == 0xF0 ? 1 : 0);
+                const uint8_t *end = pkt->data + pkt->length;
+                const uint8_t *endPtr = (const uint8_t *)memchr(start, 0xF7, end - start);
+                size_t dataLength = (endPtr ? endPtr : end) - start;
+                if (len + 4 + dataLength + 2 > sizeof(encoded)) {
+                    // as much as fits, the rest continues the segment
+                    cut = true;
+                    if (len + 4 + 1 + 2 > sizeof(encoded))
+                        break;
+                    dataLength = sizeof(encoded) - len - 4 - 2;
+                    endPtr = NULL;
+                }
+                if (next != first || messages)
+                    len += writeVarLen(encoded + len, messages ? 0 : delta);
+                messageOffsets[messages++] = len;
+                encoded[len++] = status == 0xF0 ? 0xF0 : 0xF7;
+                memcpy(encoded + len, start, dataLength);
+                len += dataLength;
+                encoded[len++] = endPtr ? 0xF7 : 0xF0;
+                sysEx = ! endPtr;
+                runningStatus = 0;
+                pos = (start - pkt->data) + dataLength + (endPtr ? 1 : 0);
+                if (cut)
+                    break;
+                continue;
+            }
+            
+            size_t msgLength;
+            bool implicitStatus = false;
+            if (status & 0x80) {
+                msgLength = messageLength(status);
+                if (status < 0xF8)
+                    sysEx = false; // anything but realtime ends a sysex
+                if (status < 0xF0)
+                    runningStatus = status;
+                else if (status < 0xF8)
+                    runningStatus = 0;
+            } else if (runningStatus) {
+                implicitStatus = true;
+                status = runningStatus;
+                msgLength = messageLength(status);
+            } else {
+                pos++; // stray data byte
+                continue;
+            }
+
+            size_t dataLength = msgLength - 1;
+            const uint8_t *data = pkt->data + pos + (implicitStatus ? 0 : 1);
+            if (data + dataLength > pkt->data + pkt->length)
+                break; // truncated
+            if (len + 4 + msgLength > sizeof(encoded)) {
+                // this message and the rest go in the next RTP packet
+                cut = true;
+                break;
+            }
+            pos += dataLength + (implicitStatus ? 0 : 1);
+
+            if (next != first || messages)
+                len += writeVarLen(encoded + len, messages ? 0 : delta);
+            messageOffsets[messages++] = len;
+            encoded[len++] = status;
+            memcpy(encoded + len, data, dataLength);
+            len += dataLength;
+        }
+
+        if (length + len > room) {
+            if (next == first) {
+                LMX_LOG(LOG_WARN, "RTP-MIDI: %d bytes of MIDI don't fit in a packet, dropping", pkt->length);
+                next++;
+                resumeOffset = 0;
+                return true;
+            }
+            break; // goes in the next RTP packet
+        }
+
+        sendingSysEx = sysEx;
+        memcpy(commands + length, encoded, len);
+        for (size_t m = 0; m < messages; m++) {
+            const uint8_t *msg = commands + length + messageOffsets[m];
+            journal.record(sendSeq, msg, messageLength(msg[0]));
+        }
+        length += len;
+        if ((int32_t)(time - lastTime) > 0)
+            lastTime = time;
+
+        if (cut) {
+            resumeOffset = pos;
+            resumeStatus = runningStatus;
+            break;
+        }
+        resumeOffset = 0;
+    }
+
+    if (length)
+        sendRTP(length, rtpTime, journalLength);
+    return next > first || resumeOffset != firstOffset;
+}
+
+void RTPMIDISession::sendRTP(size_t commandLength, uint32_t rtpTime, size_t journalLength) {
+    packet[0] = RTP_VERSION;
+    packet[1] = RTP_PAYLOAD_TYPE;
+    put16(packet + 2, sendSeq);
+    put32(packet + 4, rtpTime);
+    put32(packet + 8, ssrc);
+
+    // command section header: B J Z P LEN, one byte if LEN fits in 4 bits
+    uint8_t flags = journalLength ? COMMAND_J : 0;
+    size_t pos = RTP_HEADER_SIZE;
+    if (commandLength <= 0x0F) {
+        packet[pos++] = flags | commandLength;
+        memmove(packet + pos, packet + pos + 1, commandLength);
+    } else {
+        packet[pos++] = COMMAND_B | flags | (commandLength >> 8);
+        packet[pos++] = commandLength & 0xFF;
+    }
+    pos += commandLength;
+
+    memcpy(packet + pos, journalBuffer, journalLength);
+    pos += journalLength;
+
+    ssize_t res = sendto(dataSocket, packet, pos, MSG_DONTWAIT, (const sockaddr *)&sendAddress, sizeof(sendAddress));
+    if (res < 0)
+        LMX_LOG(LOG_WARN, "RTP-MIDI send failed: %s", strerror(errno));
+
+    sendSeq++;
+    sentCount++;
+}
+
+/*******/
+// network thread
+
+void RTPMIDISession::networkThreadEntry() {
+    uint8_t buf[2048];
+
+    while (running) {
+        runTimers(clock->now());
+        
+        pollfd fds[2];
+        fds[0].fd = controlSocket;
+        fds[1].fd = dataSocket;
+        fds[0].events = fds[1].events = POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+
+        int n = poll(fds, 2, NETWORK_POLL_MS);
+        if (n < 0 && errno != EINTR) {
+            LMX_LOG(LOG_ERROR, "RTP-MIDI poll failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < 2 && n > 0; i++) {
+            if (! (fds[i].revents & POLLIN))
+                continue;
+
+            sockaddr_in from;
+            socklen_t fromLength = sizeof(from);
+            ssize_t len = recvfrom(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT, (sockaddr *)&from, &fromLength);
+            if (len <= 0)
+                continue;
+
+            if (i == 0)
+                handleControlPacket(buf, len, from);
+            else
+                handleDataPacket(buf, len, from);
+        }
+    }
+}
+
+void RTPMIDISession::runTimers(uint64_t now) {
+    int st = state.load();
+
+    if ((st == INVITING_CONTROL || st == INVITING_DATA) && initiator && now >= nextInvitation) {
+        if (invitationsLeft-- > 0) {
+            sendInvitation();
+            nextInvitation = now + INVITATION_INTERVAL_NS;
+        } else {
+            LMX_LOG(LOG_ERROR, "RTP-MIDI peer %s:%d did not answer our invitation", initiatorHost.c_str(), initiatorPort);
+            state = IDLE;
+        }
+    }
+
+    if (st == CONNECTED && initiator && now >= nextClockSync) {
+        sendClockSync(0, sessionTime(now), 0, 0);
+        clockSyncsSent++;
+        nextClockSync = now + (clockSyncsSent < CLOCK_SYNC_FAST_COUNT ? CLOCK_SYNC_FAST_NS : CLOCK_SYNC_NS);
+    }
+
+    if (st == CONNECTED && feedbackPending && now >= nextFeedback) {
+        sendFeedback();
+        feedbackPending = false;
+        nextFeedback = now + FEEDBACK_INTERVAL_NS;
+    }
+}
+
+void RTPMIDISession::sendInvitation() {
+    if (state.load() == INVITING_CONTROL)
+        sendExchange(controlSocket, peerControl, "IN", token);
+    else
+        sendExchange(dataSocket, peerData, "IN", token);
+}
+
+// IN/OK/NO/BY: FFFF, command, protocol version, token, SSRC, name
+void RTPMIDISession::sendExchange(int socket, const sockaddr_in &to, const char *command, uint32_t exchangeToken) {
+    uint8_t buf[EXCHANGE_HEADER_SIZE + 64];
+    buf[0] = buf[1] = 0xFF;
+    buf[2] = command[0];
+    buf[3] = command[1];
+    put32(buf + 4, PROTOCOL_VERSION);
+    put32(buf + 8, exchangeToken);
+    put32(buf + 12, ssrc);
+    size_t len = EXCHANGE_HEADER_SIZE;
+
+    if (strcmp(command, "BY")) {
+        size_t nameLength = sessionName.size() < sizeof(buf) - len - 1 ? sessionName.size() : sizeof(buf) - len - 1;
+        memcpy(buf + len, sessionName.data(), nameLength);
+        len += nameLength;
+        buf[len++] = '\0';
+    }
+
+    sendto(socket, buf, len, MSG_DONTWAIT, (const sockaddr *)&to, sizeof(to));
+}
+
+// CK: FFFF, "CK", SSRC, count, padding, three 64 bit timestamps
+void RTPMIDISession::sendClockSync(uint8_t count, uint64_t ts1, uint64_t ts2, uint64_t ts3) {
+    uint8_t buf[CLOCK_SYNC_SIZE];
+    memset(buf, 0, sizeof(buf));
+    buf[0] = buf[1] = 0xFF;
+    buf[2] = 'C';
+    buf[3] = 'K';
+    put32(buf + 4, ssrc);
+    buf[8] = count;
+    put64(buf + 12, ts1);
+    put64(buf + 20, ts2);
+    put64(buf + 28, ts3);
+    sendto(dataSocket, buf, sizeof(buf), MSG_DONTWAIT, (const sockaddr *)&peerData, sizeof(peerData));
+}
+
+// RS: FFFF, "RS", SSRC, newest sequence number received (upper 16 bits)
+void RTPMIDISession::sendFeedback() {
+    uint8_t buf[FEEDBACK_SIZE];
+    buf[0] = buf[1] = 0xFF;
+    buf[2] = 'R';
+    buf[3] = 'S';
+    put32(buf + 4, ssrc);
+    put32(buf + 8, (uint32_t)lastReceivedSeq << 16);
+    sendto(controlSocket, buf, sizeof(buf), MSG_DONTWAIT, (const sockaddr *)&peerControl, sizeof(peerControl));
+}
+
+void RTPMIDISession::connect(const sockaddr_in &control, const sockaddr_in &data, uint32_t peer) {
+    peerControl = control;
+    peerData = data;
+    peerSSRC = peer;
+
+    feedback = 0;
+    haveReceiveSeq = false;
+    receivingSysEx = false;
+    feedbackPending = false;
+    recovery.reset();
+    clockSyncsSent = 0;
+    nextClockSync = 0; // right away
+
+    generation++;
+    state.store(CONNECTED, std::memory_order_release);
+
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &control.sin_addr, host, sizeof(host));
+    LMX_LOG(LOG_INFO, "RTP-MIDI session connected to %s:%d", host, ntohs(control.sin_port));
+}
+
+void RTPMIDISession::disconnect() {
+    state = IDLE;
+    LMX_LOG(LOG_INFO, "RTP-MIDI session ended by peer");
+}
+
+void RTPMIDISession::handleControlPacket(const uint8_t *data, size_t length, const sockaddr_in &from) {
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xFF)
+        return;
+
+    int st = state.load();
+    const char *command = (const char *)data + 2;
+
+    if (! memcmp(command, "RS", 2)) {
+        if (length < FEEDBACK_SIZE || st != CONNECTED || get32(data + 4) != peerSSRC)
+            return;
+        feedback = 0x10000 | (get32(data + 8) >> 16);
+        return;
+    }
+
+    if (length < EXCHANGE_HEADER_SIZE)
+        return;
+    uint32_t exchangeToken = get32(data + 8);
+    uint32_t peer = get32(data + 12);
+
+    if (! memcmp(command, "IN", 2)) {
+        if (initiator) {
+            sendExchange(controlSocket, from, "NO", exchangeToken);
+        } else if (st == IDLE) {
+            peerControl = from;
+            peerSSRC = peer;
+            token = exchangeToken;
+            state = INVITING_DATA;
+            sendExchange(controlSocket, from, "OK", exchangeToken);
+        } else if (peer == peerSSRC) {
+            // our OK got lost
+            sendExchange(controlSocket, from, "OK", exchangeToken);
+        } else {
+            sendExchange(controlSocket, from, "NO", exchangeToken);
+        }
+    } else if (! memcmp(command, "OK", 2)) {
+        if (st != INVITING_CONTROL || exchangeToken != token)
+            return;
+        peerSSRC = peer;
+        state = INVITING_DATA;
+        invitationsLeft = INVITATION_ATTEMPTS;
+        nextInvitation = clock->now() + INVITATION_INTERVAL_NS;
+        sendInvitation();
+    } else if (! memcmp(command, "NO", 2)) {
+        if ((st == INVITING_CONTROL || st == INVITING_DATA) && exchangeToken == token) {
+            LMX_LOG(LOG_ERROR, "RTP-MIDI peer rejected our invitation");
+            state = IDLE;
+        }
+    } else if (! memcmp(command, "BY", 2)) {
+        if (st != IDLE && peer == peerSSRC)
+            disconnect();
+    }
+}
+
+void RTPMIDISession::handleDataPacket(const uint8_t *data, size_t length, const sockaddr_in &from) {
+    if (length < 4)
+        return;
+
+    if (data[0] != 0xFF || data[1] != 0xFF) {
+        if ((data[0] & 0xC0) == RTP_VERSION && state.load() == CONNECTED)
+            handleRTP(data, length);
+        return;
+    }
+
+    int st = state.load();
+    const char *command = (const char *)data + 2;
+
+    if (! memcmp(command, "CK", 2)) {
+        handleClockSync(data, length, from);
+        return;
+    }
+
+    if (length < EXCHANGE_HEADER_SIZE)
+        return;
+    uint32_t exchangeToken = get32(data + 8);
+    uint32_t peer = get32(data + 12);
+
+    if (! memcmp(command, "IN", 2)) {
+        if (! initiator && peer == peerSSRC && sameHost(from, peerControl) && (st == INVITING_DATA || st == CONNECTED)) {
+            sendExchange(dataSocket, from, "OK", exchangeToken);
+            if (st == INVITING_DATA)
+                connect(peerControl, from, peer);
+        } else {
+            sendExchange(dataSocket, from, "NO", exchangeToken);
+        }
+    } else if (! memcmp(command, "OK", 2)) {
+        if (st == INVITING_DATA && initiator && exchangeToken == token && peer == peerSSRC)
+            connect(peerControl, from, peer);
+    } else if (! memcmp(command, "NO", 2)) {
+        if (st == INVITING_DATA && exchangeToken == token) {
+            LMX_LOG(LOG_ERROR, "RTP-MIDI peer rejected our invitation");
+            state = IDLE;
+        }
+    } else if (! memcmp(command, "BY", 2)) {
+        if (st != IDLE && peer == peerSSRC)
+            disconnect();
+    }
+}
+
+// three way exchange started by the initiator:
+// CK0 carries its time ts1, CK1 adds the responder's time ts2,
+// CK2 adds the initiator's time ts3 on receiving CK1
+void RTPMIDISession::handleClockSync(const uint8_t *data, size_t length, const sockaddr_in & /* from */) {
+    if (length < CLOCK_SYNC_SIZE || state.load() != CONNECTED || get32(data + 4) != peerSSRC)
+        return;
+
+    uint8_t count = data[8];
+    uint64_t ts1 = get64(data + 12);
+    uint64_t ts2 = get64(data + 20);
+    uint64_t ts3 = get64(data + 28);
+    uint64_t now = sessionTime(clock->now());
+
+    if (count == 0 && ! initiator) {
+        sendClockSync(1, ts1, now, 0);
+    } else if (count == 1 && initiator) {
+        sendClockSync(2, ts1, ts2, now);
+        // the responder read its clock halfway through the round trip
+        peerClockOffset = (int64_t)ts2 - (int64_t)((ts1 + now) / 2);
+        clockSyncCount++;
+    } else if (count == 2 && ! initiator) {
+        peerClockOffset = (int64_t)((ts1 + ts3) / 2) - (int64_t)ts2;
+        clockSyncCount++;
+    }
+}
+
+void RTPMIDISession::handleRTP(const uint8_t *data, size_t length) {
+    if (length < RTP_HEADER_SIZE + 1 || (data[1] & 0x7F) != RTP_PAYLOAD_TYPE || get32(data + 8) != peerSSRC)
+        return;
+
+    uint16_t seq = get16(data + 2);
+    size_t pos = RTP_HEADER_SIZE + 4 * (data[0] & 0x0F); // CSRCs
+    if (data[0] & 0x10) {
+        // header extension
+        if (pos + 4 > length)
+            return;
+        pos += 4 + 4 * get16(data + pos + 2);
+    }
+    if (pos >= length)
+        return;
+
+    uint8_t flags = data[pos];
+    size_t commandLength = flags & 0x0F;
+    if (flags & COMMAND_B) {
+        if (pos + 2 > length)
+            return;
+        commandLength = (commandLength << 8) | data[pos + 1];
+        pos += 2;
+    } else {
+        pos += 1;
+    }
+    if (pos + commandLength > length)
+        return;
+    const uint8_t *commands = data + pos;
+    const uint8_t *journalData = commands + commandLength;
+    size_t journalLength = length - pos - commandLength;
+
+    if (haveReceiveSeq && seq != receiveSeq) {
+        int16_t gap = (int16_t)(seq - receiveSeq);
+        if (gap < 0)
+            return; // late or duplicate, its content is in a later journal
+
+        lostCount += gap;
+        if (flags & COMMAND_J) {
+            uint8_t repair[LMX_RTPMIDI_MAX_PACKET * 2];
+            size_t repairLength = recovery.recover(journalData, journalLength, repair, sizeof(repair));
+            // the recovery commands are all three bytes long
+            for (size_t i = 0; i + 3 <= repairLength; i += 3)
+                deliver(repair + i, 3);
+            recoveredCount += repairLength / 3;
+        }
+    }
+    haveReceiveSeq = true;
+    receiveSeq = seq + 1;
+    lastReceivedSeq = seq;
+    feedbackPending = true;
+
+    // commands, each but the first (unless Z) preceded by a delta time
+    // the timing within the packet is flattened, commands are played on arrival
+    const uint8_t *p = commands, *end = commands + commandLength;
+    uint8_t runningStatus = 0;
+    bool first = ! (flags & COMMAND_Z);
+    while (p < end) {
+        if (! first) {
+            // skip the delta time
+            int i = 0;
+            while (p < end && (*p & 0x80) && i++ < 3)
+                p++;
+            p++;
+            if (p >= end)
+                break;
+        }
+        first = false;
+
+        uint8_t message[3];
+        uint8_t status = *p;
+        if (status & 0x80) {
+            p++;
+        } else if (runningStatus) {
+            status = runningStatus;
+        } else {
+            break; // phantom status from the previous packet, can't decode
+        }
+
+        size_t msgLength = messageLength(status);
+        if (! msgLength || (status == 0xF7 && receivingSysEx)) {
+            // sysex up to F7, or a segment of one: F0..F0 starts it,
+            // F7..F0 continues it and F7..F7 ends it; the segments are
+            // passed on as the plain sysex bytes
+            bool continued = status == 0xF7;
+            const uint8_t *sysexEnd = p;
+            while (sysexEnd < end && *sysexEnd != 0xF7 && *sysexEnd != 0xF0)
+                sysexEnd++;
+            bool segmented = sysexEnd < end && *sysexEnd == 0xF0;
+            if (sysexEnd < end)
+                sysexEnd++;
+            // a segment can be longer than a MIDIPacket, it's passed on
+            // a MIDIPacket's worth at a time
+            uint8_t sysex[LMX_ENCODER_MAX_PACKET];
+            size_t length = 0;
+            if (! continued)
+                sysex[length++] = 0xF0;
+            const uint8_t *data = p;
+            size_t dataLength = sysexEnd - p - (segmented ? 1 : 0);
+            do {
+                size_t n = dataLength < sizeof(sysex) - length ? dataLength : sizeof(sysex) - length;
+                memcpy(sysex + length, data, n);
+                length += n;
+                if (length)
+                    deliver(sysex, length);
+                data += n;
+                dataLength -= n;
+                length = 0;
+            } while (dataLength);
+            receivingSysEx = segmented;
+            p = sysexEnd;
+            continue;
+        }
+        if (status < 0xF8)
+            receivingSysEx = false;
+
+        if (status < 0xF0)
+            runningStatus = status;
+        else if (status < 0xF8)
+            runningStatus = 0;
+
+        if (p + msgLength - 1 > end)
+            break;
+        message[0] = status;
+        memcpy(message + 1, p, msgLength - 1);
+        p += msgLength - 1;
+        deliver(message, msgLength);
+    }
+
+    if (receiver && ! receivedList.empty()) {
+        receiver->send(receivedList.get());
+        receivedList.reset();
+    }
+}
+
+void RTPMIDISession::deliver(const uint8_t *message, size_t length) {
+    recovery.track(message, length);
+    if (! receiver)
+        return;
+
+    if (! receivedList.add(0, length, message)) {
+        receiver->send(receivedList.get());
+        receivedList.reset();
+        receivedList.add(0, length, message);
+    }
+}
+
+} // namespace leapmidi
@@ -0,0 +1,187 @@
+//
+//  RTPMIDISession.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// RTP-MIDI network session (RFC 6295, with Apple's session protocol), so
+// MIDI can go straight to another machine on the network without a
+// virtual source and a bridge in between.
+// A session uses two UDP ports, control and control + 1 for data. As
+// initiator it invites a remote responder (e.g. a Mac's Network MIDI
+// session); as responder it accepts the first invitation it gets.
+// After the invitation the initiator starts a clock synchronization
+// exchange, repeated every few seconds, that estimates the offset between
+// the two clocks.
+// Every send() from the Device becomes one RTP packet (or more if it
+// doesn't fit), with a delta time between commands and the recovery
+// journal appended, so a receiver can recover from lost packets. The
+// receiver's feedback moves the journal's checkpoint forward. SysEx that
+// spans MIDIPackets, or RTP packets when a MIDIPacket is too big for one,
+// goes out in segments, and is reassembled on the way in.
+// MIDI coming the other way, with any losses repaired from its journal,
+// can be passed on to another output with setReceiver().
+// send() never blocks; a network thread handles the session traffic.
+
+#ifndef __LeapMIDIX__RTPMIDISession__
+#define __LeapMIDIX__RTPMIDISession__
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "OutputBackend.h"
+#include "RTPMIDIJournal.h"
+#include "PacketList.h"
+#include "HostClock.h"
+
+// the port Apple's Network MIDI sessions use by default
+#define LMX_RTPMIDI_DEFAULT_PORT 5004
+
+// largest datagram we send, safely under a typical MTU
+#define LMX_RTPMIDI_MAX_PACKET 1400
+
+namespace leapmidi {
+
+class RTPMIDISession : public OutputBackend {
+public:
+    enum State {
+        IDLE,             // not connected, waiting for an invitation if responder
+        INVITING_CONTROL, // initiator, waiting for OK on the control port
+        INVITING_DATA,    // waiting for the invitation on the data port to complete
+        CONNECTED
+    };
+
+    // localPort 0 picks any free pair of ports
+    // clock is the one the packet timestamps come from, defaults to the
+    // shared host clock
+    RTPMIDISession(const std::string &name, uint16_t localPort = LMX_RTPMIDI_DEFAULT_PORT, Clock *clock = NULL);
+    virtual ~RTPMIDISession();
+
+    // invite host:port (its control port) when opened instead of waiting
+    // for an invitation; must be called before open()
+    void setInitiator(const std::string &host, uint16_t port = LMX_RTPMIDI_DEFAULT_PORT);
+
+    // MIDI received from the peer goes to this output, from the network
+    // thread; must be called before open()
+    void setReceiver(OutputBackend *receiver);
+
+    // bind the ports and start the network thread (and invite, if initiator)
+    virtual bool open();
+    // say goodbye to the peer and stop
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    // the receiver plays packets at their RTP timestamps
+    virtual bool schedulesPackets() const { return true; }
+    virtual const char *name() const { return "RTP-MIDI"; }
+
+    State getState() const { return (State)state.load(); }
+    bool connected() const { return state.load() == CONNECTED; }
+    // the control port actually bound
+    uint16_t getControlPort() const { return controlPort; }
+
+    // peer clock minus ours, in 100 microsecond units, from the latest
+    // clock synchronization
+    int64_t clockOffset() const { return peerClockOffset.load(); }
+    bool clockSynced() const { return clockSyncCount.load() > 0; }
+
+    unsigned long packetsSent() const { return sentCount.load(); }
+    // packets missing from the peer's stream, and commands played to
+    // make up for them
+    unsigned long packetsLost() const { return lostCount.load(); }
+    unsigned long commandsRecovered() const { return recoveredCount.load(); }
+
+protected:
+    // network thread
+    void networkThreadEntry();
+    void handleControlPacket(const uint8_t *data, size_t length, const sockaddr_in &from);
+    void handleDataPacket(const uint8_t *data, size_t length, const sockaddr_in &from);
+    void handleRTP(const uint8_t *data, size_t length);
+    void handleClockSync(const uint8_t *data, size_t length, const sockaddr_in &from);
+    void deliver(const uint8_t *message, size_t length);
+    void runTimers(uint64_t now);
+    void sendInvitation();
+    void sendExchange(int socket, const sockaddr_in &to, const char *command, uint32_t token);
+    void sendClockSync(uint8_t count, uint64_t ts1, uint64_t ts2, uint64_t ts3);
+    void sendFeedback();
+    void connect(const sockaddr_in &control, const sockaddr_in &data, uint32_t ssrc);
+    void disconnect();
+
+    // sending thread
+    bool encodeCommands(const MIDIPacketList *packets, size_t &next, uint64_t now);
+    void sendRTP(size_t commandLength, uint32_t rtpTime, size_t journalLength);
+
+    // session time, 100 microsecond units
+    uint64_t sessionTime(uint64_t nanos) const { return (nanos - startTime) / 100000; }
+
+    std::string sessionName;
+    uint16_t controlPort;
+    Clock *clock;
+    uint64_t startTime;
+    uint32_t ssrc;
+
+    bool initiator;
+    std::string initiatorHost;
+    uint16_t initiatorPort;
+    OutputBackend *receiver;
+
+    int controlSocket;
+    int dataSocket;
+    std::atomic<bool> running;
+    pthread_t networkThread;
+    bool networkStarted;
+
+    // session state, written by the network thread
+    std::atomic<int> state;
+    std::atomic<unsigned int> generation; // bumped on every new connection
+    sockaddr_in peerControl;
+    sockaddr_in peerData;
+    uint32_t peerSSRC;
+    uint32_t token;
+    int invitationsLeft;
+    uint64_t nextInvitation;
+    uint64_t nextClockSync;
+    int clockSyncsSent;
+    std::atomic<int64_t> peerClockOffset;
+    std::atomic<unsigned long> clockSyncCount;
+
+    // receiving side (network thread)
+    RTPMIDIRecovery recovery;
+    PacketList receivedList;
+    bool haveReceiveSeq;
+    uint16_t receiveSeq;      // next expected
+    uint16_t lastReceivedSeq;
+    bool receivingSysEx; // the last packet ended inside a sysex segment
+    bool feedbackPending;
+    uint64_t nextFeedback;
+    std::atomic<unsigned long> lostCount;
+    std::atomic<unsigned long> recoveredCount;
+
+    // sending side (sending thread)
+    // feedback from the peer: 0x10000 | seq, 0 if none new
+    std::atomic<uint32_t> feedback;
+    unsigned int sendGeneration;
+    sockaddr_in sendAddress;
+    uint16_t sendSeq;
+    bool sendingSysEx; // the last packet ended inside a SysEx message
+    // where the MIDIPacket being sent was cut off when it didn't all fit
+    // in one RTP packet, and the running status at that point
+    size_t resumeOffset;
+    uint8_t resumeStatus;
+    RTPMIDIJournal journal;
+    uint8_t packet[LMX_RTPMIDI_MAX_PACKET];
+    uint8_t journalBuffer[LMX_RTPMIDI_MAX_PACKET];
+    std::atomic<unsigned long> sentCount;
+
+private:
+    static void *_networkThreadEntry(void *This) { ((RTPMIDISession *)This)->networkThreadEntry(); return NULL; }
+
+    RTPMIDISession(const RTPMIDISession &);
+    RTPMIDISession &operator=(const RTPMIDISession &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__RTPMIDISession__) */
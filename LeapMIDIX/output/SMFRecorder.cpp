@@ -0,0 +1,387 @@
+//
+//  SMFRecorder.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "SMFRecorder.h"
+#include "Log.h"
+
+// 1000 ticks per quarter note at 120 bpm: one tick is 0.5ms
+#define SMF_DIVISION 1000
+#define SMF_TEMPO_USEC 500000
+#define SMF_NS_PER_TICK (SMF_TEMPO_USEC * 1000ULL / SMF_DIVISION)
+
+// where the track chunk's length and data are in the file
+#define SMF_TRACK_LENGTH_OFFSET 18
+#define SMF_TRACK_DATA_OFFSET 22
+
+#define FILE_BUFFER_SIZE (64 * 1024)
+#define SYNC_INTERVAL_NS 1000000000ULL
+
+// how long the writer sleeps when there's nothing to write
+#define WRITER_IDLE_USEC 10000
+
+namespace leapmidi {
+
+static void putBE32(uint8_t *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+SMFRecorder::SMFRecorder(const std::string &path_, Clock *clock_) {
+    path = path_;
+    clock = clock_ ? clock_ : HostClock::shared();
+    dropped = 0;
+    running = false;
+    writerStarted = false;
+    file = NULL;
+    startTime = 0;
+    lastTick = 0;
+    trackLength = 0;
+    dirty = false;
+    status = 0;
+    messageLength = 0;
+    inSysex = false;
+    sysexTick = 0;
+    sysexLength = 0;
+    skippedSysex = 0;
+}
+
+SMFRecorder::~SMFRecorder() {
+    close();
+}
+
+bool SMFRecorder::open() {
+    file = fopen(path.c_str(), "wb");
+    if (! file) {
+        LMX_LOG(LOG_ERROR, "Failed to create MIDI file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, FILE_BUFFER_SIZE);
+
+    // header chunk: format 0, one track, ticks per quarter note
+    uint8_t header[SMF_TRACK_DATA_OFFSET] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        0, 0, 0, 1, SMF_DIVISION >> 8, SMF_DIVISION & 0xFF,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0
+    };
+    fwrite(header, 1, sizeof(header), file);
+
+    startTime = clock->now();
+    lastTick = 0;
+    trackLength = 0;
+
+    // tempo, so the tick length is what we think it is
+    const uint8_t tempo[] = { 0xFF, 0x51, 0x03, (SMF_TEMPO_USEC >> 16) & 0xFF, (SMF_TEMPO_USEC >> 8) & 0xFF, SMF_TEMPO_USEC & 0xFF };
+    writeEvent(0, tempo, sizeof(tempo));
+    syncFile();
+
+    running = true;
+    if (pthread_create(&writerThread, NULL, _writerThreadEntry, this)) {
+        LMX_LOG(LOG_ERROR, "Failed to start MIDI file writer thread");
+        running = false;
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+    writerStarted = true;
+
+    LMX_LOG(LOG_INFO, "Recording MIDI to %s", path.c_str());
+    return true;
+}
+
+void SMFRecorder::close() {
+    if (writerStarted) {
+        running = false;
+        pthread_join(writerThread, NULL);
+        writerStarted = false;
+    }
+    if (! file)
+        return;
+
+    // whatever made it into the ring before the sender stopped
+    while (writeChunks())
+        ;
+
+    const uint8_t endOfTrack[] = { 0xFF, 0x2F, 0x00 };
+    writeEvent(lastTick, endOfTrack, sizeof(endOfTrack));
+    syncFile();
+    fclose(file);
+    file = NULL;
+
+    if (dropped.load())
+        LMX_LOG(LOG_WARN, "MIDI file %s is missing %lu packets", path.c_str(), dropped.load());
+}
+
+// sending thread, never blocks
+OSStatus SMFRecorder::send(const MIDIPacketList *packets) {
+    MIDITimeStamp now = clock->toHostTicks(clock->now());
+    Chunk chunks[(sizeof(((MIDIPacket *)0)->data) + LMX_SMF_CHUNK_DATA - 1) / LMX_SMF_CHUNK_DATA];
+
+    const MIDIPacket *pkt = &packets->packet[0];
+    for (UInt32 i = 0; i < packets->numPackets; i++, pkt = MIDIPacketNext(pkt)) {
+        // split the packet up, it goes into the ring whole or not at all
+        size_t count = 0;
+        for (size_t pos = 0; pos < pkt->length; pos += LMX_SMF_CHUNK_DATA) {
+            Chunk &chunk = chunks[count++];
+            chunk.timestamp = pkt->timeStamp ? pkt->timeStamp : now;
+            chunk.length = pkt->length - pos < LMX_SMF_CHUNK_DATA ? pkt->length - pos : LMX_SMF_CHUNK_DATA;
+            memcpy(chunk.data, pkt->data + pos, chunk.length);
+        }
+
+        if (! ring.pushBatch(chunks, count))
+            dropped++;
+    }
+
+    return 0;
+}
+
+void SMFRecorder::writerThreadEntry() {
+    uint64_t lastSync = clock->now();
+
+    while (running) {
+        size_t count = writeChunks();
+
+        uint64_t now = clock->now();
+        if (dirty && now - lastSync >= SYNC_INTERVAL_NS) {
+            syncFile();
+            lastSync = now;
+        }
+
+        if (! count)
+            usleep(WRITER_IDLE_USEC);
+    }
+}
+
+// drain and write one batch, returns number of chunks written
+size_t SMFRecorder::writeChunks() {
+    size_t count = ring.drain(drained, LMX_SMF_RING_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        const Chunk &chunk = drained[i];
+        uint32_t tick = tickAt(chunk.timestamp);
+        for (size_t j = 0; j < chunk.length; j++)
+            parseByte(chunk.data[j], tick);
+    }
+    return count;
+}
+
+uint32_t SMFRecorder::tickAt(MIDITimeStamp timestamp) const {
+    uint64_t nanos = clock->fromHostTicks(timestamp);
+    if (nanos <= startTime)
+        return 0;
+    // rounded, from the absolute time so deltas don't accumulate error
+    return (uint32_t)((nanos - startTime + SMF_NS_PER_TICK / 2) / SMF_NS_PER_TICK);
+}
+
+// turn the MIDI byte stream back into messages
+void SMFRecorder::parseByte(uint8_t byte, uint32_t tick) {
+    // realtime messages have no place in a file
+    if (byte >= 0xF8)
+        return;
+
+    if (byte & 0x80) {
+        if (inSysex) {
+            inSysex = false;
+            if (byte == 0xF7 && sysexLength < LMX_SMF_MAX_SYSEX) {
+                // stored as F0 <length> <data after F0, including F7>
+                sysex[sysexLength++] = 0xF7;
+                const uint8_t start = 0xF0;
+                uint32_t delta = sysexTick > lastTick ? sysexTick - lastTick : 0;
+                writeVarLen(delta);
+                writeBytes(&start, 1);
+                writeVarLen((uint32_t)sysexLength);
+                writeBytes(sysex, sysexLength);
+                lastTick += delta;
+                dirty = true;
+                return;
+            }
+            // too long or cut short
+            skippedSysex++;
+            if (byte == 0xF7)
+                return;
+        }
+
+        messageLength = 0;
+        if (byte == 0xF0) {
+            inSysex = true;
+            sysexTick = tick;
+            sysexLength = 0;
+            status = 0;
+        } else if (byte >= 0xF1) {
+            // system common, not representable in a file
+            status = 0;
+        } else {
+            status = byte;
+        }
+        return;
+    }
+
+    if (inSysex) {
+        if (sysexLength < LMX_SMF_MAX_SYSEX)
+            sysex[sysexLength] = byte;
+        if (sysexLength <= LMX_SMF_MAX_SYSEX)
+            sysexLength++;
+        return;
+    }
+
+    // data byte without a status to go with it
+    if (! status)
+        return;
+
+    message[messageLength++] = byte;
+    size_t needed = (status & 0xE0) == 0xC0 ? 1 : 2; // program change, channel pressure
+    if (messageLength < needed)
+        return;
+
+    uint8_t event[3] = { status, message[0], message[1] };
+    writeEvent(tick, event, needed + 1);
+    messageLength = 0;
+}
+
+void SMFRecorder::writeEvent(uint32_t tick, const uint8_t *data, size_t length) {
+    // timestamps can go backwards a little (events sent "now" between
+    // scheduled ones), the file can't
+    uint32_t delta = tick > lastTick ? tick - lastTick : 0;
+    writeVarLen(delta);
+    writeBytes(data, length);
+    lastTick += delta;
+    dirty = true;
+}
+
+void SMFRecorder::writeVarLen(uint32_t value) {
+    // 7 bits per byte, most significant first, high bit set on all but the last
+    uint8_t buf[5];
+    size_t len = 0;
+    buf[4 - len++] = value & 0x7F;
+    while (value >>= 7)
+        buf[4 - len++] = 0x80 | (value & 0x7F);
+    writeBytes(buf + 5 - len, len);
+}
+
+void SMFRecorder::writeBytes(const void *data, size_t length) {
+    fwrite(data, 1, length, file);
+    trackLength += length;
+}
+
+// push buffered data to the file and update the track length to match
+void SMFRecorder::syncFile() {
+    uint8_t length[4];
+    putBE32(length, trackLength);
+
+    fflush(file);
+    fseek(file, SMF_TRACK_LENGTH_OFFSET, SEEK_SET);
+    fwrite(length, 1, sizeof(length), file);
+    fseek(file, 0, SEEK_END);
+    fflush(file);
+    dirty = false;
+}
+
+static bool readVarLen(FILE *f, uint32_t &value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = fgetc(f);
+        if (c == EOF)
+            return false;
+        value = (value << 7) | (c & 0x7F);
+        if (! (c & 0x80))
+            return true;
+    }
+    return false; // too long, corrupt
+}
+
+bool SMFRecorder::repair(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "rb+");
+    if (! f) {
+        LMX_LOG(LOG_ERROR, "Failed to open MIDI file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    uint8_t header[SMF_TRACK_DATA_OFFSET];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+        memcmp(header, "MThd", 4) || memcmp(header + 14, "MTrk", 4)) {
+        LMX_LOG(LOG_ERROR, "%s is not a MIDI file we recorded", path.c_str());
+        fclose(f);
+        return false;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, SMF_TRACK_DATA_OFFSET, SEEK_SET);
+
+    // walk the events, remembering where the last complete one ended
+    long end = SMF_TRACK_DATA_OFFSET;
+    bool endOfTrack = false;
+    uint8_t runningStatus = 0;
+    while (! endOfTrack) {
+        uint32_t delta, length;
+        if (! readVarLen(f, delta))
+            break;
+        int c = fgetc(f);
+        if (c == EOF)
+            break;
+
+        long skip;
+        if (c == 0xFF) {
+            int type = fgetc(f);
+            if (type == EOF || ! readVarLen(f, length))
+                break;
+            skip = length;
+            endOfTrack = type == 0x2F;
+            runningStatus = 0;
+        } else if (c == 0xF0 || c == 0xF7) {
+            if (! readVarLen(f, length))
+                break;
+            skip = length;
+            runningStatus = 0;
+        } else {
+            if (c & 0x80) {
+                if (c > 0xEF)
+                    break; // corrupt
+                runningStatus = c;
+                skip = 0;
+            } else if (runningStatus) {
+                skip = -1; // c was the first data byte
+            } else {
+                break;
+            }
+            skip += (runningStatus & 0xE0) == 0xC0 ? 1 : 2;
+        }
+
+        if (ftell(f) + skip > size)
+            break;
+        fseek(f, skip, SEEK_CUR);
+        end = ftell(f);
+    }
+
+    // drop the partial event (or anything after the end of track)
+    fflush(f);
+    if (ftruncate(fileno(f), end)) {
+        LMX_LOG(LOG_ERROR, "Failed to truncate %s: %s", path.c_str(), strerror(errno));
+        fclose(f);
+        return false;
+    }
+    fseek(f, end, SEEK_SET);
+    if (! endOfTrack) {
+        const uint8_t eot[] = { 0x00, 0xFF, 0x2F, 0x00 };
+        fwrite(eot, 1, sizeof(eot), f);
+        end += sizeof(eot);
+    }
+
+    uint8_t length[4];
+    putBE32(length, (uint32_t)(end - SMF_TRACK_DATA_OFFSET));
+    fseek(f, SMF_TRACK_LENGTH_OFFSET, SEEK_SET);
+    fwrite(length, 1, sizeof(length), f);
+
+    bool ok = fclose(f) == 0;
+    LMX_LOG(LOG_INFO, "Repaired MIDI file %s (%ld bytes of events)", path.c_str(), end - SMF_TRACK_DATA_OFFSET);
+    return ok;
+}
+
+} // namespace leapmidi
@@ -0,0 +1,121 @@
+//
+//  SMFRecorder.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Output that records everything the Device sends to a Standard MIDI File
+// (format 0, one track) while it is being played.
+// send() only copies the packets into a lock-free ring, it never touches
+// the file or blocks. A low-priority thread drains the ring, turns the
+// bytes into track events with variable-length delta times and writes
+// them through a fixed-size stdio buffer, so memory use doesn't grow with
+// the length of the session.
+// Once a second the written data is flushed and the track chunk length in
+// the file is updated. close() writes the end of track event and the final
+// length; a file left behind by a crash can be made whole with repair().
+// Packets that don't fit in the ring are dropped whole and counted.
+
+#ifndef __LeapMIDIX__SMFRecorder__
+#define __LeapMIDIX__SMFRecorder__
+
+#include <atomic>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "OutputBackend.h"
+#include "MessageRing.h"
+#include "HostClock.h"
+
+// bytes of MIDI data per ring entry, a packet takes one or more entries
+#define LMX_SMF_CHUNK_DATA 48
+// ring entries, must be a power of two
+#define LMX_SMF_RING_SIZE 4096
+// longest sysex message that is recorded, longer ones are skipped
+#define LMX_SMF_MAX_SYSEX 4096
+
+namespace leapmidi {
+
+class SMFRecorder : public OutputBackend {
+public:
+    // clock is the one the packet timestamps come from, defaults to the
+    // shared host clock
+    SMFRecorder(const std::string &path, Clock *clock = NULL);
+    virtual ~SMFRecorder();
+
+    // create/truncate the file and start the writer
+    virtual bool open();
+    // write everything still queued and finish the file
+    virtual void close();
+    virtual OSStatus send(const MIDIPacketList *packets);
+    // events are recorded at their timestamps
+    virtual bool schedulesPackets() const { return true; }
+    virtual const char *name() const { return "SMF recorder"; }
+
+    // packets lost because the writer fell behind
+    unsigned long droppedCount() const { return dropped.load(); }
+    // sysex messages too long to record
+    unsigned long skippedSysexCount() const { return skippedSysex; }
+
+    // make a file from an interrupted recording readable: cut off a
+    // partially written last event, add the end of track event and fix
+    // the track chunk length
+    static bool repair(const std::string &path);
+
+protected:
+    struct Chunk {
+        MIDITimeStamp timestamp; // host clock ticks
+        uint8_t length;
+        uint8_t data[LMX_SMF_CHUNK_DATA];
+    };
+
+    // writer thread
+    void writerThreadEntry();
+    size_t writeChunks();
+    void parseByte(uint8_t byte, uint32_t tick);
+    void writeEvent(uint32_t tick, const uint8_t *data, size_t length);
+    void writeVarLen(uint32_t value);
+    void writeBytes(const void *data, size_t length);
+    void syncFile();
+    uint32_t tickAt(MIDITimeStamp timestamp) const;
+
+    std::string path;
+    Clock *clock;
+
+    MessageRing<Chunk, LMX_SMF_RING_SIZE> ring;
+    std::atomic<unsigned long> dropped;
+
+    std::atomic<bool> running;
+    pthread_t writerThread;
+    bool writerStarted;
+
+    // only touched by the writer (or close() once it has stopped)
+    Chunk drained[LMX_SMF_RING_SIZE];
+    FILE *file;
+    uint64_t startTime;   // nanoseconds, tick 0
+    uint32_t lastTick;    // tick of the last event written
+    uint32_t trackLength; // bytes of track data written so far
+    bool dirty;           // written since the last sync
+
+    // message being assembled from the byte stream
+    uint8_t status;       // running status, 0 if none
+    uint8_t message[2];
+    size_t messageLength;
+    bool inSysex;
+    uint32_t sysexTick;
+    uint8_t sysex[LMX_SMF_MAX_SYSEX];
+    size_t sysexLength;   // > LMX_SMF_MAX_SYSEX once it's too long
+    unsigned long skippedSysex;
+
+private:
+    static void *_writerThreadEntry(void *This) { ((SMFRecorder *)This)->writerThreadEntry(); return NULL; }
+
+    SMFRecorder(const SMFRecorder &);
+    SMFRecorder &operator=(const SMFRecorder &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__SMFRecorder__) */
@@ -0,0 +1,99 @@
+//
+//  EffectBench.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// EffectChain cost per message for chains of 0 to 8 stages, over a 64
+// message frame of half notes (on and off) and half controls, copied in
+// fresh for every pass. Stages are added in turn from transpose, scale
+// quantize, channel remap, velocity curve and control to note. Also
+// counts heap allocations made while processing, which should be none.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <new>
+#include "EffectChain.h"
+#include "Device.h"
+
+#define FRAME_MESSAGES 64
+#define PASSES 200000
+
+using namespace leapmidi;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (! p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    free(p);
+}
+
+static uint64_t nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void addStage(EffectChain &effects, int stage) {
+    switch (stage % 5) {
+        case 0:
+            effects.addTranspose(1);
+            break;
+        case 1:
+            effects.addScaleQuantize(2, LMX_SCALE_MINOR);
+            break;
+        case 2: {
+            uint8_t map[16];
+            for (int channel = 0; channel < 16; channel++)
+                map[channel] = (channel + 1) & 0x0F;
+            effects.addChannelRemap(map);
+            break;
+        }
+        case 3:
+            effects.addVelocityCurve(1.5f);
+            break;
+        case 4:
+            effects.addControlToNote(10, 64, 60);
+            break;
+    }
+}
+
+int main() {
+    MessageBatch frame;
+    for (int i = 0; i < FRAME_MESSAGES; i++) {
+        if (i % 2)
+            frame.addNote(i % 40, (i / 2) % 2 ? 100 : 0);
+        else
+            frame.addControl(i % 30, i);
+    }
+
+    for (int stages = 0; stages <= LMX_EFFECT_MAX_STAGES; stages++) {
+        EffectChain *effects = new EffectChain();
+        for (int s = 0; s < stages; s++)
+            addStage(*effects, s);
+
+        MessageBatch batch;
+        size_t kept = 0;
+        size_t allocated = allocations;
+        uint64_t start = nanos();
+        for (int pass = 0; pass < PASSES; pass++) {
+            batch = frame;
+            effects->process(batch);
+            kept += batch.size();
+        }
+        uint64_t elapsed = nanos() - start;
+        printf("%d stages: %5.2f ns per message, %zu of %d kept, %zu allocations\n", stages,
+               (double)elapsed / PASSES / FRAME_MESSAGES, kept / PASSES, FRAME_MESSAGES, allocations - allocated);
+        delete effects;
+    }
+    return 0;
+}
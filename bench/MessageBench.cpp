@@ -0,0 +1,106 @@
+//
+//  MessageBench.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// midi_message before and after it was packed into 8 bytes: the memory
+// the Device's ring, drain array and a frame batch take, and the cost of
+// pushing a frame through a ring and draining it, with the ring in cache
+// and with enough rings (Devices) in turn that it isn't.
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include "LeapMIDI.h"
+#include "MessageRing.h"
+#include "MIDIMessage.h"
+
+#define RING_SIZE 1024
+#define FRAME_MESSAGES 128
+#define FRAMES 200000
+
+using namespace leapmidi;
+
+// what Device queued before
+struct OldMessage {
+    leapmidi::midi_control_index control_index;
+    leapmidi::midi_control_value control_value;
+    leapmidi::midi_note_index note_index;
+    leapmidi::midi_note_value note_value;
+    unsigned char channel;
+    int type;
+    uint64_t timestamp;
+};
+
+static uint64_t nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static OldMessage makeMessage(OldMessage *, unsigned i) {
+    OldMessage msg = { (midi_control_index)(i & 0x7F), (midi_control_value)(i & 0x7F), 0, 0, 0, 0, i };
+    return msg;
+}
+
+static midi_message makeMessage(midi_message *, unsigned i) {
+    return makeControlMessage(i & 0x7F, i & 0x7F, 0, i);
+}
+
+// what the sending thread looks at of each message
+static unsigned consume(const OldMessage &msg) {
+    return msg.type ? msg.note_index + msg.note_value : msg.control_index + msg.control_value + msg.channel + (unsigned)msg.timestamp;
+}
+
+static unsigned consume(const midi_message &msg) {
+    return msg.status + msg.data1 + msg.data2 + msg.time;
+}
+
+template <typename Message>
+static void footprint(const char *name) {
+    printf("%-12s %2zu bytes, ring %6zu bytes, drain array %6zu bytes, batch %5zu bytes\n", name,
+           sizeof(Message), sizeof(MessageRing<Message, RING_SIZE>), RING_SIZE * sizeof(Message),
+           FRAME_MESSAGES * sizeof(Message));
+}
+
+// push a frame into each ring in turn and drain it again
+template <typename Message>
+static void drain(const char *name, size_t rings) {
+    std::vector<MessageRing<Message, RING_SIZE> *> ring(rings);
+    for (size_t r = 0; r < rings; r++)
+        ring[r] = new MessageRing<Message, RING_SIZE>();
+    static Message frame[FRAME_MESSAGES], drained[RING_SIZE];
+    for (unsigned i = 0; i < FRAME_MESSAGES; i++)
+        frame[i] = makeMessage((Message *)NULL, i);
+
+    unsigned sum = 0;
+    size_t total = 0;
+    uint64_t start = nanos();
+    for (size_t f = 0; f < FRAMES; f++) {
+        MessageRing<Message, RING_SIZE> &r = *ring[f % rings];
+        r.pushBatch(frame, FRAME_MESSAGES);
+        size_t count = r.drain(drained, RING_SIZE);
+        for (size_t i = 0; i < count; i++)
+            sum += consume(drained[i]);
+        total += count;
+    }
+    uint64_t elapsed = nanos() - start;
+
+    printf("%-12s %3zu rings (%5zu KB): %5.2f ns per message (%u)\n", name, rings,
+           rings * sizeof(MessageRing<Message, RING_SIZE>) / 1024, (double)elapsed / total, sum);
+    for (size_t r = 0; r < rings; r++)
+        delete ring[r];
+}
+
+int main() {
+    footprint<OldMessage>("24 byte");
+    footprint<midi_message>("8 byte");
+    size_t ringCounts[] = { 1, 16, 256 };
+    for (size_t i = 0; i < sizeof(ringCounts) / sizeof(ringCounts[0]); i++) {
+        drain<OldMessage>("24 byte", ringCounts[i]);
+        drain<midi_message>("8 byte", ringCounts[i]);
+    }
+    return 0;
+}
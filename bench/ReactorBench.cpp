@@ -0,0 +1,117 @@
+//
+//  ReactorBench.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// N Devices each with its own sending thread against the same N Devices
+// served by one OutputReactor, for 1, 4 and 16 endpoints. Every 1ms a
+// frame of 8 controls is pushed into each Device; measured are the CPU
+// time and context switches of the whole process over the run, and the
+// latency from a frame being pushed to its packet going out.
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+#include "Device.h"
+#include "OutputReactor.h"
+#include "MemoryOutput.h"
+#include "HostClock.h"
+
+#define FRAMES 2000
+#define FRAME_INTERVAL_NS 1000000
+#define FRAME_CONTROLS 8
+#define SETTLE_US 50000
+
+using namespace leapmidi;
+
+static double cpuMillis(const struct rusage &r) {
+    return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1e3 + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e3;
+}
+
+static void bench(int endpoints, bool useReactor) {
+    ThreadConfig config;
+    config.realtime = false;
+    OutputReactor *reactor = NULL;
+    if (useReactor) {
+        reactor = new OutputReactor();
+        reactor->setThreadConfig(config);
+    }
+
+    std::vector<MemoryOutput *> outputs;
+    std::vector<Device *> devices;
+    for (int i = 0; i < endpoints; i++) {
+        outputs.push_back(new MemoryOutput());
+        Device *device = new Device(NULL, outputs.back());
+        device->setLatencyOffset(0);
+        device->setSenderThreadConfig(config);
+        if (reactor)
+            device->setReactor(reactor);
+        device->init();
+        devices.push_back(device);
+    }
+    usleep(SETTLE_US);
+
+    Clock *clock = HostClock::shared();
+    std::vector<uint64_t> pushedAt(FRAMES);
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    uint64_t start = clock->now();
+    for (int f = 0; f < FRAMES; f++) {
+        uint64_t due = start + f * (uint64_t)FRAME_INTERVAL_NS;
+        struct timespec ts = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        pushedAt[f] = clock->now();
+        for (int i = 0; i < endpoints; i++) {
+            MessageBatch batch;
+            for (int cc = 0; cc < FRAME_CONTROLS; cc++)
+                batch.addControl(cc, (f + cc + 1) & 0x7F);
+            devices[i]->addMessages(batch);
+        }
+    }
+    usleep(SETTLE_US);
+    getrusage(RUSAGE_SELF, &after);
+
+    // each packet against the newest frame pushed before it went out
+    std::vector<uint64_t> latencies;
+    size_t packets = 0;
+    for (int i = 0; i < endpoints; i++) {
+        std::vector<MemoryOutput::Packet> sent = outputs[i]->packets();
+        packets += sent.size();
+        for (size_t p = 0; p < sent.size(); p++) {
+            std::vector<uint64_t>::iterator pushed = std::upper_bound(pushedAt.begin(), pushedAt.end(), sent[p].sentAt);
+            if (pushed != pushedAt.begin())
+                latencies.push_back(sent[p].sentAt - *(pushed - 1));
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    long switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+    printf("%-7s %2d endpoints: cpu %7.1fms, %6ld context switches, %6zu packets", useReactor ? "reactor" : "threads",
+           endpoints, cpuMillis(after) - cpuMillis(before), switches, packets);
+    if (! latencies.empty())
+        printf(", latency p50 %5.1fus p99 %6.1fus max %7.1fus", latencies[latencies.size() / 2] / 1e3,
+               latencies[latencies.size() * 99 / 100] / 1e3, latencies.back() / 1e3);
+    if (reactor)
+        printf(", %lu wakeups %lu passes", reactor->wakeupCount(), reactor->passCount());
+    printf("\n");
+
+    for (int i = 0; i < endpoints; i++)
+        delete devices[i];
+    delete reactor;
+    for (int i = 0; i < endpoints; i++)
+        delete outputs[i];
+}
+
+int main() {
+    int endpointCounts[] = { 1, 4, 16 };
+    for (size_t i = 0; i < sizeof(endpointCounts) / sizeof(endpointCounts[0]); i++) {
+        bench(endpointCounts[i], false);
+        bench(endpointCounts[i], true);
+    }
+    return 0;
+}
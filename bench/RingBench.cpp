@@ -0,0 +1,222 @@
+//
+//  RingBench.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The Device's message queue before and after the MPSC ring: a
+// std::queue behind a mutex with a condition variable signalled on every
+// message, copied out element by element by the consumer, against
+// MessageRing with the sending thread's park/wake handshake.
+// Throughput: producers push as fast as they can, timed until the
+// consumer has everything, and the time producers spend per push (what
+// the Leap callback thread pays). Latency: producers push a frame of 16
+// messages every 500us, each message carries the low 32 bits of its
+// push time.
+
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <atomic>
+#include <queue>
+#include <vector>
+#include <algorithm>
+#include "MessageRing.h"
+#include "MIDIMessage.h"
+#include "EventNotifier.h"
+
+#define RING_SIZE 1024
+#define THROUGHPUT_MESSAGES 1000000
+#define FRAME_MESSAGES 16
+#define FRAMES 2000
+#define FRAME_INTERVAL_NS 500000
+
+using namespace leapmidi;
+
+static uint64_t nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// what Device did before the ring
+class MutexQueue {
+public:
+    MutexQueue() {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    }
+
+    void push(const midi_message &msg) {
+        pthread_mutex_lock(&mutex);
+        queue.push(msg);
+        pthread_mutex_unlock(&mutex);
+        pthread_cond_signal(&cond);
+    }
+
+    // wait for messages, then copy them all out
+    size_t drain(std::queue<midi_message> &copy, const std::atomic<bool> &running) {
+        pthread_mutex_lock(&mutex);
+        while (queue.empty() && running) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&cond, &mutex, &ts);
+        }
+        size_t count = queue.size();
+        while (! queue.empty()) {
+            copy.push(queue.front());
+            queue.pop();
+        }
+        pthread_mutex_unlock(&mutex);
+        return count;
+    }
+
+protected:
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::queue<midi_message> queue;
+};
+
+// what Device does now
+class RingQueue {
+public:
+    RingQueue() : waiting(false) {}
+
+    void push(const midi_message &msg) {
+        while (! ring.push(msg))
+            sched_yield(); // full, the benchmark must not lose messages
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load() && waiting.exchange(false))
+            notifier.signal();
+    }
+
+    size_t drain(midi_message *out, const std::atomic<bool> &running) {
+        for (;;) {
+            size_t count = ring.drain(out, RING_SIZE);
+            if (count || ! running)
+                return count;
+            waiting.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring.empty())
+                notifier.wait(1000000);
+            waiting.store(false);
+        }
+    }
+
+protected:
+    MessageRing<midi_message, RING_SIZE> ring;
+    EventNotifier notifier;
+    std::atomic<bool> waiting;
+};
+
+struct Run {
+    bool ring;
+    bool paced;
+    size_t perProducer;
+    MutexQueue mutexQueue;
+    RingQueue ringQueue;
+    std::atomic<bool> running;
+    std::atomic<size_t> received;
+    std::vector<uint32_t> latencies;
+};
+
+static void *producer(void *arg) {
+    Run *run = (Run *)arg;
+    uint64_t start = nanos();
+    for (size_t i = 0; i < run->perProducer; i++) {
+        if (run->paced && ! (i % FRAME_MESSAGES)) {
+            uint64_t due = start + (i / FRAME_MESSAGES) * FRAME_INTERVAL_NS;
+            struct timespec ts = { (time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+        midi_message msg = makeControlMessage(i & 0x7F, i & 0x7F, 0, (uint32_t)nanos());
+        if (run->ring)
+            run->ringQueue.push(msg);
+        else
+            run->mutexQueue.push(msg);
+    }
+    return NULL;
+}
+
+static void consume(Run *run, const midi_message *msgs, size_t count) {
+    run->received += count;
+    if (! run->paced)
+        return;
+    uint32_t now = (uint32_t)nanos();
+    for (size_t i = 0; i < count; i++)
+        run->latencies.push_back(now - msgs[i].time);
+}
+
+static void *consumer(void *arg) {
+    Run *run = (Run *)arg;
+    static midi_message drained[RING_SIZE];
+    std::vector<midi_message> copied;
+    while (run->running) {
+        if (run->ring) {
+            size_t count = run->ringQueue.drain(drained, run->running);
+            consume(run, drained, count);
+        } else {
+            std::queue<midi_message> copy;
+            run->mutexQueue.drain(copy, run->running);
+            copied.clear();
+            for (; ! copy.empty(); copy.pop())
+                copied.push_back(copy.front());
+            consume(run, copied.data(), copied.size());
+        }
+    }
+    return NULL;
+}
+
+static void bench(bool ring, bool paced, int producers) {
+    Run *run = new Run;
+    run->ring = ring;
+    run->paced = paced;
+    run->perProducer = paced ? FRAMES * FRAME_MESSAGES : THROUGHPUT_MESSAGES / producers;
+    run->running = true;
+    run->received = 0;
+    size_t total = run->perProducer * producers;
+
+    pthread_t consumerThread, producerThreads[8];
+    pthread_create(&consumerThread, NULL, consumer, run);
+    uint64_t start = nanos();
+    for (int i = 0; i < producers; i++)
+        pthread_create(&producerThreads[i], NULL, producer, run);
+    for (int i = 0; i < producers; i++)
+        pthread_join(producerThreads[i], NULL);
+    uint64_t produced = nanos() - start;
+    while (run->received < total)
+        sched_yield();
+    uint64_t consumed = nanos() - start;
+    run->running = false;
+    pthread_join(consumerThread, NULL);
+
+    const char *name = ring ? "ring" : "mutex+cond";
+    if (! paced) {
+        printf("%-10s %d producers: %6.2f M messages/s through, %6.1f ns per push\n", name, producers,
+               total / (consumed / 1e3), (double)produced * producers / total);
+    } else {
+        std::vector<uint32_t> &lat = run->latencies;
+        std::sort(lat.begin(), lat.end());
+        printf("%-10s %d producers: latency p50 %6.1fus p99 %6.1fus max %7.1fus (%zu messages)\n", name, producers,
+               lat[lat.size() / 2] / 1e3, lat[lat.size() * 99 / 100] / 1e3, lat.back() / 1e3, lat.size());
+    }
+    delete run;
+}
+
+int main() {
+    int producerCounts[] = { 1, 2, 4 };
+    for (int paced = 0; paced < 2; paced++) {
+        for (size_t i = 0; i < sizeof(producerCounts) / sizeof(producerCounts[0]); i++) {
+            bench(false, paced, producerCounts[i]);
+            bench(true, paced, producerCounts[i]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+//
+//  WheelBench.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The TimerWheel against a list scanned on every tick (what the sending
+// thread would otherwise do with its held messages): the cost of advancing
+// by a 100us tick with 100 to 4000 messages waiting further out, and of
+// an insert followed by a cancel. Also how late messages come out when
+// advanced to the wheel's own next deadline.
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+#include "TimerWheel.h"
+
+#define TICK_NS 100000
+#define TICKS 10000
+#define INSERTS 1000000
+
+using namespace leapmidi;
+
+static uint64_t nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// held messages in insertion order, every advance looks at all of them
+class ScannedList {
+public:
+    void insert(uint64_t due, uint64_t, const midi_message &msg) {
+        Held held = { due, msg };
+        messages.push_back(held);
+    }
+
+    size_t advance(uint64_t now, midi_message *out, size_t max) {
+        size_t count = 0, kept = 0;
+        for (size_t i = 0; i < messages.size(); i++) {
+            if (messages[i].due <= now && count < max)
+                out[count++] = messages[i].msg;
+            else
+                messages[kept++] = messages[i];
+        }
+        messages.resize(kept);
+        return count;
+    }
+
+protected:
+    struct Held {
+        uint64_t due;
+        midi_message msg;
+    };
+    std::vector<Held> messages;
+};
+
+static midi_message released[LMX_TIMER_WHEEL_SIZE];
+
+// pending messages due from 2s out, 1ms apart, then TICKS advances
+template <typename Queue>
+static double advanceCost(Queue &held, size_t pending) {
+    uint64_t now = 1000000000ULL;
+    for (size_t i = 0; i < pending; i++) {
+        midi_message msg = makeNoteMessage(0, 100, 0, (uint32_t)i);
+        held.insert(now + 2000000000ULL + i * 1000000ULL, now, msg);
+    }
+    uint64_t start = nanos();
+    for (int i = 0; i < TICKS; i++) {
+        now += TICK_NS;
+        held.advance(now, released, LMX_TIMER_WHEEL_SIZE);
+    }
+    return (double)(nanos() - start) / TICKS;
+}
+
+static void lateness() {
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = 1000000000ULL;
+    std::vector<uint64_t> due(LMX_TIMER_WHEEL_SIZE);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < due.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        due[i] = now + (seed >> 8) % 2000000000ULL;
+        wheel->insert(due[i], now, makeNoteMessage(0, 100, 0, (uint32_t)i));
+    }
+
+    std::vector<uint64_t> late;
+    while (! wheel->empty()) {
+        now = wheel->nextDeadline();
+        size_t count = wheel->advance(now, released, LMX_TIMER_WHEEL_SIZE);
+        for (size_t i = 0; i < count; i++)
+            late.push_back(now - due[released[i].time]);
+    }
+    std::sort(late.begin(), late.end());
+    printf("advanced to its deadlines: %zu released, late p50 %.0fns max %.0fns\n", late.size(),
+           (double)late[late.size() / 2], (double)late.back());
+    delete wheel;
+}
+
+int main() {
+    size_t pendingCounts[] = { 100, 1000, 4000 };
+    for (size_t i = 0; i < sizeof(pendingCounts) / sizeof(pendingCounts[0]); i++) {
+        TimerWheel *wheel = new TimerWheel();
+        ScannedList list;
+        double wheelCost = advanceCost(*wheel, pendingCounts[i]);
+        double listCost = advanceCost(list, pendingCounts[i]);
+        printf("%4zu pending: advance by a tick %7.1fns timer wheel, %8.1fns scanned list\n", pendingCounts[i],
+               wheelCost, listCost);
+        delete wheel;
+    }
+
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = 1000000000ULL;
+    midi_message msg = makeNoteMessage(0, 100);
+    uint64_t start = nanos();
+    for (int i = 0; i < INSERTS; i++) {
+        TimerWheel::Handle handle = wheel->insert(now + (i % 1000) * 1000000ULL, now, msg);
+        wheel->cancel(handle);
+    }
+    printf("insert and cancel: %.1fns\n", (double)(nanos() - start) / INSERTS);
+    delete wheel;
+
+    lateness();
+    return 0;
+}
@@ -0,0 +1,47 @@
+#
+#  core.mk
+#  LeapMIDIX
+#
+#  Copyright (c) 2013 DBA int80. All rights reserved.
+#
+
+# Builds the platform independent core (everything but the Leap listener,
+# the visualizer and the native MIDI outputs) into a static library, for
+# the tests and benchmarks that run outside Xcode.
+# LEAPMIDI_INCLUDE and LEAP_INCLUDE are the leapmidi library and Leap SDK
+# headers, by default the sibling checkouts the Xcode project expects.
+# Outputs default to MemoryOutput (LMX_MEMORY_DEFAULT_OUTPUT).
+
+ROOT := $(dir $(lastword $(MAKEFILE_LIST)))
+SRC := $(ROOT)LeapMIDIX
+LEAPMIDI_INCLUDE ?= $(ROOT)../leapmidi/leapmidi
+LEAP_INCLUDE ?= $(ROOT)../LeapSDK/include
+BUILD ?= build
+
+CORE_SOURCES := \
+    $(filter-out %/LMXListener.cpp %/Visualizer.cpp %/main.cpp,$(wildcard $(SRC)/*.cpp)) \
+    $(filter-out %/CoreMIDIOutput.cpp %/AlsaOutput.cpp,$(wildcard $(SRC)/output/*.cpp))
+CORE_OBJECTS := $(addprefix $(BUILD)/,$(notdir $(CORE_SOURCES:.cpp=.o)))
+CORE_LIB := $(BUILD)/libleapmidix.a
+
+CXX ?= c++
+CXXFLAGS ?= -std=gnu++0x -O2 -g -Wall -Wextra
+CPPFLAGS += -I$(SRC) -I$(SRC)/output -I$(LEAPMIDI_INCLUDE) -I$(LEAP_INCLUDE) -DLMX_MEMORY_DEFAULT_OUTPUT
+LDLIBS += -lpthread
+ifeq ($(shell uname -s),Darwin)
+LDLIBS += -framework CoreMIDI -framework CoreFoundation
+endif
+
+vpath %.cpp $(SRC) $(SRC)/output
+
+# objects are rebuilt when a header they include changes
+$(BUILD)/%.o: %.cpp | $(BUILD)
+	$(CXX) $(CPPFLAGS) $(CXXFLAGS) -MMD -MP -c -o $@ $<
+
+-include $(wildcard $(BUILD)/*.d)
+
+$(CORE_LIB): $(CORE_OBJECTS)
+	$(AR) rcs $@ $^
+
+$(BUILD):
+	mkdir -p $@
@@ -0,0 +1,105 @@
+//
+//  ControlCoalescerTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The ControlCoalescer on its own and behind the Device: a controller
+// updated several times before a flush goes out once with its newest
+// value, and controllers go out in the order they were first dirtied.
+
+#include "TestSupport.h"
+#include "ControlCoalescer.h"
+
+using namespace leapmidi;
+
+static void checkEntry(const ControlCoalescer::Entry &entry, unsigned char channel, unsigned char controller,
+                       leapmidi::midi_control_value value) {
+    CHECK_EQUAL(channel, entry.channel);
+    CHECK_EQUAL(controller, entry.controller);
+    CHECK_EQUAL(value, entry.value);
+}
+
+static void testUpdates() {
+    ControlCoalescer coalescer;
+    CHECK(! coalescer.update(0, 5, 10, 1, false, 100));
+    CHECK(! coalescer.update(1, 5, 20, 2, false, 200));
+    CHECK(! coalescer.update(0, 3, 30, 3, false, 300));
+    CHECK(coalescer.update(0, 5, 40, 4, true, 400));
+    CHECK(coalescer.update(0, 3, 50, 5, false, 500));
+    CHECK(coalescer.update(0, 5, 60, 6, false, 600));
+
+    // newest value and timestamp, queued when first dirtied
+    CHECK_EQUAL(3, coalescer.pendingCount());
+    CHECK_EQUAL(3, coalescer.supersededCount());
+    checkEntry(coalescer.pendingEntry(0), 0, 5, 60);
+    CHECK_EQUAL(6, coalescer.pendingEntry(0).timestamp);
+    CHECK_EQUAL(100, coalescer.pendingEntry(0).queuedAt);
+    CHECK(! coalescer.pendingEntry(0).highRes);
+    checkEntry(coalescer.pendingEntry(1), 1, 5, 20);
+    checkEntry(coalescer.pendingEntry(2), 0, 3, 50);
+    CHECK_EQUAL(300, coalescer.pendingEntry(2).queuedAt);
+}
+
+static void testConsume() {
+    ControlCoalescer coalescer;
+    coalescer.update(0, 1, 10);
+    coalescer.update(0, 2, 20);
+    coalescer.update(0, 3, 30);
+
+    // the rest stay in order, a sent controller starts over at the end
+    coalescer.consume(1);
+    CHECK_EQUAL(2, coalescer.pendingCount());
+    CHECK(! coalescer.update(0, 1, 11));
+    CHECK(coalescer.update(0, 2, 21));
+    CHECK_EQUAL(3, coalescer.pendingCount());
+    checkEntry(coalescer.pendingEntry(0), 0, 2, 21);
+    checkEntry(coalescer.pendingEntry(1), 0, 3, 30);
+    checkEntry(coalescer.pendingEntry(2), 0, 1, 11);
+
+    coalescer.clear();
+    CHECK_EQUAL(0, coalescer.pendingCount());
+    CHECK(! coalescer.update(0, 3, 31));
+    CHECK_EQUAL(1, coalescer.pendingCount());
+    CHECK_EQUAL(1, coalescer.supersededCount());
+}
+
+// several values per controller in one frame make one message each
+static void testDevice() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+
+    MessageBatch batch;
+    batch.addControl(5, 10);
+    batch.addControl(3, 20);
+    batch.addControl(5, 30);
+    batch.addControl(7, 1);
+    batch.addControl(3, 40);
+    batch.addControl(5, 50);
+    device.addMessages(batch);
+    device.pump();
+
+    const Byte expected[] = { 0xB0, 5, 50, 3, 40, 7, 1 };
+    CHECK_BYTES(expected, output.bytes());
+    CHECK_EQUAL(1, output.packetCount());
+    CHECK_EQUAL(3, device.getDropPolicy().supersededCount());
+
+    // sent, so the next value goes out on its own
+    output.clear();
+    batch.clear();
+    batch.addControl(3, 41);
+    device.addMessages(batch);
+    device.pump();
+    const Byte next[] = { 0xB0, 3, 41 };
+    CHECK_BYTES(next, output.bytes());
+}
+
+int main() {
+    testUpdates();
+    testConsume();
+    testDevice();
+    return testResult("ControlCoalescerTest");
+}
@@ -0,0 +1,137 @@
+//
+//  DropPolicyTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Per-class drop deadlines, on their own and with a Device on a fake
+// clock falling behind.
+
+#include "TestSupport.h"
+#include "DropPolicy.h"
+
+using namespace leapmidi;
+
+#define MS 1000000ULL
+
+static void testDeadlines() {
+    DropPolicy policy;
+    uint64_t due = 100 * MS;
+
+    // note-ons: 2ms by default
+    CHECK_EQUAL(2 * MS, policy.getDeadline(DropPolicy::NOTE_ON));
+    CHECK(! policy.shouldDrop(DropPolicy::NOTE_ON, due, due + 2 * MS));
+    CHECK(policy.shouldDrop(DropPolicy::NOTE_ON, due, due + 2 * MS + 1));
+    CHECK_EQUAL(1, policy.dropCount(DropPolicy::NOTE_ON));
+
+    // note-offs: never, whatever the deadline is set to
+    policy.setDeadline(DropPolicy::NOTE_OFF, 1);
+    CHECK_EQUAL(0, policy.getDeadline(DropPolicy::NOTE_OFF));
+    CHECK(! policy.shouldDrop(DropPolicy::NOTE_OFF, due, due + 10000 * MS));
+    CHECK_EQUAL(0, policy.dropCount(DropPolicy::NOTE_OFF));
+
+    // controls: only superseded unless given a deadline
+    CHECK(! policy.shouldDrop(DropPolicy::CONTROL, due, due + 10000 * MS));
+    policy.countSuperseded();
+    CHECK_EQUAL(1, policy.supersededCount());
+    CHECK_EQUAL(0, policy.dropCount(DropPolicy::CONTROL));
+}
+
+static void testRuntimeDeadlines() {
+    DropPolicy policy;
+    uint64_t due = 100 * MS;
+
+    policy.setDeadline(DropPolicy::CONTROL, 5 * MS);
+    CHECK(! policy.shouldDrop(DropPolicy::CONTROL, due, due + 5 * MS));
+    CHECK(policy.shouldDrop(DropPolicy::CONTROL, due, due + 6 * MS));
+
+    policy.setDeadline(DropPolicy::NOTE_ON, 20 * MS);
+    CHECK(! policy.shouldDrop(DropPolicy::NOTE_ON, due, due + 10 * MS));
+    // 0 is never
+    policy.setDeadline(DropPolicy::NOTE_ON, 0);
+    CHECK(! policy.shouldDrop(DropPolicy::NOTE_ON, due, due + 10000 * MS));
+
+    CHECK_EQUAL(1, policy.dropCount(DropPolicy::CONTROL));
+    CHECK_EQUAL(0, policy.dropCount(DropPolicy::NOTE_ON));
+}
+
+// the sending thread falling behind: the note-off of a played note still
+// goes out, a note-on that's too late for its deadline doesn't
+static void testDeviceStale() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+    DropPolicy &policy = device.getDropPolicy();
+    uint64_t stale = device.getLatencyOffset() + policy.getDeadline(DropPolicy::NOTE_ON) + 1;
+
+    MessageBatch batch;
+    batch.addNote(0, 100);
+    device.addMessages(batch);
+    device.pump();
+
+    batch.clear();
+    batch.addNote(0, 0);
+    batch.addNote(1, 100);
+    device.addMessages(batch);
+    clock.advance(stale);
+    device.pump();
+
+    CHECK_EQUAL(1, policy.dropCount(DropPolicy::NOTE_ON));
+    CHECK_EQUAL(0, policy.dropCount(DropPolicy::NOTE_OFF));
+    const Byte expected[] = { 0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY, 0x80, LMX_NOTE_BASE, 0x7F };
+    CHECK_BYTES(expected, output.bytes());
+
+    // with the deadline lifted while running, a late note-on plays
+    policy.setDeadline(DropPolicy::NOTE_ON, 0);
+    output.clear();
+    batch.clear();
+    batch.addNote(2, 100);
+    device.addMessages(batch);
+    clock.advance(stale);
+    device.pump();
+    const Byte late[] = { 0x90, LMX_NOTE_BASE + 2, LMX_NOTE_VELOCITY };
+    CHECK_BYTES(late, output.bytes());
+    CHECK_EQUAL(1, policy.dropCount(DropPolicy::NOTE_ON));
+}
+
+// values of a controller that never went out are counted, only the
+// newest is sent; a control deadline set while running drops late ones
+static void testDeviceControls() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+    DropPolicy &policy = device.getDropPolicy();
+
+    MessageBatch batch;
+    batch.addControl(1, 10);
+    batch.addControl(1, 20);
+    batch.addControl(2, 5);
+    batch.addControl(1, 30);
+    device.addMessages(batch);
+    device.pump();
+
+    CHECK_EQUAL(2, policy.supersededCount());
+    const Byte expected[] = { 0xB0, 1, 30, 2, 5 };
+    CHECK_BYTES(expected, output.bytes());
+
+    policy.setDeadline(DropPolicy::CONTROL, MS);
+    output.clear();
+    batch.clear();
+    batch.addControl(3, 1);
+    device.addMessages(batch);
+    clock.advance(device.getLatencyOffset() + 2 * MS);
+    device.pump();
+    CHECK_EQUAL(0, output.packetCount());
+    CHECK_EQUAL(1, policy.dropCount(DropPolicy::CONTROL));
+}
+
+int main() {
+    testDeadlines();
+    testRuntimeDeadlines();
+    testDeviceStale();
+    testDeviceControls();
+    return testResult("DropPolicyTest");
+}
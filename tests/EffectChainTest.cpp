@@ -0,0 +1,158 @@
+//
+//  EffectChainTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The EffectChain on its own: a note-off follows its note-on after the
+// chain changes or is cleared, scale quantization rounds down on a tie,
+// the velocity curve's endpoints, and a controller turned into a note as
+// it crosses the threshold each way. Also that notes past MIDI note 127
+// never make it into a batch.
+
+#include "TestSupport.h"
+#include "EffectChain.h"
+
+using namespace leapmidi;
+
+static midi_message note(uint8_t number, uint8_t velocity, uint8_t channel = 0) {
+    midi_message msg = { (uint8_t)(LMX_STATUS_NOTE | channel), number, velocity, 0, 0 };
+    return msg;
+}
+
+// one message through the chain, status 0 if it was dropped
+static midi_message run(EffectChain &effects, const midi_message &in) {
+    midi_message msg = in;
+    if (! effects.process(&msg, 1))
+        msg.status = 0;
+    return msg;
+}
+
+static void checkMessage(const midi_message &msg, uint8_t status, uint8_t data1, uint8_t data2) {
+    CHECK_EQUAL(status, msg.status);
+    if (status) {
+        CHECK_EQUAL(data1, msg.data1);
+        CHECK_EQUAL(data2, msg.data2);
+    }
+}
+
+static void testNoteOffFollowsNoteOn() {
+    EffectChain effects;
+    effects.addTranspose(2);
+    checkMessage(run(effects, note(60, 100)), 0x90, 62, 100);
+
+    // the transpose changes while 60 is held, its note-off goes to 62
+    effects.clear();
+    effects.addTranspose(5);
+    checkMessage(run(effects, note(61, 100)), 0x90, 66, 100);
+    checkMessage(run(effects, note(60, 0)), 0x90, 62, 0);
+    checkMessage(run(effects, note(60, 100)), 0x90, 65, 100);
+
+    // a remap on top, then no stages at all
+    uint8_t map[16];
+    for (int channel = 0; channel < 16; channel++)
+        map[channel] = 15 - channel;
+    effects.addChannelRemap(map);
+    checkMessage(run(effects, note(62, 100)), 0x9F, 67, 100);
+    effects.clear();
+    checkMessage(run(effects, note(60, 0)), 0x90, 65, 0);
+    checkMessage(run(effects, note(61, 0)), 0x90, 66, 0);
+    checkMessage(run(effects, note(62, 0)), 0x9F, 67, 0);
+    checkMessage(run(effects, note(62, 100)), 0x90, 62, 100);
+
+    // a note-on the chain dropped has its note-off dropped too
+    effects.addTranspose(100);
+    checkMessage(run(effects, note(40, 100)), 0, 0, 0);
+    effects.clear();
+    checkMessage(run(effects, note(40, 0)), 0, 0, 0);
+    checkMessage(run(effects, note(40, 0)), 0x90, 40, 0);
+}
+
+static void testScaleQuantizeTie() {
+    EffectChain effects;
+    effects.addScaleQuantize(0, LMX_SCALE_MAJOR);
+    checkMessage(run(effects, note(60, 100)), 0x90, 60, 100);
+    checkMessage(run(effects, note(61, 100)), 0x90, 60, 100);
+    checkMessage(run(effects, note(66, 100)), 0x90, 65, 100);
+    checkMessage(run(effects, note(70, 100)), 0x90, 69, 100);
+    checkMessage(run(effects, note(0, 100)), 0x90, 0, 100);
+    checkMessage(run(effects, note(127, 100)), 0x90, 127, 100);
+
+    // D pentatonic major (D E F# A B): a tie goes down, otherwise nearest
+    effects.clear();
+    effects.addScaleQuantize(2, LMX_SCALE_PENTATONIC_MAJOR);
+    checkMessage(run(effects, note(63, 100)), 0x90, 62, 100);
+    checkMessage(run(effects, note(67, 100)), 0x90, 66, 100);
+    checkMessage(run(effects, note(68, 100)), 0x90, 69, 100);
+    checkMessage(run(effects, note(72, 100)), 0x90, 71, 100);
+    checkMessage(run(effects, note(73, 100)), 0x90, 74, 100);
+
+    CHECK(! effects.addScaleQuantize(12, LMX_SCALE_MAJOR));
+    CHECK(! effects.addScaleQuantize(0, 0));
+}
+
+static void testVelocityCurveEndpoints() {
+    EffectChain effects;
+    effects.addVelocityCurve(2.0f, 10, 100);
+    checkMessage(run(effects, note(60, 1)), 0x90, 60, 10);
+    checkMessage(run(effects, note(60, 127)), 0x90, 60, 100);
+    checkMessage(run(effects, note(60, 0)), 0x90, 60, 0);
+
+    // a soft curve still lands on its ends
+    effects.clear();
+    effects.addVelocityCurve(0.5f);
+    checkMessage(run(effects, note(61, 1)), 0x90, 61, 12);
+    checkMessage(run(effects, note(61, 127)), 0x90, 61, 127);
+
+    // a minimum of 0 would turn a note-on into a note-off
+    effects.clear();
+    effects.addVelocityCurve(3.0f, 0, 200);
+    checkMessage(run(effects, note(62, 1)), 0x90, 62, 1);
+    checkMessage(run(effects, note(62, 127)), 0x90, 62, 127);
+}
+
+static void testControlToNote() {
+    EffectChain effects;
+    effects.addControlToNote(10, 64, 60, 90);
+
+    // nothing until it gets to the threshold, then once each way
+    checkMessage(run(effects, makeControlMessage(10, 63)), 0, 0, 0);
+    checkMessage(run(effects, makeControlMessage(10, 64)), 0x90, 60, 90);
+    checkMessage(run(effects, makeControlMessage(10, 127)), 0, 0, 0);
+    checkMessage(run(effects, makeControlMessage(10, 63)), 0x90, 60, 0);
+    checkMessage(run(effects, makeControlMessage(10, 0)), 0, 0, 0);
+
+    // other controllers pass, each channel crosses on its own
+    checkMessage(run(effects, makeControlMessage(11, 100)), 0xB0, 11, 100);
+    checkMessage(run(effects, makeControlMessage(10, 70, 1)), 0x91, 60, 90);
+    checkMessage(run(effects, makeControlMessage(10, 70)), 0x90, 60, 90);
+    checkMessage(run(effects, makeControlMessage(10, 10, 1)), 0x91, 60, 0);
+
+    // down, up and back down within one batch
+    midi_message msgs[] = { makeControlMessage(10, 20), makeControlMessage(10, 10), makeControlMessage(10, 80), makeControlMessage(10, 30) };
+    CHECK_EQUAL(3, effects.process(msgs, 4));
+    checkMessage(msgs[0], 0x90, 60, 0);
+    checkMessage(msgs[1], 0x90, 60, 90);
+    checkMessage(msgs[2], 0x90, 60, 0);
+}
+
+// indexes up to LMX_NOTE_COUNT - 1 reach 127, past that they're left out
+static void testNotesPastTop() {
+    MessageBatch batch;
+    batch.addNote(LMX_NOTE_COUNT - 1, 100);
+    batch.addNote(LMX_NOTE_COUNT, 100);
+    batch.addNote(LMX_NOTE_COUNT + 10, 100);
+    batch.addCancel(LMX_NOTE_COUNT);
+    CHECK_EQUAL(1, batch.size());
+    CHECK_EQUAL(127, batch.begin()[0].data1);
+}
+
+int main() {
+    testNoteOffFollowsNoteOn();
+    testScaleQuantizeTie();
+    testVelocityCurveEndpoints();
+    testControlToNote();
+    testNotesPastTop();
+    return testResult("EffectChainTest");
+}
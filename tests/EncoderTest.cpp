@@ -0,0 +1,282 @@
+//
+//  EncoderTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Running status packing, in the encoder and byte for byte out of the
+// Device. Runs of typed messages are checked against appending the same
+// messages one at a time, which is how everything was encoded before.
+// Also which NRPN bytes the Device leaves out as already sent.
+
+#include "TestSupport.h"
+#include "MIDIEncoder.h"
+
+using namespace leapmidi;
+
+static std::vector<Byte> encoded(const MIDIEncoder &encoder) {
+    return std::vector<Byte>(encoder.data(), encoder.data() + encoder.length());
+}
+
+static void testRunningStatus() {
+    MIDIEncoder encoder;
+    CHECK(encoder.append(0xB0, 1, 10));
+    CHECK(encoder.append(0xB0, 2, 20));
+    CHECK(encoder.append(0xB1, 2, 20));  // another channel
+    CHECK(encoder.append(0xC1, 5, 0, 1)); // one data byte
+    CHECK(encoder.append(0xC1, 6, 0, 1));
+    CHECK(encoder.append(0x90, 60, 127));
+    const Byte expected[] = { 0xB0, 1, 10, 2, 20, 0xB1, 2, 20, 0xC1, 5, 6, 0x90, 60, 127 };
+    CHECK_BYTES(expected, encoded(encoder));
+    CHECK_EQUAL(2, encoder.runningStatusSavings());
+
+    // a new packet starts with its status byte again
+    encoder.reset();
+    CHECK(encoder.append(0x90, 61, 127));
+    const Byte next[] = { 0x90, 61, 127 };
+    CHECK_BYTES(next, encoded(encoder));
+}
+
+static void testFullPacket() {
+    MIDIEncoder encoder;
+    size_t count = 0;
+    while (encoder.append(0xB0, count & 0x7F, 1))
+        count++;
+    // one status byte and two data bytes per message
+    CHECK_EQUAL((LMX_ENCODER_MAX_PACKET - 1) / 2, count);
+    CHECK(encoder.length() <= LMX_ENCODER_MAX_PACKET);
+
+    // a refused message leaves the packet as it was
+    size_t length = encoder.length();
+    CHECK(! encoder.append(0x90, 60, 127));
+    CHECK_EQUAL(length, encoder.length());
+}
+
+// what the Device sent before it encoded runs: every message appended on
+// its own, a new packet whenever one is full
+class ReferencePackets {
+public:
+    void add(Byte status, Byte data1, Byte data2, size_t dataLength = 2) {
+        if (! encoder.append(status, data1, data2, dataLength)) {
+            flush();
+            encoder.append(status, data1, data2, dataLength);
+        }
+    }
+
+    void flush() {
+        if (! encoder.empty())
+            packets.push_back(encoded(encoder));
+        encoder.reset();
+    }
+
+    MIDIEncoder encoder;
+    std::vector<std::vector<Byte> > packets;
+};
+
+// every kind, after every kind of running status, and more than fits
+template <typename Message>
+static void checkRun(Message (*make)(unsigned i)) {
+    for (int before = 0; before < 3; before++) {
+        MIDIEncoder single, run;
+        if (before == 1) {
+            ControlChange other(0, 1, 2);
+            single.append(other.status, other.data1, other.data2);
+            run.appendRun(&other, 1);
+        } else if (before == 2) {
+            Message same = make(0);
+            single.append(same.status, same.data1, same.data2, Message::dataLength);
+            run.appendRun(&same, 1);
+        }
+
+        std::vector<Message> msgs;
+        for (unsigned i = 0; i < 200; i++)
+            msgs.push_back(make(i));
+        size_t fit = 0;
+        while (fit < msgs.size() && single.append(msgs[fit].status, msgs[fit].data1, msgs[fit].data2, Message::dataLength))
+            fit++;
+        CHECK_EQUAL(fit, run.appendRun(msgs.data(), msgs.size()));
+        CHECK(encoded(single) == encoded(run));
+        CHECK_EQUAL(single.runningStatusSavings(), run.runningStatusSavings());
+    }
+}
+
+static NoteOn makeNoteOn(unsigned i) { return NoteOn(3, i, i % 127 + 1); }
+static NoteOff makeNoteOff(unsigned i) { return NoteOff(3, i, 0x7F); }
+static ControlChange makeControlChange(unsigned i) { return ControlChange(3, i % 120, i); }
+static ProgramChange makeProgramChange(unsigned i) { return ProgramChange(3, i); }
+static PitchBend makePitchBend(unsigned i) { return PitchBend(3, i * 81); }
+
+static void testAppendRun() {
+    checkRun(makeNoteOn);
+    checkRun(makeNoteOff);
+    checkRun(makeControlChange);
+    checkRun(makeProgramChange);
+    checkRun(makePitchBend);
+}
+
+// takes messages on any channel, as the effects can leave them
+class ChannelDevice : public TestDevice {
+public:
+    ChannelDevice(Clock *clock, OutputBackend *output) : TestDevice(clock, output) {}
+    void add(const std::vector<midi_message> &msgs) { enqueueMessages(msgs.data(), msgs.size()); }
+};
+
+// a mixed frame, the Device gathering its notes and controls into runs,
+// against the same messages encoded one at a time
+static void testDeviceRuns() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    ChannelDevice device(&clock, &output);
+    device.open();
+
+    std::vector<midi_message> msgs;
+    msgs.push_back(makeControlMessage(1, 10));
+    msgs.push_back(makeNoteMessage(0, 100));
+    msgs.push_back(makeNoteMessage(2, 100));
+    msgs.push_back(makeNoteMessage(0, 100, 1));
+    msgs.push_back(makeNoteMessage(0, 100));    // already on, not sent
+    msgs.push_back(makeNoteMessage(2, 0));
+    msgs.push_back(makeNoteMessage(4, 0));
+    msgs.push_back(makeNoteMessage(5, 100));
+    msgs.push_back(makeControlMessage(2, 20));
+    msgs.push_back(makeControl14Message(5, 0x1234));
+    msgs.push_back(makeControlMessage(1, 11));  // replaces 10
+    msgs.push_back(makeControlMessage(3, 30));
+    msgs.push_back(makeControlMessage(1, 5, 2));
+    for (int cc = 0; cc < 120; cc++)            // more than a packet
+        msgs.push_back(makeControlMessage(cc, cc, 3));
+    device.add(msgs);
+    device.pump();
+
+    ReferencePackets reference;
+    reference.add(0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY);
+    reference.add(0x90, LMX_NOTE_BASE + 2, LMX_NOTE_VELOCITY);
+    reference.add(0x91, LMX_NOTE_BASE, LMX_NOTE_VELOCITY);
+    reference.add(0x80, LMX_NOTE_BASE + 2, 0x7F);
+    reference.add(0x80, LMX_NOTE_BASE + 4, 0x7F);
+    reference.add(0x90, LMX_NOTE_BASE + 5, LMX_NOTE_VELOCITY);
+    reference.add(0xB0, 1, 11);
+    reference.add(0xB0, 2, 20);
+    reference.add(0xB0, 5, 0x1234 >> 7);
+    reference.add(0xB0, 37, 0x1234 & 0x7F);
+    reference.add(0xB0, 3, 30);
+    reference.add(0xB2, 1, 5);
+    for (int cc = 0; cc < 120; cc++)
+        reference.add(0xB3, cc, cc);
+    reference.flush();
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(2, reference.packets.size());
+    CHECK_EQUAL(reference.packets.size(), packets.size());
+    for (size_t i = 0; i < packets.size() && i < reference.packets.size(); i++)
+        CHECK(packets[i].data == reference.packets[i]);
+}
+
+// a frame's notes and controls go out as one packet, notes first
+static void testDevicePacket() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+
+    MessageBatch batch;
+    batch.addControl(1, 10);
+    batch.addNote(0, 100);
+    batch.addControl(2, 20);
+    batch.addNote(1, 100);
+    device.addMessages(batch);
+    device.pump();
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(1, packets.size());
+    const Byte expected[] = {
+        0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY, LMX_NOTE_BASE + 1, LMX_NOTE_VELOCITY,
+        0xB0, 1, 10, 2, 20
+    };
+    CHECK_BYTES(expected, output.bytes());
+    // sent ahead of time, due after the latency offset
+    if (! packets.empty())
+        CHECK_EQUAL(clock.now() + device.getLatencyOffset(), packets[0].timestamp);
+}
+
+// frames with different timestamps don't share a packet or a running status
+static void testDeviceTimestamps() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+
+    MessageBatch first;
+    first.addControl(1, 10);
+    device.addMessages(first);
+    clock.advance(1000000);
+    MessageBatch second;
+    second.addControl(2, 20);
+    device.addMessages(second);
+    device.pump();
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(2, packets.size());
+    const Byte expected[] = { 0xB0, 1, 10, 0xB0, 2, 20 };
+    CHECK_BYTES(expected, output.bytes());
+}
+
+// one frame of its own, what it sent
+static std::vector<Byte> sendFrame(TestDevice &device, FakeClock &clock, MemoryOutput &output, MessageBatch &batch) {
+    output.clear();
+    device.addMessages(batch);
+    batch.clear();
+    clock.advance(1000000);
+    device.pump();
+    return output.bytes();
+}
+
+// the NRPN select only goes out when the parameter changes, or after a
+// plain CC that touches data entry or parameter selection
+static void testDeviceNRPN() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.open();
+
+    MessageBatch batch;
+    batch.addNRPN(300, 1000);
+    const Byte selected[] = { 0xB0, 99, 2, 98, 44, 6, 7, 38, 104 };
+    CHECK_BYTES(selected, sendFrame(device, clock, output, batch));
+
+    // same parameter, no select
+    batch.addNRPN(300, 1001);
+    const Byte lsb[] = { 0xB0, 38, 105 };
+    CHECK_BYTES(lsb, sendFrame(device, clock, output, batch));
+    batch.addNRPN(300, 1200);
+    const Byte full[] = { 0xB0, 6, 9, 38, 48 };
+    CHECK_BYTES(full, sendFrame(device, clock, output, batch));
+
+    // an unrelated CC changes nothing
+    batch.addControl(7, 1);
+    sendFrame(device, clock, output, batch);
+    batch.addNRPN(300, 1201);
+    const Byte lsbAgain[] = { 0xB0, 38, 49 };
+    CHECK_BYTES(lsbAgain, sendFrame(device, clock, output, batch));
+
+    const unsigned char controllers[] = { 6, 38, 98, 99, 100, 101 };
+    for (size_t i = 0; i < sizeof(controllers); i++) {
+        batch.addControl(controllers[i], 1);
+        sendFrame(device, clock, output, batch);
+        batch.addNRPN(300, 1201);
+        const Byte reselected[] = { 0xB0, 99, 2, 98, 44, 6, 9, 38, 49 };
+        CHECK_BYTES(reselected, sendFrame(device, clock, output, batch));
+    }
+}
+
+int main() {
+    testRunningStatus();
+    testFullPacket();
+    testAppendRun();
+    testDevicePacket();
+    testDeviceTimestamps();
+    testDeviceRuns();
+    testDeviceNRPN();
+    return testResult("EncoderTest");
+}
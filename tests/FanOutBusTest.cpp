@@ -0,0 +1,180 @@
+//
+//  FanOutBusTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The fan-out bus with MemoryOutput sinks on a fake clock: a sink that
+// stops sending loses batches without holding up the others or draining
+// the pool, each sink's latency offset shifts its timestamps, and close()
+// still sends everything that was queued.
+
+#include <atomic>
+#include <pthread.h>
+#include "TestSupport.h"
+#include "FanOutBus.h"
+#include "PacketList.h"
+
+using namespace leapmidi;
+
+#define BATCHES 40
+
+// a sink whose send() doesn't return until it's let go
+class GatedOutput : public MemoryOutput {
+public:
+    GatedOutput(Clock *clock) : MemoryOutput(clock), entered(0), released(false) {}
+
+    virtual OSStatus send(const MIDIPacketList *packets) {
+        entered++;
+        while (! released)
+            usleep(1000);
+        return MemoryOutput::send(packets);
+    }
+
+    void release() { released = true; }
+
+    std::atomic<int> entered;
+    std::atomic<bool> released;
+};
+
+static void *releaseLater(void *output) {
+    usleep(50000);
+    ((GatedOutput *)output)->release();
+    return NULL;
+}
+
+// one control change, its value counting the batches
+static const MIDIPacketList *batchOf(PacketList &list, int n) {
+    const Byte data[] = { 0xB0, 1, (Byte)n };
+    list.reset();
+    list.add(0, sizeof(data), data);
+    return list.get();
+}
+
+// the last data byte of every packet, in the order they were sent
+static std::vector<int> batchNumbers(const MemoryOutput &output) {
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    std::vector<int> numbers;
+    for (size_t i = 0; i < packets.size(); i++)
+        numbers.push_back(packets[i].data.back());
+    return numbers;
+}
+
+static std::vector<int> counting(int from, int to) {
+    std::vector<int> numbers;
+    for (int n = from; n < to; n++)
+        numbers.push_back(n);
+    return numbers;
+}
+
+static void testBlockedSink() {
+    FakeClock clock;
+    MemoryOutput fast(&clock);
+    GatedOutput blocked(&clock);
+    FanOutBus bus(&clock);
+    bus.addSink(&fast);
+    bus.addSink(&blocked);
+    CHECK(bus.open());
+
+    // the blocked sink takes the first batch and stops there
+    PacketList list;
+    bus.send(batchOf(list, 0));
+    CHECK(waitFor([&]() { return blocked.entered == 1; }, 1000));
+    for (int n = 1; n < BATCHES; n++) {
+        bus.send(batchOf(list, n));
+        CHECK(waitFor([&]() { return bus.sentCount(0) == (unsigned long)n + 1; }, 1000));
+    }
+
+    // a queue full behind the one it's holding, the rest lost
+    CHECK(batchNumbers(fast) == counting(0, BATCHES));
+    CHECK_EQUAL(0, bus.droppedCount(0));
+    CHECK_EQUAL(BATCHES - 1 - LMX_FANOUT_QUEUE_SIZE, bus.droppedCount(1));
+    CHECK_EQUAL(0, bus.poolExhaustedCount());
+
+    blocked.release();
+    bus.close();
+    CHECK(batchNumbers(blocked) == counting(0, LMX_FANOUT_QUEUE_SIZE + 1));
+    CHECK_EQUAL(LMX_FANOUT_QUEUE_SIZE + 1, bus.sentCount(1));
+    CHECK_EQUAL(0, bus.poolExhaustedCount());
+}
+
+static std::vector<MIDITimeStamp> timestamps(const MemoryOutput &output) {
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    std::vector<MIDITimeStamp> stamps;
+    for (size_t i = 0; i < packets.size(); i++)
+        stamps.push_back(packets[i].timestamp);
+    return stamps;
+}
+
+// packets for now, half a millisecond out and 5ms out
+static void testLatencyOffsets() {
+    FakeClock clock;
+    MemoryOutput unshifted(&clock), later(&clock), earlier(&clock);
+    FanOutBus bus(&clock);
+    bus.addSink(&unshifted);
+    bus.addSink(&later, 2000000);
+    bus.addSink(&earlier, -1000000);
+    CHECK(bus.open());
+
+    uint64_t now = clock.now();
+    const Byte data[] = { 0x90, 60, 100 };
+    PacketList list;
+    list.add(0, sizeof(data), data);
+    list.add(now + 500000, sizeof(data), data);
+    list.add(now + 5000000, sizeof(data), data);
+    bus.send(list.get());
+    bus.close();
+
+    std::vector<MIDITimeStamp> expected;
+    expected.push_back(0);
+    expected.push_back(now + 500000);
+    expected.push_back(now + 5000000);
+    CHECK(timestamps(unshifted) == expected);
+
+    // now counts from the clock
+    expected[0] = now + 2000000;
+    expected[1] = now + 2500000;
+    expected[2] = now + 7000000;
+    CHECK(timestamps(later) == expected);
+
+    // early only as far as now, where the first two become one packet
+    // (MIDIPacketListAdd merges packets with the same timestamp)
+    expected.clear();
+    expected.push_back(0);
+    expected.push_back(now + 4000000);
+    CHECK(timestamps(earlier) == expected);
+    CHECK_EQUAL(3 * sizeof(data), earlier.bytes().size());
+}
+
+// batches still queued when the bus is closed are sent before it returns
+static void testCloseDrains() {
+    FakeClock clock;
+    GatedOutput output(&clock);
+    FanOutBus bus(&clock);
+    bus.addSink(&output);
+    CHECK(bus.open());
+
+    PacketList list;
+    bus.send(batchOf(list, 0));
+    CHECK(waitFor([&]() { return output.entered == 1; }, 1000));
+    for (int n = 1; n < 5; n++)
+        bus.send(batchOf(list, n));
+    CHECK_EQUAL(0, output.packetCount());
+
+    pthread_t releaser;
+    pthread_create(&releaser, NULL, releaseLater, &output);
+    bus.close();
+    pthread_join(releaser, NULL);
+
+    CHECK(batchNumbers(output) == counting(0, 5));
+    CHECK_EQUAL(5, bus.sentCount(0));
+    CHECK_EQUAL(0, bus.droppedCount(0));
+}
+
+int main() {
+    testBlockedSink();
+    testLatencyOffsets();
+    testCloseDrains();
+    return testResult("FanOutBusTest");
+}
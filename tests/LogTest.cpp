@@ -0,0 +1,112 @@
+//
+//  LogTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The shared Logger with its writer held up: records below the level never
+// take a place in the ring, the ring holds LMX_LOG_RING_SIZE records and
+// the ones past that are dropped and counted, and the writer reports how
+// many went missing once it gets going again.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "TestSupport.h"
+#include "Log.h"
+
+using namespace leapmidi;
+
+#define EXTRA_RECORDS 10
+
+// reaches the writer's lock on the shared logger
+class StalledLogger : public Logger {
+public:
+    static pthread_mutex_t &drainLock(Logger &logger) {
+        pthread_mutex_t Logger::*lock = &StalledLogger::drainMutex;
+        return logger.*lock;
+    }
+};
+
+static std::string readFile(const char *path) {
+    std::string text;
+    FILE *f = fopen(path, "r");
+    if (! f)
+        return text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+    return text;
+}
+
+static size_t countLines(const std::string &text, const char *part) {
+    size_t count = 0;
+    for (size_t pos = text.find(part); pos != std::string::npos; pos = text.find(part, pos + 1))
+        count++;
+    return count;
+}
+
+static void testStalledWriter() {
+    Logger &logger = Logger::shared();
+    LogLevel level = logger.getLevel();
+
+    // what the writer writes goes to a file, and so would failed checks,
+    // so they wait until stderr is back
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/LogTest-%d.log", (int)getpid());
+    fflush(stderr);
+    int savedStderr = dup(fileno(stderr));
+    bool redirected = freopen(path, "w", stderr) != NULL;
+
+    logger.flush();
+    unsigned long dropped = logger.droppedCount();
+    pthread_mutex_lock(&StalledLogger::drainLock(logger));
+
+    // more than the ring holds, but below the level
+    logger.setLevel(LOG_WARN);
+    for (int i = 0; i < LMX_LOG_RING_SIZE + EXTRA_RECORDS; i++) {
+        LMX_LOG(LOG_DEBUG, "debug %d", i);
+        LMX_LOG(LOG_INFO, "info %d", i);
+    }
+    unsigned long droppedBelowLevel = logger.droppedCount() - dropped;
+
+    // the ring still has room for all of its own
+    for (int i = 0; i < LMX_LOG_RING_SIZE + EXTRA_RECORDS; i++)
+        LMX_LOG(LOG_WARN, "warn %d", i);
+    unsigned long droppedFull = logger.droppedCount() - dropped;
+
+    pthread_mutex_unlock(&StalledLogger::drainLock(logger));
+    logger.flush();
+    logger.setLevel(level);
+
+    fflush(stderr);
+    dup2(savedStderr, fileno(stderr));
+    close(savedStderr);
+
+    CHECK(redirected);
+    CHECK_EQUAL(0, droppedBelowLevel);
+    CHECK_EQUAL(EXTRA_RECORDS, droppedFull);
+
+    // the first LMX_LOG_RING_SIZE, then the count of the rest
+    std::string written = readFile(path);
+    CHECK_EQUAL(LMX_LOG_RING_SIZE, countLines(written, "WARN: warn "));
+    CHECK_EQUAL(0, countLines(written, "debug "));
+    CHECK_EQUAL(0, countLines(written, "info "));
+    char line[64];
+    snprintf(line, sizeof(line), "WARN: warn %d\n", LMX_LOG_RING_SIZE - 1);
+    CHECK_EQUAL(1, countLines(written, line));
+    snprintf(line, sizeof(line), "WARN: warn %d\n", LMX_LOG_RING_SIZE);
+    CHECK_EQUAL(0, countLines(written, line));
+    snprintf(line, sizeof(line), "WARN: %d log messages dropped\n", EXTRA_RECORDS);
+    CHECK_EQUAL(1, countLines(written, line));
+    unlink(path);
+}
+
+int main() {
+    testStalledWriter();
+    return testResult("LogTest");
+}
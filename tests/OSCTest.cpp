@@ -0,0 +1,210 @@
+//
+//  OSCTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// OSCOutput sending to a UDP socket on localhost: every datagram is
+// decoded and checked, bundles that outgrow one datagram are split with
+// the same timetag, and timetags follow capture times.
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include "TestSupport.h"
+#include "OSCOutput.h"
+
+using namespace leapmidi;
+
+struct OSCMessage {
+    std::string address;
+    float value;
+};
+
+struct OSCBundle {
+    uint64_t timetag;
+    std::vector<OSCMessage> messages;
+    size_t length;
+};
+
+static uint32_t readWord(const uint8_t *p) {
+    uint32_t word;
+    memcpy(&word, p, 4);
+    return ntohl(word);
+}
+
+// false if it isn't a bundle of messages with one float each
+static bool decodeBundle(const uint8_t *data, size_t length, OSCBundle &bundle) {
+    if (length < 16 || memcmp(data, "#bundle", 8))
+        return false;
+    bundle.timetag = ((uint64_t)readWord(data + 8) << 32) | readWord(data + 12);
+    bundle.length = length;
+    bundle.messages.clear();
+
+    for (size_t pos = 16; pos < length; ) {
+        if (pos + 4 > length)
+            return false;
+        size_t size = readWord(data + pos);
+        const uint8_t *message = data + pos + 4;
+        pos += 4 + size;
+        if (pos > length || size % 4)
+            return false;
+
+        OSCMessage decoded;
+        decoded.address = std::string((const char *)message, strnlen((const char *)message, size));
+        size_t tags = (decoded.address.size() + 4) & ~3;
+        if (tags + 8 != size || memcmp(message + tags, ",f\0\0", 4))
+            return false;
+        uint32_t bits = readWord(message + tags + 4);
+        memcpy(&decoded.value, &bits, 4);
+        bundle.messages.push_back(decoded);
+    }
+    return true;
+}
+
+class Receiver {
+public:
+    Receiver() {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(sock, (sockaddr *)&addr, sizeof(addr));
+        socklen_t length = sizeof(addr);
+        getsockname(sock, (sockaddr *)&addr, &length);
+        port = ntohs(addr.sin_port);
+
+        timeval timeout = { 1, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    ~Receiver() { ::close(sock); }
+
+    // the next datagram, false if none came or it doesn't decode
+    bool receive(OSCBundle &bundle) {
+        uint8_t buffer[2048];
+        ssize_t length = recv(sock, buffer, sizeof(buffer), 0);
+        return length > 0 && decodeBundle(buffer, length, bundle);
+    }
+
+    // true if nothing is waiting
+    bool idle() {
+        uint8_t buffer[2048];
+        return recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT) < 0;
+    }
+
+    uint16_t port;
+
+protected:
+    int sock;
+};
+
+static std::string address(const char *kind, int index) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "/leapmidi/%s/%d", kind, index);
+    return buffer;
+}
+
+// a frame's worth of controls, more than fit in one datagram
+static void testSplitBundle() {
+    Receiver receiver;
+    FakeClock clock;
+    OSCOutput osc("127.0.0.1", receiver.port, "/leapmidi", &clock);
+    CHECK(osc.open());
+
+    osc.beginBundle(clock.now());
+    for (int i = 0; i < 100; i++)
+        osc.addControl(i, i * 0.5f);
+    osc.addNote(3, 0.25f);
+    osc.sendBundle();
+
+    std::vector<OSCMessage> messages;
+    size_t datagrams = 0;
+    uint64_t timetag = 0;
+    OSCBundle bundle;
+    while (messages.size() < 101 && receiver.receive(bundle)) {
+        CHECK(bundle.length <= LMX_OSC_MAX_PACKET);
+        if (datagrams++)
+            CHECK_EQUAL(timetag, bundle.timetag);
+        timetag = bundle.timetag;
+        messages.insert(messages.end(), bundle.messages.begin(), bundle.messages.end());
+    }
+
+    CHECK(datagrams > 1);
+    CHECK_EQUAL(datagrams, osc.sentCount());
+    CHECK_EQUAL(0, osc.droppedCount());
+    CHECK_EQUAL(101, messages.size());
+    for (size_t i = 0; i < messages.size() && i < 100; i++) {
+        CHECK(messages[i].address == address("control", i));
+        CHECK(messages[i].value == i * 0.5f);
+    }
+    if (messages.size() == 101) {
+        CHECK(messages[100].address == address("note", 3));
+        CHECK(messages[100].value == 0.25f);
+    }
+    CHECK(receiver.idle());
+}
+
+// timetags are capture time + latency, in NTP's 32.32 fixed point
+static void testTimetags() {
+    Receiver receiver;
+    FakeClock clock;
+    OSCOutput osc("127.0.0.1", receiver.port, "/leapmidi", &clock);
+    CHECK(osc.open());
+
+    uint64_t captured = clock.now();
+    OSCBundle bundles[3];
+    osc.beginBundle(captured);
+    osc.addControl(1, 1.0f);
+    osc.sendBundle();
+    CHECK(receiver.receive(bundles[0]));
+
+    osc.beginBundle(captured + 1000000000ULL);
+    osc.addControl(1, 1.0f);
+    osc.sendBundle();
+    CHECK(receiver.receive(bundles[1]));
+
+    osc.setLatency(500000000ULL);
+    osc.beginBundle(captured);
+    osc.addControl(1, 1.0f);
+    osc.sendBundle();
+    CHECK(receiver.receive(bundles[2]));
+
+    // a second later, then half a second later, give or take rounding
+    int64_t second = bundles[1].timetag - bundles[0].timetag;
+    int64_t half = bundles[2].timetag - bundles[0].timetag;
+    CHECK(second >= (1LL << 32) - 1 && second <= (1LL << 32) + 1);
+    CHECK(half >= (1LL << 31) - 1 && half <= (1LL << 31) + 1);
+
+    // nothing in it, nothing sent
+    osc.beginBundle(captured);
+    osc.sendBundle();
+    CHECK(receiver.idle());
+    CHECK_EQUAL(3, osc.sentCount());
+}
+
+// outside of a frame, a bundle of its own
+static void testSingle() {
+    Receiver receiver;
+    OSCOutput osc("127.0.0.1", receiver.port, "/leapmidi");
+    CHECK(osc.open());
+
+    osc.sendControl(7, 0.75f);
+    OSCBundle bundle;
+    CHECK(receiver.receive(bundle));
+    CHECK_EQUAL(1, bundle.messages.size());
+    if (bundle.messages.size() == 1) {
+        CHECK(bundle.messages[0].address == address("control", 7));
+        CHECK(bundle.messages[0].value == 0.75f);
+    }
+}
+
+int main() {
+    testSplitBundle();
+    testTimetags();
+    testSingle();
+    return testResult("OSCTest");
+}
@@ -0,0 +1,130 @@
+//
+//  RTPMIDITest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// An RTP-MIDI initiator and responder talking over localhost, the
+// responder playing what it receives into a MemoryOutput: session setup,
+// delivery, recovery from the journal after a lost packet, SysEx across
+// packets, a MIDIPacket too big for one RTP packet, clock synchronization
+// and goodbye.
+
+#include <initializer_list>
+#include "TestSupport.h"
+#include "RTPMIDISession.h"
+#include "PacketList.h"
+
+using namespace leapmidi;
+
+// a session that can lose a packet on purpose
+class LossySession : public RTPMIDISession {
+public:
+    LossySession() : RTPMIDISession("initiator", 0) {}
+
+    // goes through the sending side (sequence number, journal) but never
+    // reaches the network
+    void lose(const MIDIPacketList *packets) {
+        int socket = dataSocket;
+        dataSocket = -1;
+        send(packets);
+        dataSocket = socket;
+    }
+};
+
+static const MIDIPacketList *packetOf(PacketList &list, std::initializer_list<Byte> bytes) {
+    std::vector<Byte> data(bytes);
+    list.reset();
+    list.add(0, data.size(), data.data());
+    return list.get();
+}
+
+// a list with one packet of any length, bigger than PacketList makes them
+static const MIDIPacketList *bigPacketOf(std::vector<Byte> &buffer, const std::vector<Byte> &data) {
+    buffer.assign(sizeof(MIDIPacketList) + data.size(), 0);
+    MIDIPacketList *packets = (MIDIPacketList *)buffer.data();
+    packets->numPackets = 1;
+    packets->packet[0].timeStamp = 0;
+    packets->packet[0].length = data.size();
+    memcpy(packets->packet[0].data, data.data(), data.size());
+    return packets;
+}
+
+int main() {
+    MemoryOutput received;
+    RTPMIDISession responder("responder", 0);
+    responder.setReceiver(&received);
+    CHECK(responder.open());
+
+    LossySession initiator;
+    initiator.setInitiator("127.0.0.1", responder.getControlPort());
+    CHECK(initiator.open());
+    CHECK(waitFor([&]() { return initiator.connected() && responder.connected(); }, 2000));
+
+    PacketList list;
+    initiator.send(packetOf(list, { 0x90, 0x40, 0x7F, 0xB0, 0x07, 0x10 }));
+    CHECK(waitFor([&]() { return received.packetCount() == 1; }, 1000));
+    const Byte first[] = { 0x90, 0x40, 0x7F, 0xB0, 0x07, 0x10 };
+    CHECK_BYTES(first, received.bytes());
+
+    // the next packet tells the responder one went missing, the journal
+    // gets it the note-off, the controller and the new note
+    received.clear();
+    initiator.lose(packetOf(list, { 0x80, 0x40, 0x7F, 0xB0, 0x07, 0x64, 0x90, 0x41, 0x60 }));
+    initiator.send(packetOf(list, { 0xB0, 0x01, 0x05 }));
+    CHECK(waitFor([&]() { return received.bytes().size() >= 12; }, 1000));
+    const Byte recovered[] = { 0xB0, 0x07, 0x64, 0x90, 0x41, 0x60, 0x80, 0x40, 0x40, 0xB0, 0x01, 0x05 };
+    CHECK_BYTES(recovered, received.bytes());
+    CHECK_EQUAL(1, responder.packetsLost());
+    CHECK_EQUAL(3, responder.commandsRecovered());
+
+    // a SysEx message split over three packets arrives whole
+    received.clear();
+    initiator.send(packetOf(list, { 0xF0, 0x01, 0x02, 0x03 }));
+    initiator.send(packetOf(list, { 0x04, 0x05, 0x06 }));
+    initiator.send(packetOf(list, { 0x07, 0xF7, 0x90, 0x42, 0x50 }));
+    CHECK(waitFor([&]() { return received.bytes().size() >= 12; }, 1000));
+    const Byte sysEx[] = { 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0xF7, 0x90, 0x42, 0x50 };
+    CHECK_BYTES(sysEx, received.bytes());
+
+    // a packet whose commands need more than one RTP packet: notes in
+    // running status, then a SysEx message carried on in F7 ... segments
+    received.clear();
+    std::vector<Byte> big, buffer;
+    big.push_back(0x90);
+    for (int i = 0; i < 200; i++) {
+        big.push_back(i % 128);
+        big.push_back(1 + i % 127);
+    }
+    initiator.send(bigPacketOf(buffer, big));
+    CHECK(waitFor([&]() { return received.bytes().size() >= 600; }, 1000));
+    std::vector<Byte> notes;
+    for (int i = 0; i < 200; i++) {
+        notes.push_back(0x90);
+        notes.push_back(i % 128);
+        notes.push_back(1 + i % 127);
+    }
+    CHECK(received.bytes() == notes);
+
+    received.clear();
+    big.assign(1, 0xF0);
+    for (int i = 0; i < 1200; i++)
+        big.push_back(i % 128);
+    big.push_back(0xF7);
+    big.push_back(0x90);
+    big.push_back(0x43);
+    big.push_back(0x50);
+    initiator.send(bigPacketOf(buffer, big));
+    CHECK(waitFor([&]() { return received.bytes().size() >= big.size(); }, 1000));
+    CHECK(received.bytes() == big);
+
+    // both ends synchronize clocks shortly after connecting
+    CHECK(waitFor([&]() { return initiator.clockSynced() && responder.clockSynced(); }, 3000));
+
+    initiator.close();
+    CHECK(waitFor([&]() { return responder.getState() == RTPMIDISession::IDLE; }, 1000));
+    responder.close();
+
+    return testResult("RTPMIDITest");
+}
@@ -0,0 +1,93 @@
+//
+//  RateLimitTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The per-output byte rate limit on a fake clock: what it lets through is
+// charged the bytes that were actually encoded, and every output gets the
+// same stream under the tightest cap.
+
+#include "TestSupport.h"
+#include "TokenBucket.h"
+
+using namespace leapmidi;
+
+#define BURST 30
+
+// nanoseconds for bytes at DIN speed
+static uint64_t dinTime(size_t bytes) {
+    return bytes * 1000000000ULL / LMX_DIN_BYTES_PER_SECOND;
+}
+
+static void testRunningStatusCharged() {
+    FakeClock clock;
+    MemoryOutput din(&clock);
+    MemoryOutput recorder(&clock);
+    TestDevice device(&clock, &din);
+    device.addOutput(&recorder);
+    device.setRateLimit(&din, LMX_DIN_BYTES_PER_SECOND, BURST);
+    device.open();
+
+    MessageBatch batch;
+    for (int cc = 0; cc < 20; cc++)
+        batch.addControl(cc, 1);
+    device.addMessages(batch);
+    device.pump();
+
+    // the first control takes 3 bytes, the rest 2 with running status;
+    // a control needs 3 bytes of credit to go, so 14 fit in the burst
+    // (charged 3 bytes each, only 10 would)
+    std::vector<Byte> sent = din.bytes();
+    CHECK_EQUAL(1 + 14 * 2, sent.size());
+
+    // the last 6, once there's credit for them
+    clock.advance(dinTime(1 + 6 * 2));
+    device.pump();
+    sent = din.bytes();
+    CHECK_EQUAL(1 + 14 * 2 + 1 + 6 * 2, sent.size());
+    if (sent.size() == 1 + 14 * 2 + 1 + 6 * 2) {
+        CHECK_EQUAL(0xB0, sent[0]);
+        CHECK_EQUAL(0xB0, sent[1 + 14 * 2]);
+        CHECK_EQUAL(19, sent[sent.size() - 2]);
+    }
+    CHECK_EQUAL(20, device.laneSentCount(Device::LANE_CONTROL));
+
+    // the unlimited output got the same stream
+    CHECK(recorder.bytes() == din.bytes());
+}
+
+// bytes the receiver already has aren't charged either
+static void testSuppressedCharged() {
+    FakeClock clock;
+    MemoryOutput din(&clock);
+    TestDevice device(&clock, &din);
+    device.setRateLimit(&din, LMX_DIN_BYTES_PER_SECOND, 9);
+    device.open();
+
+    // MSB and LSB: 6 of the 9 bytes
+    MessageBatch batch;
+    batch.addControl14(1, 0x2000);
+    device.addMessages(batch);
+    device.pump();
+
+    // then only LSBs, 3 bytes each; a 14 bit controller needs 6 bytes of
+    // credit to go, 3 are left over and 3 come in between (charged 6
+    // bytes each, the last one would have to wait)
+    for (int value = 1; value <= 2; value++) {
+        clock.advance(dinTime(3));
+        batch.clear();
+        batch.addControl14(1, 0x2000 + value);
+        device.addMessages(batch);
+        device.pump();
+    }
+    const Byte expected[] = { 0xB0, 1, 0x40, 33, 0x00, 0xB0, 33, 0x01, 0xB0, 33, 0x02 };
+    CHECK_BYTES(expected, din.bytes());
+}
+
+int main() {
+    testRunningStatusCharged();
+    testSuppressedCharged();
+    return testResult("RateLimitTest");
+}
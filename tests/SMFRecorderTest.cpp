@@ -0,0 +1,122 @@
+//
+//  SMFRecorderTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The SMFRecorder on a fake clock: delta times either side of the one and
+// two byte variable-length boundaries, the track chunk length filled in by
+// close(), and repair() of a file left with a stale length and a partly
+// written last event.
+
+#include <stdio.h>
+#include <unistd.h>
+#include "TestSupport.h"
+#include "SMFRecorder.h"
+#include "PacketList.h"
+
+using namespace leapmidi;
+
+// half a millisecond, one tick of the file
+#define TICK_NS 500000ULL
+
+static std::string tempPath() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/SMFRecorderTest-%d.mid", (int)getpid());
+    return path;
+}
+
+static std::vector<Byte> readFile(const std::string &path) {
+    std::vector<Byte> bytes;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (! f)
+        return bytes;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+        bytes.push_back(c);
+    fclose(f);
+    return bytes;
+}
+
+static void writeFile(const std::string &path, const std::vector<Byte> &bytes) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (! f)
+        return;
+    fwrite(&bytes[0], 1, bytes.size(), f);
+    fclose(f);
+}
+
+// header and tempo as open() writes them, then a note on and off with
+// deltas of 0x7F, 0x80, 0x3FFF and 0x4000 ticks
+static const Byte recorded[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x03, 0xE8,
+    'M', 'T', 'r', 'k', 0, 0, 0, 31,
+    0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+    0x7F, 0x90, 60, 100,
+    0x81, 0x00, 0x80, 60, 0,
+    0xFF, 0x7F, 0x90, 62, 100,
+    0x81, 0x80, 0x00, 0x80, 62, 0,
+    0x00, 0xFF, 0x2F, 0x00
+};
+
+static void record(const std::string &path) {
+    FakeClock clock;
+    SMFRecorder recorder(path, &clock);
+    CHECK(recorder.open());
+
+    uint64_t start = clock.now();
+    const Byte on60[] = { 0x90, 60, 100 }, off60[] = { 0x80, 60, 0 };
+    const Byte on62[] = { 0x90, 62, 100 }, off62[] = { 0x80, 62, 0 };
+    PacketList list;
+    list.add(start + 0x7F * TICK_NS, sizeof(on60), on60);
+    list.add(start + (0x7F + 0x80) * TICK_NS, sizeof(off60), off60);
+    list.add(start + (0x7F + 0x80 + 0x3FFF) * TICK_NS, sizeof(on62), on62);
+    list.add(start + (0x7F + 0x80 + 0x3FFF + 0x4000) * TICK_NS, sizeof(off62), off62);
+    recorder.send(list.get());
+
+    recorder.close();
+    CHECK_EQUAL(0, recorder.droppedCount());
+}
+
+static void testRecord() {
+    std::string path = tempPath();
+    record(path);
+    CHECK_BYTES(recorded, readFile(path));
+    unlink(path.c_str());
+}
+
+static void testRepair() {
+    std::string path = tempPath();
+    std::vector<Byte> whole(recorded, recorded + sizeof(recorded));
+
+    // as a crash leaves it: the length from the last sync (just the
+    // tempo), no end of track and half a note on
+    std::vector<Byte> damaged(whole.begin(), whole.end() - 4);
+    damaged[21] = 7;
+    damaged.push_back(0x05);
+    damaged.push_back(0x90);
+    damaged.push_back(60);
+    writeFile(path, damaged);
+    CHECK(SMFRecorder::repair(path));
+    CHECK_BYTES(recorded, readFile(path));
+
+    // complete but for the length
+    damaged = whole;
+    damaged[21] = 0;
+    writeFile(path, damaged);
+    CHECK(SMFRecorder::repair(path));
+    CHECK_BYTES(recorded, readFile(path));
+
+    // not one of ours
+    damaged.assign(10, 0);
+    writeFile(path, damaged);
+    CHECK(! SMFRecorder::repair(path));
+    unlink(path.c_str());
+}
+
+int main() {
+    testRecord();
+    testRepair();
+    return testResult("SMFRecorderTest");
+}
@@ -0,0 +1,116 @@
+//
+//  ScheduleTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Future-dated messages on a fake clock, run through an EffectChain the
+// way LMXListener schedules them: they come out moved by the effects when
+// they're due, and a cancel finds the note on whatever note and channel
+// the effects sent it to.
+
+#include "TestSupport.h"
+#include "EffectChain.h"
+
+using namespace leapmidi;
+
+#define DELAY_NS 5000000
+
+// what LMXListener::sendLater() does
+static void sendLater(Device &device, EffectChain &effects, MessageBatch &batch, uint64_t delay) {
+    effects.process(batch);
+    device.addMessages(batch, device.getClock()->now() + delay);
+}
+
+// a chain sending notes up two semitones on channel 5
+static void setUpEffects(EffectChain &effects) {
+    uint8_t map[16];
+    for (int channel = 0; channel < 16; channel++)
+        map[channel] = channel;
+    map[0] = 5;
+    effects.addTranspose(2);
+    effects.addChannelRemap(map);
+}
+
+static void testScheduledThroughEffects() {
+    FakeClock clock;
+    MemoryOutput output(&clock, false);
+    TestDevice device(&clock, &output);
+    device.setLatencyOffset(0);
+    device.open();
+    EffectChain effects;
+    setUpEffects(effects);
+
+    MessageBatch batch;
+    batch.addNote(0, 100);
+    batch.addControl(7, 90);
+    sendLater(device, effects, batch, DELAY_NS);
+    device.pump();
+    CHECK_EQUAL(0, output.packetCount());
+    CHECK_EQUAL(2, device.scheduledMessageCount());
+
+    clock.advance(DELAY_NS);
+    device.pump();
+    const Byte expected[] = { 0x95, LMX_NOTE_BASE + 2, LMX_NOTE_VELOCITY, 0xB5, 7, 90 };
+    CHECK_BYTES(expected, output.bytes());
+}
+
+// a note-on and its note-off scheduled, then cancelled, first the way
+// the listener does it and then with the device's own cancel
+static void testCancelThroughEffects() {
+    FakeClock clock;
+    MemoryOutput output(&clock, false);
+    TestDevice device(&clock, &output);
+    device.setLatencyOffset(0);
+    device.open();
+    EffectChain effects;
+    setUpEffects(effects);
+
+    MessageBatch batch;
+    batch.addNote(0, 100);
+    sendLater(device, effects, batch, DELAY_NS);
+    batch.clear();
+    batch.addNote(0, 0);
+    sendLater(device, effects, batch, 2 * DELAY_NS);
+    device.pump();
+    CHECK_EQUAL(2, device.scheduledMessageCount());
+
+    // as it is, it doesn't find the note on channel 0
+    batch.clear();
+    batch.addCancel(0);
+    device.addMessages(batch);
+    device.pump();
+    CHECK_EQUAL(2, device.scheduledMessageCount());
+
+    // through the effects it does
+    batch.clear();
+    batch.addCancel(0);
+    effects.process(batch);
+    device.addMessages(batch);
+    device.pump();
+    CHECK_EQUAL(0, device.scheduledMessageCount());
+
+    batch.clear();
+    batch.addNote(1, 100);
+    sendLater(device, effects, batch, DELAY_NS);
+    device.pump();
+    CHECK_EQUAL(1, device.scheduledMessageCount());
+    device.cancelScheduledNote(1);
+    device.cancelScheduledNote(3);
+    device.pump();
+    CHECK_EQUAL(1, device.scheduledMessageCount());
+    device.cancelScheduledNote(3, 5);
+    device.pump();
+    CHECK_EQUAL(0, device.scheduledMessageCount());
+
+    clock.advance(2 * DELAY_NS);
+    device.pump();
+    CHECK_EQUAL(0, output.packetCount());
+}
+
+int main() {
+    testScheduledThroughEffects();
+    testCancelThroughEffects();
+    return testResult("ScheduleTest");
+}
@@ -0,0 +1,124 @@
+//
+//  SysExTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// SysEx dumps streamed a chunk at a time into a MemoryOutput: a message
+// longer than a chunk arrives whole and in order with nothing in between,
+// chunks end on message boundaries where they can, and a message cut
+// short by the Device going away still gets its end.
+
+#include "TestSupport.h"
+
+using namespace leapmidi;
+
+#define CHUNK_SIZE 16
+
+// a single SysEx message of length bytes
+static std::vector<Byte> sysExMessage(size_t length, Byte seed) {
+    std::vector<Byte> message;
+    message.push_back(0xF0);
+    for (size_t i = 0; i < length - 2; i++)
+        message.push_back((seed + i) & 0x7F);
+    message.push_back(0xF7);
+    return message;
+}
+
+// one message over three chunks, a note played meanwhile waits for its end
+static void testThreeChunks() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.setSysExChunkSize(CHUNK_SIZE);
+    device.open();
+
+    std::vector<Byte> dump = sysExMessage(2 * CHUNK_SIZE + 8, 1);
+    SysExTransfer transfer(dump.data(), dump.size());
+    CHECK(device.sendSysEx(&transfer));
+    CHECK(device.step());
+    CHECK_EQUAL(SysExTransfer::SENDING, transfer.getState());
+    CHECK_EQUAL(CHUNK_SIZE, transfer.bytesSent());
+
+    MessageBatch batch;
+    batch.addNote(0, 100);
+    device.addMessages(batch);
+    device.pump();
+    CHECK_EQUAL(SysExTransfer::SENT, transfer.getState());
+    CHECK_EQUAL(dump.size(), transfer.bytesSent());
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(4, packets.size());
+    if (packets.size() == 4) {
+        size_t lengths[] = { CHUNK_SIZE, CHUNK_SIZE, 8 };
+        size_t offset = 0;
+        for (int i = 0; i < 3; i++) {
+            std::vector<Byte> chunk(dump.begin() + offset, dump.begin() + offset + lengths[i]);
+            CHECK(packets[i].data == chunk);
+            offset += lengths[i];
+        }
+        const Byte note[] = { 0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY };
+        CHECK_BYTES(note, packets[3].data);
+    }
+}
+
+// short messages go a whole one per chunk, a note can go in between
+static void testMessageBoundaries() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.setSysExChunkSize(CHUNK_SIZE);
+    device.open();
+
+    std::vector<Byte> dump;
+    for (Byte m = 0; m < 3; m++) {
+        std::vector<Byte> message = sysExMessage(10, m);
+        dump.insert(dump.end(), message.begin(), message.end());
+    }
+    SysExTransfer transfer(dump.data(), dump.size());
+    CHECK(device.sendSysEx(&transfer));
+    CHECK(device.step());
+
+    MessageBatch batch;
+    batch.addNote(0, 100);
+    device.addMessages(batch);
+    device.pump();
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(4, packets.size());
+    if (packets.size() == 4) {
+        CHECK(packets[0].data == std::vector<Byte>(dump.begin(), dump.begin() + 10));
+        const Byte note[] = { 0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY };
+        CHECK_BYTES(note, packets[1].data);
+        CHECK(packets[2].data == std::vector<Byte>(dump.begin() + 10, dump.begin() + 20));
+        CHECK(packets[3].data == std::vector<Byte>(dump.begin() + 20, dump.end()));
+    }
+}
+
+static void testCutShort() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    std::vector<Byte> dump = sysExMessage(3 * CHUNK_SIZE, 1);
+    SysExTransfer transfer(dump.data(), dump.size());
+    {
+        TestDevice device(&clock, &output);
+        device.setSysExChunkSize(CHUNK_SIZE);
+        device.open();
+        CHECK(device.sendSysEx(&transfer));
+        CHECK(device.step());
+    }
+
+    CHECK_EQUAL(SysExTransfer::FAILED, transfer.getState());
+    std::vector<Byte> sent = output.bytes();
+    std::vector<Byte> expected(dump.begin(), dump.begin() + CHUNK_SIZE);
+    expected.push_back(0xF7);
+    CHECK(sent == expected);
+}
+
+int main() {
+    testThreeChunks();
+    testMessageBoundaries();
+    testCutShort();
+    return testResult("SysExTest");
+}
@@ -0,0 +1,123 @@
+//
+//  TestSupport.h
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// What the tests share: checks that count failures instead of stopping,
+// a clock the test sets by hand, and a Device without a sending thread
+// that the test drives itself, so what it sends only depends on the
+// messages and the clock.
+
+#ifndef __LeapMIDIX__TestSupport__
+#define __LeapMIDIX__TestSupport__
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "Device.h"
+#include "MemoryOutput.h"
+#include "HostClock.h"
+
+namespace leapmidi {
+
+static int testFailures = 0;
+
+#define CHECK(cond) do { \
+    if (! (cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        testFailures++; \
+    } \
+} while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+    unsigned long long e_ = (unsigned long long)(expected), a_ = (unsigned long long)(actual); \
+    if (e_ != a_) { \
+        fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual, a_, e_); \
+        testFailures++; \
+    } \
+} while (0)
+
+// bytes against an expected array, printing both when they differ
+#define CHECK_BYTES(expected, actual) \
+    checkBytes(__FILE__, __LINE__, expected, sizeof(expected), actual)
+
+static inline void printBytes(const char *label, const Byte *bytes, size_t length) {
+    fprintf(stderr, "  %s:", label);
+    for (size_t i = 0; i < length; i++)
+        fprintf(stderr, " %02X", bytes[i]);
+    fprintf(stderr, "\n");
+}
+
+static inline void checkBytes(const char *file, int line, const Byte *expected, size_t length, const std::vector<Byte> &actual) {
+    if (actual.size() == length && ! memcmp(actual.data(), expected, length))
+        return;
+    fprintf(stderr, "%s:%d: bytes differ\n", file, line);
+    printBytes("expected", expected, length);
+    printBytes("actual", actual.data(), actual.size());
+    testFailures++;
+}
+
+// 0 if every check passed, for main() to return
+static inline int testResult(const char *name) {
+    if (testFailures)
+        fprintf(stderr, "%s: %d checks failed\n", name, testFailures);
+    else
+        printf("%s: ok\n", name);
+    return testFailures ? 1 : 0;
+}
+
+// poll for something another thread does, true if it happened in time
+template <typename Condition>
+static bool waitFor(Condition done, int millis) {
+    for (int i = 0; i < millis / 10 && ! done(); i++)
+        usleep(10000);
+    return done();
+}
+
+// only moves when the test says so
+class FakeClock : public Clock {
+public:
+    // starts well away from 0, the Device takes its epoch from it
+    FakeClock(uint64_t start = 1000000000ULL) : t(start) {}
+
+    virtual uint64_t now() const { return t; }
+    void advance(uint64_t nanos) { t += nanos; }
+    void set(uint64_t nanos) { t = nanos; }
+
+protected:
+    uint64_t t;
+};
+
+// sends whatever is ready whenever pump() is called, on the caller's
+// thread, instead of from a thread of its own
+class TestDevice : public Device {
+public:
+    TestDevice(Clock *clock, OutputBackend *output) : Device(clock, output) {}
+
+    // open the outputs, instead of init()
+    void open() { createDevice(); }
+
+    // send everything that can go at the clock's current time
+    void pump() {
+        uint64_t deadline;
+        while (serviceSender(deadline))
+            ;
+    }
+
+    // one pass of the sending thread, true if anything was sent
+    bool step() {
+        uint64_t deadline;
+        return serviceSender(deadline);
+    }
+
+private:
+    TestDevice(const TestDevice &);
+    TestDevice &operator=(const TestDevice &);
+};
+
+} // namespace leapmidi
+
+#endif /* defined(__LeapMIDIX__TestSupport__) */
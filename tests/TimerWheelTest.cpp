@@ -0,0 +1,208 @@
+//
+//  TimerWheelTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// The TimerWheel on its own: messages due on every level and beyond the
+// wheel's reach come out exactly when they're due, however unevenly it's
+// advanced, in insertion order within a tick; the next deadline is never
+// after a message is due; cancelling by handle and by key.
+
+#include "TestSupport.h"
+#include "TimerWheel.h"
+
+using namespace leapmidi;
+
+// one tick, and the ticks each level turns over at
+#define TICK_NS (1ULL << 16)
+#define LEVEL1_TICKS (1ULL << 8)
+#define LEVEL2_TICKS (1ULL << 14)
+#define LEVEL3_TICKS (1ULL << 20)
+#define WHEEL_TICKS (1ULL << 26)
+
+// near the end of a turn of every level, so the slots wanted next are
+// before the current one
+#define START_TICK ((63ULL << 20) + (63ULL << 14) + (62ULL << 8) + 200)
+
+static midi_message idMessage(uint32_t id) {
+    return makeNoteMessage(0, 100, 0, id);
+}
+
+struct Expected {
+    uint64_t due;
+    uint32_t id;
+    bool released;
+};
+
+static midi_message out[LMX_TIMER_WHEEL_SIZE];
+
+// advance to now, checking that exactly what's due by then comes out, in
+// order of due tick
+static void advanceTo(TimerWheel &wheel, uint64_t now, std::vector<Expected> &expected) {
+    size_t count = wheel.advance(now, out, LMX_TIMER_WHEEL_SIZE);
+    size_t due = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (! expected[i].released && expected[i].due <= now)
+            due++;
+    }
+    CHECK_EQUAL(due, count);
+
+    uint64_t lastTick = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool found = false;
+        for (size_t e = 0; e < expected.size(); e++) {
+            if (expected[e].id != out[i].time || expected[e].released)
+                continue;
+            found = expected[e].due <= now;
+            expected[e].released = true;
+            CHECK(expected[e].due / TICK_NS >= lastTick);
+            lastTick = expected[e].due / TICK_NS;
+        }
+        CHECK(found);
+    }
+}
+
+// the earliest due time still waiting, 0 if none
+static uint64_t nextDue(const std::vector<Expected> &expected) {
+    uint64_t next = 0;
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (! expected[i].released && (! next || expected[i].due < next))
+            next = expected[i].due;
+    }
+    return next;
+}
+
+// due past each level and past the wheel, stepped through in uneven
+// jumps that stop a nanosecond before and at every due time
+static void testLevels() {
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = START_TICK * TICK_NS + 777;
+    uint64_t delays[] = {
+        10 * TICK_NS + 5,
+        LEVEL1_TICKS * TICK_NS + 300 * TICK_NS + 17,
+        LEVEL2_TICKS * TICK_NS + 41 * TICK_NS,
+        LEVEL2_TICKS * TICK_NS * 5 + 3,
+        LEVEL3_TICKS * TICK_NS + 1000 * TICK_NS + 999,
+        LEVEL3_TICKS * TICK_NS * 33,
+        WHEEL_TICKS * TICK_NS - TICK_NS,
+        WHEEL_TICKS * TICK_NS + 1000 * TICK_NS + 1,   // beyond the wheel
+        WHEEL_TICKS * TICK_NS * 3 + 12345,
+    };
+    std::vector<Expected> expected;
+    for (uint32_t i = 0; i < sizeof(delays) / sizeof(delays[0]); i++) {
+        Expected e = { now + delays[i], i, false };
+        expected.push_back(e);
+        CHECK(wheel->insert(e.due, now, idMessage(i)));
+    }
+
+    uint32_t seed = 7;
+    for (int steps = 0; ! wheel->empty() && steps < 100000; steps++) {
+        uint64_t next = nextDue(expected);
+        uint64_t deadline = wheel->nextDeadline();
+        CHECK(deadline && deadline <= next);
+
+        // anywhere from under a tick to a few level 3 turns
+        seed = seed * 1103515245 + 12345;
+        uint64_t step = ((uint64_t)(seed >> 8) % 1000 + 1) << ((seed >> 4) % 40);
+        uint64_t to = now + step;
+        if (now < next - 1 && to >= next - 1)
+            to = next - 1;
+        else if (to > next)
+            to = next;
+        now = to;
+        advanceTo(*wheel, now, expected);
+    }
+    CHECK(wheel->empty());
+    CHECK_EQUAL(0, nextDue(expected));
+    delete wheel;
+}
+
+// messages sharing a tick come out in the order they went in, also after
+// being cascaded down from the top level
+static void testOrderWithinTick() {
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = START_TICK * TICK_NS;
+    uint64_t tick = (START_TICK + LEVEL3_TICKS * 2 + 5) * TICK_NS;
+    uint64_t offsets[] = { 300, 100, 200, 100 };
+    for (uint32_t i = 0; i < 4; i++)
+        wheel->insert(tick + offsets[i], now, idMessage(i));
+
+    // partway into the tick only what's due by then
+    size_t count = wheel->advance(tick + 150, out, LMX_TIMER_WHEEL_SIZE);
+    CHECK_EQUAL(2, count);
+    if (count == 2) {
+        CHECK_EQUAL(1, out[0].time);
+        CHECK_EQUAL(3, out[1].time);
+    }
+    count = wheel->advance(tick + TICK_NS - 1, out, LMX_TIMER_WHEEL_SIZE);
+    CHECK_EQUAL(2, count);
+    if (count == 2) {
+        CHECK_EQUAL(0, out[0].time);
+        CHECK_EQUAL(2, out[1].time);
+    }
+    delete wheel;
+}
+
+static void testCancel() {
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = START_TICK * TICK_NS;
+
+    TimerWheel::Handle first = wheel->insert(now + LEVEL2_TICKS * TICK_NS, now, idMessage(1));
+    CHECK(first);
+    CHECK(wheel->cancel(first));
+    CHECK(! wheel->cancel(first));
+    CHECK(! wheel->cancel(0));
+
+    // the entry is used again, the old handle doesn't reach the new one
+    TimerWheel::Handle second = wheel->insert(now + 10 * TICK_NS, now, idMessage(2));
+    CHECK(second && second != first);
+    CHECK_EQUAL(first & 0xFFFF, second & 0xFFFF);
+    CHECK(! wheel->cancel(first));
+    CHECK_EQUAL(1, wheel->size());
+
+    // nor once it has come out
+    CHECK_EQUAL(1, wheel->advance(now + 10 * TICK_NS, out, LMX_TIMER_WHEEL_SIZE));
+    CHECK(! wheel->cancel(second));
+    CHECK(wheel->empty());
+    delete wheel;
+}
+
+static void testCancelKey() {
+    TimerWheel *wheel = new TimerWheel();
+    uint64_t now = START_TICK * TICK_NS;
+
+    // key 5 on three levels, key 6 and no key alongside
+    wheel->insert(now + 3 * TICK_NS, now, idMessage(1), 5);
+    wheel->insert(now + LEVEL1_TICKS * 3 * TICK_NS, now, idMessage(2), 5);
+    wheel->insert(now + LEVEL3_TICKS * 2 * TICK_NS, now, idMessage(3), 5);
+    wheel->insert(now + 3 * TICK_NS, now, idMessage(4), 6);
+    wheel->insert(now + 3 * TICK_NS, now, idMessage(5));
+    CHECK_EQUAL(5, wheel->size());
+
+    CHECK_EQUAL(3, wheel->cancelKey(5));
+    CHECK_EQUAL(0, wheel->cancelKey(5));
+    CHECK_EQUAL(0, wheel->cancelKey(LMX_TIMER_WHEEL_KEYS));
+    CHECK_EQUAL(2, wheel->size());
+
+    size_t count = wheel->advance(now + LEVEL3_TICKS * 3 * TICK_NS, out, LMX_TIMER_WHEEL_SIZE);
+    CHECK_EQUAL(2, count);
+    if (count == 2) {
+        CHECK_EQUAL(4, out[0].time);
+        CHECK_EQUAL(5, out[1].time);
+    }
+
+    // a released message isn't cancelled with its key any more
+    CHECK_EQUAL(0, wheel->cancelKey(6));
+    CHECK(wheel->empty());
+    delete wheel;
+}
+
+int main() {
+    testLevels();
+    testOrderWithinTick();
+    testCancel();
+    testCancelKey();
+    return testResult("TimerWheelTest");
+}
@@ -0,0 +1,142 @@
+//
+//  TimestampTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Capture time timestamps on a fake clock: the Leap to host clock mapping
+// following offset and drift under jittery delivery, and packets stamped
+// (or held back) to go out a fixed latency after capture.
+
+#include <math.h>
+#include "TestSupport.h"
+#include "ClockMapper.h"
+
+using namespace leapmidi;
+
+#define FRAME_MICROS 10000      // 100 frames per second
+#define DRIFT_PPM 100           // host clock runs this much faster
+#define MIN_DELAY_NS 2000000    // delivery delay, never less
+#define JITTER_NS 3000000       // and up to this much more
+
+static void testClockMapper() {
+    ClockMapper mapper;
+    const uint64_t hostBase = 5000000000ULL;
+    const int64_t leapBase = 123456789;
+    uint32_t random = 1;
+
+    double worst = 0;
+    for (int frame = 0; frame < 2000; frame++) {
+        int64_t elapsed = (int64_t)frame * FRAME_MICROS;
+        // when the frame was really captured, in host time
+        double captured = hostBase + elapsed * 1000.0 * (1.0 + DRIFT_PPM / 1e6);
+        // every tenth frame comes through without any extra delay
+        random = random * 1103515245 + 12345;
+        uint64_t jitter = frame % 10 ? (random >> 8) % JITTER_NS : 0;
+        uint64_t arrived = (uint64_t)captured + MIN_DELAY_NS + jitter;
+
+        uint64_t mapped = mapper.update(leapBase + elapsed, arrived);
+        // settled after a few windows: the captures line up at the least
+        // delayed arrivals, whatever the jitter of this one
+        if (frame >= 500) {
+            double error = fabs((double)mapped - (captured + MIN_DELAY_NS));
+            if (error > worst)
+                worst = error;
+        }
+    }
+
+    CHECK(mapper.synced());
+    CHECK(fabs(mapper.rate() - 1000.0 * (1.0 + DRIFT_PPM / 1e6)) < 0.01);
+    if (worst >= 50000)
+        fprintf(stderr, "  mapping off by %.0fns\n", worst);
+    CHECK(worst < 50000);
+
+    // the Leap service restarting starts over
+    mapper.update(leapBase, hostBase);
+    CHECK_EQUAL(hostBase, mapper.map(leapBase));
+}
+
+// messages captured at t go out stamped t + latency offset
+static void testLatencyOffset() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+    device.setLatencyOffset(3000000);
+    device.open();
+    // nothing is captured before the Device's epoch
+    clock.advance(1000000000);
+
+    uint64_t now = clock.now();
+    MessageBatch batch;
+    batch.addControl(1, 10);
+    device.addMessages(batch, now - 1000000);
+    device.pump();
+
+    // already too late for the offset: right away
+    batch.clear();
+    batch.addControl(2, 20);
+    device.addMessages(batch, now - 4000000);
+    device.pump();
+
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(2, packets.size());
+    if (packets.size() == 2) {
+        CHECK_EQUAL(now + 2000000, packets[0].timestamp);
+        CHECK_EQUAL(0, packets[1].timestamp);
+    }
+}
+
+// an output that can't schedule gets every message exactly when it's due
+static void testHeldUntilDue() {
+    FakeClock clock;
+    MemoryOutput output(&clock, false);
+    TestDevice device(&clock, &output);
+    device.setLatencyOffset(3000000);
+    device.open();
+
+    uint64_t captured = clock.now();
+    MessageBatch batch;
+    batch.addControl(1, 10);
+    device.addMessages(batch, captured);
+    device.pump();
+    CHECK_EQUAL(0, output.packetCount());
+    CHECK_EQUAL(1, device.scheduledMessageCount());
+
+    clock.advance(2999999);
+    device.pump();
+    CHECK_EQUAL(0, output.packetCount());
+
+    clock.advance(1);
+    device.pump();
+    std::vector<MemoryOutput::Packet> packets = output.packets();
+    CHECK_EQUAL(1, packets.size());
+    if (packets.size() == 1) {
+        CHECK_EQUAL(0, packets[0].timestamp);
+        CHECK_EQUAL(captured + 3000000, packets[0].sentAt);
+    }
+}
+
+// message times are microseconds since the Device's epoch, truncated to
+// 32 bits, and come back as the time nearest to now
+static void testMessageTime() {
+    FakeClock clock;
+    MemoryOutput output(&clock);
+    TestDevice device(&clock, &output);
+
+    uint64_t time = clock.now() + 1234567000ULL;
+    CHECK_EQUAL(time, device.messageTime(device.messageClock(time), clock.now()));
+
+    // the 32 bit microsecond clock wraps after about 71 minutes
+    clock.advance(5000ULL * 1000000000ULL);
+    time = clock.now() - 7000;
+    CHECK_EQUAL(time, device.messageTime(device.messageClock(time), clock.now()));
+}
+
+int main() {
+    testClockMapper();
+    testLatencyOffset();
+    testHeldUntilDue();
+    testMessageTime();
+    return testResult("TimestampTest");
+}
@@ -0,0 +1,136 @@
+//
+//  UMPTest.cpp
+//  LeapMIDIX
+//
+//  Copyright (c) 2013 DBA int80. All rights reserved.
+//
+
+// Universal MIDI Packets: the words the encoder writes, the translation
+// back to MIDI 1.0, and a Device in UMP mode sending to one output that
+// takes UMP and one that doesn't.
+
+#include "TestSupport.h"
+#include "UMPEncoder.h"
+#include "UMPTranslator.h"
+
+using namespace leapmidi;
+
+static void testEncoder() {
+    UMPEncoder encoder;
+    CHECK(encoder.noteOn(0, 60, 0xFFFF));
+    CHECK(encoder.controlChange(1, 7, 0x80000000));
+    CHECK_EQUAL(4, encoder.wordCount());
+    if (encoder.wordCount() == 4) {
+        const uint32_t *words = encoder.words();
+        CHECK_EQUAL(0x40903C00, words[0]);
+        CHECK_EQUAL(0xFFFF0000, words[1]);
+        CHECK_EQUAL(0x40B10700, words[2]);
+        CHECK_EQUAL(0x80000000, words[3]);
+    }
+
+    // min-center-max: 0 and the center stay put, the top fills every bit
+    CHECK_EQUAL(0, UMPEncoder::scaleUp(0, 7, 32));
+    CHECK_EQUAL(0x80000000, UMPEncoder::scaleUp(64, 7, 32));
+    CHECK_EQUAL(0xFFFFFFFF, UMPEncoder::scaleUp(127, 7, 32));
+    bool roundTrip = true;
+    for (uint32_t value = 0; value < 16384; value++)
+        roundTrip = roundTrip && UMPEncoder::scaleDown(UMPEncoder::scaleUp(value, 14, 32), 32, 14) == value;
+    CHECK(roundTrip);
+}
+
+static std::vector<Byte> translate(UMPTranslator &translator, UMPEncoder &encoder) {
+    Byte out[LMX_UMP_MAX_WORDS * 6];
+    size_t length = translator.toMIDI1(encoder.words(), encoder.wordCount(), out, sizeof(out));
+    encoder.reset();
+    return std::vector<Byte>(out, out + length);
+}
+
+static void testTranslator() {
+    UMPTranslator translator;
+    UMPEncoder encoder;
+
+    // a 7 bit value scaled up is a plain CC
+    encoder.controlChange(0, 1, UMPEncoder::scaleUp(100, 7, 32));
+    const Byte plain[] = { 0xB0, 1, 100 };
+    CHECK_BYTES(plain, translate(translator, encoder));
+
+    // more resolution than that is an MSB/LSB pair, every message with
+    // its status byte
+    encoder.controlChange(0, 1, UMPEncoder::scaleUp(0x2005, 14, 32));
+    const Byte pair[] = { 0xB0, 1, 0x40, 0xB0, 33, 0x05 };
+    CHECK_BYTES(pair, translate(translator, encoder));
+
+    // a 14 bit controller's value with an LSB of 0 looks like a 7 bit one,
+    // but still needs its LSB sent
+    translator.setControl14(0, 2, true);
+    encoder.controlChange(0, 2, UMPEncoder::scaleUp(0x2000, 14, 32));
+    const Byte zeroLSB[] = { 0xB0, 2, 0x40, 0xB0, 34, 0x00 };
+    CHECK_BYTES(zeroLSB, translate(translator, encoder));
+    encoder.controlChange(0, 2, UMPEncoder::scaleUp(0x1000, 14, 32));
+    const Byte lowZeroLSB[] = { 0xB0, 2, 0x20, 0xB0, 34, 0x00 };
+    CHECK_BYTES(lowZeroLSB, translate(translator, encoder));
+
+    // a MIDI 2.0 note-on with velocity 0 is still a note-on
+    encoder.noteOn(3, 60, 0);
+    const Byte note[] = { 0x93, 60, 1 };
+    CHECK_BYTES(note, translate(translator, encoder));
+}
+
+// everything goes out once as UMP and once translated, a 14 bit
+// controller always with its LSB
+static void testDevice() {
+    FakeClock clock;
+    MemoryOutput umpOutput(&clock, true, true);
+    MemoryOutput legacyOutput(&clock);
+    TestDevice device(&clock, &umpOutput);
+    device.addOutput(&legacyOutput);
+    device.setProtocol(Device::PROTOCOL_UMP);
+    device.open();
+
+    MessageBatch batch;
+    batch.addControl14(1, 0x2000);
+    device.addMessages(batch);
+    device.pump();
+
+    clock.advance(1000000);
+    batch.clear();
+    batch.addControl14(1, 0x2005);
+    device.addMessages(batch);
+    device.pump();
+
+    // the same controller as a 7 bit one
+    clock.advance(1000000);
+    batch.clear();
+    batch.addControl(1, 100);
+    batch.addNote(0, 100);
+    device.addMessages(batch);
+    device.pump();
+
+    const Byte expected[] = {
+        0xB0, 1, 0x40, 33, 0x00,
+        0xB0, 33, 0x05,
+        0x90, LMX_NOTE_BASE, LMX_NOTE_VELOCITY, 0xB0, 1, 100
+    };
+    CHECK_BYTES(expected, legacyOutput.bytes());
+    CHECK_EQUAL(0, umpOutput.packetCount());
+
+    std::vector<uint32_t> words;
+    std::vector<MemoryOutput::UMPPacket> packets = umpOutput.umpPackets();
+    for (size_t i = 0; i < packets.size(); i++)
+        words.insert(words.end(), packets[i].words.begin(), packets[i].words.end());
+    const uint32_t expectedWords[] = {
+        0x40B00100, UMPEncoder::scaleUp(0x2000, 14, 32),
+        0x40B00100, UMPEncoder::scaleUp(0x2005, 14, 32),
+        0x40904800, 0xFFFF0000,
+        0x40B00100, UMPEncoder::scaleUp(100, 7, 32)
+    };
+    CHECK_EQUAL(sizeof(expectedWords) / sizeof(expectedWords[0]), words.size());
+    CHECK(words.size() == sizeof(expectedWords) / sizeof(expectedWords[0]) && ! memcmp(words.data(), expectedWords, sizeof(expectedWords)));
+}
+
+int main() {
+    testEncoder();
+    testTranslator();
+    testDevice();
+    return testResult("UMPTest");
+}